@@ -0,0 +1,155 @@
+// Traffic of one busy peer connection over loopback, TCP_NODELAY: every
+// event-loop pass queues a few REQUESTs and a HAVE, now and then an
+// INTERESTED or UNCHOKE, and every other pass a 16 KiB PIECE. Compares
+// writing each message as it is produced (a syscall, and usually a packet,
+// per message) with one OutputQueue flush per pass (small messages coalesced
+// into one buffer, PIECE blocks gathered behind them). Reports send syscalls
+// and TCP segments per MB. Linux only.
+#include "../include/output_queue.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr int PASSES = 200000;
+constexpr size_t BLOCK_SIZE = 16384;
+
+using Clock = std::chrono::steady_clock;
+
+const std::vector<uint8_t> REQUEST = {0, 0, 0, 13, 6, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 64, 0};
+const std::vector<uint8_t> HAVE = {0, 0, 0, 5, 4, 0, 0, 0, 1};
+const std::vector<uint8_t> INTERESTED = {0, 0, 0, 1, 2};
+const std::vector<uint8_t> UNCHOKE = {0, 0, 0, 1, 1};
+const std::vector<uint8_t> PIECE_HEADER = {0, 0, 64, 9, 7, 0, 0, 0, 1, 0, 0, 0, 0};
+
+void connectedPair(int& sender, int& receiver) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    listen(listener, 1);
+    socklen_t length = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    connect(sender, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    receiver = accept(listener, nullptr, nullptr);
+    close(listener);
+    int one = 1;
+    setsockopt(sender, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+uint32_t segmentsOut(int sock) {
+    tcp_info info{};
+    socklen_t length = sizeof(info);
+    getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length);
+    return info.tcpi_segs_out;
+}
+
+// The messages of one event-loop pass, in the order they are produced
+template <typename Message, typename Block>
+void producePass(int pass, Message message, Block block) {
+    for (int i = 0; i < 4; ++i) message(REQUEST);
+    message(HAVE);
+    if (pass % 10 == 0) message(INTERESTED);
+    if (pass % 10 == 5) message(UNCHOKE);
+    if (pass % 2 == 0) block();
+}
+
+struct Result {
+    size_t bytes = 0;
+    size_t syscalls = 0;
+    uint32_t segments = 0;
+    double seconds = 0;
+};
+
+void sendAll(int sock, const uint8_t* data, size_t size, size_t& syscalls) {
+    while (size > 0) {
+        ssize_t sent = send(sock, data, size, MSG_NOSIGNAL);
+        ++syscalls;
+        if (sent <= 0) return;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+}
+
+Result run(bool coalesce) {
+    int sender, receiver;
+    connectedPair(sender, receiver);
+    std::atomic<bool> done{false};
+    std::thread drain([&]() {
+        std::vector<uint8_t> sink(256 * 1024);
+        while (recv(receiver, sink.data(), sink.size(), 0) > 0) {}
+        done = true;
+    });
+
+    auto blockData = std::make_shared<std::vector<uint8_t>>(BLOCK_SIZE, 0xab);
+    Result result;
+    uint32_t segmentsBefore = segmentsOut(sender);
+    auto start = Clock::now();
+    for (int pass = 0; pass < PASSES; ++pass) {
+        if (!coalesce) {
+            producePass(pass,
+                [&](const std::vector<uint8_t>& message) {
+                    sendAll(sender, message.data(), message.size(), result.syscalls);
+                    result.bytes += message.size();
+                },
+                [&]() {
+                    sendAll(sender, PIECE_HEADER.data(), PIECE_HEADER.size(), result.syscalls);
+                    sendAll(sender, blockData->data(), blockData->size(), result.syscalls);
+                    result.bytes += PIECE_HEADER.size() + BLOCK_SIZE;
+                });
+            continue;
+        }
+
+        OutputQueue queue;
+        producePass(pass,
+            [&](const std::vector<uint8_t>& message) { queue.append(message); },
+            [&]() {
+                BlockView view;
+                view.buffer = blockData;
+                view.data = blockData->data();
+                view.size = BLOCK_SIZE;
+                queue.appendBlock(PIECE_HEADER, std::move(view));
+            });
+        result.bytes += queue.size();
+        while (!queue.empty()) {
+            size_t attempted;
+            ++result.syscalls;
+            if (queue.writeTo(sender, MSG_NOSIGNAL, attempted) <= 0) break;
+        }
+        queue.uncork(sender);
+    }
+    result.segments = segmentsOut(sender) - segmentsBefore;
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    shutdown(sender, SHUT_WR);
+    drain.join();
+    close(sender);
+    close(receiver);
+    return result;
+}
+
+void report(const char* name, const Result& result) {
+    double megabytes = result.bytes / 1e6;
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << result.syscalls / megabytes << " syscalls/MB"
+              << std::setw(10) << result.segments / megabytes << " segments/MB"
+              << std::setw(9) << megabytes / result.seconds << " MB/s\n";
+}
+
+int main() {
+    std::cout << PASSES << " loop passes, 4 REQUEST + HAVE per pass, a 16 KiB PIECE every other pass\n";
+    report("per message", run(false));
+    report("coalesced", run(true));
+    return 0;
+}
@@ -0,0 +1,277 @@
+// 2,000 loopback peers, each with one REQUEST outstanding: the server answers
+// every REQUEST with a HAVE, and the peer sends its next REQUEST when the answer
+// arrives. Compares the event loop with the old model of two threads per peer
+// (blocking reader, writer polling every 100 ms), by round trips per second and
+// latency. Linux only.
+#include "../include/event_loop.hpp"
+#include "../include/peer_connection.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+constexpr int NUM_PEERS = 2000;
+constexpr auto WARMUP = std::chrono::seconds(1);
+constexpr auto MEASURE = std::chrono::seconds(5);
+constexpr size_t REPLY_SIZE = 9;  // HAVE: length, id, piece index
+
+using Clock = std::chrono::steady_clock;
+
+const std::vector<uint8_t> REQUEST = {0, 0, 0, 13, 6, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 64, 0};
+const std::vector<uint8_t> HAVE = {0, 0, 0, 5, 4, 0, 0, 0, 1};
+
+int listenOnLoopback(uint16_t& port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    listen(sock, SOMAXCONN);
+    socklen_t length = sizeof(address);
+    getsockname(sock, reinterpret_cast<sockaddr*>(&address), &length);
+    port = ntohs(address.sin_port);
+    return sock;
+}
+
+void setNoDelay(int sock) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Server side on the event loop: PeerConnection frames the input, and queued
+// output is written at the end of the loop pass
+class LoopServer {
+public:
+    explicit LoopServer(int listenSocket) : listenSocket(listenSocket) {
+        fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL) | O_NONBLOCK);
+        loop.add(listenSocket, [this](uint32_t) { acceptAll(); });
+        thread = std::thread([this]() { loop.run(); });
+    }
+    ~LoopServer() {
+        loop.stop();
+        thread.join();
+        for (auto& conn : connections) close(conn->socket);
+        fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL) & ~O_NONBLOCK);
+    }
+    size_t threads() const { return 1; }
+
+private:
+    void acceptAll() {
+        while (true) {
+            int sock = accept4(listenSocket, nullptr, nullptr, SOCK_NONBLOCK);
+            if (sock < 0) return;
+            setNoDelay(sock);
+            auto conn = std::make_shared<PeerConnection>();
+            conn->socket = sock;
+            PeerConnection* raw = conn.get();
+            conn->on_message = [raw](uint8_t id, const uint8_t*, size_t) {
+                if (id == 6) raw->append_to_output(HAVE);
+            };
+            conn->on_output = [this, raw]() { loop.post([raw]() { flush(*raw); }); };
+            loop.add(sock, [this, raw](uint32_t events) {
+                if (events & EPOLLIN) read(*raw);
+                if (events & EPOLLOUT) flush(*raw);
+            });
+            connections.push_back(std::move(conn));
+        }
+    }
+
+    void read(PeerConnection& conn) {
+        while (true) {
+            size_t space;
+            uint8_t* target = conn.input_buffer.prepare(space);
+            ssize_t received = recv(conn.socket, target, space, 0);
+            if (received <= 0) return;
+            conn.input_buffer.commit(static_cast<size_t>(received));
+            conn.process_input_buffer();
+        }
+    }
+
+    static void flush(PeerConnection& conn) {
+        conn.flush_scheduled = false;
+        std::lock_guard<std::mutex> lock(conn.buffer_mutex);
+        size_t attempted;
+        conn.output_queue.writeTo(conn.socket, MSG_NOSIGNAL, attempted);
+    }
+
+    int listenSocket;
+    EventLoop loop;
+    std::thread thread;
+    std::vector<std::shared_ptr<PeerConnection>> connections;
+};
+
+// The old model: a blocking reader and a writer waking every 100 ms per peer
+class ThreadServer {
+public:
+    explicit ThreadServer(int listenSocket) : listenSocket(listenSocket) {
+        acceptor = std::thread([this]() {
+            for (int i = 0; i < NUM_PEERS; ++i) {
+                int sock = accept(this->listenSocket, nullptr, nullptr);
+                if (sock < 0) return;
+                setNoDelay(sock);
+                auto conn = std::make_shared<PeerConnection>();
+                conn->socket = sock;
+                PeerConnection* raw = conn.get();
+                conn->on_message = [raw](uint8_t id, const uint8_t*, size_t) {
+                    if (id == 6) raw->append_to_output(HAVE);
+                };
+                workers.emplace_back([raw]() {
+                    uint8_t buffer[4096];
+                    ssize_t received;
+                    while ((received = recv(raw->socket, buffer, sizeof(buffer), 0)) > 0) {
+                        raw->input_buffer.append(buffer, static_cast<size_t>(received));
+                        raw->process_input_buffer();
+                    }
+                });
+                workers.emplace_back([this, raw]() {
+                    while (!stopping) {
+                        OutputQueue queue;
+                        {
+                            std::lock_guard<std::mutex> lock(raw->buffer_mutex);
+                            std::swap(queue, raw->output_queue);
+                        }
+                        size_t attempted;
+                        while (!queue.empty() && queue.writeTo(raw->socket, MSG_NOSIGNAL, attempted) > 0) {}
+                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    }
+                });
+                connections.push_back(std::move(conn));
+            }
+        });
+    }
+    ~ThreadServer() {
+        acceptor.join();
+        stopping = true;
+        for (auto& conn : connections) shutdown(conn->socket, SHUT_RDWR);
+        for (auto& worker : workers) worker.join();
+        for (auto& conn : connections) close(conn->socket);
+    }
+    size_t threads() const { return 1 + 2 * NUM_PEERS; }
+
+private:
+    int listenSocket;
+    std::atomic<bool> stopping{false};
+    std::thread acceptor;
+    std::vector<std::thread> workers;
+    std::vector<std::shared_ptr<PeerConnection>> connections;
+};
+
+struct Peer {
+    int sock = -1;
+    size_t pending = 0;  // Bytes of the current reply received
+    Clock::time_point sentAt;
+};
+
+struct Result {
+    uint64_t roundTrips = 0;
+    std::vector<double> latenciesMs;
+};
+
+// Peers on their own event loop, so the client never needs thousands of threads
+Result runPeers(uint16_t port) {
+    std::vector<Peer> peers(NUM_PEERS);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    for (auto& peer : peers) {
+        peer.sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(peer.sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            std::cerr << "connect failed: " << strerror(errno) << "\n";
+            std::exit(1);
+        }
+        setNoDelay(peer.sock);
+    }
+
+    EventLoop loop;
+    Result result;
+    bool measuring = false;
+    Clock::time_point start = Clock::now();
+
+    for (auto& peer : peers) {
+        Peer* p = &peer;
+        loop.add(peer.sock, [&, p](uint32_t events) {
+            if (!(events & EPOLLIN)) return;
+            uint8_t buffer[4096];
+            ssize_t received;
+            while ((received = recv(p->sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+                p->pending += static_cast<size_t>(received);
+                while (p->pending >= REPLY_SIZE) {
+                    p->pending -= REPLY_SIZE;
+                    auto now = Clock::now();
+                    if (measuring) {
+                        ++result.roundTrips;
+                        result.latenciesMs.push_back(std::chrono::duration<double, std::milli>(now - p->sentAt).count());
+                    }
+                    p->sentAt = now;
+                    send(p->sock, REQUEST.data(), REQUEST.size(), MSG_NOSIGNAL);
+                }
+            }
+        });
+        peer.sentAt = Clock::now();
+        send(peer.sock, REQUEST.data(), REQUEST.size(), MSG_NOSIGNAL);
+    }
+
+    loop.post([&]() { start = Clock::now(); });
+    loop.runEvery(std::chrono::milliseconds(50), [&]() {
+        auto elapsed = Clock::now() - start;
+        if (!measuring && elapsed >= WARMUP) measuring = true;
+        if (elapsed >= WARMUP + MEASURE) loop.stop();
+    });
+    loop.run();
+
+    for (auto& peer : peers) close(peer.sock);
+    return result;
+}
+
+template <typename Server>
+void measure(const char* name) {
+    uint16_t port;
+    int listenSocket = listenOnLoopback(port);
+    Result result;
+    size_t threads;
+    {
+        Server server(listenSocket);
+        threads = server.threads();
+        result = runPeers(port);
+    }
+    close(listenSocket);
+
+    auto& latencies = result.latenciesMs;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    double seconds = std::chrono::duration<double>(MEASURE).count();
+    std::cout << std::left << std::setw(22) << name << std::right
+              << std::setw(6) << threads << " threads  "
+              << std::setw(10) << static_cast<uint64_t>(result.roundTrips / seconds) << " round trips/s  "
+              << "p50 " << std::setw(7) << percentile(0.5) << " ms  "
+              << "p99 " << std::setw(7) << percentile(0.99) << " ms\n";
+}
+
+int main() {
+    // Two fds per peer (both ends are in this process)
+    rlimit limit{};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 4 * NUM_PEERS + 64);
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    std::cout << NUM_PEERS << " loopback peers, one REQUEST outstanding each, "
+              << std::chrono::duration<double>(MEASURE).count() << " s\n"
+              << std::fixed << std::setprecision(2);
+    measure<LoopServer>("Event loop:");
+    measure<ThreadServer>("Threads (2 per peer):");
+    return 0;
+}
@@ -0,0 +1,190 @@
+// One upload-heavy connection over loopback: about 2 MiB of 16 KiB PIECE
+// messages is kept queued, sent under a 50 MB/s upload limit, while a
+// REQUEST is queued every 5 ms. Compares the REQUEST's time from being queued
+// to arriving at the peer when it waits behind the queued blocks (one FIFO
+// queue, as before) with OutputQueue sending control messages at the next
+// message boundary. Linux only.
+#include "../include/output_queue.hpp"
+#include "../include/rate_limiter.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr size_t BLOCK_SIZE = 16384;
+constexpr size_t BACKLOG = 2 * 1024 * 1024;
+constexpr size_t UPLOAD_LIMIT = 50 * 1000 * 1000;
+constexpr auto REQUEST_INTERVAL = std::chrono::milliseconds(5);
+constexpr size_t REQUESTS = 400;
+
+using Clock = std::chrono::steady_clock;
+
+void connectedPair(int& sender, int& receiver) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    listen(listener, 1);
+    socklen_t length = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    connect(sender, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    receiver = accept(listener, nullptr, nullptr);
+    close(listener);
+    int one = 1;
+    setsockopt(sender, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(sender, F_SETFL, fcntl(sender, F_GETFL) | O_NONBLOCK);
+}
+
+// REQUEST: length, id, index (the sequence number here), begin, length
+std::vector<uint8_t> requestMessage(uint32_t sequence) {
+    std::vector<uint8_t> message(17, 0);
+    uint32_t fields[4] = {htonl(13), htonl(sequence), 0, htonl(BLOCK_SIZE)};
+    memcpy(message.data(), &fields[0], 4);
+    message[4] = 6;
+    memcpy(message.data() + 5, &fields[1], 4);
+    memcpy(message.data() + 13, &fields[3], 4);
+    return message;
+}
+
+std::vector<uint8_t> pieceHeader() {
+    std::vector<uint8_t> header(13, 0);
+    uint32_t length = htonl(9 + BLOCK_SIZE);
+    memcpy(header.data(), &length, 4);
+    header[4] = 7;
+    return header;
+}
+
+struct Result {
+    std::vector<double> latencies;  // Milliseconds, queued to received
+    double uploadRate = 0;          // MB/s of PIECE data
+};
+
+Result run(bool prioritize) {
+    int sender, receiver;
+    connectedPair(sender, receiver);
+    std::vector<std::atomic<int64_t>> queuedAt(REQUESTS);
+    std::vector<double> latencies;
+    std::atomic<size_t> pieceBytes{0};
+    std::atomic<size_t> requestsReceived{0};
+
+    // The peer: frames messages and timestamps each REQUEST as it arrives
+    std::thread peer([&]() {
+        std::vector<uint8_t> buffer;
+        std::vector<uint8_t> chunk(256 * 1024);
+        ssize_t count;
+        while ((count = recv(receiver, chunk.data(), chunk.size(), 0)) > 0) {
+            buffer.insert(buffer.end(), chunk.begin(), chunk.begin() + count);
+            size_t offset = 0;
+            while (buffer.size() - offset >= 4) {
+                uint32_t length;
+                memcpy(&length, buffer.data() + offset, 4);
+                length = ntohl(length);
+                if (buffer.size() - offset < 4 + length) break;
+                uint8_t id = buffer[offset + 4];
+                if (id == 6) {
+                    uint32_t sequence;
+                    memcpy(&sequence, buffer.data() + offset + 5, 4);
+                    int64_t now = Clock::now().time_since_epoch().count();
+                    latencies.push_back((now - queuedAt[ntohl(sequence)].load()) / 1e6);
+                    ++requestsReceived;
+                } else if (id == 7) {
+                    pieceBytes += length - 9;
+                }
+                offset += 4 + length;
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + offset);
+        }
+    });
+
+    auto block = std::make_shared<std::vector<uint8_t>>(BLOCK_SIZE, 0xab);
+    RateLimiter limiter(UPLOAD_LIMIT);
+    OutputQueue queue;
+    size_t sequence = 0;
+    auto start = Clock::now();
+    auto nextRequest = start;
+    while (sequence < REQUESTS) {
+        while (queue.bulkSize() < BACKLOG) {
+            BlockView view;
+            view.buffer = block;
+            view.data = block->data();
+            view.size = BLOCK_SIZE;
+            queue.appendBlock(pieceHeader(), std::move(view));
+        }
+        if (Clock::now() >= nextRequest) {
+            queuedAt[sequence] = Clock::now().time_since_epoch().count();
+            auto request = requestMessage(static_cast<uint32_t>(sequence++));
+            if (prioritize) {
+                queue.append(std::move(request));
+            } else {
+                queue.appendBlock(std::move(request), BlockView());  // Behind every queued block
+            }
+            nextRequest += REQUEST_INTERVAL;
+        }
+
+        // One flush, as the event loop would do it per pass
+        while (!queue.empty()) {
+            size_t attempted;
+            size_t bulkBefore = queue.bulkSize();
+            ssize_t sent = queue.writeTo(sender, MSG_DONTWAIT | MSG_NOSIGNAL, attempted, limiter.available());
+            limiter.consume(bulkBefore - queue.bulkSize());
+            if (sent <= 0 || static_cast<size_t>(sent) < attempted) break;
+        }
+        queue.uncork(sender);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Keep flushing until the last REQUESTs arrive
+    auto deadline = Clock::now() + std::chrono::seconds(10);
+    while (requestsReceived < REQUESTS && Clock::now() < deadline) {
+        size_t attempted;
+        size_t bulkBefore = queue.bulkSize();
+        queue.writeTo(sender, MSG_DONTWAIT | MSG_NOSIGNAL, attempted, limiter.available());
+        limiter.consume(bulkBefore - queue.bulkSize());
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    shutdown(sender, SHUT_WR);
+    shutdown(receiver, SHUT_RD);
+    peer.join();
+    close(sender);
+    close(receiver);
+
+    Result result;
+    result.latencies = std::move(latencies);
+    result.uploadRate = pieceBytes / 1e6 / seconds;
+    return result;
+}
+
+void report(const char* name, Result result) {
+    auto& latencies = result.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double fraction) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, size_t(fraction * latencies.size()))];
+    };
+    std::cout << std::left << std::setw(13) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(5) << latencies.size() << " REQUESTs  median " << std::setw(7) << at(0.5)
+              << " ms  p99 " << std::setw(7) << at(0.99) << " ms  upload " << std::setprecision(1)
+              << result.uploadRate << " MB/s\n";
+}
+
+int main() {
+    std::cout << REQUESTS << " REQUESTs behind " << BACKLOG / 1024 << " KiB of queued PIECEs, upload limited to "
+              << UPLOAD_LIMIT / 1e6 << " MB/s\n";
+    report("fifo", run(false));
+    report("prioritized", run(true));
+    return 0;
+}
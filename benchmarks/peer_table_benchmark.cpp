@@ -0,0 +1,104 @@
+// Peer table operations at 5000 peers: lookups (as every read and flush
+// does), snapshots of all peers (as the choker and HAVE broadcasts take under
+// the shard lock) and drop/reconnect churn. Compares the old
+// std::unordered_map keyed by socket with SlotMap, looked up by the slot the
+// I/O paths keep in their PeerHandle. Reports nanoseconds per operation.
+#include "../include/slot_map.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+constexpr int PEERS = 5000;
+constexpr int FIRST_SOCKET = 16;
+constexpr size_t LOOKUPS = 4000000;
+constexpr size_t SNAPSHOTS = 4000;
+constexpr size_t CHURN = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+struct Peer {
+    int socket;
+    uint64_t downloaded = 0;
+};
+
+double nanosPer(Clock::time_point start, size_t operations) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / operations;
+}
+
+void report(const std::string& name, double mapNanos, double slotNanos) {
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << mapNanos << std::setw(12) << slotNanos << '\n';
+}
+
+int main() {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> pick(FIRST_SOCKET, FIRST_SOCKET + PEERS - 1);
+    std::vector<int> order(LOOKUPS);
+    for (auto& sock : order) sock = pick(gen);
+
+    std::unordered_map<int, std::shared_ptr<Peer>> map;
+    SlotMap<std::shared_ptr<Peer>> slots;
+    std::vector<uint32_t> socketSlots(FIRST_SOCKET + PEERS);
+    for (int sock = FIRST_SOCKET; sock < FIRST_SOCKET + PEERS; ++sock) {
+        map[sock] = std::make_shared<Peer>(Peer{sock});
+        socketSlots[sock] = slots.insert(std::make_shared<Peer>(Peer{sock})).slot;
+    }
+
+    std::cout << PEERS << " peers, ns per operation\n"
+              << std::left << std::setw(12) << "" << std::right << std::setw(12) << "map" << std::setw(12)
+              << "slot map" << '\n';
+
+    uint64_t checksum = 0;
+    auto start = Clock::now();
+    for (int sock : order) checksum += map.find(sock)->second->downloaded;
+    double mapLookup = nanosPer(start, LOOKUPS);
+    start = Clock::now();
+    for (int sock : order) {
+        auto* peer = slots.get(slots.current(socketSlots[sock]));
+        if (peer && (*peer)->socket == sock) checksum += (*peer)->downloaded;
+    }
+    report("lookup", mapLookup, nanosPer(start, LOOKUPS));
+
+    std::vector<std::shared_ptr<Peer>> snapshot;
+    start = Clock::now();
+    for (size_t i = 0; i < SNAPSHOTS; ++i) {
+        snapshot.clear();
+        for (const auto& pair : map) snapshot.push_back(pair.second);
+        checksum += snapshot.size();
+    }
+    double mapSnapshot = nanosPer(start, SNAPSHOTS);
+    start = Clock::now();
+    for (size_t i = 0; i < SNAPSHOTS; ++i) {
+        snapshot.assign(slots.begin(), slots.end());
+        checksum += snapshot.size();
+    }
+    report("snapshot", mapSnapshot, nanosPer(start, SNAPSHOTS));
+    snapshot.clear();
+
+    // A peer drops and another connects on the same socket number
+    start = Clock::now();
+    for (size_t i = 0; i < CHURN; ++i) {
+        int sock = order[i];
+        auto peer = std::move(map.find(sock)->second);
+        map.erase(sock);
+        map[sock] = std::move(peer);
+    }
+    double mapChurn = nanosPer(start, CHURN);
+    start = Clock::now();
+    for (size_t i = 0; i < CHURN; ++i) {
+        int sock = order[i];
+        SlotHandle handle = slots.current(socketSlots[sock]);
+        auto peer = std::move(*slots.get(handle));
+        slots.erase(handle);
+        socketSlots[sock] = slots.insert(std::move(peer)).slot;
+    }
+    report("churn", mapChurn, nanosPer(start, CHURN));
+
+    if (checksum == 0) std::cout << "";  // Keep the loops from being optimized away
+    return 0;
+}
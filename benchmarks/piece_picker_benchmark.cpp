@@ -0,0 +1,93 @@
+// PiecePicker cost with 10k peers and 1M pieces: availability updates from
+// BITFIELD, HAVE and disconnects, and rarest-first picks.
+#include "../include/piece_picker.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+constexpr int NUM_PIECES = 1000000;
+constexpr int NUM_PEERS = 10000;
+constexpr int SEED_PERCENT = 10;
+constexpr double PEER_DENSITY = 0.02;  // Fraction of pieces a non-seed peer has
+constexpr int PICKING_PEERS = 100;
+constexpr int PICKS_PER_PEER = 1000;
+constexpr int NUM_HAVES = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+bool isSeed(int peer) {
+    return peer % 100 < SEED_PERCENT;
+}
+
+// Regenerated on demand from the peer index, so 10k bitfields never live at once
+Bitfield peerBitfield(int peer) {
+    Bitfield bits(NUM_PIECES);
+    if (isSeed(peer)) {
+        bits.setAll();
+        return bits;
+    }
+    std::mt19937 rng(peer);
+    std::uniform_int_distribution<int> pieceDist(0, NUM_PIECES - 1);
+    for (int i = 0; i < NUM_PIECES * PEER_DENSITY; ++i) bits.set(pieceDist(rng));
+    return bits;
+}
+
+int main() {
+    PiecePicker picker(NUM_PIECES, 42);
+    std::cout << "PiecePicker, " << NUM_PIECES << " pieces, " << NUM_PEERS << " peers ("
+              << SEED_PERCENT << "% seeds, others " << PEER_DENSITY * 100 << "% of pieces)\n"
+              << std::fixed << std::setprecision(1);
+
+    double elapsed = 0;
+    size_t updates = 0;
+    for (int peer = 0; peer < NUM_PEERS; ++peer) {
+        Bitfield bits = peerBitfield(peer);
+        if (!isSeed(peer)) updates += bits.count();
+        auto start = Clock::now();
+        picker.addPeer(bits);
+        elapsed += secondsSince(start);
+    }
+    std::cout << "BITFIELD:   " << elapsed * 1e3 << " ms for " << updates << " piece updates ("
+              << elapsed * 1e9 / updates << " ns/update)\n";
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pieceDist(0, NUM_PIECES - 1);
+    auto start = Clock::now();
+    for (int i = 0; i < NUM_HAVES; ++i) picker.addHave(pieceDist(rng));
+    elapsed = secondsSince(start);
+    std::cout << "HAVE:       " << elapsed * 1e9 / NUM_HAVES << " ns/message\n";
+
+    for (bool seeds : {false, true}) {
+        elapsed = 0;
+        int picked = 0;
+        for (int peer = 0, used = 0; used < PICKING_PEERS; ++peer) {
+            if (isSeed(peer) != seeds) continue;
+            ++used;
+            Bitfield bits = peerBitfield(peer);
+            auto pickStart = Clock::now();
+            for (int i = 0; i < PICKS_PER_PEER; ++i) {
+                if (picker.pickPiece(peer, bits) != PiecePicker::NO_PIECE) ++picked;
+            }
+            elapsed += secondsSince(pickStart);
+        }
+        std::cout << (seeds ? "Pick/seed:  " : "Pick/peer:  ") << elapsed * 1e9 / (PICKING_PEERS * PICKS_PER_PEER)
+                  << " ns/pick (" << picked << " picked)\n";
+    }
+
+    elapsed = 0;
+    for (int peer = 0; peer < NUM_PEERS; ++peer) {
+        Bitfield bits = peerBitfield(peer);
+        auto removeStart = Clock::now();
+        picker.removePeer(bits, isSeed(peer));
+        elapsed += secondsSince(removeStart);
+    }
+    std::cout << "Disconnect: " << elapsed * 1e3 << " ms for all peers ("
+              << elapsed * 1e9 / updates << " ns/update)\n";
+    return 0;
+}
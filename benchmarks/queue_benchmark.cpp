@@ -0,0 +1,146 @@
+// Handoff throughput between pipeline threads: N producers push small jobs
+// (the size of a disk write job's index fields) to one consumer that waits
+// when there is nothing to do. Compares a std::deque behind a mutex and a
+// condition variable (notify_one per push, as the disk and hashing queues
+// did) with MpscQueue, and with SpscRing for a single producer. Reports
+// million items per second, and how often (per thousand items) the consumer
+// found the queue empty and had to wait.
+#include "../include/concurrent_queue.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr size_t ITEMS = 4000000;
+constexpr size_t CAPACITY = 4096;
+
+using Clock = std::chrono::steady_clock;
+
+struct Job {
+    int pieceIndex = 0;
+    int blockOffset = 0;
+    const void* data = nullptr;
+};
+
+class LockedQueue {
+public:
+    void push(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(job);
+        }
+        available.notify_one();
+    }
+    bool pop(Job& job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (queue.empty()) ++waits;
+        available.wait(lock, [this]() { return closed || !queue.empty(); });
+        if (queue.empty()) return false;
+        job = queue.front();
+        queue.pop_front();
+        return true;
+    }
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        available.notify_all();
+    }
+    size_t waits = 0;
+
+private:
+    std::deque<Job> queue;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool closed = false;
+};
+
+// Counts the times the consumer found the queue empty
+template <typename Queue>
+bool popCounting(Queue& queue, Job& job, size_t& waits) {
+    if (queue.tryPop(job)) return true;
+    ++waits;
+    return queue.pop(job);
+}
+
+struct Result {
+    double itemsPerSecond;
+    double waitsPerThousand;
+};
+
+template <typename Queue, typename Push, typename Pop>
+Result run(Queue& queue, size_t producers, Push push, Pop pop) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    size_t perProducer = ITEMS / producers;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+            ++ready;
+            while (!go) {}
+            for (size_t i = 0; i < perProducer; ++i) {
+                push(Job{static_cast<int>(p), static_cast<int>(i), nullptr});
+            }
+        });
+    }
+    while (ready < producers) {}
+
+    size_t waits = 0;
+    auto start = Clock::now();
+    go = true;
+    Job job;
+    size_t received = 0;
+    uint64_t checksum = 0;
+    while (received < perProducer * producers && pop(job, waits)) {
+        checksum += static_cast<uint64_t>(job.blockOffset);
+        ++received;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (auto& thread : threads) thread.join();
+    queue.close();
+    if (checksum == 0) std::cout << "";  // Keep the loop from being optimized away
+    return {received / seconds, waits * 1000.0 / received};
+}
+
+void report(const std::string& name, size_t producers, const Result& result) {
+    std::cout << std::left << std::setw(14) << name << std::right << std::setw(3) << producers << " producers"
+              << std::fixed << std::setprecision(1) << std::setw(9) << result.itemsPerSecond / 1e6 << " M items/s"
+              << std::setw(9) << result.waitsPerThousand << " waits/1000\n";
+}
+
+int main() {
+    std::cout << ITEMS / 1000000 << "M items per run, one consumer, " << std::thread::hardware_concurrency()
+              << " cores\n";
+    for (size_t producers : {1, 2, 4, 8}) {
+        {
+            LockedQueue queue;
+            report("mutex+deque", producers, run(queue, producers,
+                [&](Job job) { queue.push(job); },
+                [&](Job& job, size_t& waits) {
+                    bool ok = queue.pop(job);
+                    waits = queue.waits;
+                    return ok;
+                }));
+        }
+        {
+            MpscQueue<Job> queue(CAPACITY);
+            report("MpscQueue", producers, run(queue, producers,
+                [&](Job job) { queue.push(job); },
+                [&](Job& job, size_t& waits) { return popCounting(queue, job, waits); }));
+        }
+        if (producers == 1) {
+            SpscRing<Job> ring(CAPACITY);
+            report("SpscRing", producers, run(ring, producers,
+                [&](Job job) { ring.push(job); },
+                [&](Job& job, size_t& waits) { return popCounting(ring, job, waits); }));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Uploads 16 KiB PIECE messages from a file in the page cache to a loopback
+// peer, the way blocks of pieces already written to disk are served: a
+// header write followed by sendfile (the block never enters user space),
+// against the buffered path (pread into a buffer, then a gather write of
+// header and buffer). Reports the sender's CPU time per Gbit sent, user and
+// system. Linux only.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+constexpr size_t BLOCK_SIZE = 16384;
+constexpr size_t FILE_SIZE = 64 * 1024 * 1024;  // Read once first, so it is all in the page cache
+constexpr size_t BYTES_TO_SEND = size_t(4) * 1024 * 1024 * 1024;
+
+using Clock = std::chrono::steady_clock;
+
+struct CpuTime {
+    double user = 0;
+    double system = 0;
+};
+
+CpuTime threadCpuTime() {
+    rusage usage{};
+    getrusage(RUSAGE_THREAD, &usage);
+    auto seconds = [](const timeval& time) { return time.tv_sec + time.tv_usec / 1e6; };
+    return {seconds(usage.ru_utime), seconds(usage.ru_stime)};
+}
+
+void connectedPair(int& sender, int& receiver) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    listen(listener, 1);
+    socklen_t length = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length);
+
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    connect(sender, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    receiver = accept(listener, nullptr, nullptr);
+    close(listener);
+}
+
+// PIECE header: length, id, index, begin
+void makeHeader(uint8_t* header, uint32_t pieceIndex, uint32_t blockOffset) {
+    uint32_t fields[3] = {htonl(9 + BLOCK_SIZE), htonl(pieceIndex), htonl(blockOffset)};
+    memcpy(header, &fields[0], 4);
+    header[4] = 7;
+    memcpy(header + 5, &fields[1], 4);
+    memcpy(header + 9, &fields[2], 4);
+}
+
+bool sendAll(int sock, iovec* buffers, int count) {
+    while (count > 0) {
+        ssize_t sent = writev(sock, buffers, count);
+        if (sent <= 0) return false;
+        for (size_t left = static_cast<size_t>(sent); left > 0;) {
+            size_t step = std::min(left, buffers->iov_len);
+            buffers->iov_base = static_cast<uint8_t*>(buffers->iov_base) + step;
+            buffers->iov_len -= step;
+            left -= step;
+            if (buffers->iov_len == 0) {
+                ++buffers;
+                --count;
+            }
+        }
+    }
+    return true;
+}
+
+bool sendBuffered(int sock, int fd, off_t offset, const uint8_t* header, std::vector<uint8_t>& buffer) {
+    if (pread(fd, buffer.data(), BLOCK_SIZE, offset) != static_cast<ssize_t>(BLOCK_SIZE)) return false;
+    iovec buffers[2] = {{const_cast<uint8_t*>(header), 13}, {buffer.data(), BLOCK_SIZE}};
+    return sendAll(sock, buffers, 2);
+}
+
+bool sendFromFile(int sock, int fd, off_t offset, const uint8_t* header) {
+    // The header is held back (MSG_MORE) so it leaves in one segment with the block
+    if (send(sock, header, 13, MSG_MORE) != 13) return false;
+    size_t left = BLOCK_SIZE;
+    while (left > 0) {
+        ssize_t sent = sendfile(sock, fd, &offset, left);
+        if (sent <= 0) return false;
+        left -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+struct Result {
+    double seconds;
+    CpuTime cpu;
+};
+
+Result run(int fd, bool useSendfile) {
+    int sender, receiver;
+    connectedPair(sender, receiver);
+
+    std::atomic<size_t> received{0};
+    std::thread drain([&]() {
+        std::vector<uint8_t> sink(256 * 1024);
+        while (received < BYTES_TO_SEND / BLOCK_SIZE * (13 + BLOCK_SIZE)) {
+            ssize_t count = recv(receiver, sink.data(), sink.size(), 0);
+            if (count <= 0) break;
+            received += static_cast<size_t>(count);
+        }
+    });
+
+    std::vector<uint8_t> buffer(BLOCK_SIZE);
+    uint8_t header[13];
+    auto start = Clock::now();
+    CpuTime before = threadCpuTime();
+    for (size_t block = 0; block < BYTES_TO_SEND / BLOCK_SIZE; ++block) {
+        off_t offset = static_cast<off_t>((block * BLOCK_SIZE) % FILE_SIZE);
+        makeHeader(header, static_cast<uint32_t>(offset / (1 << 20)), static_cast<uint32_t>(offset % (1 << 20)));
+        bool ok = useSendfile ? sendFromFile(sender, fd, offset, header) : sendBuffered(sender, fd, offset, header, buffer);
+        if (!ok) {
+            perror("send");
+            break;
+        }
+    }
+    CpuTime after = threadCpuTime();
+    drain.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    close(sender);
+    close(receiver);
+    return {seconds, {after.user - before.user, after.system - before.system}};
+}
+
+void report(const char* name, const Result& result) {
+    double gbits = BYTES_TO_SEND * 8 / 1e9;
+    std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(8) << gbits / result.seconds << " Gbit/s"
+              << std::setw(9) << (result.cpu.user + result.cpu.system) / gbits * 1000 << " ms CPU/Gbit"
+              << "  (user " << result.cpu.user / gbits * 1000 << ", system " << result.cpu.system / gbits * 1000
+              << ")\n";
+}
+
+int main() {
+    char path[] = "/tmp/upload_benchmark_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    std::vector<uint8_t> chunk(1 << 20);
+    for (size_t i = 0; i < chunk.size(); ++i) chunk[i] = static_cast<uint8_t>(i * 31);
+    for (size_t written = 0; written < FILE_SIZE; written += chunk.size()) {
+        if (write(fd, chunk.data(), chunk.size()) != static_cast<ssize_t>(chunk.size())) {
+            perror("write");
+            return 1;
+        }
+    }
+
+    std::cout << "Sending " << BYTES_TO_SEND / (1 << 20) << " MiB in " << BLOCK_SIZE / 1024
+              << " KiB PIECE messages over loopback\n";
+    report("buffered", run(fd, false));
+    report("sendfile", run(fd, true));
+    close(fd);
+    return 0;
+}
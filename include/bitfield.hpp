@@ -0,0 +1,86 @@
+#ifndef BITFIELD_HPP
+#define BITFIELD_HPP
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Compact piece/block availability set stored as 64-bit words.
+//
+// Bit i lives in word i / 64 at mask (1 << 63) >> (i % 64), so a word is the
+// big-endian load of 8 wire bytes and the BitTorrent BITFIELD payload can be
+// loaded/stored with memcpy + byte swap. Bits past size() are always zero.
+//
+// The set operations use AVX2 when the CPU has it (checked at run time) and
+// fall back to word loops otherwise. A "have all" flag short-circuits them for seeds.
+class Bitfield {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    Bitfield() = default;
+    explicit Bitfield(size_t numBits, bool value = false);
+    Bitfield(const Bitfield& other);
+    Bitfield(Bitfield&& other) noexcept;
+    Bitfield& operator=(const Bitfield& other);
+    Bitfield& operator=(Bitfield&& other) noexcept;
+
+    size_t size() const { return numBits; }
+    bool empty() const { return numBits == 0; }
+    void resize(size_t newSize, bool value = false);
+
+    // Single bit access
+    bool get(size_t index) const {
+        return (bits[index >> 6] & bitMask(index)) != 0;
+    }
+    bool operator[](size_t index) const { return get(index); }
+    void set(size_t index);
+    void clear(size_t index);
+    void assign(size_t index, bool value) { value ? set(index) : clear(index); }
+
+    // Word-atomic updates, for bitfields shared between threads (our own "have" set).
+    // Readers on other threads see a snapshot that may lag the latest writes.
+    bool setAtomic(size_t index);    // Returns true if the bit was newly set
+    bool clearAtomic(size_t index);
+    bool getAtomic(size_t index) const;
+
+    // Whole-set operations
+    void setAll();
+    void clearAll();
+    bool hasAll() const;        // Fast path: O(1) when the set is known to be full
+    bool none() const;
+    size_t count() const;
+
+    size_t findNextSet(size_t from = 0) const;
+    size_t findNextClear(size_t from = 0) const;
+
+    // BitTorrent wire format (MSB first, zero padded to whole bytes)
+    static Bitfield fromWire(const uint8_t* data, size_t byteCount, size_t numBits);
+    size_t wireSize() const { return (numBits + 7) / 8; }
+    void storeWire(uint8_t* out) const;
+    std::vector<uint8_t> toWire() const;
+
+    // Set algebra
+    Bitfield& operator&=(const Bitfield& other);
+    Bitfield& andNot(const Bitfield& other);                    // this &= ~other
+    static bool intersects(const Bitfield& a, const Bitfield& b);  // (a & b) != 0
+    static bool anyAndNot(const Bitfield& a, const Bitfield& b);   // (a & ~b) != 0
+    static size_t countAndNot(const Bitfield& a, const Bitfield& b);
+    size_t findNextSetAndNot(const Bitfield& other, size_t from = 0) const;
+
+    const uint64_t* words() const { return bits.data(); }
+    size_t wordCount() const { return bits.size(); }
+
+private:
+    static uint64_t bitMask(size_t index) {
+        return (uint64_t(1) << 63) >> (index & 63);
+    }
+    uint64_t tailMask() const;
+    void clearTail();
+
+    std::vector<uint64_t> bits;
+    size_t numBits = 0;
+    mutable std::atomic<bool> full{false};  // Set when every bit is known to be set
+};
+
+#endif // BITFIELD_HPP
@@ -0,0 +1,296 @@
+#ifndef CONCURRENT_QUEUE_HPP
+#define CONCURRENT_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// Bounded lock-free queues for handing work between the pipeline's threads
+// (network -> hashing -> disk -> announce), with blocking waits that cost
+// nothing while nobody sleeps.
+//
+// Both queues hold a power-of-two ring of slots, allocated up front. T must
+// be default constructible and movable; a popped slot is reset to T() right
+// away, so it doesn't keep buffers pinned. The blocking push() and pop()
+// return false once the queue is closed (pop() only after draining it).
+// Producers blocked on a full queue are woken once it is down to half, not
+// for every slot freed, so they don't trade places with the consumer per item.
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Lets threads sleep until another thread signals, without a mutex (an
+// event count). A waiter registers, re-checks its condition and only then
+// sleeps, until the epoch moves past the value it registered with:
+//
+//     uint32_t token = point.prepareWait();
+//     if (conditionHolds()) point.cancelWait(); else point.wait(token);
+//
+// Signalling is a fence and a load while nobody waits. Sleeps on a futex on
+// Linux, std::atomic::wait elsewhere.
+class WaitPoint {
+public:
+    uint32_t prepareWait();
+    void cancelWait();
+    void wait(uint32_t token);  // Returns at once if signalled since prepareWait()
+    void notifyOne();
+    void notifyAll();
+
+private:
+    void notify(bool all);
+
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> waiters{0};
+};
+
+// Single producer, single consumer ring. Each side keeps a cached copy of
+// the other's index, so the shared ones are only read when the ring looks
+// full (or empty).
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity);  // Rounded up to a power of two
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Non-blocking; value is left untouched when the ring is full
+    bool tryPush(T&& value);
+    bool tryPop(T& value);
+    // Blocking
+    bool push(T value);
+    bool pop(T& value);
+
+    // Wakes everyone; pushes fail from now on, pops once the ring is empty.
+    // Call once the producer is done: a push racing with it may be lost.
+    void close();
+    bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+    size_t size() const;  // A snapshot when called off the two threads
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::unique_ptr<T[]> slots;
+    size_t mask;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0};  // Next to pop
+    size_t cachedTail = 0;                                 // Consumer only
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0};  // Next to push
+    size_t cachedHead = 0;                                 // Producer only
+
+    alignas(CACHE_LINE_SIZE) WaitPoint notEmpty;
+    WaitPoint notFull;
+    std::atomic<bool> closed{false};
+};
+
+// Multiple producer, single consumer queue. Producers claim a slot with a
+// compare-and-swap on the tail, then publish it through the slot's sequence
+// number, so a slow producer never blocks the others (only the consumer,
+// which sees the queue end at the unpublished slot until it is filled).
+// Items from one producer come out in the order it pushed them.
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity);  // Rounded up to a power of two
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Non-blocking; value is left untouched when the queue is full
+    bool tryPush(T&& value);
+    bool tryPop(T& value);  // Consumer only
+    // Blocking
+    bool push(T value);
+    bool pop(T& value);  // Consumer only
+
+    // Wakes everyone; pushes fail from now on, pops once the queue is empty.
+    // Call once the producers are done: a push racing with it may be lost.
+    void close();
+    bool isClosed() const { return closed.load(std::memory_order_acquire); }
+
+    size_t size() const;  // A snapshot
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;  // == position: free; == position + 1: holds a value
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0};  // Next to claim
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0};  // Next to pop; written by the consumer only
+
+    alignas(CACHE_LINE_SIZE) WaitPoint notEmpty;
+    WaitPoint notFull;
+    std::atomic<bool> closed{false};
+};
+
+namespace concurrent_queue_detail {
+
+inline size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 2;
+    while (result < value) result <<= 1;
+    return result;
+}
+
+// Retries tryOp, sleeping on point in between, until it succeeds or the queue
+// is closed. Once closed, pops still take what is left; pushes fail.
+template <typename TryOp>
+bool waitFor(WaitPoint& point, const std::atomic<bool>& closed, bool drainWhenClosed, TryOp tryOp) {
+    while (true) {
+        if (closed.load(std::memory_order_acquire)) return drainWhenClosed && tryOp();
+        if (tryOp()) return true;
+        // Give the other side a chance first: cheaper than sleeping when it
+        // is about to come through
+        std::this_thread::yield();
+        if (tryOp()) return true;
+        uint32_t token = point.prepareWait();
+        if (closed.load(std::memory_order_acquire)) {
+            point.cancelWait();
+            continue;
+        }
+        if (tryOp()) {
+            point.cancelWait();
+            return true;
+        }
+        point.wait(token);
+    }
+}
+
+}  // namespace concurrent_queue_detail
+
+// SpscRing
+
+template <typename T>
+SpscRing<T>::SpscRing(size_t capacity) {
+    size_t size = concurrent_queue_detail::roundUpToPowerOfTwo(capacity);
+    slots = std::make_unique<T[]>(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool SpscRing<T>::tryPush(T&& value) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    if (position - cachedHead > mask) {
+        cachedHead = head.load(std::memory_order_acquire);
+        if (position - cachedHead > mask) return false;
+    }
+    slots[position & mask] = std::move(value);
+    tail.store(position + 1, std::memory_order_release);
+    notEmpty.notifyOne();
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::tryPop(T& value) {
+    size_t position = head.load(std::memory_order_relaxed);
+    if (position == cachedTail) {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if (position == cachedTail) return false;
+    }
+    value = std::move(slots[position & mask]);
+    slots[position & mask] = T();
+    head.store(position + 1, std::memory_order_release);
+    if (cachedTail - position <= capacity() / 2) notFull.notifyAll();
+    return true;
+}
+
+template <typename T>
+bool SpscRing<T>::push(T value) {
+    return concurrent_queue_detail::waitFor(notFull, closed, false, [&]() { return tryPush(std::move(value)); });
+}
+
+template <typename T>
+bool SpscRing<T>::pop(T& value) {
+    return concurrent_queue_detail::waitFor(notEmpty, closed, true, [&]() { return tryPop(value); });
+}
+
+template <typename T>
+void SpscRing<T>::close() {
+    closed.store(true, std::memory_order_release);
+    notEmpty.notifyAll();
+    notFull.notifyAll();
+}
+
+template <typename T>
+size_t SpscRing<T>::size() const {
+    size_t first = head.load(std::memory_order_acquire);
+    size_t last = tail.load(std::memory_order_acquire);
+    return last > first ? last - first : 0;
+}
+
+// MpscQueue
+
+template <typename T>
+MpscQueue<T>::MpscQueue(size_t capacity) {
+    size_t size = concurrent_queue_detail::roundUpToPowerOfTwo(capacity);
+    cells = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    mask = size - 1;
+}
+
+template <typename T>
+bool MpscQueue<T>::tryPush(T&& value) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells[position & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        } else if (difference < 0) {
+            return false;  // The consumer hasn't freed this cell yet: full
+        } else {
+            position = tail.load(std::memory_order_relaxed);  // Another producer took it
+        }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    notEmpty.notifyOne();
+    return true;
+}
+
+template <typename T>
+bool MpscQueue<T>::tryPop(T& value) {
+    size_t position = head.load(std::memory_order_relaxed);
+    Cell& cell = cells[position & mask];
+    if (cell.sequence.load(std::memory_order_acquire) != position + 1) return false;
+    value = std::move(cell.value);
+    cell.value = T();
+    cell.sequence.store(position + mask + 1, std::memory_order_release);  // Free for the next lap
+    head.store(position + 1, std::memory_order_release);
+    if (tail.load(std::memory_order_relaxed) - position <= capacity() / 2) notFull.notifyAll();
+    return true;
+}
+
+template <typename T>
+bool MpscQueue<T>::push(T value) {
+    return concurrent_queue_detail::waitFor(notFull, closed, false, [&]() { return tryPush(std::move(value)); });
+}
+
+template <typename T>
+bool MpscQueue<T>::pop(T& value) {
+    return concurrent_queue_detail::waitFor(notEmpty, closed, true, [&]() { return tryPop(value); });
+}
+
+template <typename T>
+void MpscQueue<T>::close() {
+    closed.store(true, std::memory_order_release);
+    notEmpty.notifyAll();
+    notFull.notifyAll();
+}
+
+template <typename T>
+size_t MpscQueue<T>::size() const {
+    size_t first = head.load(std::memory_order_acquire);
+    size_t last = tail.load(std::memory_order_acquire);
+    return last > first ? last - first : 0;
+}
+
+#endif // CONCURRENT_QUEUE_HPP
@@ -0,0 +1,102 @@
+#ifndef CONNECTION_MANAGER_HPP
+#define CONNECTION_MANAGER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ConnectionConfig {
+    size_t maxHalfOpen = 32;       // Connects in progress at once
+    size_t maxConnections = 200;   // Established plus in progress
+    std::chrono::milliseconds connectTimeout{5000};
+    // After the n-th failure in a row an endpoint waits initialBackoff * 2^(n-1)
+    std::chrono::milliseconds initialBackoff{15000};
+    std::chrono::milliseconds maxBackoff{30 * 60 * 1000};
+    int maxFailures = 8;           // Then the endpoint is forgotten
+};
+
+// Which discovered peers to dial, and when. Connects are non-blocking and
+// capped (half-open limit), so thousands of discovered peers cost a short
+// queue rather than a thread each. Endpoints are dialed best first: by where
+// they came from, then by past successes; failed ones back off exponentially
+// and are dropped after repeated failures.
+//
+// Only bookkeeping lives here; the caller owns the sockets and reports each
+// attempt's outcome.
+class ConnectionManager {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = ConnectionConfig;
+
+    // Higher is dialed first
+    enum Source : uint8_t { DHT, PEX, TRACKER, MANUAL };
+
+    struct Endpoint {
+        std::string ip;
+        uint16_t port = 0;
+    };
+
+    struct Stats {
+        size_t known = 0;
+        size_t halfOpen = 0;
+        size_t connected = 0;
+        size_t backingOff = 0;
+        uint64_t attempts = 0;
+        uint64_t failures = 0;
+        uint64_t timeouts = 0;
+    };
+
+    explicit ConnectionManager(const Config& config = Config());
+
+    // New endpoints are queued; a known one keeps its history and takes the better source
+    void addPeer(const std::string& ip, uint16_t port, Source source);
+
+    // Endpoints to dial now, best first, up to the half-open and connection
+    // limits. They count as half-open until one of the calls below.
+    std::vector<Endpoint> nextToConnect(Clock::time_point now = Clock::now());
+
+    void onConnected(const Endpoint& endpoint);
+    void onFailed(const Endpoint& endpoint, Clock::time_point now = Clock::now());
+    void onTimedOut(const Endpoint& endpoint, Clock::time_point now = Clock::now());
+    // An established connection closed; the endpoint may be dialed again after the initial backoff
+    void onDisconnected(const Endpoint& endpoint, Clock::time_point now = Clock::now());
+
+    const Config& getConfig() const {
+        return config;
+    }
+    Stats getStats(Clock::time_point now = Clock::now()) const;
+
+private:
+    enum State : uint8_t { IDLE, HALF_OPEN, CONNECTED };
+
+    struct Peer {
+        Endpoint endpoint;
+        Source source = DHT;
+        State state = IDLE;
+        int successes = 0;
+        int failures = 0;               // In a row
+        Clock::time_point retryAt{};    // Not dialed before this
+        uint64_t order = 0;             // Discovery order breaks ties
+    };
+
+    static std::string key(const Endpoint& endpoint);
+    // Whether a should be dialed before b
+    static bool better(const Peer& a, const Peer& b);
+    void fail(const Endpoint& endpoint, Clock::time_point now);
+
+    Config config;
+    std::unordered_map<std::string, Peer> peers;
+    size_t halfOpen = 0;
+    size_t connected = 0;
+    uint64_t nextOrder = 0;
+    uint64_t attempts = 0;
+    uint64_t failures = 0;
+    uint64_t timeouts = 0;
+    mutable std::mutex mutex;
+};
+
+#endif // CONNECTION_MANAGER_HPP
@@ -0,0 +1,145 @@
+#ifndef DISK_IO_HPP
+#define DISK_IO_HPP
+
+#include "torrent_file_parser.hpp"
+#include "piece_manager.hpp"
+#include "resume_journal.hpp"
+#include "bitfield.hpp"
+#include "concurrent_queue.hpp"
+#include <vector>
+#include <unordered_set>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <cstdint>
+
+// A block of a written piece as the file regions holding it (a block can
+// cross file boundaries), so it can be sent with sendfile without being read
+// into memory. The descriptors stay open as long as the DiskIO.
+struct FileBlock {
+    struct Region {
+        int fd;
+        int64_t offset;
+        size_t length;
+    };
+    std::vector<Region> regions;
+    size_t size = 0;
+
+    explicit operator bool() const { return size > 0; }
+};
+
+// Maps pieces onto the torrent's files and writes verified pieces to disk on
+// a background thread. Written pieces are evicted from PieceManager (freeing
+// their write-cache budget); later reads for uploads go straight to the files.
+//
+// Blocks of unfinished pieces can also be written as they arrive. With a
+// journal attached, every write is recorded once it is on disk so partial
+// pieces survive a restart.
+//
+// Skipped files are never created. The few bytes of a skipped file that share
+// a piece with a wanted file (its head and tail) are kept in <file>.part.
+class DiskIO {
+public:
+    DiskIO(const TorrentFile& torrent, const std::string& downloadDir, PieceManager& pieceStorage,
+           ResumeJournal* journal = nullptr);
+    ~DiskIO();
+
+    DiskIO(const DiskIO&) = delete;
+    DiskIO& operator=(const DiskIO&) = delete;
+
+    // Queues a verified piece held in PieceManager for writing. If all of its
+    // blocks already went out through queueBlockWrite() only the journal is updated.
+    void queueWrite(int pieceIndex);
+    // Queues a received block of an unfinished piece; the view pins its data.
+    // Never waits: false if the queue is full, and the piece is then written
+    // in full once verified.
+    bool queueBlockWrite(int pieceIndex, int blockOffset, BlockView block);
+    // Records (in order with pending writes) that a piece failed its hash check
+    void queueReset(int pieceIndex);
+    size_t pendingWrites() const;
+    // True while the queue is nearly full; network threads stop reading until it drains
+    bool isBacklogged() const;
+
+    // Reads a block of a piece that has already been written
+    bool readBlock(int pieceIndex, int blockOffset, int blockSize, std::vector<uint8_t>& data);
+    // Where a written block lives on disk, for sending it from the page cache.
+    // False for blocks kept in part files (their descriptors can be closed);
+    // read those with readBlock().
+    bool getFileBlock(int pieceIndex, int blockOffset, int blockSize, FileBlock& block);
+    // Reads a whole piece back from disk (e.g. to recheck existing data)
+    bool readPiece(int pieceIndex, std::vector<uint8_t>& data);
+
+    // Moves the file's piece-boundary bytes between the file and its part file
+    bool setFileSkipped(size_t fileIndex, bool skipped);
+
+    int64_t getTotalSize() const { return totalSize; }
+    int64_t getPieceSize(int pieceIndex) const;
+
+private:
+    struct FileEntry {
+        std::string path;
+        int64_t offset;  // Offset of the file within the torrent's byte stream
+        int64_t length;
+        int fd = -1;
+
+        // Skipped files: only [0, headLength) and [length - tailLength, length) are stored
+        bool skipped = false;
+        int64_t headLength = 0;
+        int64_t tailLength = 0;
+        int partFd = -1;
+    };
+
+    // Calls fn(file, fileOffset, length, bufferOffset) for each file region covered
+    // by [torrentOffset, torrentOffset + length)
+    bool forEachSpan(int64_t torrentOffset, int64_t length,
+                     const std::function<bool(FileEntry&, int64_t, int64_t, int64_t)>& fn);
+    bool openFile(const std::string& path, int& fd);
+    // File descriptor and offset to use for a span; NOT_STORED for the parts of a
+    // skipped file that no wanted piece covers
+    int resolveSpan(FileEntry& file, int64_t& fileOffset);
+    bool copyBoundaryBytes(FileEntry& file, bool toPartFile);
+    static constexpr int NOT_STORED = -2;
+    bool writeRange(int64_t torrentOffset, const uint8_t* data, int64_t length);
+    bool writePiece(int pieceIndex, const std::vector<uint8_t>& data);
+    void writerLoop();
+
+    struct WriteJob {
+        enum Type { PIECE, BLOCK, RESET } type = PIECE;
+        int pieceIndex = -1;
+        int blockOffset = 0;
+        BlockView block;
+
+        WriteJob() = default;
+        WriteJob(Type type, int pieceIndex, int blockOffset = 0, BlockView block = {})
+            : type(type), pieceIndex(pieceIndex), blockOffset(blockOffset), block(std::move(block)) {}
+    };
+    void runJob(WriteJob& job);
+
+    std::vector<FileEntry> files;
+    int64_t totalSize = 0;
+    int64_t pieceLength;
+    int numPieces;
+    PieceManager& pieceStorage;
+    ResumeJournal* journal;  // Optional, not owned
+
+    // Writer thread only: pieces whose blocks were all written as they arrived
+    std::unordered_set<int> streamedPieces;
+    std::unordered_set<int> failedBlockWrites;
+    // Pieces with a block that didn't fit in the queue (set by the network
+    // threads, cleared by the writer once the whole piece is written)
+    Bitfield droppedBlockWrites;
+
+    std::mutex fileMutex;  // Guards opening files (and seek+read/write on Windows)
+    std::shared_mutex layoutMutex;  // Exclusive while a file is (un)skipped
+
+    // Filled by the network threads (blocks) and the hashing workers (pieces,
+    // resets). When it is full the hashing workers wait for the writer; the
+    // network threads never do (see queueBlockWrite and isBacklogged).
+    static constexpr size_t WRITE_QUEUE_CAPACITY = 8192;
+    MpscQueue<WriteJob> writeQueue{WRITE_QUEUE_CAPACITY};
+    std::thread writer;
+};
+
+#endif // DISK_IO_HPP
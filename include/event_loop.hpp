@@ -0,0 +1,91 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#ifdef __linux__
+
+#include "concurrent_queue.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Single-threaded epoll loop that owns a set of non-blocking sockets. Each fd
+// is registered edge-triggered for reading and writing, so its handler runs
+// when data arrives or a full socket drains, and must read (or write) until
+// EAGAIN. Other threads hand work to the loop with post(), which wakes it
+// through an eventfd; tasks posted while the loop is busy run together at the
+// end of the current batch of events. Posting is lock-free unless the loop
+// falls thousands of tasks behind.
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Handler = std::function<void(uint32_t events)>;  // EPOLLIN, EPOLLOUT, EPOLLRDHUP, ...
+
+    EventLoop();  // Throws std::runtime_error if epoll or the eventfd can't be created
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Thread safe; off the loop thread they take effect on the loop's next pass.
+    // Remove an fd before closing it.
+    void add(int fd, Handler handler);
+    void remove(int fd);
+    void post(std::function<void()> task);
+    // Runs task on the loop every interval
+    void runEvery(std::chrono::milliseconds interval, std::function<void()> task);
+
+    // Dispatches events until stop(); call from one thread only
+    void run();
+    void stop();
+    bool inLoopThread() const;
+
+    size_t size() const;  // Registered fds
+
+private:
+    struct Entry {
+        Handler handler;
+        bool removed = false;
+    };
+    struct Timer {
+        std::chrono::milliseconds interval;
+        Clock::time_point due;
+        std::function<void()> task;
+    };
+
+    void addNow(int fd, Handler handler);
+    void removeNow(int fd);
+    void runPosted();
+    int runTimers();  // Returns the epoll_wait timeout until the next one, -1 if none
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    // Loop thread only. Removed entries live until the end of the batch, since
+    // later events in it may still point at them.
+    std::unordered_map<int, std::unique_ptr<Entry>> entries;
+    std::vector<std::unique_ptr<Entry>> retired;
+    std::vector<Timer> timers;
+    std::atomic<size_t> registered{0};
+
+    // Posted tasks. When the queue is full they spill into a locked list, and
+    // once anything has spilled every post goes there until the loop has run
+    // it, so each thread's tasks still run in the order it posted them.
+    static constexpr size_t POST_QUEUE_CAPACITY = 4096;
+    MpscQueue<std::function<void()>> postQueue{POST_QUEUE_CAPACITY};
+    std::mutex overflowMutex;
+    std::vector<std::function<void()>> overflow;
+    std::atomic<bool> overflowing{false};
+    std::atomic<bool> wakePending{false};  // The eventfd is written once per batch
+    std::atomic<bool> stopping{false};
+    std::atomic<std::thread::id> loopThread{};
+};
+
+#endif // __linux__
+
+#endif // EVENT_LOOP_HPP
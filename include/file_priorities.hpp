@@ -0,0 +1,50 @@
+#ifndef FILE_PRIORITIES_HPP
+#define FILE_PRIORITIES_HPP
+
+#include "torrent_file_parser.hpp"
+#include "bitfield.hpp"
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Per-file download priorities mapped onto pieces through the file table. A
+// piece gets the highest priority of the files it overlaps, so a piece that
+// straddles a skipped file and a wanted one is still downloaded.
+class FilePriorities {
+public:
+    enum Priority : uint8_t {
+        SKIP = 0,
+        LOW,
+        NORMAL,
+        HIGH
+    };
+
+    explicit FilePriorities(const TorrentFile& torrent);
+
+    size_t fileCount() const { return fileOffsets.size(); }
+
+    // Returns the pieces whose priority changed
+    std::vector<int> setFilePriority(size_t fileIndex, Priority priority);
+    Priority getFilePriority(size_t fileIndex) const;
+    Priority getPiecePriority(int pieceIndex) const;
+
+    bool isPieceWanted(int pieceIndex) const { return getPiecePriority(pieceIndex) != SKIP; }
+    Bitfield wantedPieces() const;
+
+    // [first, last] pieces overlapping a file; first > last for empty files
+    std::pair<int, int> filePieceRange(size_t fileIndex) const;
+
+private:
+    Priority computePiecePriority(int pieceIndex) const;  // Caller holds the mutex
+
+    int numPieces;
+    int64_t pieceLength;
+    std::vector<int64_t> fileOffsets;
+    std::vector<int64_t> fileLengths;
+    std::vector<Priority> filePriorities;
+    std::vector<Priority> piecePriorities;
+    mutable std::mutex mutex;
+};
+
+#endif // FILE_PRIORITIES_HPP
@@ -0,0 +1,77 @@
+#ifndef MEMORY_BUDGET_HPP
+#define MEMORY_BUDGET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Default global budget for piece data held in memory (256 MiB)
+constexpr size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+// Pieces allowed in progress at once when the budget has room for them
+constexpr size_t MIN_PIECES_IN_PROGRESS = 4;
+
+// Tracks the bytes of piece data held in memory across the download pipeline
+// (partial pieces -> verify queue -> write cache). Once usage goes over the
+// limit the budget is "throttled" until it drains back below the resume mark,
+// so callers can stop requesting blocks and stop reading from peer sockets.
+class MemoryBudget {
+public:
+    enum Category {
+        PARTIAL_PIECES = 0,
+        VERIFY_QUEUE,
+        WRITE_CACHE,
+        NUM_CATEGORIES
+    };
+
+    struct Stats {
+        size_t limit = 0;
+        size_t used = 0;
+        size_t peakUsed = 0;
+        size_t partialPieces = 0;
+        size_t verifyQueue = 0;
+        size_t writeCache = 0;
+        uint64_t throttleEvents = 0;  // Times the budget went over the limit
+        bool throttled = false;
+    };
+
+    // resumeRatio: fraction of the limit usage must drop to before throttling ends
+    explicit MemoryBudget(size_t limitBytes = DEFAULT_MEMORY_BUDGET, double resumeRatio = 0.9);
+
+    // Accounting (charging always succeeds: data already on the wire has to land somewhere)
+    void charge(Category category, size_t bytes);
+    void release(Category category, size_t bytes);
+    void transfer(Category from, Category to, size_t bytes);
+
+    // Backpressure
+    bool isThrottled() const;
+    bool canAllocate(size_t bytes) const;
+    bool waitForRoom(std::chrono::milliseconds timeout);
+
+    // Pieces that may be downloading or partial at once. Their buffers stay
+    // under the resume mark with room left for pieces waiting on the hasher
+    // and the disk writer, so partial pieces alone can't keep reads stopped.
+    // Never less than one piece, even if that doesn't fit.
+    size_t inProgressLimit(size_t pieceLength) const;
+
+    void setLimit(size_t limitBytes);
+    size_t getLimit() const;
+    Stats getStats() const;
+
+private:
+    void updateThrottleLocked();
+
+    size_t limit;
+    double resumeRatio;
+    size_t used = 0;
+    size_t peakUsed = 0;
+    size_t usedByCategory[NUM_CATEGORIES] = {};
+    uint64_t throttleEvents = 0;
+    bool throttled = false;
+
+    mutable std::mutex mutex;
+    std::condition_variable roomAvailable;
+};
+
+#endif // MEMORY_BUDGET_HPP
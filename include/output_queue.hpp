@@ -0,0 +1,126 @@
+#ifndef OUTPUT_QUEUE_HPP
+#define OUTPUT_QUEUE_HPP
+
+#include "piece_manager.hpp"
+#include "disk_io.hpp"
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+#else
+    #include <sys/types.h>
+#endif
+
+// Messages waiting to be sent on one connection, in two queues: control
+// messages, and bulk PIECE data. Control messages go out at the next message
+// boundary, ahead of any queued blocks: a PIECE already partly written is
+// finished first, since messages can't interleave on the wire. Bulk data can
+// be held to an allowance (the upload rate limit); control never waits.
+//
+// Each queue holds segments: bytes the queue owns (control messages, or a
+// PIECE header) optionally followed by block data it only references.
+// Queueing copies nothing into a shared buffer; a flush hands what is due to
+// one gather write (sendmsg) of up to MAX_BUFFERS buffers, and block data
+// goes to the socket straight from the piece buffer, or from the file with
+// sendfile for blocks on disk. A write that is cut short leaves the queues
+// exactly where it stopped, in the middle of a segment if need be.
+//
+// Small control messages are copied onto the end of the last control
+// segment, so the messages of one event-loop pass leave as a single buffer.
+// A flush that takes more than one call keeps the kernel from sending a
+// short packet in between: MSG_MORE on gather writes, TCP_CORK around
+// sendfile (undone by uncork() once the flush is over). Sockets can
+// otherwise stay TCP_NODELAY.
+class OutputQueue {
+public:
+#ifdef IOV_MAX
+    static constexpr size_t MAX_BUFFERS = IOV_MAX;
+#else
+    static constexpr size_t MAX_BUFFERS = 1024;
+#endif
+    static constexpr size_t COALESCE_MESSAGE_SIZE = 64;         // Copied onto the last segment up to this size
+    static constexpr size_t COALESCE_SEGMENT_SIZE = 16 * 1024;  // while that stays below this
+    static constexpr size_t NO_LIMIT = SIZE_MAX;
+
+    // Control message
+    void append(std::vector<uint8_t> message);
+    // PIECE messages. The block stays pinned (and the file open) until it is fully sent.
+    void appendBlock(std::vector<uint8_t> header, BlockView block);
+    void appendFile(std::vector<uint8_t> header, FileBlock file);
+
+    bool empty() const {
+        return control.empty() && bulk.empty();
+    }
+    // Bytes still to be written
+    size_t size() const {
+        return controlQueued + bulkQueued;
+    }
+    size_t bulkSize() const {
+        return bulkQueued;
+    }
+    size_t segmentCount() const {
+        return control.size() + bulk.size();
+    }
+
+    // One write of as much of what is due as a single call takes: a gather
+    // write of up to MAX_BUFFERS buffers, or sendfile when a block on disk is
+    // next. A PIECE not yet started is only included if the rest of
+    // bulkAllowance covers all of it. attempted is the number of bytes
+    // offered: a result below it means the socket is full, and 0 means only
+    // bulk data is left and it has to wait for more allowance. Returns what
+    // the call returned.
+    ssize_t writeTo(int sock, int flags, size_t& attempted, size_t bulkAllowance = NO_LIMIT);
+
+    // Ends a flush: sends what TCP_CORK held back (if writeTo corked the socket)
+    void uncork(int sock);
+
+    // Drops bytes from the front, in the order writeTo sends them, as if written
+    void consume(size_t bytes);
+
+    // Drops the queued PIECE for the block (the peer sent CANCEL), unless it
+    // has started going out. Returns whether one was dropped.
+    bool cancelBlock(uint32_t pieceIndex, uint32_t blockOffset, uint32_t length);
+
+    // Moves everything queued in other (nothing of which may have been
+    // written yet) to the ends of this queue's control and bulk queues
+    void splice(OutputQueue& other);
+
+private:
+    struct Segment {
+        std::vector<uint8_t> bytes;  // Owned: control messages, or a PIECE header
+        BlockView block;             // Referenced data sent after the bytes
+        FileBlock file;              // Or data sent from disk after the bytes
+
+        size_t size() const {
+            return bytes.size() + block.size + file.size;
+        }
+    };
+
+    // Calls fn(segment, isBulk) for the segments in the order they are sent,
+    // until it returns false
+    template <typename Fn>
+    void forEachScheduled(Fn fn) const;
+    // Calls fn(data, size) for the buffers of one gather write. Returns true
+    // if it stopped with more to send right away (MAX_BUFFERS, or a block sent
+    // with sendfile next) rather than because everything due was included.
+    template <typename Fn>
+    bool forEachPending(size_t bulkAllowance, Fn fn) const;
+    // The segment the next byte comes from
+    bool frontIsBulk() const {
+        return bulkStarted || control.empty();
+    }
+
+    std::deque<Segment> control;
+    std::deque<Segment> bulk;
+    size_t frontSent = 0;      // Bytes of the front segment already written
+    bool bulkStarted = false;  // The front segment is a PIECE partly written
+    size_t controlQueued = 0;
+    size_t bulkQueued = 0;
+    bool corked = false;
+};
+
+#endif // OUTPUT_QUEUE_HPP
@@ -1,12 +1,17 @@
 #ifndef PEER_CONNECTION_HPP
 #define PEER_CONNECTION_HPP
 
+#include "bitfield.hpp"
+#include "piece_manager.hpp"
+#include "receive_buffer.hpp"
+#include "output_queue.hpp"
 #include <vector>
 #include <array>
 #include <mutex>
 #include <atomic>
 #include <chrono>
 #include <deque>
+#include <functional>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -14,6 +19,7 @@
     #pragma comment(lib, "ws2_32.lib") // Link Windows Sockets library
 #else
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <arpa/inet.h>
     #include <unistd.h>
 #endif
@@ -25,39 +31,92 @@ public:
     std::atomic<bool> choked_by_us{true};
     std::atomic<bool> interested{false};
     std::atomic<bool> peer_interested{false};
+    // Sent no block for the snub timeout while we had requests out: gets one
+    // request at a time and is unchoked last, until a block arrives
+    std::atomic<bool> snubbed{false};
 
     // BitTorrent protocol data
-    std::vector<bool> bitfield;
+    Bitfield bitfield;
     std::array<uint8_t, 20> info_hash;
     std::array<uint8_t, 20> peer_id;
 
-    // Network buffers
-    std::vector<uint8_t> input_buffer;
-    std::vector<uint8_t> output_buffer;
+    // Network buffers. Input is read straight into input_buffer and framed in
+    // place. Output is queued as messages and flushed with gather writes; PIECE
+    // blocks are sent straight from the piece buffer (the queue pins it until
+    // then), or from the page cache with sendfile for pieces already on disk.
+    ReceiveBuffer input_buffer;
+    OutputQueue output_queue;  // Guarded by buffer_mutex
     std::mutex buffer_mutex;
+
+    // Called after data is queued for sending, once until flush_scheduled is
+    // cleared again, so a burst of messages costs one wakeup of the writer
+    std::function<void()> on_output;
+    std::atomic<bool> flush_scheduled{false};
     
     // Statistics
     std::atomic<double> download_rate{0.0};
     std::atomic<double> upload_rate{0.0};
     std::chrono::time_point<std::chrono::steady_clock> last_activity;
-
-    // Message queue
-    std::deque<std::vector<uint8_t>> message_queue;
-    std::mutex queue_mutex;
+    // When the kernel's RTT estimate is next read (input thread only)
+    std::chrono::time_point<std::chrono::steady_clock> next_rtt_sample;
 
     // Socket descriptor
     int socket = -1;
+    // Names the peer to the request bookkeeping; unlike the socket number it
+    // isn't handed to another peer once this one is gone
+    int id = -1;
+
+    // Called for the messages the protocol layer acts on (CHOKE, UNCHOKE, HAVE,
+    // BITFIELD, REQUEST, PIECE), after the flags above are updated. HAVE is only
+    // reported for pieces not already in the bitfield.
+    std::function<void(uint8_t message_id, const uint8_t* payload, size_t payload_size)> on_message;
+
+    // PIECE payloads are received in place: once a PIECE header is framed,
+    // reserve_block supplies the block's slot in the piece buffer and the
+    // rest of the payload is read straight into it. on_block gets the filled
+    // slot. Without a slot (unwanted or duplicate block) the PIECE goes to
+    // on_message as usual.
+    std::function<BlockSlot(uint32_t piece_index, uint32_t block_offset, uint32_t length)> reserve_block;
+    std::function<void(uint32_t piece_index, uint32_t block_offset, BlockSlot slot)> on_block;
+
+    // Block being received in place (input thread only)
+    struct IncomingBlock {
+        uint32_t piece_index = 0;
+        uint32_t block_offset = 0;
+        BlockSlot slot;
+        size_t received = 0;
+    };
+    IncomingBlock incoming_block;
+    bool receiving_block = false;
+
+    // Piece picker bookkeeping: whether the bitfield is counted in availability,
+    // and whether it was counted as a seed (HAVEs may complete it later)
+    bool in_picker = false;
+    bool picker_seed = false;
+
+    // The peer's handshake hasn't been read yet (event loop). Outbound
+    // connections send ours first; incoming ones reply once theirs checks out.
+    bool awaiting_handshake = false;
+    bool handshake_sent = false;
 
     // Message handling
     void send_choke();
     void send_unchoke();
     void send_interested();
     void send_not_interested();
-    void handle_message(const std::vector<uint8_t>& message);
+    void handle_message(const uint8_t* message, size_t length);
     void update_rate_counters(size_t downloaded, size_t uploaded);
     // Buffer management
     void append_to_output(const std::vector<uint8_t>& data);
-    void process_input_buffer();
+    void append_to_output(std::vector<uint8_t>&& data);
+    void append_block(uint32_t piece_index, uint32_t block_offset, BlockView block);
+    void append_block(uint32_t piece_index, uint32_t block_offset, FileBlock block);
+    // Reads from the socket: the rest of a block being received goes to its
+    // slot, everything else to input_buffer. Returns what recv returned.
+    ssize_t receive(int flags = 0);
+    // Dispatches every complete message in input_buffer. Returns false if the
+    // peer sent a length over the maximum; the connection should be dropped.
+    bool process_input_buffer();
 
 private:
     // Protocol message IDs
@@ -72,8 +131,16 @@ private:
         PIECE,
         CANCEL
     };
+    // Length, id, index and begin of a PIECE message, ahead of the block
+    static constexpr size_t PIECE_HEADER_SIZE = 13;
+
+    // Takes a PIECE at the front of input_buffer into its slot; false if it has none
+    bool begin_incoming_block();
+    void finish_incoming_block();
 
     // Message construction helpers
+    std::vector<uint8_t> piece_header(uint32_t piece_index, uint32_t block_offset, size_t block_size) const;
+    void output_queued();
     void create_message_header(MessageType type, uint32_t length = 0);
     void create_request_message(uint32_t piece_index, uint32_t block_offset, uint32_t block_length);
 
@@ -5,13 +5,33 @@
 
 #include "../include/torrent_file_parser.hpp"
 #include "../include/piece_manager.hpp"
+#include "../include/memory_budget.hpp"
+#include "../include/bitfield.hpp"
+#include "../include/piece_verifier.hpp"
+#include "../include/disk_io.hpp"
+#include "../include/resume_journal.hpp"
+#include "../include/streaming_scheduler.hpp"
+#include "../include/piece_stream.hpp"
+#include "../include/file_priorities.hpp"
+#include "../include/piece_picker.hpp"
+#include "../include/request_tracker.hpp"
+#include "../include/request_pipeline.hpp"
+#include "../include/sha1_engine.hpp"
+#include "../include/event_loop.hpp"
+#include "../include/connection_manager.hpp"
+#include "../include/rate_limiter.hpp"
+#include "../include/slot_map.hpp"
 #include "dht_bootstrap.hpp"
 #include <iomanip>
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <algorithm>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <thread>
 #include <iostream>
 #include <sstream>
@@ -22,6 +42,9 @@
     #pragma comment(lib, "ws2_32.lib") // Link Windows Sockets library
 #else
     #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
     #include <unistd.h>
 #endif
@@ -35,38 +58,74 @@ constexpr int MESSAGE_LENGTH_SIZE = 4;
 // Forward declaration
 class PeerConnection;
 
+// Network threads. Each shard is an event loop thread with its own listener on
+// the port (SO_REUSEPORT) and its own table of peers; a peer stays on one shard.
+struct NetworkConfig {
+    size_t threads = 1;       // 0 = one per core
+    bool pinThreads = false;  // Pin shard i to core i
+    ConnectionConfig connections;
+    size_t uploadRateLimit = 0;  // Bytes per second of PIECE data to all peers, 0 = unlimited
+};
+
 class PeerWireProtocol {
 public:
     // Constructor & Destructor
-    PeerWireProtocol(const std::string& torrentFilePath);
+    PeerWireProtocol(const std::string& torrentFilePath, size_t memoryBudgetBytes = DEFAULT_MEMORY_BUDGET,
+                     const std::string& downloadDir = ".", const NetworkConfig& network = NetworkConfig());
     ~PeerWireProtocol();
 
-    // Establishes a connection with a peer
+#ifndef __linux__
+    // Establishes a connection with a peer (blocking; see addPeers) and returns
+    // its id. On Linux peers are only dialed and handshaken on the event loops,
+    // via addPeers.
     int connectToPeer(const std::string& peerIP, int peerPort);
+#endif
 
-    // Sends handshake message to initiate the protocol
-    void sendHandshake(int peerSocket);
+    // Queues discovered peers. They are dialed without blocking, a few at a
+    // time and best first, with backoff for endpoints that fail.
+    void addPeers(const std::vector<DHT::Node>& nodes, ConnectionManager::Source source);
+    ConnectionManager::Stats getConnectionStats() const {
+        return connections.getStats();
+    }
+
+    // Below, peers are named by id (PeerConnection::id), not by socket: a
+    // socket number is reused as soon as its peer is closed
 
-    // Handles an incoming handshake from a peer
-    void handleHandshake(int peerSocket);
+#ifndef __linux__
+    // Sends handshake message to initiate the protocol (blocking)
+    void sendHandshake(int peerId);
+
+    // Handles an incoming handshake from a peer (blocking)
+    void handleHandshake(int peerId);
+#endif
 
     // Sends the bitfield message to inform peers about available pieces
-    void sendBitfield(int peerSocket, const std::vector<bool>& bitfield);
+    void sendBitfield(int peerId, const Bitfield& bitfield);
 
     // Handles an incoming bitfield message
-    void handleBitfield(int peerSocket, const std::vector<uint8_t>& bitfield);
+    void handleBitfield(int peerId, const std::vector<uint8_t>& bitfield);
 
     // Sends a request for a specific piece
-    void sendRequest(int peerSocket, int pieceIndex, int blockOffset, int blockSize);
+    void sendRequest(int peerId, int pieceIndex, int blockOffset, int blockSize);
+
+    // Withdraws a request (endgame: the block arrived from another peer)
+    void sendCancel(int peerId, int pieceIndex, int blockOffset, int blockSize);
 
     // Handles an incoming request for a piece
-    void handleRequest(int peerSocket, int pieceIndex, int blockOffset, int blockSize);
+    void handleRequest(int peerId, int pieceIndex, int blockOffset, int blockSize);
 
     // Sends a piece to a peer in response to a request
-    void sendPiece(int peerSocket, int pieceIndex, int blockOffset, const std::vector<uint8_t>& blockData);
+    void sendPiece(int peerId, int pieceIndex, int blockOffset, const std::vector<uint8_t>& blockData);
 
     // Handles an incoming piece message
-    void handlePiece(int peerSocket, int pieceIndex, int blockOffset, const std::vector<uint8_t>& blockData);
+    void handlePiece(int peerId, int pieceIndex, int blockOffset, const std::vector<uint8_t>& blockData);
+
+    // Sends a HAVE for a newly verified piece to every connected peer
+    void broadcastHave(int pieceIndex);
+
+    // Hashes pieces already present in the download directory and marks the
+    // matching ones as owned. Returns the number of pieces found.
+    int recheckPieces();
 
     // Implements choking logic (tit-for-tat)
     void manageChoking();
@@ -74,12 +133,18 @@ public:
     // Periodically unchokes a random peer (Optimistic Unchoking)
     void optimisticUnchoke();
 
-    void handlePeerInput(int sock);
-    void handlePeerOutput(int sock);
+    // Per-peer I/O threads (platforms without the event loop)
+    void handlePeerInput(int peerId);
+    void handlePeerOutput(int peerId);
 
-    // Runs the PWP event loop
+    // Accepts peers on every shard and runs the choker; doesn't return
     void run();
 
+    size_t peerCount() const;
+    size_t shardCount() const {
+        return shards.size();
+    }
+
     // void setInfoHash(const std::array<uint8_t, 20>& hash) {
     //     info_hash = hash;
     // }
@@ -90,19 +155,215 @@ public:
 
     std::vector<DHT::Node> queryTracker();
 
+    // Memory used by in-flight piece data (partial pieces, verify queue, write cache)
+    MemoryBudget::Stats getMemoryStats() const {
+        return memoryBudget.getStats();
+    }
+    void setMemoryBudget(size_t limitBytes) {
+        memoryBudget.setLimit(limitBytes);
+        picker->setInProgressLimit(memoryBudget.inProgressLimit(static_cast<size_t>(torrentFile.pieceLength)));
+    }
+
+    // Streaming mode: verified data is written in order to outputFd (e.g. 1 for
+    // stdout, or a pipe), and pieces near the playback cursor are requested by
+    // deadline from the fastest peers. Call before connecting to peers.
+    void enableStreaming(int outputFd, const StreamingScheduler::Config& config = StreamingScheduler::Config());
+    StreamingScheduler::Stats getStreamingStats() const;
+
+    // Hands the most urgent streaming pieces to unchoked peers, fastest first
+    void scheduleStreamingRequests();
+
+    // Per-file priorities for multi-file torrents; SKIP stops requesting the file's
+    // pieces (unless they overlap a wanted file) and keeps it off the disk
+    void setFilePriority(size_t fileIndex, FilePriorities::Priority priority);
+    FilePriorities::Priority getFilePriority(size_t fileIndex) const;
+
+    // Does the peer have any piece we are still missing?
+    bool peerHasPiecesWeNeed(const PeerConnection& conn) const;
+
+    // Tops up the peer's outstanding requests to its pipeline depth: missing
+    // blocks of its pieces first, then of the rarest piece it has that we need
+    void requestMorePieces(int peerId);
+    PiecePicker::Stats getPickerStats() const {
+        return picker->getStats();
+    }
+    // Outstanding requests, endgame duplicates, CANCELs and wasted bytes
+    RequestTracker::Stats getRequestStats() const {
+        return requestTracker.getStats();
+    }
+    RequestPipeline::PeerStats getPipelineStats(int peerId) const {
+        return pipeline.getPeerStats(peerId);
+    }
+
+    // A peer with requests outstanding that sends no block for this long is snubbed
+    void setSnubTimeout(std::chrono::seconds timeout) {
+        snubTimeout = timeout;
+    }
+
+    // Expires requests past their peer's timeout (back to the picker for other
+    // peers) and snubs peers that stopped sending. Run about once a second.
+    void checkRequestTimeouts();
+
     // Make the following private (public only for testing)
-    std::unordered_map<int, std::shared_ptr<PeerConnection>> peers; // Stores peer connections
     TorrentFile torrentFile; 
     std::unique_ptr<PieceManager> pieceStorage;
+    Bitfield havePieces;               // Our own verified pieces (updated atomically)
     DHT::DHTBootstrap* dht_instance;   // Pointer to DHT instance
 
 private:
-    // std::unordered_map<int, std::shared_ptr<PeerConnection>> peers; // Stores peer connections
-    std::mutex peerMutex; // Synchronization for multi-threading
+    MemoryBudget memoryBudget; // Global budget for piece data held in memory
+    std::atomic<bool> requestsHeldBack{false};  // New pieces weren't started while throttled
+
+    // A registered peer: its shard and slot there. Stays valid until the peer
+    // is dropped; after that lookups miss, even once its socket number is reused.
+    struct PeerHandle {
+        uint32_t shard = 0;
+        SlotHandle slot;
+
+        explicit operator bool() const { return static_cast<bool>(slot); }
+        bool operator==(const PeerHandle& other) const { return shard == other.shard && slot == other.slot; }
+    };
+
+    // Peers are split across shards, each with its own lock (and on Linux its
+    // own event loop thread and listener). Never hold two shard locks at once.
+    // A shard's peers are stored densely, so broadcasts and the choker walk
+    // one array.
+    struct PeerShard {
+        uint32_t index = 0;
+        SlotMap<std::shared_ptr<PeerConnection>> peers;
+        std::unordered_map<int, SlotHandle> ids;  // Peer id -> slot
+        uint32_t nextId = 0;
+        std::unordered_map<int, ConnectionManager::Endpoint> dialed;  // Peers we connected to, by id
+        std::mutex mutex;
+#ifdef __linux__
+        struct PendingConnect {
+            ConnectionManager::Endpoint endpoint;
+            ConnectionManager::Clock::time_point deadline;
+        };
+        std::unordered_map<int, PendingConnect> connecting;  // Loop thread only
+        std::unique_ptr<EventLoop> eventLoop;
+        std::thread thread;
+        std::vector<PeerHandle> pausedReaders;     // Not read while readingPaused() (loop thread)
+        std::vector<PeerHandle> throttledWriters;  // Blocks waiting for the upload limit (loop thread)
+        int listenSocket = -1;
+#endif
+    };
+    NetworkConfig networkConfig;
+    ConnectionManager connections;
+    RateLimiter uploadLimiter;  // PIECE data to all peers; control messages are never held back
+    std::vector<std::unique_ptr<PeerShard>> shards;
+    std::atomic<size_t> nextShard{0};  // Round robin for outbound connections
+
+    // A peer id is its shard's index plus a multiple of the shard count
+    PeerShard& shardOf(int peerId) const;
+    // The slot of the peer, if it is in this shard (whose lock the caller holds)
+    SlotHandle slotOf(const PeerShard& shard, int peerId) const;
+    std::shared_ptr<PeerConnection> findPeer(int peerId) const;
+    std::shared_ptr<PeerConnection> findPeer(PeerHandle handle) const;
+    PeerHandle handleOf(int peerId) const;
+    // Gives the peer its id and the callbacks that name it by that id
+    PeerHandle registerPeer(std::shared_ptr<PeerConnection> conn, size_t shard);
+    // Snapshot across shards, taking one shard lock at a time
+    std::vector<std::shared_ptr<PeerConnection>> allPeers() const;
     // DHT::DHTBootstrap* dht_instance;   // Pointer to DHT instance
     TorrentFileParser torrentFileParser;
     // TorrentFile torrentFile; 
     std::array<uint8_t, 20> infoHash;
+    std::unique_ptr<FilePriorities> filePriorities;
+    std::unique_ptr<PiecePicker> picker;      // Rarest-first selection from peer availability
+    RequestTracker requestTracker;            // Outstanding block requests per peer
+    RequestPipeline pipeline;                 // How many requests each peer gets, and how long they may take
+    std::atomic<std::chrono::seconds> snubTimeout{std::chrono::seconds(60)};
+    Bitfield piecesNotNeeded;  // Verified or skipped; updated atomically like havePieces
+    std::unique_ptr<ResumeJournal> journal;   // Received blocks on disk, for resuming partial pieces
+    std::unique_ptr<DiskIO> diskIO;           // Writes verified pieces (declared before verifier: outlives it)
+    std::unique_ptr<StreamingScheduler> streaming;  // Null unless streaming is enabled
+    std::unique_ptr<PieceStream> pieceStream;
+    std::unique_ptr<PieceVerifier> verifier;  // Hashing pool for completed pieces
+
+    std::thread streamingThread;  // Joined by the destructor before pieceStream goes
+
+    // Set by the destructor, waking the background loops so they can be joined
+    bool stopping = false;
+    std::mutex stopMutex;
+    std::condition_variable stopSignal;
+    // Sleeps for period; false once the loops are being stopped
+    bool sleepUnlessStopping(std::chrono::milliseconds period);
+
+    void streamingLoop();
+#ifndef __linux__
+    std::thread timeoutThread;  // On Linux shard 0's loop expires requests
+    void requestTimeoutLoop();
+#endif
+    std::atomic<int> optimisticPeer{-1};  // Id of the optimistic unchoke, which the choker keeps
+
+    // Our side of the handshake, and a check of the peer's (read from conn's input)
+    std::vector<uint8_t> handshakeMessage() const;
+    bool acceptHandshake(PeerConnection& conn);
+
+#ifdef __linux__
+    // Each shard's loop thread serves its peer sockets: reads are framed into
+    // messages as they arrive, queued output is written when the socket takes it
+    void startShard(size_t index);
+    void listenOnShard(size_t index, uint16_t port);
+    void acceptPeers(size_t index);
+    void watchPeer(int sock, PeerHandle handle);
+    void readFromPeer(PeerHandle handle);
+    void flushToPeer(PeerHandle handle);
+    // Queues message on the shard's peers, a chunk per loop pass so I/O runs in between
+    void broadcastOnShard(PeerShard& shard, std::shared_ptr<const std::vector<uint8_t>> message,
+                          std::shared_ptr<const std::vector<std::shared_ptr<PeerConnection>>> peers, size_t from);
+    void resumePausedReaders(PeerShard& shard);
+    void resumeThrottledWriters(PeerShard& shard);
+    // Non-blocking connect on a shard's loop, finished when the socket turns writable
+    void startConnect(const ConnectionManager::Endpoint& endpoint);
+    void finishConnect(size_t index, int sock);
+    void expireConnects(PeerShard& shard);
+#endif
+    // Starts connects to queued peers while the connection manager allows
+    void dialPeers();
+
+    // New connection; registerPeer routes its messages to onPeerMessage
+    std::shared_ptr<PeerConnection> makePeerConnection(int sock);
+    // Dispatches a parsed message; runs on the peer's input thread without shard locks
+    void onPeerMessage(int peerId, uint8_t messageId, const uint8_t* payload, size_t payloadSize);
+    // PIECE received in place: the slot its payload is read into (empty if
+    // the block isn't wanted), and the filled slot once the payload is in
+    BlockSlot reserveBlock(int peerId, int pieceIndex, int blockOffset, int blockSize);
+    // A block we asked this peer for, at its full size. Anything else would
+    // take a piece buffer past the memory budget and in-progress limit, or
+    // (short) mark a whole block received and fail the piece's hash.
+    bool isExpectedBlock(int peerId, int pieceIndex, int blockOffset, int blockSize);
+    void finishBlock(int peerId, int pieceIndex, int blockOffset, const BlockSlot& slot);
+    // Shared by both PIECE paths: snub, latency and RTT bookkeeping on arrival,
+    // and the disk write and hash hand-off once the block is stored
+    void notePieceArrival(int peerId, int pieceIndex, int blockOffset, size_t blockSize);
+    void blockStored(int pieceIndex, int blockOffset, size_t blockSize);
+    void requestMissingBlocks(int peerId, int pieceIndex);
+    // Blocks of the piece neither received nor requested from anyone
+    void collectUnrequestedBlocks(int pieceIndex, size_t maxBlocks, std::vector<RequestTracker::Block>& blocks);
+    // Lets every unchoked peer but one top up its requests (after blocks were dropped)
+    void refillPipelines(int exceptPeer);
+    // Endgame starts once every missing block is requested; returns whether it is on
+    bool updateEndgame();
+    // Returns the peer's unfinished pieces to the picker (choke or disconnect)
+    void releasePeerPieces(int peerId);
+    void dropPeer(PeerHandle handle);
+    // Over the memory budget or the disk writer is backlogged: the peer isn't
+    // read, and TCP flow control pushes back on it until things drain. Over
+    // the budget, peers that owe blocks of pieces we hold are still read.
+    bool readingPaused(int peerId) const;
+    // Once the memory budget is clear, tops up the pipelines that held back
+    // new pieces while it was throttled
+    void resumeHeldRequests();
+
+    // Reloads pieces recorded in the journal: complete ones are marked as owned,
+    // blocks of partial ones are read back into PieceManager
+    void resumeFromJournal();
+
+    // Hashing pool callbacks (run on verifier threads, never on network threads)
+    bool verifyPiece(int pieceIndex);
+    void onPieceVerified(int pieceIndex, bool passed);
     // std::vector<DHT::Node> parseTrackerPeers(const BencodedValue& peersValue);
 
     std::string computeSHA1(const std::vector<uint8_t>& data);
@@ -3,32 +3,93 @@
 
 #define MAX_BLOCK_SIZE 16384
 
+#include "memory_budget.hpp"
+#include "bitfield.hpp"
+#include "sha1_engine.hpp"
+#include <array>
 #include <vector>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
+// Shared, read-only handle to a piece's data; keeps the buffer alive after eviction
+using PieceBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+// Read-only view of one block inside a piece buffer. The view pins the buffer,
+// so it stays valid while queued for sending even if the piece is evicted.
+struct BlockView {
+    PieceBuffer buffer;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    explicit operator bool() const { return buffer != nullptr; }
+};
+
+// Writable view of a block being received straight into the piece buffer.
+// Pins the buffer like BlockView, so the socket never writes into freed memory.
+struct BlockSlot {
+    std::shared_ptr<std::vector<uint8_t>> buffer;
+    uint8_t* data = nullptr;
+    size_t size = 0;
+
+    explicit operator bool() const { return buffer != nullptr; }
+};
+
 class PieceManager {
 public:
-    explicit PieceManager(int numPieces, int pieceLength);
+    // totalLength is the size of the whole torrent (the last piece may be short)
+    PieceManager(int numPieces, int pieceLength, int64_t totalLength, MemoryBudget* budget = nullptr);
 
     bool getPieceBlock(int pieceIndex, int blockOffset, int blockSize, std::vector<uint8_t>& data);
+    // Same as getPieceBlock without copying; returns an empty view on failure
+    BlockView getBlockView(int pieceIndex, int blockOffset, int blockSize);
     bool storePieceBlock(int pieceIndex, int blockOffset, const std::vector<uint8_t>& data);
+    // In-place receive: the slot for a block nobody has stored or is writing
+    // (empty otherwise); commitBlock then marks it received, like storePieceBlock.
+    // A slot that won't be filled is given back with releaseBlock.
+    BlockSlot reserveBlock(int pieceIndex, int blockOffset, int blockSize);
+    bool commitBlock(int pieceIndex, int blockOffset, const BlockSlot& slot);
+    void releaseBlock(int pieceIndex, int blockOffset, const BlockSlot& slot);
     bool isPieceComplete(int pieceIndex);
     bool getFullPiece(int pieceIndex, std::vector<uint8_t>& data);
     bool markPieceAsDownloaded(int pieceIndex);
     int getBlockCount(int pieceIndex);
+    int getPieceSize(int pieceIndex);
+    bool isPieceAllocated(int pieceIndex);
+    Bitfield getReceivedBlocks(int pieceIndex);  // One bit per block; empty if not allocated
+    bool hasBlock(int pieceIndex, int blockOffset);
+    bool evictPiece(int pieceIndex);  // Drops a written piece from memory
+    bool resetPiece(int pieceIndex);  // Discards a piece that failed its hash check
+    PieceBuffer getPieceBuffer(int pieceIndex);
+
+    // Finishes the running SHA-1 of a complete piece (blocks are hashed in order as they arrive)
+    bool finalizePieceHash(int pieceIndex, Sha1Digest& digest);
 
 private:
     int numPieces;
     int pieceLength;
+    int64_t totalLength;
+    MemoryBudget* budget;  // Optional, not owned
     
     struct PieceData {
-        std::vector<uint8_t> data;
-        std::vector<bool> receivedBlocks;
+        std::shared_ptr<std::vector<uint8_t>> data;
+        Bitfield receivedBlocks;
+        Bitfield reservedBlocks;  // Being received in place
         int receivedBlockCount = 0;
+        MemoryBudget::Category budgetCategory = MemoryBudget::PARTIAL_PIECES;
+
+        // Running SHA-1 over the contiguous prefix of received blocks
+        Sha1Context hashContext;
+        int hashedBytes = 0;
+        bool hashFinalized = false;
     };
 
+    void advanceHash(int pieceIndex, PieceData& piece);
+    // Checks the block range and allocates the piece on first use; null if invalid
+    PieceData* pieceForBlock(int pieceIndex, int blockOffset, size_t blockSize, const char* caller);
+    void markReceived(int pieceIndex, int blockIndex, PieceData& piece);
+
     std::unordered_map<int, PieceData> pieces;  // Store pieces by index
     std::unordered_set<int> completedPieces; // completed pieces
     std::mutex mutex;  // Protects concurrent access
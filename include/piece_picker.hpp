@@ -0,0 +1,130 @@
+#ifndef PIECE_PICKER_HPP
+#define PIECE_PICKER_HPP
+
+#include "bitfield.hpp"
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// Rarest-first piece selection. Pieces we still need sit in buckets keyed by
+// (priority, availability); an availability change moves a piece to the
+// neighbouring bucket with a swap-remove, so BITFIELD/HAVE/disconnect updates
+// are O(1) per piece. Seeds are counted separately and never touch buckets.
+//
+// Picking scans buckets from the highest priority and lowest availability,
+// starting at a random slot inside each bucket so peers don't all converge on
+// the same piece. A peer holding few pieces can make that scan long, so after
+// MAX_BUCKET_PROBES misses the rarest of a random run of MAX_BITFIELD_SAMPLES
+// pieces from the peer's own bitfield is taken instead.
+// Partially downloaded pieces whose peer went away are offered first, so they
+// are finished before new pieces are started.
+//
+// Peers are classed slow/medium/fast by how long a whole piece would take them.
+// A slow peer holds one piece at a time and leaves partial pieces to faster
+// ones; faster peers may join a slower peer's piece for the blocks it hasn't
+// requested yet, so the piece doesn't wait on the slow peer. With an
+// in-progress limit set, no new piece is started while that many are
+// downloading or partial; peers then join pieces of their own class or slower.
+class PiecePicker {
+public:
+    static constexpr int NO_PIECE = -1;
+    static constexpr int NUM_PRIORITIES = 4;  // 0 = don't download (same levels as FilePriorities)
+    static constexpr int DEFAULT_PRIORITY = 2;
+    static constexpr size_t MAX_BUCKET_PROBES = 512;      // Then fall back to scanning the peer's bitfield
+    static constexpr size_t MAX_BITFIELD_SAMPLES = 1024;  // Pieces of the peer's bitfield looked at
+
+    enum SpeedClass : uint8_t { SLOW, MEDIUM, FAST };
+    static constexpr double FAST_PIECE_SECONDS = 5;   // FAST: downloads a whole piece within this
+    static constexpr double SLOW_PIECE_SECONDS = 30;  // SLOW: takes longer than this
+
+    struct Stats {
+        size_t wantedPieces = 0;       // Still to be picked (in buckets)
+        size_t downloadingPieces = 0;
+        size_t partialPieces = 0;      // Started, waiting for a new peer
+        size_t havePieces = 0;
+        int seeds = 0;
+        size_t inProgressLimit = 0;    // Downloading + partial; 0 = unbounded
+        size_t peakInProgress = 0;
+    };
+
+    explicit PiecePicker(int numPieces, uint32_t seed = std::random_device{}());
+
+    // Unmeasured peers (rate 0) are MEDIUM
+    static SpeedClass classify(double bytesPerSecond, int pieceLength);
+    void setInProgressLimit(size_t limit);
+
+    // Availability. addPeer returns true if the peer was counted as a seed; pass
+    // that back to removePeer, since HAVEs may have completed its bitfield since.
+    bool addPeer(const Bitfield& peerHas);
+    void removePeer(const Bitfield& peerHas, bool countedAsSeed);
+    void addHave(int pieceIndex);
+    int getAvailability(int pieceIndex) const;
+
+    void setPiecePriority(int pieceIndex, int priority);
+    int getPiecePriority(int pieceIndex) const;
+
+    // Rarest wanted piece the peer has, or NO_PIECE. The piece is then marked
+    // as downloading by peerId until it is verified, failed or aborted.
+    int pickPiece(int peerId, const Bitfield& peerHas, SpeedClass speed = MEDIUM);
+    // Pieces other peers are downloading that this one may request blocks of,
+    // slowest owners first. Ownership stays with the other peer.
+    std::vector<int> joinablePieces(int peerId, const Bitfield& peerHas, SpeedClass speed) const;
+    // Marks a piece chosen elsewhere (e.g. by the streaming scheduler) as downloading
+    void markDownloading(int pieceIndex, int peerId);
+    // Marks a wanted piece whose blocks were restored (e.g. from the resume journal) as partial
+    void markPartial(int pieceIndex);
+
+    void pieceVerified(int pieceIndex);
+    void pieceFailed(int pieceIndex);                   // Hash check failed: back to wanted
+    void abortPiece(int pieceIndex, bool hasData);      // Peer gave up on it
+    std::vector<int> piecesDownloadingBy(int peerId) const;
+    std::vector<int> downloadingPieces() const;   // By any peer
+
+    bool isDownloading(int pieceIndex) const;
+    Stats getStats() const;
+
+private:
+    enum State : uint8_t { WANTED, DOWNLOADING, PARTIAL, HAVE };
+
+    // Bucket bookkeeping; callers hold the mutex
+    std::vector<int>& bucketFor(int pieceIndex);
+    void insertIntoBucket(int pieceIndex);
+    void removeFromBucket(int pieceIndex);
+    void removePartial(int pieceIndex);
+    void setDownloading(int pieceIndex, int peerId, SpeedClass speed);
+    void stopDownloading(int pieceIndex);
+    void makeWanted(int pieceIndex);  // Into the bucket, if its priority allows
+    bool atInProgressLimit() const;
+    int pickPartial(int peerId, const Bitfield& peerHas, SpeedClass speed);
+    int pickFromBuckets(int peerId, const Bitfield& peerHas, SpeedClass speed);
+    int pickFromPeerBitfield(int peerId, const Bitfield& peerHas, SpeedClass speed);
+
+    // Kept together so walking a peer's bitfield touches one cache line per piece
+    struct PieceEntry {
+        int availability = 0;    // Excluding seeds
+        int bucketPosition = -1; // Index inside its bucket, -1 if not in one
+        int downloadingBy = -1;  // Peer while DOWNLOADING
+        uint8_t priority = DEFAULT_PRIORITY;
+        State state = WANTED;
+        SpeedClass speed = MEDIUM;  // Of the peer while DOWNLOADING
+    };
+
+    int numPieces;
+    int seeds = 0;
+    std::vector<PieceEntry> pieces;
+    std::vector<std::vector<std::vector<int>>> buckets;  // [priority][availability] -> pieces
+    std::vector<int> partialPieces;
+    std::unordered_map<int, std::vector<int>> peerPieces;
+    size_t wantedCount = 0;
+    size_t haveCount = 0;
+    size_t downloadingCount = 0;
+    size_t inProgressLimit = 0;
+    size_t peakInProgress = 0;
+
+    std::mt19937 rng;
+    mutable std::mutex mutex;
+};
+
+#endif // PIECE_PICKER_HPP
@@ -0,0 +1,55 @@
+#ifndef PIECE_STREAM_HPP
+#define PIECE_STREAM_HPP
+
+#include "bitfield.hpp"
+#include "streaming_scheduler.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes verified torrent data in order to a file descriptor (stdout or a
+// pipe) on its own thread. Only waits when the next piece hasn't been
+// verified yet; each written piece advances the scheduler's playback cursor.
+class PieceStream {
+public:
+    using ReadPiece = std::function<bool(int pieceIndex, std::vector<uint8_t>& data)>;
+
+    // Pieces already marked in `have` are available immediately
+    PieceStream(int outputFd, int numPieces, int64_t pieceLength, const Bitfield& have,
+                ReadPiece readPiece, StreamingScheduler& scheduler);
+    ~PieceStream();
+
+    PieceStream(const PieceStream&) = delete;
+    PieceStream& operator=(const PieceStream&) = delete;
+
+    void notifyPieceVerified(int pieceIndex);
+
+    // All data written, or the output failed
+    bool isFinished() const { return finished; }
+    uint64_t bytesWritten() const { return written; }
+
+private:
+    void run();
+    bool writeAll(const uint8_t* data, size_t length);
+
+    int outputFd;
+    int numPieces;
+    int64_t pieceLength;
+    ReadPiece readPiece;
+    StreamingScheduler& scheduler;
+
+    Bitfield available;
+    std::mutex mutex;
+    std::condition_variable pieceAvailable;
+    bool stopping = false;
+
+    std::atomic<bool> finished{false};
+    std::atomic<uint64_t> written{0};
+    std::thread writer;
+};
+
+#endif // PIECE_STREAM_HPP
@@ -0,0 +1,60 @@
+#ifndef PIECE_VERIFIER_HPP
+#define PIECE_VERIFIER_HPP
+
+#include "bitfield.hpp"
+#include "concurrent_queue.hpp"
+#include <vector>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Worker pool that SHA-1 checks completed pieces off the network threads.
+// Completed pieces are queued by index; a worker runs the hash check and then
+// delivers a completion event (on the worker thread) with the result.
+//
+// Each worker has its own lock-free queue; a piece goes to the one with the
+// least queued. Pieces are all the same size, so that balances well enough.
+class PieceVerifier {
+public:
+    using HashCheck = std::function<bool(int pieceIndex)>;               // true if the hash matches
+    using Completion = std::function<void(int pieceIndex, bool passed)>;
+
+    PieceVerifier(size_t numPieces, size_t numThreads, HashCheck check, Completion onComplete);
+    ~PieceVerifier();
+
+    PieceVerifier(const PieceVerifier&) = delete;
+    PieceVerifier& operator=(const PieceVerifier&) = delete;
+
+    // Queues a completed piece; returns false if it is already queued or being hashed
+    bool submit(int pieceIndex);
+
+    size_t queuedCount() const;
+    uint64_t verifiedCount() const { return passedCount + failedCount; }
+    uint64_t failedHashCount() const { return failedCount; }
+
+    static size_t defaultThreadCount();
+
+private:
+    struct Worker {
+        explicit Worker(size_t capacity) : queue(capacity) {}
+        MpscQueue<int> queue;
+        std::thread thread;
+    };
+    void workerLoop(Worker& worker);
+
+    HashCheck check;
+    Completion onComplete;
+
+    Bitfield inFlight;  // Queued or being hashed (atomic bit updates)
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> nextWorker{0};  // Where the search for the least loaded starts
+
+    std::atomic<uint64_t> passedCount{0};
+    std::atomic<uint64_t> failedCount{0};
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+#endif // PIECE_VERIFIER_HPP
@@ -0,0 +1,45 @@
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Token bucket shared by every connection's bulk (PIECE) output. Tokens accrue
+// at the configured rate up to the burst size; senders ask how many bytes
+// they may send now and are charged for what they sent. The balance may go
+// below zero, since a message already partly on the wire is finished rather
+// than cut off, and the debt is paid back before anything else is allowed.
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t UNLIMITED = SIZE_MAX;
+    static constexpr size_t MIN_BURST = 64 * 1024;  // At least a few PIECE messages
+
+    // bytesPerSecond 0 means no limit; burstBytes 0 picks a tenth of a second's
+    // worth. The burst is at least MIN_BURST.
+    explicit RateLimiter(size_t bytesPerSecond = 0, size_t burstBytes = 0);
+
+    void setRate(size_t bytesPerSecond, size_t burstBytes = 0);
+    size_t getRate() const {
+        return rate.load(std::memory_order_relaxed);
+    }
+
+    // Bytes that may be sent now, UNLIMITED without a limit
+    size_t available(Clock::time_point now = Clock::now());
+    void consume(size_t bytes);
+
+private:
+    void refillLocked(Clock::time_point now);
+
+    std::atomic<size_t> rate;
+    double burst = 0;
+    double tokens = 0;
+    Clock::time_point lastRefill;
+    std::mutex mutex;
+};
+
+#endif // RATE_LIMITER_HPP
@@ -0,0 +1,63 @@
+#ifndef RECEIVE_BUFFER_HPP
+#define RECEIVE_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Received bytes of one connection, framed into length-prefixed messages in
+// place. The socket reads straight into the free space (prepare/commit), and
+// each complete message is handed out as a view into the buffer, so framing
+// copies nothing. Consuming a message only moves the read position; the
+// unread tail (at most one partial message) is moved to the front only when
+// the space after it runs short, so each byte is moved at most once.
+//
+// Lengths above the maximum are rejected before anything is buffered for
+// them, so a hostile length prefix can't make the buffer grow.
+class ReceiveBuffer {
+public:
+    static constexpr size_t LENGTH_PREFIX = 4;
+    static constexpr size_t DEFAULT_MAX_MESSAGE_LENGTH = 9 + 16384;  // PIECE with a 16 KiB block
+    static constexpr size_t MIN_READ_SPACE = 64 * 1024;              // prepare() offers at least this
+
+    enum FrameStatus { FRAME_READY, FRAME_INCOMPLETE, FRAME_TOO_LONG };
+
+    explicit ReceiveBuffer(size_t maxMessageLength = DEFAULT_MAX_MESSAGE_LENGTH);
+
+    // Raise (or lower) the longest accepted message, e.g. for a large BITFIELD
+    void setMaxMessageLength(size_t length);
+    size_t maxMessageLength() const {
+        return maxLength;
+    }
+
+    // Free space to receive into; call commit() with the bytes written.
+    // Invalidates views returned by nextMessage().
+    uint8_t* prepare(size_t& space);
+    void commit(size_t bytes);
+    // Copies bytes in (for callers that don't read from a socket)
+    void append(const uint8_t* bytes, size_t length);
+
+    // Unread bytes, e.g. for a handshake read before framing starts
+    const uint8_t* data() const {
+        return storage.data() + readPos;
+    }
+    size_t size() const {
+        return writePos - readPos;
+    }
+    void consume(size_t bytes);
+
+    // The next complete message (id and payload, without the length prefix;
+    // empty for a keep-alive), consumed from the buffer. The view stays valid
+    // until the next prepare() or append().
+    FrameStatus nextMessage(const uint8_t*& message, size_t& length);
+
+private:
+    void makeRoom(size_t space);
+
+    std::vector<uint8_t> storage;
+    size_t readPos = 0;
+    size_t writePos = 0;
+    size_t maxLength;
+};
+
+#endif // RECEIVE_BUFFER_HPP
@@ -0,0 +1,82 @@
+#ifndef REQUEST_PIPELINE_HPP
+#define REQUEST_PIPELINE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+
+struct PipelineConfig {
+    int minDepth = 4;
+    int maxDepth = 512;        // 8 MiB of 16 KiB blocks in flight per peer
+    int initialDepth = 8;
+    double headroom = 1.5;     // Depth = bandwidth-delay product (in blocks) times this
+    size_t blockBytes = 16384;
+    std::chrono::milliseconds rateWindow{500};
+    // Request timeout: smoothed latency + 4 deviations (as TCP's RTO), within these bounds
+    std::chrono::milliseconds minRequestTimeout{2000};
+    std::chrono::milliseconds maxRequestTimeout{60000};
+    std::chrono::milliseconds initialRequestTimeout{20000};  // Before the first block
+};
+
+// How many block requests to keep outstanding at each peer. With one request
+// per round trip a 100 ms peer caps at 160 KB/s, so the depth follows the
+// peer's bandwidth-delay product: measured download rate times round-trip time.
+//
+// The round trip comes from the kernel's TCP estimate when the caller has one
+// (onRttSample). Otherwise it is the smallest request-to-block latency seen:
+// once the pipe is full every latency includes queueing behind our own
+// requests, so a filter that follows recent samples would inflate the depth
+// without bound. Until the first rate sample the depth grows by one per block
+// received, like TCP slow start. A depth-limited peer delivers at most
+// depth/RTT, so with headroom above 1 the depth keeps growing until the
+// peer's or our link is the limit.
+//
+// Latencies also feed a smoothed mean and deviation, from which each peer's
+// request timeout is derived, so a slow peer isn't timed out early and a
+// fast one isn't waited on for long.
+class RequestPipeline {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Config = PipelineConfig;
+
+    struct PeerStats {
+        double bytesPerSecond = 0;
+        double rttMs = 0;
+        int depth = 0;
+    };
+
+    explicit RequestPipeline(const Config& config = Config());
+
+    // A requested block arrived latency after its REQUEST was sent
+    void onBlockReceived(int peerId, size_t bytes, Clock::duration latency, Clock::time_point now = Clock::now());
+    // Smoothed round trip from the transport (e.g. TCP_INFO); preferred over latencies
+    void onRttSample(int peerId, Clock::duration rtt);
+    void removePeer(int peerId);
+
+    int targetDepth(int peerId) const;
+    // How long a request to this peer may stay unanswered
+    Clock::duration requestTimeout(int peerId) const;
+    PeerStats getPeerStats(int peerId) const;
+
+private:
+    struct PeerState {
+        double bytesPerSecond = 0;  // 0 until the first window closes
+        Clock::duration minLatency = Clock::duration::max();
+        Clock::duration smoothedLatency = Clock::duration::zero();
+        Clock::duration latencyDeviation = Clock::duration::zero();
+        Clock::duration transportRtt = Clock::duration::zero();  // Zero if none reported
+        size_t windowBytes = 0;
+        Clock::time_point windowStart;
+        int blocksReceived = 0;
+    };
+
+    int depthFor(const PeerState& peer) const;
+    static Clock::duration roundTrip(const PeerState& peer);
+
+    Config config;
+    std::unordered_map<int, PeerState> peers;
+    mutable std::mutex mutex;
+};
+
+#endif // REQUEST_PIPELINE_HPP
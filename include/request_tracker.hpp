@@ -0,0 +1,120 @@
+#ifndef REQUEST_TRACKER_HPP
+#define REQUEST_TRACKER_HPP
+
+#include "bitfield.hpp"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Outstanding block REQUESTs, by block and by peer.
+//
+// Normally each block is requested from one peer. Once every missing block has
+// been requested (endgame), idle peers are handed blocks that are already
+// outstanding elsewhere, so the last pieces don't wait on the slowest peer.
+// The first copy to arrive wins and the other requesters are sent CANCEL.
+// Duplicates are bounded per block and per peer, and the bytes that still
+// arrive twice are counted as waste.
+//
+// Requests are timestamped, so ones a peer never answers can be expired, and
+// peers that have sent nothing for a while (snubbed) can be found.
+class RequestTracker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t MAX_PEERS_PER_BLOCK = 3;      // Original request plus two duplicates
+    static constexpr size_t MAX_DUPLICATES_PER_PEER = 8;  // Endgame requests outstanding per peer
+
+    struct Block {
+        int pieceIndex;
+        int blockOffset;
+        int length;
+    };
+
+    struct Stats {
+        bool endgame = false;
+        size_t outstandingBlocks = 0;
+        uint64_t duplicateRequests = 0;  // Requests for blocks already outstanding elsewhere
+        uint64_t cancelsSent = 0;
+        uint64_t duplicateBlocks = 0;    // Blocks that arrived after we already had them
+        uint64_t wastedBytes = 0;
+        uint64_t timedOutRequests = 0;
+    };
+
+    struct ExpiredRequest {
+        int peerId;
+        Block block;
+        bool orphaned;  // No other peer was asked for it either
+    };
+
+    void addRequest(int peerId, int pieceIndex, int blockOffset, int length, Clock::time_point now = Clock::now());
+
+    // Requested from anyone and not yet received
+    bool isRequested(int pieceIndex, int blockOffset) const;
+    // Outstanding from peerId, requested at this length
+    bool isRequestedFrom(int peerId, int pieceIndex, int blockOffset, int length) const;
+    // Time since the block was requested from peerId; false if it wasn't
+    bool requestLatency(int peerId, int pieceIndex, int blockOffset, Clock::duration& latency,
+                        Clock::time_point now = Clock::now()) const;
+
+    // A block arrived from peerId. Returns the other peers it was requested
+    // from, which should be sent CANCEL; the block is no longer outstanding.
+    std::vector<int> blockReceived(int peerId, int pieceIndex, int blockOffset, Clock::time_point now = Clock::now());
+
+    // Data we already had (late duplicate) arrived
+    void recordWaste(size_t bytes);
+
+    // Drops everything outstanding from the peer (choke or disconnect). Returns
+    // the blocks nobody else was asked for, in request order.
+    std::vector<Block> removePeer(int peerId);
+
+    // Drops requests older than timeoutFor(peerId) and returns them
+    std::vector<ExpiredRequest> expireRequests(const std::function<Clock::duration(int)>& timeoutFor,
+                                               Clock::time_point now = Clock::now());
+    // Peers with requests outstanding that have sent no block for at least period
+    std::vector<int> idlePeers(Clock::duration period, Clock::time_point now = Clock::now()) const;
+
+    // Returns true if the mode changed
+    bool setEndgame(bool active);
+    bool isEndgame() const;
+
+    // Endgame only: outstanding blocks of pieces the peer has that it could
+    // also be asked for, least duplicated first, within the duplicate bounds
+    std::vector<Block> pickDuplicates(int peerId, const Bitfield& peerHas) const;
+
+    size_t outstandingCount(int peerId) const;
+    // Whether any block outstanding from the peer is of a piece matching
+    // isPiece (called under the tracker's lock)
+    bool owesBlockOf(int peerId, const std::function<bool(int)>& isPiece) const;
+    Stats getStats() const;
+
+private:
+    struct Requester {
+        int peerId;
+        Clock::time_point requestedAt;
+    };
+
+    struct PendingBlock {
+        int length = 0;
+        std::vector<Requester> peers;  // peers[0] was asked first
+    };
+
+    static std::vector<Requester>::const_iterator findRequester(const PendingBlock& block, int peerId);
+
+    static uint64_t blockKey(int pieceIndex, int blockOffset) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(pieceIndex)) << 32) | static_cast<uint32_t>(blockOffset);
+    }
+    void eraseFromPeer(int peerId, uint64_t key);
+
+    std::unordered_map<uint64_t, PendingBlock> blocks;
+    std::unordered_map<int, std::vector<uint64_t>> peerBlocks;  // Per peer, in request order
+    // Last block received, or the first request if none since; only peers with requests outstanding
+    std::unordered_map<int, Clock::time_point> peerActivity;
+    bool endgame = false;
+    Stats stats;
+    mutable std::mutex mutex;
+};
+
+#endif // REQUEST_TRACKER_HPP
@@ -0,0 +1,78 @@
+#ifndef RESUME_JOURNAL_HPP
+#define RESUME_JOURNAL_HPP
+
+#include "bitfield.hpp"
+#include <array>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Append-only log of which blocks have reached their final location on disk.
+// Each record is written after the block's data, so after a crash (of the
+// process, not the machine: nothing is fsync'ed) every journaled block can be
+// read back from the download files. Records are replayed on startup and the
+// file is then rewritten in compact form.
+//
+// The header names the torrent by infohash: complete pieces are trusted
+// without hashing, so a journal left by another torrent (same name and piece
+// count, say) must never be replayed.
+class ResumeJournal {
+public:
+    struct State {
+        std::unordered_map<int, Bitfield> partialPieces;  // Block masks of unfinished pieces
+        Bitfield completePieces;                          // Verified and written
+    };
+
+    ResumeJournal(const std::string& path, const std::array<uint8_t, 20>& infoHash, int numPieces);
+    ~ResumeJournal();
+
+    ResumeJournal(const ResumeJournal&) = delete;
+    ResumeJournal& operator=(const ResumeJournal&) = delete;
+
+    // Replays the journal on disk; blockCount(piece) gives the mask size per piece.
+    // Must be called before any record*() call.
+    State load(const std::function<int(int)>& blockCount);
+
+    void recordBlock(int pieceIndex, int blockIndex);
+    void recordPieceComplete(int pieceIndex);
+    void recordPieceReset(int pieceIndex);  // Failed its hash check, blocks are void
+
+    // Rewrites the journal so it only holds the given state
+    bool compact(const State& state);
+
+    const std::string& getPath() const { return path; }
+
+private:
+    static constexpr uint32_t MAGIC = 0x324a4747;  // "GGJ2"
+    static constexpr uint32_t PIECE_COMPLETE = 0xffffffff;
+    static constexpr uint32_t PIECE_RESET = 0xfffffffe;
+
+    struct Record {
+        uint32_t pieceIndex;
+        uint32_t blockIndex;  // Or PIECE_COMPLETE / PIECE_RESET
+    };
+
+    // Magic, piece count, infohash
+    struct Header {
+        uint32_t magic;
+        uint32_t numPieces;
+        std::array<uint8_t, 20> infoHash;
+    };
+    Header header() const;
+
+    bool readRecords(std::vector<Record>& records);
+    bool openForAppend();
+    void append(uint32_t pieceIndex, uint32_t blockIndex);
+
+    std::string path;
+    std::array<uint8_t, 20> infoHash;
+    int numPieces;
+    FILE* file = nullptr;
+    std::mutex mutex;
+};
+
+#endif // RESUME_JOURNAL_HPP
@@ -0,0 +1,69 @@
+#ifndef SHA1_ENGINE_HPP
+#define SHA1_ENGINE_HPP
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using Sha1Digest = std::array<uint8_t, 20>;
+
+// Incremental SHA-1 producing raw 20-byte digests. Whole 64-byte blocks go
+// through the engine's single-buffer backend (SHA-NI when available).
+class Sha1Context {
+public:
+    Sha1Context() { reset(); }
+
+    void reset();
+    void update(const uint8_t* data, size_t length);
+    Sha1Digest finalize();  // The context must be reset before reuse
+
+    uint64_t bytesHashed() const { return totalBytes; }
+
+private:
+    friend class Sha1Engine;
+
+    uint32_t state[5];
+    uint64_t totalBytes;
+    uint8_t buffer[64];
+    size_t bufferLength;
+};
+
+// SHA-1 backends with runtime CPU detection:
+//  - SCALAR:            portable C++ fallback
+//  - SHA_NI:            x86 SHA extensions, one buffer at a time
+//  - AVX2_MULTI_BUFFER: 8 independent buffers hashed in parallel AVX2 lanes
+class Sha1Engine {
+public:
+    enum Backend {
+        SCALAR = 0,
+        SHA_NI,
+        AVX2_MULTI_BUFFER
+    };
+
+    static bool isSupported(Backend backend);
+    static const char* backendName(Backend backend);
+
+    // Backend used for single buffers / incremental hashing (SHA_NI or SCALAR)
+    static Backend singleBufferBackend();
+    // Backend used by hashMany()
+    static Backend multiBufferBackend();
+    // Overrides detection (benchmarks and tests); unsupported backends are ignored
+    static void forceBackend(Backend backend);
+    static void resetBackend();
+
+    static Sha1Digest hash(const uint8_t* data, size_t length);
+    static Sha1Digest hash(const std::vector<uint8_t>& data) { return hash(data.data(), data.size()); }
+
+    // Hashes count independent buffers (e.g. pieces during a recheck), up to
+    // 8 at a time on the multi-buffer backend
+    static void hashMany(const uint8_t* const* data, const size_t* lengths, size_t count, Sha1Digest* digests);
+
+    static constexpr size_t MULTI_BUFFER_LANES = 8;
+
+private:
+    friend class Sha1Context;
+    static void compress(uint32_t state[5], const uint8_t* data, size_t numBlocks);
+};
+
+#endif // SHA1_ENGINE_HPP
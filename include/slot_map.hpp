@@ -0,0 +1,120 @@
+#ifndef SLOT_MAP_HPP
+#define SLOT_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Refers to a SlotMap entry: the slot it lives in, and the slot's generation
+// when it was inserted. Erasing bumps the generation, so a handle kept past
+// its entry's removal misses instead of finding whatever took the slot next.
+struct SlotHandle {
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    uint32_t slot = NO_SLOT;
+    uint32_t generation = 0;
+
+    explicit operator bool() const { return slot != NO_SLOT; }
+    bool operator==(const SlotHandle& other) const {
+        return slot == other.slot && generation == other.generation;
+    }
+    bool operator!=(const SlotHandle& other) const { return !(*this == other); }
+};
+
+// Map from generation-checked handles to values, with O(1) insert, lookup
+// and erase. The values are stored densely, in no particular order (erase
+// moves the last one into the hole), so walking all of them is a scan of one
+// contiguous array. Freed slots are reused, most recently freed first.
+//
+// Not thread safe: guard it like any other container.
+template <typename T>
+class SlotMap {
+public:
+    using Handle = SlotHandle;
+
+    Handle insert(T value) {
+        uint32_t slot;
+        if (freeHead != NONE) {
+            slot = freeHead;
+            freeHead = slots[slot].nextFree;
+        } else {
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back({});
+        }
+        slots[slot].dense = static_cast<uint32_t>(values.size());
+        values.push_back(std::move(value));
+        denseSlots.push_back(slot);
+        return {slot, slots[slot].generation};
+    }
+
+    // nullptr if the handle is stale (its entry was erased) or empty
+    T* get(Handle handle) {
+        if (!live(handle)) return nullptr;
+        return &values[slots[handle.slot].dense];
+    }
+    const T* get(Handle handle) const {
+        if (!live(handle)) return nullptr;
+        return &values[slots[handle.slot].dense];
+    }
+    bool contains(Handle handle) const { return live(handle); }
+
+    // The handle of whatever lives in the slot now (empty if nothing does)
+    Handle current(uint32_t slot) const {
+        if (slot >= slots.size() || slots[slot].dense == NONE) return {};
+        return {slot, slots[slot].generation};
+    }
+
+    // False if the handle was stale
+    bool erase(Handle handle) {
+        if (!live(handle)) return false;
+        Slot& erased = slots[handle.slot];
+        uint32_t last = static_cast<uint32_t>(values.size() - 1);
+        if (erased.dense != last) {
+            values[erased.dense] = std::move(values[last]);
+            denseSlots[erased.dense] = denseSlots[last];
+            slots[denseSlots[last]].dense = erased.dense;
+        }
+        values.pop_back();
+        denseSlots.pop_back();
+
+        erased.dense = NONE;
+        ++erased.generation;
+        erased.nextFree = freeHead;
+        freeHead = handle.slot;
+        return true;
+    }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    // Dense iteration over the values; handleAt() gives the handle of the i-th
+    typename std::vector<T>::iterator begin() { return values.begin(); }
+    typename std::vector<T>::iterator end() { return values.end(); }
+    typename std::vector<T>::const_iterator begin() const { return values.begin(); }
+    typename std::vector<T>::const_iterator end() const { return values.end(); }
+    Handle handleAt(size_t denseIndex) const {
+        uint32_t slot = denseSlots[denseIndex];
+        return {slot, slots[slot].generation};
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Slot {
+        uint32_t generation = 0;
+        uint32_t dense = NONE;     // Index into values while the slot is in use
+        uint32_t nextFree = NONE;  // Free list link while it isn't
+    };
+
+    bool live(Handle handle) const {
+        return handle.slot < slots.size() && slots[handle.slot].dense != NONE &&
+               slots[handle.slot].generation == handle.generation;
+    }
+
+    std::vector<Slot> slots;
+    std::vector<T> values;
+    std::vector<uint32_t> denseSlots;  // Slot of each value
+    uint32_t freeHead = NONE;
+};
+
+#endif // SLOT_MAP_HPP
@@ -0,0 +1,91 @@
+#ifndef STREAMING_SCHEDULER_HPP
+#define STREAMING_SCHEDULER_HPP
+
+#include "bitfield.hpp"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct StreamingConfig {
+    int readAheadPieces = 16;
+    double playbackBytesPerSecond = 1024 * 1024;      // Expected consumer read rate
+    std::chrono::milliseconds duplicateWindow{2000};  // Duplicate pieces due this soon
+    int maxPeersPerPiece = 2;
+};
+
+// Deadline-driven piece selection for sequential consumers (media players,
+// transcoders). Pieces inside the read-ahead window after the playback cursor
+// get a deadline: the time the consumer is expected to reach them at the
+// configured playback rate. The earliest-deadline piece a peer has goes to
+// that peer; callers ask for peers fastest first. A piece close to its deadline
+// may be handed to more than one peer.
+class StreamingScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    using Config = StreamingConfig;
+
+    struct Stats {
+        int cursorPiece = 0;
+        uint64_t piecesOnTime = 0;
+        uint64_t deadlineMisses = 0;      // Verified after their deadline
+        uint64_t consumerStalls = 0;      // Consumer had to wait for the next piece
+        uint64_t duplicateAssignments = 0;
+        int64_t timeToFirstByteMs = -1;   // From start() to the first byte delivered
+    };
+
+    static constexpr int NO_PIECE = -1;
+
+    StreamingScheduler(int numPieces, int64_t pieceLength, int64_t totalLength, const Config& config = Config());
+
+    // Starts the clock for time-to-first-byte and sets deadlines from the start of the torrent
+    void start(Clock::time_point now = Clock::now());
+
+    // Moves the playback cursor (byte offset of the next byte the consumer reads)
+    void setCursor(int64_t byteOffset, Clock::time_point now = Clock::now());
+    int getCursorPiece() const;
+
+    // Earliest-deadline piece in the window that the peer has and we still need,
+    // or NO_PIECE. A peer works on one streaming piece at a time.
+    int pickPiece(int peerId, const Bitfield& peerHas, const Bitfield& have, Clock::time_point now = Clock::now());
+
+    // Piece a peer is currently assigned, or NO_PIECE
+    int assignedPiece(int peerId) const;
+
+    void onPieceVerified(int pieceIndex, Clock::time_point now = Clock::now());
+    // Hash check failed: the piece's peers are freed and it can be assigned again
+    void onPieceFailed(int pieceIndex);
+    // Frees the peer's assignment; also on choke and timed-out requests
+    void onPeerDisconnected(int peerId);
+    void onFirstByteDelivered(Clock::time_point now = Clock::now());
+    void onConsumerStall();
+
+    Clock::time_point getDeadline(int pieceIndex) const;  // Clock::time_point::max() outside the window
+    Stats getStats() const;
+
+private:
+    void assignDeadlines(Clock::time_point now);  // Caller holds the mutex
+    void releasePiece(int pieceIndex);            // Caller holds the mutex
+
+    int numPieces;
+    int64_t pieceLength;
+    int64_t totalLength;
+    Config config;
+
+    int64_t cursorByte = 0;
+    int cursorPiece = 0;
+    Clock::time_point startTime;
+    bool started = false;
+
+    // Fixed once a piece enters the window, so later cursor moves don't hide misses
+    std::vector<Clock::time_point> deadlines;
+    std::unordered_map<int, std::vector<int>> piecePeers;  // Piece -> assigned peers
+    std::unordered_map<int, int> peerPiece;                // Peer -> assigned piece
+
+    Stats stats;
+    mutable std::mutex mutex;
+};
+
+#endif // STREAMING_SCHEDULER_HPP
@@ -0,0 +1,413 @@
+#include "../include/bitfield.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+// The AVX2 loops are compiled with a per-function target attribute and
+// picked at run time, so the rest of the file (and the build) needs no
+// -mavx2. MSVC can't test for AVX2 cheaply here; it only uses them when the
+// whole build targets AVX2.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #if defined(__GNUC__) || defined(__clang__)
+        #define BITFIELD_AVX2 1
+        #define AVX2_TARGET __attribute__((target("avx2")))
+    #elif defined(__AVX2__)
+        #define BITFIELD_AVX2 1
+        #define AVX2_TARGET
+    #endif
+#endif
+#ifdef BITFIELD_AVX2
+    #include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+    #include <stdlib.h>  // _byteswap_uint64
+#endif
+
+namespace {
+
+constexpr uint64_t ALL_ONES = ~uint64_t(0);
+
+inline uint64_t byteSwap64(uint64_t value) {
+#ifdef _MSC_VER
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+// Wire bytes are MSB first, which is exactly a big-endian 64-bit load
+inline uint64_t fromBigEndian(uint64_t value) {
+    if constexpr (std::endian::native == std::endian::little) return byteSwap64(value);
+    return value;
+}
+
+inline uint64_t toBigEndian(uint64_t value) {
+    return fromBigEndian(value);
+}
+
+#ifdef BITFIELD_AVX2
+bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return true;
+#endif
+}
+
+// Word count the AVX2 loops handle (whole vectors), 0 without AVX2
+inline size_t avx2Words(size_t n) {
+    return cpuHasAvx2() ? n & ~size_t(3) : 0;
+}
+
+// Per-64-bit-lane popcount of a 256-bit vector (nibble lookup + SAD)
+AVX2_TARGET inline __m256i popcount256(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, lowNibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibble);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+AVX2_TARGET inline size_t horizontalSum(__m256i v) {
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+AVX2_TARGET inline __m256i load256(const uint64_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+AVX2_TARGET inline void store256(uint64_t* p, __m256i v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// The kernels below take n as a multiple of 4 words (see avx2Words)
+AVX2_TARGET size_t popcountAndNotAvx2(const uint64_t* a, const uint64_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i va = load256(a + i);
+        __m256i v = b ? _mm256_andnot_si256(load256(b + i), va) : va;
+        acc = _mm256_add_epi64(acc, popcount256(v));
+    }
+    return horizontalSum(acc);
+}
+
+// First vector in [begin, n) with a nonzero (a & ~b) word, or n
+AVX2_TARGET size_t firstNonZeroAndNotAvx2(const uint64_t* a, const uint64_t* b, size_t begin, size_t n) {
+    size_t i = begin;
+    for (; i < n; i += 4) {
+        __m256i va = load256(a + i);
+        int zero = b ? _mm256_testc_si256(load256(b + i), va)  // (va & ~vb) == 0
+                     : _mm256_testz_si256(va, va);
+        if (!zero) break;
+    }
+    return i;
+}
+
+AVX2_TARGET void andAvx2(uint64_t* a, const uint64_t* b, size_t n) {
+    for (size_t i = 0; i < n; i += 4) store256(a + i, _mm256_and_si256(load256(a + i), load256(b + i)));
+}
+
+AVX2_TARGET void andNotAvx2(uint64_t* a, const uint64_t* b, size_t n) {
+    for (size_t i = 0; i < n; i += 4) store256(a + i, _mm256_andnot_si256(load256(b + i), load256(a + i)));
+}
+
+AVX2_TARGET bool intersectsAvx2(const uint64_t* a, const uint64_t* b, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        if (!_mm256_testz_si256(load256(a + i), load256(b + i))) return true;
+    }
+    return false;
+}
+#else
+inline size_t avx2Words(size_t) {
+    return 0;
+}
+#endif
+
+// popcount(a[i] & ~b[i]) over n words; b == nullptr means "b is empty"
+size_t popcountAndNot(const uint64_t* a, const uint64_t* b, size_t n) {
+    size_t total = 0;
+    size_t i = avx2Words(n);
+#ifdef BITFIELD_AVX2
+    if (i > 0) total = popcountAndNotAvx2(a, b, i);
+#endif
+    for (; i < n; ++i) {
+        total += std::popcount(b ? (a[i] & ~b[i]) : a[i]);
+    }
+    return total;
+}
+
+// Index of the first word in [begin, n) where (a & ~b) != 0, or n; b == nullptr means empty
+size_t firstNonZeroAndNot(const uint64_t* a, const uint64_t* b, size_t begin, size_t n) {
+    size_t i = begin;
+#ifdef BITFIELD_AVX2
+    size_t vectorEnd = begin < n ? begin + avx2Words(n - begin) : begin;
+    if (vectorEnd > begin) i = firstNonZeroAndNotAvx2(a, b, begin, vectorEnd);
+#endif
+    for (; i < n; ++i) {
+        if (b ? (a[i] & ~b[i]) : a[i]) return i;
+    }
+    return n;
+}
+
+} // namespace
+
+Bitfield::Bitfield(size_t numBits, bool value)
+    : bits((numBits + 63) / 64, value ? ALL_ONES : 0), numBits(numBits), full(value) {
+    clearTail();
+}
+
+Bitfield::Bitfield(const Bitfield& other)
+    : bits(other.bits), numBits(other.numBits), full(other.full.load()) {}
+
+Bitfield::Bitfield(Bitfield&& other) noexcept
+    : bits(std::move(other.bits)), numBits(other.numBits), full(other.full.load()) {
+    other.numBits = 0;
+    other.full = false;
+}
+
+Bitfield& Bitfield::operator=(const Bitfield& other) {
+    if (this != &other) {
+        bits = other.bits;
+        numBits = other.numBits;
+        full = other.full.load();
+    }
+    return *this;
+}
+
+Bitfield& Bitfield::operator=(Bitfield&& other) noexcept {
+    if (this != &other) {
+        bits = std::move(other.bits);
+        numBits = other.numBits;
+        full = other.full.load();
+        other.numBits = 0;
+        other.full = false;
+    }
+    return *this;
+}
+
+uint64_t Bitfield::tailMask() const {
+    size_t used = numBits & 63;
+    return used == 0 ? ALL_ONES : ~(ALL_ONES >> used);
+}
+
+void Bitfield::clearTail() {
+    if (!bits.empty()) bits.back() &= tailMask();
+}
+
+void Bitfield::resize(size_t newSize, bool value) {
+    size_t oldSize = numBits;
+    bits.resize((newSize + 63) / 64, value ? ALL_ONES : 0);
+    numBits = newSize;
+    if (value && newSize > oldSize && (oldSize & 63) != 0) {
+        bits[oldSize >> 6] |= ALL_ONES >> (oldSize & 63);
+    }
+    clearTail();
+    if (!value && newSize > oldSize) full = false;
+}
+
+void Bitfield::set(size_t index) {
+    bits[index >> 6] |= bitMask(index);
+}
+
+void Bitfield::clear(size_t index) {
+    bits[index >> 6] &= ~bitMask(index);
+    full = false;
+}
+
+bool Bitfield::setAtomic(size_t index) {
+    std::atomic_ref<uint64_t> word(bits[index >> 6]);
+    uint64_t mask = bitMask(index);
+    return (word.fetch_or(mask, std::memory_order_acq_rel) & mask) == 0;
+}
+
+bool Bitfield::clearAtomic(size_t index) {
+    std::atomic_ref<uint64_t> word(bits[index >> 6]);
+    uint64_t mask = bitMask(index);
+    full = false;
+    return (word.fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0;
+}
+
+bool Bitfield::getAtomic(size_t index) const {
+    std::atomic_ref<uint64_t> word(const_cast<uint64_t&>(bits[index >> 6]));
+    return (word.load(std::memory_order_acquire) & bitMask(index)) != 0;
+}
+
+void Bitfield::setAll() {
+    std::fill(bits.begin(), bits.end(), ALL_ONES);
+    clearTail();
+    full = true;
+}
+
+void Bitfield::clearAll() {
+    std::fill(bits.begin(), bits.end(), 0);
+    full = numBits == 0;
+}
+
+bool Bitfield::hasAll() const {
+    if (full) return true;
+    if (count() != numBits) return false;
+    full = true;
+    return true;
+}
+
+bool Bitfield::none() const {
+    if (full) return numBits == 0;
+    return firstNonZeroAndNot(bits.data(), nullptr, 0, bits.size()) == bits.size();
+}
+
+size_t Bitfield::count() const {
+    if (full) return numBits;
+    return popcountAndNot(bits.data(), nullptr, bits.size());
+}
+
+size_t Bitfield::findNextSet(size_t from) const {
+    if (from >= numBits) return npos;
+    if (full) return from;
+
+    size_t w = from >> 6;
+    uint64_t word = bits[w] & (ALL_ONES >> (from & 63));
+    if (word) return (w << 6) + std::countl_zero(word);
+
+    w = firstNonZeroAndNot(bits.data(), nullptr, w + 1, bits.size());
+    if (w == bits.size()) return npos;
+    return (w << 6) + std::countl_zero(bits[w]);
+}
+
+size_t Bitfield::findNextClear(size_t from) const {
+    if (from >= numBits || full) return npos;
+
+    for (size_t w = from >> 6; w < bits.size(); ++w) {
+        uint64_t word = ~bits[w];
+        if (w == (from >> 6)) word &= ALL_ONES >> (from & 63);
+        if (word) {
+            size_t index = (w << 6) + std::countl_zero(word);
+            return index < numBits ? index : npos;
+        }
+    }
+    return npos;
+}
+
+Bitfield Bitfield::fromWire(const uint8_t* data, size_t byteCount, size_t numBits) {
+    Bitfield result(numBits);
+    size_t wordCount = result.bits.size();
+    size_t fullWords = std::min(wordCount, byteCount / 8);
+
+    for (size_t w = 0; w < fullWords; ++w) {
+        uint64_t word;
+        std::memcpy(&word, data + w * 8, 8);
+        result.bits[w] = fromBigEndian(word);
+    }
+    // Trailing partial word (and short payloads) are zero padded
+    if (fullWords < wordCount && fullWords * 8 < byteCount) {
+        uint8_t tail[8] = {};
+        std::memcpy(tail, data + fullWords * 8, std::min<size_t>(8, byteCount - fullWords * 8));
+        uint64_t word;
+        std::memcpy(&word, tail, 8);
+        result.bits[fullWords] = fromBigEndian(word);
+    }
+
+    result.clearTail();  // Spare bits must be zero on the wire; don't trust the peer
+    result.full = result.count() == numBits;
+    return result;
+}
+
+void Bitfield::storeWire(uint8_t* out) const {
+    size_t bytesLeft = wireSize();
+    for (size_t w = 0; w < bits.size() && bytesLeft > 0; ++w) {
+        uint64_t word = toBigEndian(bits[w]);
+        size_t n = std::min<size_t>(8, bytesLeft);
+        std::memcpy(out + w * 8, &word, n);
+        bytesLeft -= n;
+    }
+}
+
+std::vector<uint8_t> Bitfield::toWire() const {
+    std::vector<uint8_t> out(wireSize());
+    storeWire(out.data());
+    return out;
+}
+
+Bitfield& Bitfield::operator&=(const Bitfield& other) {
+    if (other.full && other.numBits >= numBits) return *this;
+
+    size_t n = std::min(bits.size(), other.bits.size());
+    size_t i = avx2Words(n);
+#ifdef BITFIELD_AVX2
+    if (i > 0) andAvx2(bits.data(), other.bits.data(), i);
+#endif
+    for (; i < n; ++i) bits[i] &= other.bits[i];
+    std::fill(bits.begin() + n, bits.end(), 0);
+    full = full && other.full && other.numBits >= numBits;
+    return *this;
+}
+
+Bitfield& Bitfield::andNot(const Bitfield& other) {
+    if (other.full && other.numBits >= numBits) {
+        clearAll();
+        return *this;
+    }
+
+    size_t n = std::min(bits.size(), other.bits.size());
+    size_t i = avx2Words(n);
+#ifdef BITFIELD_AVX2
+    if (i > 0) andNotAvx2(bits.data(), other.bits.data(), i);
+#endif
+    for (; i < n; ++i) bits[i] &= ~other.bits[i];
+    full = full && other.none();
+    return *this;
+}
+
+bool Bitfield::intersects(const Bitfield& a, const Bitfield& b) {
+    if (a.full) return !b.none();
+    if (b.full) return !a.none();
+
+    size_t n = std::min(a.bits.size(), b.bits.size());
+    size_t i = avx2Words(n);
+#ifdef BITFIELD_AVX2
+    if (i > 0 && intersectsAvx2(a.bits.data(), b.bits.data(), i)) return true;
+#endif
+    for (; i < n; ++i) {
+        if (a.bits[i] & b.bits[i]) return true;
+    }
+    return false;
+}
+
+bool Bitfield::anyAndNot(const Bitfield& a, const Bitfield& b) {
+    if (b.full && b.numBits >= a.numBits) return false;
+    if (a.full) return !b.hasAll() || a.numBits > b.numBits;
+
+    size_t n = std::min(a.bits.size(), b.bits.size());
+    if (firstNonZeroAndNot(a.bits.data(), b.bits.data(), 0, n) != n) return true;
+    return firstNonZeroAndNot(a.bits.data(), nullptr, n, a.bits.size()) != a.bits.size();
+}
+
+size_t Bitfield::countAndNot(const Bitfield& a, const Bitfield& b) {
+    if (b.full && b.numBits >= a.numBits) return 0;
+
+    size_t n = std::min(a.bits.size(), b.bits.size());
+    return popcountAndNot(a.bits.data(), b.bits.data(), n) +
+           popcountAndNot(a.bits.data() + n, nullptr, a.bits.size() - n);
+}
+
+size_t Bitfield::findNextSetAndNot(const Bitfield& other, size_t from) const {
+    if (from >= numBits) return npos;
+    if (other.full && other.numBits >= numBits) return npos;
+
+    size_t n = std::min(bits.size(), other.bits.size());
+    size_t w = from >> 6;
+    auto wordAt = [&](size_t i) { return i < n ? (bits[i] & ~other.bits[i]) : bits[i]; };
+
+    uint64_t word = wordAt(w) & (ALL_ONES >> (from & 63));
+    if (word) return (w << 6) + std::countl_zero(word);
+
+    ++w;
+    if (w < n) w = firstNonZeroAndNot(bits.data(), other.bits.data(), w, n);
+    if (w >= n) w = firstNonZeroAndNot(bits.data(), nullptr, std::max(w, n), bits.size());
+    if (w >= bits.size()) return npos;
+    return (w << 6) + std::countl_zero(wordAt(w));
+}
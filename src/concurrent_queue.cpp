@@ -0,0 +1,55 @@
+#include "../include/concurrent_queue.hpp"
+#include <climits>
+
+#ifdef __linux__
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+uint32_t WaitPoint::prepareWait() {
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    // Pairs with the fence in notify(): either the waiter sees the new state
+    // when it re-checks, or the notifier sees the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch.load(std::memory_order_acquire);
+}
+
+void WaitPoint::cancelWait() {
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void WaitPoint::wait(uint32_t token) {
+    while (epoch.load(std::memory_order_acquire) == token) {
+#ifdef __linux__
+        // Sleeps only if the epoch still holds token; spurious wakeups loop
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAIT_PRIVATE, token, nullptr, nullptr, 0);
+#else
+        epoch.wait(token, std::memory_order_acquire);
+#endif
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void WaitPoint::notifyOne() {
+    notify(false);
+}
+
+void WaitPoint::notifyAll() {
+    notify(true);
+}
+
+void WaitPoint::notify(bool all) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) == 0) return;  // The common case: no syscall
+    epoch.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#else
+    if (all) {
+        epoch.notify_all();
+    } else {
+        epoch.notify_one();
+    }
+#endif
+}
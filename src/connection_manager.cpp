@@ -0,0 +1,116 @@
+#include "../include/connection_manager.hpp"
+#include <algorithm>
+
+ConnectionManager::ConnectionManager(const Config& config) : config(config) {}
+
+std::string ConnectionManager::key(const Endpoint& endpoint) {
+    return endpoint.ip + ":" + std::to_string(endpoint.port);
+}
+
+bool ConnectionManager::better(const Peer& a, const Peer& b) {
+    if (a.source != b.source) return a.source > b.source;
+    if (a.successes != b.successes) return a.successes > b.successes;
+    if (a.failures != b.failures) return a.failures < b.failures;
+    return a.order < b.order;
+}
+
+void ConnectionManager::addPeer(const std::string& ip, uint16_t port, Source source) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Endpoint endpoint{ip, port};
+    auto [it, inserted] = peers.try_emplace(key(endpoint));
+    Peer& peer = it->second;
+    if (inserted) {
+        peer.endpoint = std::move(endpoint);
+        peer.source = source;
+        peer.order = nextOrder++;
+    } else {
+        peer.source = std::max(peer.source, source);
+    }
+}
+
+std::vector<ConnectionManager::Endpoint> ConnectionManager::nextToConnect(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t open = halfOpen + connected;
+    if (halfOpen >= config.maxHalfOpen || open >= config.maxConnections) return {};
+    size_t slots = std::min(config.maxHalfOpen - halfOpen, config.maxConnections - open);
+
+    std::vector<Peer*> ready;
+    for (auto& pair : peers) {
+        Peer& peer = pair.second;
+        if (peer.state == IDLE && peer.retryAt <= now) ready.push_back(&peer);
+    }
+    size_t count = std::min(slots, ready.size());
+    std::partial_sort(ready.begin(), ready.begin() + count, ready.end(),
+                      [](const Peer* a, const Peer* b) { return better(*a, *b); });
+
+    std::vector<Endpoint> result;
+    result.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        ready[i]->state = HALF_OPEN;
+        result.push_back(ready[i]->endpoint);
+    }
+    halfOpen += count;
+    attempts += count;
+    return result;
+}
+
+void ConnectionManager::onConnected(const Endpoint& endpoint) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(key(endpoint));
+    if (it == peers.end() || it->second.state != HALF_OPEN) return;
+    it->second.state = CONNECTED;
+    it->second.successes++;
+    it->second.failures = 0;
+    --halfOpen;
+    ++connected;
+}
+
+void ConnectionManager::onFailed(const Endpoint& endpoint, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    fail(endpoint, now);
+}
+
+void ConnectionManager::onTimedOut(const Endpoint& endpoint, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++timeouts;
+    fail(endpoint, now);
+}
+
+void ConnectionManager::fail(const Endpoint& endpoint, Clock::time_point now) {
+    auto it = peers.find(key(endpoint));
+    if (it == peers.end() || it->second.state != HALF_OPEN) return;
+    Peer& peer = it->second;
+    --halfOpen;
+    ++failures;
+    if (++peer.failures >= config.maxFailures) {
+        peers.erase(it);
+        return;
+    }
+    auto backoff = config.initialBackoff * (int64_t(1) << std::min(peer.failures - 1, 30));
+    peer.retryAt = now + std::min<Clock::duration>(backoff, config.maxBackoff);
+    peer.state = IDLE;
+}
+
+void ConnectionManager::onDisconnected(const Endpoint& endpoint, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(key(endpoint));
+    if (it == peers.end() || it->second.state != CONNECTED) return;
+    it->second.state = IDLE;
+    it->second.retryAt = now + config.initialBackoff;
+    --connected;
+}
+
+ConnectionManager::Stats ConnectionManager::getStats(Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats;
+    stats.known = peers.size();
+    stats.halfOpen = halfOpen;
+    stats.connected = connected;
+    for (const auto& pair : peers) {
+        if (pair.second.state == IDLE && pair.second.retryAt > now) stats.backingOff++;
+    }
+    stats.attempts = attempts;
+    stats.failures = failures;
+    stats.timeouts = timeouts;
+    return stats;
+}
@@ -0,0 +1,352 @@
+#include "../include/disk_io.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace {
+
+int openReadWrite(const std::string& path) {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path.c_str(), O_RDWR | O_CREAT, 0644);
+#endif
+}
+
+void closeFile(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+// Positional I/O; on Windows the caller must hold the file mutex (seek + read/write)
+bool writeAt(int fd, const uint8_t* data, int64_t length, int64_t offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+    return _write(fd, data, static_cast<unsigned int>(length)) == length;
+#else
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written <= 0) return false;
+        data += written;
+        offset += written;
+        length -= written;
+    }
+    return true;
+#endif
+}
+
+bool readAt(int fd, uint8_t* data, int64_t length, int64_t offset) {
+#ifdef _WIN32
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+    return _read(fd, data, static_cast<unsigned int>(length)) == length;
+#else
+    while (length > 0) {
+        ssize_t got = pread(fd, data, length, offset);
+        if (got <= 0) return false;
+        data += got;
+        offset += got;
+        length -= got;
+    }
+    return true;
+#endif
+}
+
+} // namespace
+
+DiskIO::DiskIO(const TorrentFile& torrent, const std::string& downloadDir, PieceManager& pieceStorage,
+               ResumeJournal* journal)
+    : pieceLength(torrent.pieceLength), numPieces(torrent.numPieces), pieceStorage(pieceStorage), journal(journal),
+      droppedBlockWrites(torrent.numPieces) {
+    // Single-file torrents are stored as <dir>/<name>, multi-file ones under <dir>/<name>/
+    bool singleFile = torrent.files.size() == 1 && torrent.files[0].first == torrent.name;
+    std::filesystem::path root = std::filesystem::path(downloadDir);
+    if (!singleFile) root /= torrent.name;
+
+    for (const auto& file : torrent.files) {
+        FileEntry entry;
+        entry.path = (root / file.first).string();
+        entry.offset = totalSize;
+        entry.length = file.second;
+        files.push_back(entry);
+        totalSize += file.second;
+    }
+
+    // Bytes of each file that share their first/last piece with a neighbouring file
+    for (auto& file : files) {
+        int64_t end = file.offset + file.length;
+        if (file.offset % pieceLength != 0) {
+            file.headLength = std::min(file.length, pieceLength - file.offset % pieceLength);
+        }
+        if (end % pieceLength != 0 && end != totalSize) {
+            file.tailLength = std::min(file.length, end % pieceLength);
+        }
+        if (file.headLength + file.tailLength >= file.length) {
+            file.headLength = file.length;
+            file.tailLength = 0;
+        }
+    }
+
+    writer = std::thread([this]() { writerLoop(); });
+}
+
+DiskIO::~DiskIO() {
+    writeQueue.close();  // The writer drains what is queued, then exits
+    if (writer.joinable()) writer.join();
+
+    for (auto& file : files) {
+        if (file.fd >= 0) closeFile(file.fd);
+        if (file.partFd >= 0) closeFile(file.partFd);
+    }
+}
+
+int64_t DiskIO::getPieceSize(int pieceIndex) const {
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return 0;
+    return std::min(pieceLength, totalSize - static_cast<int64_t>(pieceIndex) * pieceLength);
+}
+
+void DiskIO::queueWrite(int pieceIndex) {
+    writeQueue.push(WriteJob(WriteJob::PIECE, pieceIndex));
+}
+
+bool DiskIO::queueBlockWrite(int pieceIndex, int blockOffset, BlockView block) {
+    // Called from the event loop threads, which must not block on the writer
+    if (writeQueue.tryPush(WriteJob(WriteJob::BLOCK, pieceIndex, blockOffset, std::move(block)))) return true;
+    droppedBlockWrites.setAtomic(pieceIndex);
+    return false;
+}
+
+void DiskIO::queueReset(int pieceIndex) {
+    writeQueue.push(WriteJob(WriteJob::RESET, pieceIndex));
+}
+
+size_t DiskIO::pendingWrites() const {
+    return writeQueue.size();
+}
+
+bool DiskIO::isBacklogged() const {
+    return writeQueue.size() >= writeQueue.capacity() / 4 * 3;
+}
+
+bool DiskIO::forEachSpan(int64_t torrentOffset, int64_t length,
+                         const std::function<bool(FileEntry&, int64_t, int64_t, int64_t)>& fn) {
+    // Find the first file containing torrentOffset
+    auto it = std::upper_bound(files.begin(), files.end(), torrentOffset,
+        [](int64_t offset, const FileEntry& file) { return offset < file.offset + file.length; });
+
+    int64_t bufferOffset = 0;
+    for (; it != files.end() && length > 0; ++it) {
+        if (it->length == 0) continue;
+        int64_t fileOffset = torrentOffset - it->offset;
+        int64_t spanLength = std::min(length, it->length - fileOffset);
+        if (!fn(*it, fileOffset, spanLength, bufferOffset)) return false;
+        torrentOffset += spanLength;
+        bufferOffset += spanLength;
+        length -= spanLength;
+    }
+    return length == 0;
+}
+
+bool DiskIO::openFile(const std::string& path, int& fd) {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (fd >= 0) return true;
+
+    std::error_code ec;
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+
+    fd = openReadWrite(path);
+    if (fd < 0) {
+        std::cerr << "DiskIO: Failed to open " << path << ": " << strerror(errno) << '\n';
+        return false;
+    }
+    return true;
+}
+
+int DiskIO::resolveSpan(FileEntry& file, int64_t& fileOffset) {
+    if (!file.skipped) {
+        return openFile(file.path, file.fd) ? file.fd : -1;
+    }
+
+    // Spans never cross a piece boundary, so each one is inside the head, the tail or neither
+    if (fileOffset < file.headLength) {
+        // Same offset in the part file
+    } else if (file.tailLength > 0 && fileOffset >= file.length - file.tailLength) {
+        fileOffset = file.headLength + fileOffset - (file.length - file.tailLength);
+    } else {
+        return NOT_STORED;
+    }
+    return openFile(file.path + ".part", file.partFd) ? file.partFd : -1;
+}
+
+bool DiskIO::writeRange(int64_t torrentOffset, const uint8_t* data, int64_t length) {
+    std::shared_lock<std::shared_mutex> layoutLock(layoutMutex);
+    return forEachSpan(torrentOffset, length,
+        [&](FileEntry& file, int64_t fileOffset, int64_t spanLength, int64_t bufferOffset) {
+            int fd = resolveSpan(file, fileOffset);
+            if (fd == NOT_STORED) return true;  // Data of a skipped file nobody wants
+            if (fd < 0) return false;
+#ifdef _WIN32
+            std::lock_guard<std::mutex> lock(fileMutex);
+#endif
+            return writeAt(fd, data + bufferOffset, spanLength, fileOffset);
+        });
+}
+
+bool DiskIO::writePiece(int pieceIndex, const std::vector<uint8_t>& data) {
+    int64_t pieceSize = getPieceSize(pieceIndex);
+    if (static_cast<int64_t>(data.size()) < pieceSize) return false;
+
+    return writeRange(static_cast<int64_t>(pieceIndex) * pieceLength, data.data(), pieceSize);
+}
+
+bool DiskIO::readBlock(int pieceIndex, int blockOffset, int blockSize, std::vector<uint8_t>& data) {
+    if (blockOffset < 0 || blockSize <= 0 || blockOffset + blockSize > getPieceSize(pieceIndex)) {
+        return false;
+    }
+
+    data.resize(blockSize);
+    std::shared_lock<std::shared_mutex> layoutLock(layoutMutex);
+    return forEachSpan(static_cast<int64_t>(pieceIndex) * pieceLength + blockOffset, blockSize,
+        [&](FileEntry& file, int64_t fileOffset, int64_t length, int64_t bufferOffset) {
+            int fd = resolveSpan(file, fileOffset);
+            if (fd < 0) return false;
+#ifdef _WIN32
+            std::lock_guard<std::mutex> lock(fileMutex);
+#endif
+            return readAt(fd, data.data() + bufferOffset, length, fileOffset);
+        });
+}
+
+bool DiskIO::getFileBlock(int pieceIndex, int blockOffset, int blockSize, FileBlock& block) {
+    block = FileBlock();
+    if (blockOffset < 0 || blockSize <= 0 || blockOffset + blockSize > getPieceSize(pieceIndex)) {
+        return false;
+    }
+
+    std::shared_lock<std::shared_mutex> layoutLock(layoutMutex);
+    bool ok = forEachSpan(static_cast<int64_t>(pieceIndex) * pieceLength + blockOffset, blockSize,
+        [&](FileEntry& file, int64_t fileOffset, int64_t length, int64_t) {
+            if (file.skipped || !openFile(file.path, file.fd)) return false;
+            block.regions.push_back({file.fd, fileOffset, static_cast<size_t>(length)});
+            return true;
+        });
+    if (!ok) {
+        block = FileBlock();
+        return false;
+    }
+    block.size = static_cast<size_t>(blockSize);
+    return true;
+}
+
+bool DiskIO::setFileSkipped(size_t fileIndex, bool skipped) {
+    std::unique_lock<std::shared_mutex> layoutLock(layoutMutex);
+    if (fileIndex >= files.size()) return false;
+
+    FileEntry& file = files[fileIndex];
+    if (file.skipped == skipped) return true;
+
+    bool ok = copyBoundaryBytes(file, skipped);
+    file.skipped = skipped;
+    if (!skipped) {
+        // The file holds everything now; the part file is no longer needed
+        if (file.partFd >= 0) closeFile(file.partFd);
+        file.partFd = -1;
+        std::error_code ec;
+        std::filesystem::remove(file.path + ".part", ec);
+    }
+    return ok;
+}
+
+// Caller holds layoutMutex exclusively. Only copies from a file that exists.
+bool DiskIO::copyBoundaryBytes(FileEntry& file, bool toPartFile) {
+    std::string partPath = file.path + ".part";
+    if (!std::filesystem::exists(toPartFile ? file.path : partPath)) return true;
+    if (!openFile(file.path, file.fd) || !openFile(partPath, file.partFd)) return false;
+
+    int sourceFd = toPartFile ? file.fd : file.partFd;
+    int targetFd = toPartFile ? file.partFd : file.fd;
+    std::vector<uint8_t> buffer;
+    auto copy = [&](int64_t fileOffset, int64_t partOffset, int64_t length) {
+        if (length == 0) return true;
+        buffer.resize(length);
+        int64_t sourceOffset = toPartFile ? fileOffset : partOffset;
+        int64_t targetOffset = toPartFile ? partOffset : fileOffset;
+        // Regions that were never written read short; nothing to carry over
+        if (!readAt(sourceFd, buffer.data(), length, sourceOffset)) return true;
+        return writeAt(targetFd, buffer.data(), length, targetOffset);
+    };
+    return copy(0, 0, file.headLength) &&
+           copy(file.length - file.tailLength, file.headLength, file.tailLength);
+}
+
+bool DiskIO::readPiece(int pieceIndex, std::vector<uint8_t>& data) {
+    return readBlock(pieceIndex, 0, static_cast<int>(getPieceSize(pieceIndex)), data);
+}
+
+void DiskIO::writerLoop() {
+    WriteJob job;
+    while (writeQueue.pop(job)) {  // Drains pending writes before stopping
+        runJob(job);
+        job = WriteJob();  // Unpins the block while waiting for the next
+    }
+}
+
+void DiskIO::runJob(WriteJob& job) {
+    int pieceIndex = job.pieceIndex;
+
+    if (job.type == WriteJob::RESET) {
+        streamedPieces.erase(pieceIndex);
+        failedBlockWrites.erase(pieceIndex);
+        if (journal) journal->recordPieceReset(pieceIndex);
+        return;
+    }
+
+    if (job.type == WriteJob::BLOCK) {
+        int64_t torrentOffset = static_cast<int64_t>(pieceIndex) * pieceLength + job.blockOffset;
+        if (writeRange(torrentOffset, job.block.data, static_cast<int64_t>(job.block.size))) {
+            streamedPieces.insert(pieceIndex);
+            if (journal) journal->recordBlock(pieceIndex, job.blockOffset / MAX_BLOCK_SIZE);
+        } else {
+            // The piece gets written in full once verified
+            failedBlockWrites.insert(pieceIndex);
+        }
+        return;
+    }
+
+    // A dropped block may belong to an earlier, reset attempt at the piece;
+    // writing it in full again is harmless
+    bool onDisk = streamedPieces.count(pieceIndex) && !failedBlockWrites.count(pieceIndex) &&
+                  !droppedBlockWrites.getAtomic(pieceIndex);
+    if (!onDisk) {
+        PieceBuffer buffer = pieceStorage.getPieceBuffer(pieceIndex);
+        if (!buffer) {
+            std::cerr << "DiskIO: Piece " << pieceIndex << " is no longer in memory, skipping write.\n";
+            return;
+        }
+
+        if (!writePiece(pieceIndex, *buffer)) {
+            std::cerr << "DiskIO: Failed to write piece " << pieceIndex << ", keeping it in memory.\n";
+            return;
+        }
+    }
+    streamedPieces.erase(pieceIndex);
+    failedBlockWrites.erase(pieceIndex);
+    droppedBlockWrites.clearAtomic(pieceIndex);
+    if (journal) journal->recordPieceComplete(pieceIndex);
+
+    // Data is on disk now; drop it from the write cache
+    pieceStorage.evictPiece(pieceIndex);
+    std::cout << "DiskIO: Wrote piece " << pieceIndex << " to disk.\n";
+}
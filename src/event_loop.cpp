@@ -0,0 +1,197 @@
+#include "../include/event_loop.hpp"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+constexpr int MAX_EVENTS = 256;  // Per epoll_wait
+
+EventLoop::EventLoop() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) throw std::runtime_error("epoll_create1 failed");
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        close(epollFd);
+        throw std::runtime_error("eventfd failed");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;  // Marks the wakeup fd
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+}
+
+EventLoop::~EventLoop() {
+    close(wakeFd);
+    close(epollFd);
+}
+
+void EventLoop::add(int fd, Handler handler) {
+    if (inLoopThread()) {
+        addNow(fd, std::move(handler));
+        return;
+    }
+    // std::function needs a copyable callable, so the handler travels in a shared_ptr
+    auto shared = std::make_shared<Handler>(std::move(handler));
+    post([this, fd, shared]() { addNow(fd, std::move(*shared)); });
+}
+
+void EventLoop::remove(int fd) {
+    if (inLoopThread()) {
+        removeNow(fd);
+    } else {
+        post([this, fd]() { removeNow(fd); });
+    }
+}
+
+void EventLoop::addNow(int fd, Handler handler) {
+    auto entry = std::make_unique<Entry>();
+    entry->handler = std::move(handler);
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = entry.get();
+
+    auto it = entries.find(fd);
+    if (it != entries.end()) {
+        // Same fd again: swap the handler in place
+        it->second->removed = true;
+        retired.push_back(std::move(it->second));
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+        it->second = std::move(entry);
+        return;
+    }
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) return;
+    entries.emplace(fd, std::move(entry));
+    ++registered;
+}
+
+void EventLoop::removeNow(int fd) {
+    auto it = entries.find(fd);
+    if (it == entries.end()) return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    it->second->removed = true;
+    retired.push_back(std::move(it->second));
+    entries.erase(it);
+    --registered;
+}
+
+void EventLoop::post(std::function<void()> task) {
+    if (overflowing.load(std::memory_order_acquire) || !postQueue.tryPush(std::move(task))) {
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        overflow.push_back(std::move(task));
+        overflowing.store(true, std::memory_order_release);
+    }
+
+    // Pairs with the fence in runPosted(): either the loop sees the task, or
+    // this sees the flag cleared and wakes it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!wakePending.exchange(true, std::memory_order_acq_rel)) {
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void EventLoop::runEvery(std::chrono::milliseconds interval, std::function<void()> task) {
+    auto shared = std::make_shared<std::function<void()>>(std::move(task));
+    post([this, interval, shared]() {
+        timers.push_back({interval, Clock::now() + interval, std::move(*shared)});
+    });
+}
+
+void EventLoop::runPosted() {
+    wakePending.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::vector<std::function<void()>> spilled;
+    if (overflowing.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        spilled.swap(overflow);
+    }
+
+    // What is queued now (tasks posted by these run in the next batch); all
+    // of it before the spilled tasks, which were posted later. A producer
+    // can still be filling its slot: wait for it if order depends on it.
+    std::function<void()> task;
+    for (size_t count = postQueue.size(); count > 0;) {
+        if (postQueue.tryPop(task)) {
+            task();
+            --count;
+        } else if (!spilled.empty()) {
+            std::this_thread::yield();
+        } else {
+            break;
+        }
+    }
+    task = nullptr;
+
+    if (spilled.empty()) return;
+    for (auto& spilledTask : spilled) spilledTask();
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    if (overflow.empty()) overflowing.store(false, std::memory_order_release);
+}
+
+int EventLoop::runTimers() {
+    if (timers.empty()) return -1;
+    auto now = Clock::now();
+    Clock::time_point next = Clock::time_point::max();
+    for (size_t i = 0; i < timers.size(); ++i) {
+        if (timers[i].due <= now) {
+            timers[i].due = now + timers[i].interval;
+            timers[i].task();  // May add timers, so index rather than reference
+        }
+        next = std::min(next, timers[i].due);
+    }
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+    return static_cast<int>(std::max<int64_t>(wait, 0));
+}
+
+void EventLoop::run() {
+    loopThread = std::this_thread::get_id();
+    epoll_event events[MAX_EVENTS];
+
+    while (!stopping) {
+        int timeout = runTimers();
+        int count = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            auto* entry = static_cast<Entry*>(events[i].data.ptr);
+            if (!entry) {
+                uint64_t value;
+                ssize_t drained = read(wakeFd, &value, sizeof(value));
+                (void)drained;
+                continue;
+            }
+            if (!entry->removed) entry->handler(events[i].events);
+        }
+        runPosted();
+        retired.clear();
+    }
+    stopping = false;  // run() may be called again
+    loopThread = std::thread::id();
+}
+
+void EventLoop::stop() {
+    stopping = true;
+    post([]() {});  // Wake the loop so it sees the flag
+}
+
+bool EventLoop::inLoopThread() const {
+    return loopThread.load() == std::this_thread::get_id();
+}
+
+size_t EventLoop::size() const {
+    return registered;
+}
+
+#endif // __linux__
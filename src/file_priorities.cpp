@@ -0,0 +1,74 @@
+#include "../include/file_priorities.hpp"
+#include <algorithm>
+
+FilePriorities::FilePriorities(const TorrentFile& torrent)
+    : numPieces(torrent.numPieces), pieceLength(torrent.pieceLength),
+      piecePriorities(torrent.numPieces, NORMAL) {
+    int64_t offset = 0;
+    for (const auto& file : torrent.files) {
+        fileOffsets.push_back(offset);
+        fileLengths.push_back(file.second);
+        offset += file.second;
+    }
+    filePriorities.assign(fileOffsets.size(), NORMAL);
+}
+
+std::pair<int, int> FilePriorities::filePieceRange(size_t fileIndex) const {
+    if (fileIndex >= fileOffsets.size() || fileLengths[fileIndex] == 0) return {0, -1};
+    int first = static_cast<int>(fileOffsets[fileIndex] / pieceLength);
+    int last = static_cast<int>((fileOffsets[fileIndex] + fileLengths[fileIndex] - 1) / pieceLength);
+    return {first, std::min(last, numPieces - 1)};
+}
+
+FilePriorities::Priority FilePriorities::computePiecePriority(int pieceIndex) const {
+    int64_t pieceStart = static_cast<int64_t>(pieceIndex) * pieceLength;
+    int64_t pieceEnd = pieceStart + pieceLength;
+
+    // First file ending after the piece start, then every file starting before its end
+    auto it = std::upper_bound(fileOffsets.begin(), fileOffsets.end(), pieceStart);
+    size_t fileIndex = it == fileOffsets.begin() ? 0 : (it - fileOffsets.begin()) - 1;
+
+    Priority priority = SKIP;
+    for (; fileIndex < fileOffsets.size() && fileOffsets[fileIndex] < pieceEnd; ++fileIndex) {
+        if (fileLengths[fileIndex] == 0 || fileOffsets[fileIndex] + fileLengths[fileIndex] <= pieceStart) continue;
+        priority = std::max(priority, filePriorities[fileIndex]);
+    }
+    return priority;
+}
+
+std::vector<int> FilePriorities::setFilePriority(size_t fileIndex, Priority priority) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> changed;
+    if (fileIndex >= filePriorities.size() || filePriorities[fileIndex] == priority) return changed;
+
+    filePriorities[fileIndex] = priority;
+    auto [first, last] = filePieceRange(fileIndex);
+    for (int pieceIndex = first; pieceIndex <= last; ++pieceIndex) {
+        Priority piecePriority = computePiecePriority(pieceIndex);
+        if (piecePriority != piecePriorities[pieceIndex]) {
+            piecePriorities[pieceIndex] = piecePriority;
+            changed.push_back(pieceIndex);
+        }
+    }
+    return changed;
+}
+
+FilePriorities::Priority FilePriorities::getFilePriority(size_t fileIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return fileIndex < filePriorities.size() ? filePriorities[fileIndex] : SKIP;
+}
+
+FilePriorities::Priority FilePriorities::getPiecePriority(int pieceIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return SKIP;
+    return piecePriorities[pieceIndex];
+}
+
+Bitfield FilePriorities::wantedPieces() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Bitfield wanted(numPieces);
+    for (int pieceIndex = 0; pieceIndex < numPieces; ++pieceIndex) {
+        if (piecePriorities[pieceIndex] != SKIP) wanted.set(pieceIndex);
+    }
+    return wanted;
+}
@@ -574,8 +574,7 @@
 #include <vector>
 #include <string>
 #include <thread>
-#include <mutex>
-#include <atomic>
+#include <chrono>
 #include "../include/peer_wire_protocol.hpp"
 
 
@@ -621,44 +620,18 @@ int main() {
         }
     }
 
-    // Try connecting to multiple peers concurrently
-    std::atomic<bool> connected(false);
-    std::mutex outputMutex;
-    std::vector<std::thread> threads;
-
-    for (const auto& peer : peersToTry) {
-        if (connected.load())
-            break;
-
-        threads.emplace_back([&]() {
-            if (connected.load())
-                return;
-            try {
-                {
-                    std::lock_guard<std::mutex> lock(outputMutex);
-                    std::cout << "**ATTEMPTING TO CONNECT TO PEER: " << peer.ip << ":" << peer.port << "**" << '\n';
-                }
-                int sock = pwp.connectToPeer(peer.ip, peer.port);
-                if (sock >= 0) {
-                    {
-                        std::lock_guard<std::mutex> lock(outputMutex);
-                        std::cout << "**SUCCESSFUL: CONNECTED TO PEER " << peer.ip << ":" << peer.port << "**" << '\n';
-                    }
-                    connected.store(true);
-                }
-            } catch (const std::exception& e) {
-                std::lock_guard<std::mutex> lock(outputMutex);
-                std::cerr << "**ERROR: CONNECTION FAILED TO " << peer.ip << ":" << peer.port << " - " << e.what() << "**" << '\n';
-            }
-        });
+    // Dialed without blocking, a few at a time; wait for the first connection
+    pwp.addPeers(peersToTry, trackerPeers.empty() ? ConnectionManager::DHT : ConnectionManager::TRACKER);
+    bool connected = false;
+    for (int second = 0; second < 30 && !connected; ++second) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        ConnectionManager::Stats stats = pwp.getConnectionStats();
+        std::cout << "Peers: " << stats.connected << " connected, " << stats.halfOpen << " connecting, "
+                  << stats.failures << " failed" << '\n';
+        connected = stats.connected > 0;
     }
 
-    for (auto& t : threads) {
-        if (t.joinable())
-            t.join();
-    }
-
-    if (!connected.load()) {
+    if (!connected) {
         std::cerr << "**ERROR: FAILED TO CONNECT TO ANY PEERS**" << '\n';
         return 1;
     }
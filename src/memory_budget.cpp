@@ -0,0 +1,101 @@
+#include "../include/memory_budget.hpp"
+#include <algorithm>
+#include <iostream>
+
+MemoryBudget::MemoryBudget(size_t limitBytes, double resumeRatio)
+    : limit(limitBytes), resumeRatio(std::clamp(resumeRatio, 0.0, 1.0)) {}
+
+void MemoryBudget::charge(Category category, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    usedByCategory[category] += bytes;
+    used += bytes;
+    peakUsed = std::max(peakUsed, used);
+    updateThrottleLocked();
+}
+
+void MemoryBudget::release(Category category, size_t bytes) {
+    bool wasThrottled;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bytes = std::min(bytes, usedByCategory[category]);
+        usedByCategory[category] -= bytes;
+        used -= bytes;
+        wasThrottled = throttled;
+        updateThrottleLocked();
+        if (!wasThrottled || throttled) return;
+    }
+    roomAvailable.notify_all();
+}
+
+void MemoryBudget::transfer(Category from, Category to, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes = std::min(bytes, usedByCategory[from]);
+    usedByCategory[from] -= bytes;
+    usedByCategory[to] += bytes;
+}
+
+// Hysteresis: throttle above the limit, resume below limit * resumeRatio
+void MemoryBudget::updateThrottleLocked() {
+    if (!throttled && used > limit) {
+        throttled = true;
+        throttleEvents++;
+        std::cerr << "MemoryBudget: over budget (" << used << "/" << limit << " bytes), throttling.\n";
+    } else if (throttled && used <= static_cast<size_t>(limit * resumeRatio)) {
+        throttled = false;
+        std::cout << "MemoryBudget: back under budget (" << used << "/" << limit << " bytes), resuming.\n";
+    }
+}
+
+bool MemoryBudget::isThrottled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return throttled;
+}
+
+bool MemoryBudget::canAllocate(size_t bytes) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !throttled && used + bytes <= limit;
+}
+
+bool MemoryBudget::waitForRoom(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return roomAvailable.wait_for(lock, timeout, [this]() { return !throttled; });
+}
+
+size_t MemoryBudget::inProgressLimit(size_t pieceLength) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceLength == 0) return MIN_PIECES_IN_PROGRESS;
+    size_t resumeMark = static_cast<size_t>(limit * resumeRatio);
+    // A quarter of the resume mark is kept for the verify queue and write cache
+    size_t pieces = (resumeMark - resumeMark / 4) / pieceLength;
+    // The floor only applies as far as the pieces fit under the resume mark
+    pieces = std::max(pieces, std::min(MIN_PIECES_IN_PROGRESS, resumeMark / pieceLength));
+    return std::max<size_t>(pieces, 1);
+}
+
+void MemoryBudget::setLimit(size_t limitBytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = limitBytes;
+        updateThrottleLocked();
+    }
+    roomAvailable.notify_all();
+}
+
+size_t MemoryBudget::getLimit() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return limit;
+}
+
+MemoryBudget::Stats MemoryBudget::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats;
+    stats.limit = limit;
+    stats.used = used;
+    stats.peakUsed = peakUsed;
+    stats.partialPieces = usedByCategory[PARTIAL_PIECES];
+    stats.verifyQueue = usedByCategory[VERIFY_QUEUE];
+    stats.writeCache = usedByCategory[WRITE_CACHE];
+    stats.throttleEvents = throttleEvents;
+    stats.throttled = throttled;
+    return stats;
+}
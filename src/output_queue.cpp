@@ -0,0 +1,237 @@
+#include "../include/output_queue.hpp"
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+#else
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+#endif
+#ifdef __linux__
+    #include <sys/sendfile.h>
+#endif
+
+void OutputQueue::append(std::vector<uint8_t> message) {
+    if (message.empty()) return;
+    controlQueued += message.size();
+
+    // Onto the last segment while it has room (growing it is fine even if it
+    // is partly sent: only its end moves)
+    if (!control.empty() && message.size() <= COALESCE_MESSAGE_SIZE &&
+        control.back().bytes.size() + message.size() <= COALESCE_SEGMENT_SIZE) {
+        auto& bytes = control.back().bytes;
+        bytes.insert(bytes.end(), message.begin(), message.end());
+        return;
+    }
+    control.push_back({std::move(message), BlockView(), FileBlock()});
+}
+
+void OutputQueue::appendBlock(std::vector<uint8_t> header, BlockView block) {
+    bulkQueued += header.size() + block.size;
+    bulk.push_back({std::move(header), std::move(block), FileBlock()});
+}
+
+void OutputQueue::appendFile(std::vector<uint8_t> header, FileBlock file) {
+    bulkQueued += header.size() + file.size;
+    bulk.push_back({std::move(header), BlockView(), std::move(file)});
+}
+
+bool OutputQueue::cancelBlock(uint32_t pieceIndex, uint32_t blockOffset, uint32_t length) {
+    // The header is length, id, index and begin, in network byte order
+    auto field = [](const std::vector<uint8_t>& bytes, size_t at) {
+        return static_cast<uint32_t>(bytes[at]) << 24 | static_cast<uint32_t>(bytes[at + 1]) << 16 |
+               static_cast<uint32_t>(bytes[at + 2]) << 8 | bytes[at + 3];
+    };
+    // Past a PIECE already started, nothing of the bulk queue has been written
+    for (size_t i = bulkStarted ? 1 : 0; i < bulk.size(); ++i) {
+        const Segment& segment = bulk[i];
+        if (segment.bytes.size() < 13 || field(segment.bytes, 5) != pieceIndex ||
+            field(segment.bytes, 9) != blockOffset || segment.size() - segment.bytes.size() != length) {
+            continue;
+        }
+        bulkQueued -= segment.size();
+        bulk.erase(bulk.begin() + static_cast<std::ptrdiff_t>(i));
+        return true;
+    }
+    return false;
+}
+
+// A PIECE already started, then every control message, then the other PIECEs
+template <typename Fn>
+void OutputQueue::forEachScheduled(Fn fn) const {
+    size_t next = 0;
+    if (bulkStarted) {
+        if (!fn(bulk.front(), true)) return;
+        next = 1;
+    }
+    for (const Segment& segment : control) {
+        if (!fn(segment, false)) return;
+    }
+    for (; next < bulk.size(); ++next) {
+        if (!fn(bulk[next], true)) return;
+    }
+}
+
+template <typename Fn>
+bool OutputQueue::forEachPending(size_t bulkAllowance, Fn fn) const {
+    size_t count = 0;
+    size_t skip = frontSent;  // Only the front segment can be partly sent
+    bool moreNow = false;
+    forEachScheduled([&](const Segment& segment, bool isBulk) {
+        if (isBulk) {
+            // A PIECE is started only if the allowance covers all of it; one
+            // already started is finished regardless
+            size_t remaining = segment.size() - skip;
+            if (skip == 0 && remaining > bulkAllowance) return false;
+            bulkAllowance -= std::min(remaining, bulkAllowance);
+        }
+
+        if (skip < segment.bytes.size()) {
+            if (count == MAX_BUFFERS) {
+                moreNow = true;
+                return false;
+            }
+            fn(segment.bytes.data() + skip, segment.bytes.size() - skip);
+            ++count;
+            skip = 0;
+        } else {
+            skip -= segment.bytes.size();
+        }
+        if (segment.file) {
+            moreNow = true;  // Its data can't be part of a gather write
+            return false;
+        }
+
+        if (segment.block.size > skip) {
+            if (count == MAX_BUFFERS) {
+                moreNow = true;
+                return false;
+            }
+            fn(segment.block.data + skip, segment.block.size - skip);
+            ++count;
+        }
+        skip = 0;
+        return true;
+    });
+    return moreNow;
+}
+
+ssize_t OutputQueue::writeTo(int sock, int flags, size_t& attempted, size_t bulkAllowance) {
+    attempted = 0;
+    if (empty()) return 0;
+
+#ifdef __linux__
+    // Header already out: the block goes from the page cache, one file region per call
+    if (bulkStarted && bulk.front().file && frontSent >= bulk.front().bytes.size()) {
+        const Segment& front = bulk.front();
+        size_t blockOffset = frontSent - front.bytes.size();
+        for (size_t i = 0; i < front.file.regions.size(); ++i) {
+            const auto& region = front.file.regions[i];
+            if (blockOffset >= region.length) {
+                blockOffset -= region.length;
+                continue;
+            }
+            attempted = region.length - blockOffset;
+            // sendfile takes no MSG_MORE: cork so what follows right away can share the last packet
+            size_t rest = front.size() - frontSent;
+            size_t allowanceAfter = bulkAllowance > rest ? bulkAllowance - rest : 0;
+            bool moreNow = i + 1 < front.file.regions.size() || !control.empty() ||
+                           (bulk.size() > 1 && bulk[1].size() <= allowanceAfter);
+            if (moreNow && !corked) {
+                int one = 1;
+                corked = setsockopt(sock, IPPROTO_TCP, TCP_CORK, &one, sizeof(one)) == 0;
+            }
+            off_t fileOffset = static_cast<off_t>(region.offset + blockOffset);
+            ssize_t sent = sendfile(sock, region.fd, &fileOffset, attempted);
+            if (sent == 0) {
+                errno = EIO;  // The file is shorter than what was written to it
+                return -1;
+            }
+            if (sent > 0) consume(static_cast<size_t>(sent));
+            return sent;
+        }
+        errno = EINVAL;
+        return -1;
+    }
+#endif
+
+#ifdef _WIN32
+    std::vector<WSABUF> buffers;
+    forEachPending(bulkAllowance, [&](const uint8_t* data, size_t size) {
+        buffers.push_back({static_cast<ULONG>(size), reinterpret_cast<char*>(const_cast<uint8_t*>(data))});
+        attempted += size;
+    });
+    if (attempted == 0) return 0;  // Only bulk data left, over the allowance
+    (void)flags;
+    DWORD sentBytes = 0;
+    if (WSASend(sock, buffers.data(), static_cast<DWORD>(buffers.size()), &sentBytes, 0, nullptr, nullptr) != 0) {
+        return -1;
+    }
+    ssize_t sent = static_cast<ssize_t>(sentBytes);
+#else
+    iovec buffers[MAX_BUFFERS];
+    size_t count = 0;
+    bool moreNow = forEachPending(bulkAllowance, [&](const uint8_t* data, size_t size) {
+        buffers[count++] = {const_cast<uint8_t*>(data), size};
+        attempted += size;
+    });
+    if (attempted == 0) return 0;  // Only bulk data left, over the allowance
+#ifdef MSG_MORE
+    // More to come in the next call: don't push out a short packet in between
+    if (moreNow) flags |= MSG_MORE;
+#else
+    (void)moreNow;
+#endif
+
+    msghdr message{};
+    message.msg_iov = buffers;
+    message.msg_iovlen = count;
+    ssize_t sent = sendmsg(sock, &message, flags);
+#endif
+    if (sent > 0) consume(static_cast<size_t>(sent));
+    return sent;
+}
+
+void OutputQueue::uncork(int sock) {
+    if (!corked) return;
+#ifdef TCP_CORK
+    int zero = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+#else
+    (void)sock;
+#endif
+    corked = false;
+}
+
+void OutputQueue::consume(size_t bytes) {
+    while (bytes > 0 && !empty()) {
+        bool fromBulk = frontIsBulk();
+        std::deque<Segment>& queue = fromBulk ? bulk : control;
+        size_t left = queue.front().size() - frontSent;
+        size_t step = std::min(bytes, left);
+        (fromBulk ? bulkQueued : controlQueued) -= step;
+        bytes -= step;
+        if (step < left) {
+            frontSent += step;
+            bulkStarted = fromBulk;
+            return;
+        }
+        queue.pop_front();  // Unpins the piece buffer
+        frontSent = 0;
+        bulkStarted = false;
+    }
+}
+
+void OutputQueue::splice(OutputQueue& other) {
+    for (Segment& segment : other.control) control.push_back(std::move(segment));
+    for (Segment& segment : other.bulk) bulk.push_back(std::move(segment));
+    controlQueued += other.controlQueued;
+    bulkQueued += other.bulkQueued;
+    other.control.clear();
+    other.bulk.clear();
+    other.controlQueued = 0;
+    other.bulkQueued = 0;
+}
@@ -1,27 +1,24 @@
 #include "../include/peer_connection.hpp"
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 
 void PeerConnection::send_choke() {
-    std::lock_guard<std::mutex> lock(buffer_mutex);
-    create_message_header(CHOKE);
+    create_message_header(CHOKE);  // append_to_output() takes buffer_mutex
     choked_by_us = true;
 }
 
 void PeerConnection::send_unchoke() {
-    std::lock_guard<std::mutex> lock(buffer_mutex);
     create_message_header(UNCHOKE);
     choked_by_us = false;
 }
 
 void PeerConnection::send_interested() {
-    std::lock_guard<std::mutex> lock(buffer_mutex);
     create_message_header(INTERESTED);
     interested = true;
 }
 
 void PeerConnection::send_not_interested() {
-    std::lock_guard<std::mutex> lock(buffer_mutex);
     create_message_header(NOT_INTERESTED);
     interested = false;
 }
@@ -37,7 +34,7 @@ void PeerConnection::create_message_header(MessageType type, uint32_t length) {
     // Message ID
     message[4] = static_cast<uint8_t>(type);
     
-    append_to_output(message);
+    append_to_output(std::move(message));
 }
 
 void PeerConnection::create_request_message(uint32_t piece_index, 
@@ -59,43 +56,153 @@ void PeerConnection::create_request_message(uint32_t piece_index,
     uint32_t network_block_length  = htonl(block_length);
     memcpy(message.data() + 13, &network_block_length , 4);
     
-    append_to_output(message);
+    append_to_output(std::move(message));
 }
 
 void PeerConnection::append_to_output(const std::vector<uint8_t>& data) {
-    std::lock_guard<std::mutex> lock(buffer_mutex);
-    output_buffer.insert(output_buffer.end(), data.begin(), data.end());
+    append_to_output(std::vector<uint8_t>(data));
 }
 
-void PeerConnection::process_input_buffer() {
-    while (true) {
-        if (input_buffer.size() < 4) return;
+void PeerConnection::append_to_output(std::vector<uint8_t>&& data) {
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex);
+        output_queue.append(std::move(data));
+    }
+    output_queued();
+}
+
+void PeerConnection::append_block(uint32_t piece_index, uint32_t block_offset, BlockView block) {
+    std::vector<uint8_t> header = piece_header(piece_index, block_offset, block.size);
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex);
+        output_queue.appendBlock(std::move(header), std::move(block));
+    }
+    output_queued();
+}
 
-        // Get message length
-        uint32_t message_length;
-        memcpy(&message_length, input_buffer.data(), 4);
-        message_length = ntohl(message_length);
+void PeerConnection::append_block(uint32_t piece_index, uint32_t block_offset, FileBlock block) {
+    std::vector<uint8_t> header = piece_header(piece_index, block_offset, block.size);
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex);
+        output_queue.appendFile(std::move(header), std::move(block));
+    }
+    output_queued();
+}
 
-        // Check if we have complete message
-        if (input_buffer.size() < message_length + 4) return;
+std::vector<uint8_t> PeerConnection::piece_header(uint32_t piece_index, uint32_t block_offset,
+                                                  size_t block_size) const {
+    std::vector<uint8_t> header(13);  // length, id, index, begin
+    uint32_t network_length = htonl(9 + static_cast<uint32_t>(block_size));
+    uint32_t network_index = htonl(piece_index);
+    uint32_t network_offset = htonl(block_offset);
+    memcpy(header.data(), &network_length, 4);
+    header[4] = PIECE;
+    memcpy(header.data() + 5, &network_index, 4);
+    memcpy(header.data() + 9, &network_offset, 4);
+    return header;
+}
 
-        // Extract message
-        std::vector<uint8_t> message(input_buffer.begin() + 4, 
-                                   input_buffer.begin() + 4 + message_length);
-        handle_message(message);
+void PeerConnection::output_queued() {
+    if (on_output && !flush_scheduled.exchange(true)) on_output();
+}
 
-        // Remove processed data from buffer
-        input_buffer.erase(input_buffer.begin(), 
-                         input_buffer.begin() + 4 + message_length);
+ssize_t PeerConnection::receive(int flags) {
+    size_t space;
+    uint8_t* target = input_buffer.prepare(space);
+    if (!receiving_block) {
+        ssize_t received = recv(socket, reinterpret_cast<char*>(target), space, flags);
+        if (received > 0) input_buffer.commit(static_cast<size_t>(received));
+        return received;
     }
+
+    uint8_t* block = incoming_block.slot.data + incoming_block.received;
+    size_t remaining = incoming_block.slot.size - incoming_block.received;
+#ifdef _WIN32
+    ssize_t received = recv(socket, reinterpret_cast<char*>(block), static_cast<int>(remaining), flags);
+#else
+    // The rest of the block, and the header of the next message behind it:
+    // if that is another PIECE, its payload is read in place too
+    iovec buffers[2] = {{block, remaining}, {target, std::min<size_t>(space, PIECE_HEADER_SIZE)}};
+    msghdr message{};
+    message.msg_iov = buffers;
+    message.msg_iovlen = 2;
+    ssize_t received = recvmsg(socket, &message, flags);
+#endif
+    if (received <= 0) return received;
+
+    size_t into_block = std::min(static_cast<size_t>(received), remaining);
+    incoming_block.received += into_block;
+    if (static_cast<size_t>(received) > into_block) input_buffer.commit(static_cast<size_t>(received) - into_block);
+    if (incoming_block.received == incoming_block.slot.size) finish_incoming_block();
+    return received;
 }
 
-void PeerConnection::handle_message(const std::vector<uint8_t>& message) {
-    if (message.empty()) return;
+bool PeerConnection::begin_incoming_block() {
+    if (input_buffer.size() < PIECE_HEADER_SIZE) return false;
+    const uint8_t* header = input_buffer.data();
+    if (header[4] != PIECE) return false;
+
+    uint32_t length, piece_index, block_offset;
+    memcpy(&length, header, 4);
+    memcpy(&piece_index, header + 5, 4);
+    memcpy(&block_offset, header + 9, 4);
+    length = ntohl(length);
+    // Bad lengths are left to the framer, which rejects them
+    if (length <= 9 || length > input_buffer.maxMessageLength()) return false;
+
+    BlockSlot slot = reserve_block(ntohl(piece_index), ntohl(block_offset), length - 9);
+    if (!slot) return false;
+    input_buffer.consume(PIECE_HEADER_SIZE);
+
+    // Payload bytes that arrived with the header; the rest is read in place
+    size_t available = std::min(input_buffer.size(), slot.size);
+    memcpy(slot.data, input_buffer.data(), available);
+    input_buffer.consume(available);
+
+    incoming_block.piece_index = ntohl(piece_index);
+    incoming_block.block_offset = ntohl(block_offset);
+    incoming_block.slot = std::move(slot);
+    incoming_block.received = available;
+    receiving_block = true;
+    if (available == incoming_block.slot.size) finish_incoming_block();
+    return true;
+}
+
+void PeerConnection::finish_incoming_block() {
+    receiving_block = false;
+    BlockSlot slot = std::move(incoming_block.slot);
+    incoming_block.slot = BlockSlot();
+    if (on_block) on_block(incoming_block.piece_index, incoming_block.block_offset, std::move(slot));
+}
+
+bool PeerConnection::process_input_buffer() {
+    // Messages are views into the buffer, valid until it is read into again
+    const uint8_t* message;
+    size_t length;
+    while (true) {
+        // What follows a block still arriving belongs to it
+        if (receiving_block) return true;
+        if (reserve_block && begin_incoming_block()) continue;
+
+        switch (input_buffer.nextMessage(message, length)) {
+            case ReceiveBuffer::FRAME_READY:
+                handle_message(message, length);
+                break;
+            case ReceiveBuffer::FRAME_INCOMPLETE:
+                return true;
+            case ReceiveBuffer::FRAME_TOO_LONG:
+                std::cerr << "Message longer than " << input_buffer.maxMessageLength() << " bytes, dropping peer\n";
+                return false;
+        }
+    }
+}
+
+void PeerConnection::handle_message(const uint8_t* message, size_t length) {
+    if (length == 0) return;  // Keep-alive
 
     uint8_t message_id = message[0];
-    const uint8_t* payload = message.data() + 1;
-    size_t payload_size = message.size() - 1;
+    const uint8_t* payload = message + 1;
+    size_t payload_size = length - 1;
 
     switch (message_id) {
         case CHOKE:
@@ -108,86 +215,51 @@ void PeerConnection::handle_message(const std::vector<uint8_t>& message) {
             
         case INTERESTED:
             peer_interested = true;
-            break;
+            return;
             
         case NOT_INTERESTED:
             peer_interested = false;
-            break;
+            return;
             
         case HAVE: {
-            if (payload_size != 4) break;
+            if (payload_size != 4) return;
             uint32_t piece_index;
             memcpy(&piece_index, payload, 4);
             piece_index = ntohl(piece_index);
-            if (piece_index < bitfield.size()) {
-                bitfield[piece_index] = true;
-            }
+            // Repeated HAVEs must not count twice towards availability
+            // Atomic: read by other threads (picker, streaming) without this connection's lock
+            if (piece_index >= bitfield.size() || !bitfield.setAtomic(piece_index)) return;
             break;
         }
         
-        case BITFIELD: {
-            bitfield.resize(payload_size * 8);
-            for (size_t i = 0; i < payload_size; ++i) {
-                uint8_t byte = payload[i];
-                for (int j = 0; j < 8; ++j) {
-                    size_t index = i * 8 + j;
-                    if (index < bitfield.size()) {
-                        bitfield[index] = (byte >> (7 - j)) & 1;
-                    }
-                }
-            }
+        case BITFIELD:
+            // Parsed against the torrent's piece count by the protocol layer
             break;
-        }
         
-        case REQUEST: {
-            if (payload_size != 12) break;
-            uint32_t piece_index, block_offset, block_length;
-            memcpy(&piece_index, payload, 4);
-            memcpy(&block_offset, payload + 4, 4);
-            memcpy(&block_length, payload + 8, 4);
-            
-            piece_index = ntohl(piece_index);
-            block_offset = ntohl(block_offset);
-            block_length = ntohl(block_length);
-
-            // Serialize the request into bytes
-            std::vector<uint8_t> request_message;
-            request_message.resize(12); // 3 * uint32_t = 12 bytes
-
-            // Copy piece_index, block_offset, and block_length into the vector
-            memcpy(request_message.data(), &piece_index, 4);
-            memcpy(request_message.data() + 4, &block_offset, 4);
-            memcpy(request_message.data() + 8, &block_length, 4);
-            
-            // Add to message queue
-            std::lock_guard<std::mutex> lock(queue_mutex);
-            message_queue.push_back(request_message);
+        case REQUEST:
+            if (payload_size != 12) return;
             break;
-        }
         
-        case PIECE: {
-            if (payload_size < 8) break;
-            uint32_t piece_index, block_offset;
-            memcpy(&piece_index, payload, 4);
-            memcpy(&block_offset, payload + 4, 4);
-            
-            piece_index = ntohl(piece_index);
-            block_offset = ntohl(block_offset);
-            
-            // Extract block data
-            const uint8_t* block_data = payload + 8;
-            size_t data_size = payload_size - 8;
-            
-            // Handle received data
-            std::cout << "Received piece " << piece_index
-                      << " block " << block_offset
-                      << " (" << data_size << " bytes)\n";
+        case PIECE:
+            if (payload_size < 8) return;
             break;
+        
+        case CANCEL: {
+            if (payload_size != 12) return;
+            uint32_t fields[3];
+            memcpy(fields, payload, 12);
+            // Only a PIECE still waiting in the queue can be taken back
+            std::lock_guard<std::mutex> lock(buffer_mutex);
+            output_queue.cancelBlock(ntohl(fields[0]), ntohl(fields[1]), ntohl(fields[2]));
+            return;
         }
         
         default:
             std::cerr << "Unknown message type: " << static_cast<int>(message_id) << "\n";
+            return;
     }
+
+    if (on_message) on_message(message_id, payload, payload_size);
 }
 
 void PeerConnection::update_rate_counters(size_t downloaded, size_t uploaded) {
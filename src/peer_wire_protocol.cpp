@@ -8,7 +8,12 @@
 #include <random>
 #include <iostream>
 #include <array>
-#include <openssl/evp.h>
+#include <filesystem>
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <pthread.h>
+    #include <sched.h>
+#endif
 #include <winhttp.h>
 #pragma comment(lib, "winhttp.lib")
 
@@ -21,8 +26,66 @@ void closeSocket(int sock) {
 #endif
 }
 
-PeerWireProtocol::PeerWireProtocol(const std::string& torrentFilePath) 
-    : torrentFileParser(torrentFilePath), pieceStorage(nullptr) {
+#ifdef __linux__
+constexpr size_t MAX_READ_PER_EVENT = 256 * 1024;  // Then the other peers get a turn
+constexpr size_t BROADCAST_CHUNK = 512;             // Peers a HAVE is queued on per loop pass
+
+// Writes as much queued output as the socket takes without blocking, in
+// gather writes of up to OutputQueue::MAX_BUFFERS buffers each. Everything
+// queued during the loop pass goes out together: the flush runs once, after
+// the pass's events. PIECE data is held to what the upload limiter allows;
+// throttled is set when only that is left. Returns the bytes written, or -1
+// if the connection failed.
+static ssize_t writeQueued(PeerConnection& conn, RateLimiter& limiter, bool& throttled) {
+    std::lock_guard<std::mutex> lock(conn.buffer_mutex);
+    ssize_t total = 0;
+    throttled = false;
+    while (!conn.output_queue.empty()) {
+        size_t attempted;
+        size_t bulkBefore = conn.output_queue.bulkSize();
+        ssize_t sent = conn.output_queue.writeTo(conn.socket, MSG_DONTWAIT | MSG_NOSIGNAL, attempted,
+                                                 limiter.available());
+        limiter.consume(bulkBefore - conn.output_queue.bulkSize());
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+            break;
+        }
+        if (attempted == 0) {
+            throttled = true;
+            break;
+        }
+        total += sent;
+        if (static_cast<size_t>(sent) < attempted) break;  // The socket is full
+    }
+    conn.output_queue.uncork(conn.socket);
+    return total;
+}
+#endif
+
+// TCP_INFO reads are at least this far apart per peer (else once per RTT)
+constexpr std::chrono::milliseconds MIN_RTT_SAMPLE_INTERVAL(10);
+
+// Smoothed round-trip time the kernel keeps for the connection
+bool transportRoundTrip(int sock, std::chrono::microseconds& rtt) {
+#ifdef __linux__
+    tcp_info info{};
+    socklen_t length = sizeof(info);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &length) != 0 || info.tcpi_rtt == 0) return false;
+    rtt = std::chrono::microseconds(info.tcpi_rtt);
+    return true;
+#else
+    (void)sock;
+    (void)rtt;
+    return false;
+#endif
+}
+
+PeerWireProtocol::PeerWireProtocol(const std::string& torrentFilePath, size_t memoryBudgetBytes,
+                                   const std::string& downloadDir, const NetworkConfig& network) 
+    : pieceStorage(nullptr), memoryBudget(memoryBudgetBytes), networkConfig(network),
+      connections(network.connections), uploadLimiter(network.uploadRateLimit),
+      torrentFileParser(torrentFilePath) {
         std::cout << "Initializing DHT Bootstrap in PeerWireProtocol..." << '\n';
     
         // Generate a random node ID
@@ -40,7 +103,22 @@ PeerWireProtocol::PeerWireProtocol(const std::string& torrentFilePath)
         torrentFile = torrentFileParser.parse();  // Parse the torrent file
         infoHash = torrentFile.infoHash;
         // Initialize PieceManager with the number of pieces and piece length
-        // pieceStorage = std::make_unique<PieceManager>(torrentFile.numPieces, torrentFile.pieceLength);
+        int64_t totalLength = 0;
+        for (const auto& file : torrentFile.files) totalLength += file.second;
+        pieceStorage = std::make_unique<PieceManager>(torrentFile.numPieces, torrentFile.pieceLength,
+                                                      totalLength, &memoryBudget);
+        havePieces.resize(torrentFile.numPieces);
+        piecesNotNeeded.resize(torrentFile.numPieces);
+        filePriorities = std::make_unique<FilePriorities>(torrentFile);
+        picker = std::make_unique<PiecePicker>(torrentFile.numPieces);
+        picker->setInProgressLimit(memoryBudget.inProgressLimit(static_cast<size_t>(torrentFile.pieceLength)));
+        journal = std::make_unique<ResumeJournal>(
+            (std::filesystem::path(downloadDir) / (torrentFile.name + ".resume")).string(), infoHash,
+            torrentFile.numPieces);
+        diskIO = std::make_unique<DiskIO>(torrentFile, downloadDir, *pieceStorage, journal.get());
+        verifier = std::make_unique<PieceVerifier>(torrentFile.numPieces, PieceVerifier::defaultThreadCount(),
+            [this](int pieceIndex) { return verifyPiece(pieceIndex); },
+            [this](int pieceIndex, bool passed) { onPieceVerified(pieceIndex, passed); });
 
         std::cout << "Torrent parsed: " << torrentFile.numPieces 
                     << " pieces, " << torrentFile.pieceLength << " bytes each.\n";
@@ -54,18 +132,150 @@ PeerWireProtocol::PeerWireProtocol(const std::string& torrentFilePath)
         throw std::runtime_error("WSAStartup failed");
     }
 #endif
+
+#ifdef __linux__
+    size_t threads = networkConfig.threads;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, UINT16_MAX);
+#else
+    size_t threads = 1;  // Threads per peer; sharding needs the event loop
+#endif
+    for (size_t i = 0; i < threads; ++i) {
+        shards.push_back(std::make_unique<PeerShard>());
+        shards.back()->index = static_cast<uint32_t>(i);
+    }
+#ifdef __linux__
+    for (size_t i = 0; i < threads; ++i) startShard(i);
+#endif
+
+    // Last: pieces it hands to the verifier may pass (and be announced with
+    // broadcastHave on every shard's loop) before this returns
+    resumeFromJournal();
 }
 
 PeerWireProtocol::~PeerWireProtocol() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopSignal.notify_all();
+    if (streamingThread.joinable()) streamingThread.join();
+#ifndef __linux__
+    if (timeoutThread.joinable()) timeoutThread.join();
+#endif
+#ifdef __linux__
+    // Peer I/O calls into everything below, so it stops first
+    for (auto& shard : shards) shard->eventLoop->stop();
+    for (auto& shard : shards) {
+        shard->thread.join();
+        if (shard->listenSocket >= 0) closeSocket(shard->listenSocket);
+        for (auto& pair : shard->connecting) closeSocket(pair.first);
+    }
+#endif
+    // Stop hashing before the disk writer and piece storage it feeds
+    verifier.reset();
+    pieceStream.reset();
+    diskIO.reset();
 #ifdef _WIN32
     WSACleanup();
 #endif
-    std::lock_guard<std::mutex> lock(peerMutex);
-    for (auto& pair : peers) {
-        closeSocket(pair.first);
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (auto& conn : shard->peers) {
+            closeSocket(conn->socket);
+        }
+    }
+}
+
+PeerWireProtocol::PeerShard& PeerWireProtocol::shardOf(int peerId) const {
+    return *shards[static_cast<size_t>(peerId >= 0 ? peerId : 0) % shards.size()];
+}
+
+SlotHandle PeerWireProtocol::slotOf(const PeerShard& shard, int peerId) const {
+    auto it = shard.ids.find(peerId);
+    return it == shard.ids.end() ? SlotHandle() : it->second;
+}
+
+std::shared_ptr<PeerConnection> PeerWireProtocol::findPeer(int peerId) const {
+    PeerShard& shard = shardOf(peerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto* conn = shard.peers.get(slotOf(shard, peerId));
+    return conn ? *conn : nullptr;
+}
+
+std::shared_ptr<PeerConnection> PeerWireProtocol::findPeer(PeerHandle handle) const {
+    if (!handle) return nullptr;
+    PeerShard& shard = *shards[handle.shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto* conn = shard.peers.get(handle.slot);
+    return conn ? *conn : nullptr;
+}
+
+PeerWireProtocol::PeerHandle PeerWireProtocol::handleOf(int peerId) const {
+    PeerShard& shard = shardOf(peerId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return {shard.index, slotOf(shard, peerId)};
+}
+
+PeerWireProtocol::PeerHandle PeerWireProtocol::registerPeer(std::shared_ptr<PeerConnection> conn, size_t shardIndex) {
+    PeerShard& shard = *shards[shardIndex];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    PeerHandle handle{shard.index, shard.peers.insert(conn)};
+
+    // Ids count up per shard and only wrap after 2^31 connections, so the
+    // request bookkeeping, which outlives a peer by a timeout at most, never
+    // mixes one up with a later peer the way it could by socket number
+    const uint32_t idsPerShard = static_cast<uint32_t>(INT32_MAX / shards.size());
+    int id;
+    do {
+        if (shard.nextId >= idsPerShard) shard.nextId = 0;
+        id = static_cast<int>(shard.nextId++ * shards.size() + shardIndex);
+    } while (shard.ids.count(id));
+    shard.ids[id] = handle.slot;
+    conn->id = id;
+
+    conn->on_message = [this, id](uint8_t messageId, const uint8_t* payload, size_t payloadSize) {
+        onPeerMessage(id, messageId, payload, payloadSize);
+    };
+    conn->reserve_block = [this, id](uint32_t pieceIndex, uint32_t blockOffset, uint32_t blockSize) {
+        return reserveBlock(id, static_cast<int>(pieceIndex), static_cast<int>(blockOffset),
+                            static_cast<int>(blockSize));
+    };
+    conn->on_block = [this, id](uint32_t pieceIndex, uint32_t blockOffset, BlockSlot slot) {
+        notePieceArrival(id, static_cast<int>(pieceIndex), static_cast<int>(blockOffset), slot.size);
+        finishBlock(id, static_cast<int>(pieceIndex), static_cast<int>(blockOffset), slot);
+        requestMorePieces(id);
+    };
+#ifdef __linux__
+    // Flushes find the peer by handle, so one queued for a dropped peer
+    // misses instead of writing to whoever got its socket number next
+    EventLoop* loop = shard.eventLoop.get();
+    conn->on_output = [this, loop, handle]() {
+        loop->post([this, handle]() { flushToPeer(handle); });
+    };
+#endif
+    return handle;
+}
+
+std::vector<std::shared_ptr<PeerConnection>> PeerWireProtocol::allPeers() const {
+    std::vector<std::shared_ptr<PeerConnection>> result;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        result.insert(result.end(), shard->peers.begin(), shard->peers.end());
+    }
+    return result;
+}
+
+size_t PeerWireProtocol::peerCount() const {
+    size_t count = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        count += shard->peers.size();
     }
+    return count;
 }
 
+#ifndef __linux__
 int PeerWireProtocol::connectToPeer(const std::string& peerIP, int peerPort) {
     std::cout << "**ATTEMPTING TO CONNECT TO PEER: " << peerIP << ":" << peerPort << "**" << std::endl;
     
@@ -85,29 +295,71 @@ int PeerWireProtocol::connectToPeer(const std::string& peerIP, int peerPort) {
         throw std::runtime_error("Connection failed to " + peerIP);
     }
 
-    {
-        std::lock_guard<std::mutex> lock(peerMutex);
-        auto conn = std::make_shared<PeerConnection>();
-        conn->socket = sock;
-        peers[sock] = conn;
-    }
+    // Outbound peers go round robin across the shards
+    size_t shard = nextShard.fetch_add(1) % shards.size();
+    auto conn = makePeerConnection(sock);
+    registerPeer(conn, shard);
+    int peerId = conn->id;
 
     std::cout << "Sending Handshake" << '\n';
-    sendHandshake(sock);
+    sendHandshake(peerId);
     
     // Start I/O threads
-    std::thread([this, sock]() {
-        handlePeerInput(sock);
+    std::thread([this, peerId]() {
+        handlePeerInput(peerId);
     }).detach();
-    std::thread([this, sock]() {
-        handlePeerOutput(sock);
+    std::thread([this, peerId]() {
+        handlePeerOutput(peerId);
     }).detach();
 
-    return sock;
+    return peerId;
+}
+#endif
+
+void PeerWireProtocol::addPeers(const std::vector<DHT::Node>& nodes, ConnectionManager::Source source) {
+    for (const auto& node : nodes) {
+        connections.addPeer(node.ip, static_cast<uint16_t>(node.port), source);
+    }
+#ifdef __linux__
+    shards[0]->eventLoop->post([this]() { dialPeers(); });
+#else
+    dialPeers();
+#endif
+}
+
+void PeerWireProtocol::dialPeers() {
+    for (const auto& endpoint : connections.nextToConnect()) {
+#ifdef __linux__
+        startConnect(endpoint);
+#else
+        // No event loop: a blocking connect per attempt, bounded by the half-open limit
+        std::thread([this, endpoint]() {
+            try {
+                int peerId = connectToPeer(endpoint.ip, endpoint.port);
+                connections.onConnected(endpoint);
+                PeerShard& shard = shardOf(peerId);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                if (shard.peers.contains(slotOf(shard, peerId))) {
+                    shard.dialed[peerId] = endpoint;
+                } else {
+                    connections.onDisconnected(endpoint);  // Already gone
+                }
+            } catch (const std::exception&) {
+                connections.onFailed(endpoint);
+            }
+            dialPeers();
+        }).detach();
+#endif
+    }
 }
 
 
-void PeerWireProtocol::sendHandshake(int peerSocket) {
+#ifndef __linux__
+void PeerWireProtocol::sendHandshake(int peerId) {
+    auto conn = findPeer(peerId);
+    if (!conn) return;
+    int peerSocket = conn->socket;
+
     std::vector<uint8_t> handshake;
     handshake.reserve(68);
     
@@ -150,16 +402,16 @@ void PeerWireProtocol::sendHandshake(int peerSocket) {
         return;
     }
     
-    const DHT::NodeID& peerId = dht_instance->getMyNodeId();
+    const DHT::NodeID& myPeerId = dht_instance->getMyNodeId();
     std::cout << "Peer ID Retrieved: ";
-    for (uint8_t byte : peerId) {
+    for (uint8_t byte : myPeerId) {
         std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte) << " ";
     }
     std::cout << std::dec << '\n';
 
     std::cout << "Retrieved peer ID from DHT instance." << '\n';
     
-    handshake.insert(handshake.end(), peerId.begin(), peerId.end());
+    handshake.insert(handshake.end(), myPeerId.begin(), myPeerId.end());
     std::cout << "Inserted peer ID into handshake." << '\n';
 
     // Debug: Check handshake size before sending
@@ -290,7 +542,7 @@ void PeerWireProtocol::sendHandshake(int peerSocket) {
                 case 5: {  // Bitfield
                     std::cout << "Received BITFIELD message!" << '\n';
                     std::vector<uint8_t> bitfield(buffer.begin() + 5, buffer.end());
-                    handleBitfield(peerSocket, bitfield);
+                    handleBitfield(peerId, bitfield);
                     break;
                 }
                 case 0:
@@ -318,93 +570,455 @@ void PeerWireProtocol::sendHandshake(int peerSocket) {
 }
 
 
-void PeerWireProtocol::handleHandshake(int peerSocket) {
+void PeerWireProtocol::handleHandshake(int peerId) {
+    auto conn = findPeer(peerId);
+    if (!conn) return;
     uint8_t buffer[68];
-    int received = recv(peerSocket, reinterpret_cast<char *>(buffer), sizeof(buffer), 0);
+    int received = recv(conn->socket, reinterpret_cast<char *>(buffer), sizeof(buffer), 0);
     
     if (received != 68 || 
         buffer[0] != HANDSHAKE_PROTOCOL_LEN ||
         memcmp(buffer + 1, HANDSHAKE_PROTOCOL_STR, HANDSHAKE_PROTOCOL_LEN) != 0) {
-        closeSocket(peerSocket);
         throw std::runtime_error("Invalid handshake received");
     }
 
-    std::lock_guard<std::mutex> lock(peerMutex);
-    auto& conn = peers[peerSocket];
     memcpy(conn->info_hash.data(), buffer + 28, 20);
     memcpy(conn->peer_id.data(), buffer + 48, 20);
 }
+#endif
 
-void PeerWireProtocol::sendBitfield(int peerSocket, const std::vector<bool>& bitfield) {
-    std::vector<uint8_t> message;
-    const size_t byteCount = (bitfield.size() + 7) / 8;
-    message.reserve(5 + byteCount);
+void PeerWireProtocol::sendBitfield(int peerId, const Bitfield& bitfield) {
+    const size_t byteCount = bitfield.wireSize();
+    std::vector<uint8_t> message(5 + byteCount);
     
     // Message header
     uint32_t length = htonl(1 + byteCount);
-    message.insert(message.end(), 
-                 reinterpret_cast<uint8_t*>(&length),
-                 reinterpret_cast<uint8_t*>(&length) + 4);
-    message.push_back(5);  // Bitfield message ID
+    memcpy(message.data(), &length, 4);
+    message[4] = 5;  // Bitfield message ID
     
-    // Pack bits into bytes
-    for (size_t i = 0; i < byteCount; ++i) {
-        uint8_t byte = 0;
-        for (int j = 0; j < 8; ++j) {
-            size_t index = i * 8 + j;
-            if (index < bitfield.size() && bitfield[index]) {
-                byte |= (1 << (7 - j));
+    // Words are stored in wire order, so this is a byte-swapped copy
+    bitfield.storeWire(message.data() + 5);
+
+    // Queued like every other message, so it can't interleave with the writer
+    if (auto conn = findPeer(peerId)) conn->append_to_output(std::move(message));
+}
+
+std::vector<uint8_t> PeerWireProtocol::handshakeMessage() const {
+    std::vector<uint8_t> handshake;
+    handshake.reserve(68);
+    handshake.push_back(HANDSHAKE_PROTOCOL_LEN);
+    handshake.insert(handshake.end(), HANDSHAKE_PROTOCOL_STR, HANDSHAKE_PROTOCOL_STR + HANDSHAKE_PROTOCOL_LEN);
+    handshake.insert(handshake.end(), 8, 0);  // Reserved
+    handshake.insert(handshake.end(), infoHash.begin(), infoHash.end());
+    if (dht_instance) {
+        const DHT::NodeID& peerId = dht_instance->getMyNodeId();
+        handshake.insert(handshake.end(), peerId.begin(), peerId.end());
+    } else {
+        handshake.insert(handshake.end(), 20, 0);
+    }
+    return handshake;
+}
+
+bool PeerWireProtocol::acceptHandshake(PeerConnection& conn) {
+    const uint8_t* buffer = conn.input_buffer.data();
+    if (buffer[0] != HANDSHAKE_PROTOCOL_LEN ||
+        memcmp(buffer + 1, HANDSHAKE_PROTOCOL_STR, HANDSHAKE_PROTOCOL_LEN) != 0 ||
+        memcmp(buffer + 28, infoHash.data(), infoHash.size()) != 0) {
+        return false;
+    }
+    memcpy(conn.info_hash.data(), buffer + 28, 20);
+    memcpy(conn.peer_id.data(), buffer + 48, 20);
+    conn.input_buffer.consume(68);
+    conn.awaiting_handshake = false;
+
+    if (!conn.handshake_sent) {
+        conn.handshake_sent = true;
+        conn.append_to_output(handshakeMessage());
+        sendBitfield(conn.id, havePieces);
+    }
+    return true;
+}
+
+void PeerWireProtocol::handleBitfield(int peerId, const std::vector<uint8_t>& bitfieldBytes) {
+    int numPieces = torrentFile.numPieces;  // Fetch numPieces from parser
+
+    // Spare bits past numPieces are dropped by fromWire
+    Bitfield bitfield = Bitfield::fromWire(bitfieldBytes.data(), bitfieldBytes.size(), numPieces);
+
+    std::cout << "Bitfield length (bits): " << bitfield.size() << '\n';
+    std::cout << "Bitfield length (bytes): " << bitfieldBytes.size() << '\n';
+
+    // Store the processed bitfield in peer's state
+    std::shared_ptr<PeerConnection> conn;
+    {
+        PeerShard& shard = shardOf(peerId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto* found = shard.peers.get(slotOf(shard, peerId));
+        if (!found) return;
+        conn = *found;
+
+        // A repeated BITFIELD replaces the old one in the availability counts
+        if (conn->in_picker) picker->removePeer(conn->bitfield, conn->picker_seed);
+        conn->bitfield = std::move(bitfield);
+        conn->picker_seed = picker->addPeer(conn->bitfield);
+        conn->in_picker = true;
+    }
+
+    std::cout << "Processed bitfield from peer " << peerId << ": "
+              << conn->bitfield.count() << "/" << numPieces << " pieces"
+              << (conn->bitfield.hasAll() ? " (seed)" : "") << '\n';
+
+    if (!conn->interested && peerHasPiecesWeNeed(*conn)) {
+        conn->send_interested();
+    }
+}
+
+bool PeerWireProtocol::peerHasPiecesWeNeed(const PeerConnection& conn) const {
+    return Bitfield::anyAndNot(conn.bitfield, piecesNotNeeded);
+}
+
+std::shared_ptr<PeerConnection> PeerWireProtocol::makePeerConnection(int sock) {
+    auto conn = std::make_shared<PeerConnection>();
+    conn->socket = sock;
+    // BITFIELD is optional (a peer with nothing may skip it), so HAVEs must
+    // count from the start: an empty set of the torrent's size, in the picker
+    conn->bitfield = Bitfield(static_cast<size_t>(torrentFile.numPieces));
+    conn->picker_seed = picker->addPeer(conn->bitfield);
+    conn->in_picker = true;
+    // Nothing longer than a PIECE or our torrent's BITFIELD is accepted
+    conn->input_buffer.setMaxMessageLength(
+        std::max(ReceiveBuffer::DEFAULT_MAX_MESSAGE_LENGTH, 1 + havePieces.wireSize()));
+    return conn;
+}
+
+void PeerWireProtocol::onPeerMessage(int peerId, uint8_t messageId, const uint8_t* payload, size_t payloadSize) {
+    auto readUint32 = [payload](size_t offset) {
+        uint32_t value;
+        memcpy(&value, payload + offset, 4);
+        return static_cast<int>(ntohl(value));
+    };
+
+    switch (messageId) {
+        case 0:  // Choke: requests in flight are dropped by the peer
+            releasePeerPieces(peerId);
+            break;
+
+        case 1:  // Unchoke
+            requestMorePieces(peerId);
+            break;
+
+        case 4: {  // Have (only pieces new to the peer's bitfield get here)
+            int pieceIndex = readUint32(0);
+            picker->addHave(pieceIndex);
+
+            auto conn = findPeer(peerId);
+            if (!conn) return;
+            if (!conn->interested && !piecesNotNeeded.getAtomic(pieceIndex)) conn->send_interested();
+            break;
+        }
+
+        case 5:  // Bitfield
+            handleBitfield(peerId, std::vector<uint8_t>(payload, payload + payloadSize));
+            break;
+
+        case 6:  // Request
+            handleRequest(peerId, readUint32(0), readUint32(4), readUint32(8));
+            break;
+
+        case 7: {  // Piece
+            // Only blocks that weren't received in place (see finishBlock) get here
+            int pieceIndex = readUint32(0);
+            int blockOffset = readUint32(4);
+            notePieceArrival(peerId, pieceIndex, blockOffset, payloadSize - 8);
+            handlePiece(peerId, pieceIndex, blockOffset, std::vector<uint8_t>(payload + 8, payload + payloadSize));
+            // Refill on every block so the pipeline never drains
+            requestMorePieces(peerId);
+            break;
+        }
+    }
+}
+
+void PeerWireProtocol::notePieceArrival(int peerId, int pieceIndex, int blockOffset, size_t blockSize) {
+    auto conn = findPeer(peerId);
+    if (!conn) return;
+    if (conn->snubbed.exchange(false)) {
+        std::cout << "Peer " << peerId << " is sending again, no longer snubbed.\n";
+    }
+    RequestTracker::Clock::duration latency;
+    if (requestTracker.requestLatency(peerId, pieceIndex, blockOffset, latency)) {
+        pipeline.onBlockReceived(peerId, blockSize, latency);
+    }
+
+    // The kernel's estimate only moves about once per round trip, and reading
+    // it is a syscall: not one per block
+    auto now = std::chrono::steady_clock::now();
+    if (now < conn->next_rtt_sample) return;
+    std::chrono::microseconds rtt;
+    if (transportRoundTrip(conn->socket, rtt)) {
+        pipeline.onRttSample(peerId, rtt);
+        conn->next_rtt_sample = now + std::max<std::chrono::steady_clock::duration>(rtt, MIN_RTT_SAMPLE_INTERVAL);
+    } else {
+        conn->next_rtt_sample = now + MIN_RTT_SAMPLE_INTERVAL;
+    }
+}
+
+BlockSlot PeerWireProtocol::reserveBlock(int peerId, int pieceIndex, int blockOffset, int blockSize) {
+    // Anything odd goes through handlePiece, which reports and counts it
+    if (pieceIndex < 0 || pieceIndex >= torrentFile.numPieces || havePieces.getAtomic(pieceIndex) ||
+        !isExpectedBlock(peerId, pieceIndex, blockOffset, blockSize)) {
+        return {};
+    }
+    return pieceStorage->reserveBlock(pieceIndex, blockOffset, blockSize);
+}
+
+bool PeerWireProtocol::isExpectedBlock(int peerId, int pieceIndex, int blockOffset, int blockSize) {
+    int pieceSize = pieceStorage->getPieceSize(pieceIndex);
+    if (blockOffset < 0 || blockOffset >= pieceSize || blockSize != std::min(MAX_BLOCK_SIZE, pieceSize - blockOffset)) {
+        return false;
+    }
+    return requestTracker.isRequestedFrom(peerId, pieceIndex, blockOffset, blockSize);
+}
+
+void PeerWireProtocol::finishBlock(int peerId, int pieceIndex, int blockOffset, const BlockSlot& slot) {
+    for (int otherPeer : requestTracker.blockReceived(peerId, pieceIndex, blockOffset)) {
+        sendCancel(otherPeer, pieceIndex, blockOffset, static_cast<int>(slot.size));
+    }
+    // The payload is already in the piece buffer; committing it only updates the bookkeeping
+    if (!pieceStorage->commitBlock(pieceIndex, blockOffset, slot)) {
+        requestTracker.recordWaste(slot.size);  // The piece was reset while the block arrived
+        return;
+    }
+    blockStored(pieceIndex, blockOffset, slot.size);
+}
+
+void PeerWireProtocol::requestMorePieces(int peerId) {
+    // Streaming mode requests by deadline from its own loop
+    if (streaming) return;
+
+    std::vector<RequestTracker::Block> blocks;
+    {
+        PeerShard& shard = shardOf(peerId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto* conn = shard.peers.get(slotOf(shard, peerId));
+        if (!conn || (*conn)->choked_by_peer) return;
+
+        // A snubbed peer only gets one request, to find out whether it is back
+        size_t depth = (*conn)->snubbed ? 1 : static_cast<size_t>(pipeline.targetDepth(peerId));
+        size_t outstanding = requestTracker.outstandingCount(peerId);
+        if (outstanding >= depth) return;
+        size_t wanted = depth - outstanding;
+
+        // Pieces the peer is already on first, then what slower peers haven't
+        // requested of theirs, then new ones from the picker
+        // Backpressure: while over the memory budget only pieces we already
+        // hold are worked on (their blocks allocate nothing), and the picker
+        // isn't asked for new ones until the budget clears
+        bool throttled = memoryBudget.isThrottled();
+        auto held = [&](int pieceIndex) { return !throttled || pieceStorage->isPieceAllocated(pieceIndex); };
+        const Bitfield& peerHas = (*conn)->bitfield;
+        auto speed = PiecePicker::classify(pipeline.getPeerStats(peerId).bytesPerSecond,
+                                           static_cast<int>(torrentFile.pieceLength));
+        for (int pieceIndex : picker->piecesDownloadingBy(peerId)) {
+            if (blocks.size() >= wanted) break;
+            if (held(pieceIndex)) collectUnrequestedBlocks(pieceIndex, wanted - blocks.size(), blocks);
+        }
+        for (int pieceIndex : picker->joinablePieces(peerId, peerHas, speed)) {
+            if (blocks.size() >= wanted) break;
+            if (held(pieceIndex)) collectUnrequestedBlocks(pieceIndex, wanted - blocks.size(), blocks);
+        }
+        if (throttled && blocks.size() < wanted) requestsHeldBack.store(true);
+        while (!throttled && blocks.size() < wanted) {
+            int pieceIndex = picker->pickPiece(peerId, peerHas, speed);
+            if (pieceIndex == PiecePicker::NO_PIECE) break;
+            collectUnrequestedBlocks(pieceIndex, wanted - blocks.size(), blocks);
+        }
+
+        // Nothing new to start: help with blocks still outstanding at other peers
+        if (blocks.size() < wanted && updateEndgame()) {
+            auto duplicates = requestTracker.pickDuplicates(peerId, (*conn)->bitfield);
+            duplicates.erase(std::remove_if(duplicates.begin(), duplicates.end(),
+                                            [&](const auto& block) { return !held(block.pieceIndex); }),
+                             duplicates.end());
+            duplicates.resize(std::min(duplicates.size(), wanted - blocks.size()));
+            blocks.insert(blocks.end(), duplicates.begin(), duplicates.end());
+        }
+    }
+
+    // sendRequest takes the shard lock itself
+    for (const auto& block : blocks) {
+        sendRequest(peerId, block.pieceIndex, block.blockOffset, block.length);
+    }
+}
+
+bool PeerWireProtocol::updateEndgame() {
+    PiecePicker::Stats stats = picker->getStats();
+    bool endgame = stats.wantedPieces == 0 && stats.partialPieces == 0 && stats.downloadingPieces > 0;
+    // Every piece being started isn't enough: a downloading piece may still
+    // have blocks nobody was asked for, which its owner should request first
+    if (endgame) {
+        std::vector<RequestTracker::Block> unrequested;
+        for (int pieceIndex : picker->downloadingPieces()) {
+            collectUnrequestedBlocks(pieceIndex, 1, unrequested);
+            if (!unrequested.empty()) {
+                endgame = false;
+                break;
             }
         }
-        message.push_back(byte);
     }
+    if (requestTracker.setEndgame(endgame)) {
+        std::cout << (endgame ? "Entering" : "Leaving") << " endgame with " << stats.downloadingPieces
+                  << " pieces downloading.\n";
+    }
+    return endgame;
+}
 
-    send(peerSocket, reinterpret_cast<char *>(message.data()), message.size(), 0);
+void PeerWireProtocol::requestMissingBlocks(int peerId, int pieceIndex) {
+    // Partial pieces (from a peer that left, or the resume journal) keep their blocks
+    Bitfield received = pieceStorage->getReceivedBlocks(pieceIndex);
+    int pieceSize = pieceStorage->getPieceSize(pieceIndex);
+    for (int blockOffset = 0, block = 0; blockOffset < pieceSize; blockOffset += MAX_BLOCK_SIZE, ++block) {
+        if (static_cast<size_t>(block) < received.size() && received[block]) continue;
+        sendRequest(peerId, pieceIndex, blockOffset, std::min(MAX_BLOCK_SIZE, pieceSize - blockOffset));
+    }
 }
 
-void PeerWireProtocol::handleBitfield(int peerSocket, const std::vector<uint8_t>& bitfieldBytes) {
-    std::vector<bool> bitfield;  // Store pieces in a bitfield
-    int bitIndex = 0;
-    int numPieces = torrentFile.numPieces;  // Fetch numPieces from parser
+void PeerWireProtocol::collectUnrequestedBlocks(int pieceIndex, size_t maxBlocks,
+                                                std::vector<RequestTracker::Block>& blocks) {
+    Bitfield received = pieceStorage->getReceivedBlocks(pieceIndex);
+    int pieceSize = pieceStorage->getPieceSize(pieceIndex);
+    size_t added = 0;
+    for (int blockOffset = 0, block = 0; blockOffset < pieceSize && added < maxBlocks;
+         blockOffset += MAX_BLOCK_SIZE, ++block) {
+        if (static_cast<size_t>(block) < received.size() && received[block]) continue;
+        if (requestTracker.isRequested(pieceIndex, blockOffset)) continue;
+        blocks.push_back({pieceIndex, blockOffset, std::min(MAX_BLOCK_SIZE, pieceSize - blockOffset)});
+        ++added;
+    }
+}
 
+void PeerWireProtocol::refillPipelines(int exceptPeer) {
+    for (const auto& conn : allPeers()) {
+        if (conn->id != exceptPeer && !conn->choked_by_peer) requestMorePieces(conn->id);
+    }
+}
 
-    // Convert each byte into 8 bits 
-    // for (uint8_t byte : bitfieldBytes) {
-    //     for (int i = 7; i >= 0; --i) {  // Extract bits from MSB to LSB
-    //         // bitfield.push_back((byte >> i) & 1);
-    //         if (bitIndex < numPieces) {  // Only store valid bits
-    //             bitfield.push_back((byte >> i) & 1);
-    //         }
-    //         bitIndex++;
-    //     }
-    // }
-    for (size_t i = 0; i < bitfieldBytes.size(); ++i) {
-        for (int j = 7; j >= 0; --j) {
-            size_t bitIndex = (i * 8) + (7 - j);
-            if (bitIndex >= numPieces) break;  // Prevent extra bits
-            bitfield[bitIndex] = (bitfieldBytes[i] >> j) & 1;
+void PeerWireProtocol::releasePeerPieces(int peerId) {
+    if (streaming) streaming->onPeerDisconnected(peerId);
+    std::vector<RequestTracker::Block> dropped = requestTracker.removePeer(peerId);
+    for (int pieceIndex : picker->piecesDownloadingBy(peerId)) {
+        // Complete pieces are with the verifier, which settles them
+        if (pieceStorage->isPieceComplete(pieceIndex)) continue;
+        picker->abortPiece(pieceIndex, pieceStorage->isPieceAllocated(pieceIndex));
+    }
+
+    // The pieces are partial now, so other peers pick them (and the dropped blocks) first
+    if (!dropped.empty()) refillPipelines(peerId);
+}
+
+void PeerWireProtocol::checkRequestTimeouts() {
+    auto expired = requestTracker.expireRequests(
+        [this](int peerId) { return pipeline.requestTimeout(peerId); });
+    for (const auto& request : expired) {
+        // A streaming piece the peer is late with can go to someone else
+        if (streaming && streaming->assignedPiece(request.peerId) == request.block.pieceIndex) {
+            streaming->onPeerDisconnected(request.peerId);
         }
+        // Blocks still requested from another peer (endgame) may yet arrive from it
+        if (!request.orphaned) continue;
+        // Otherwise the piece goes back to the picker as partial, so any peer can finish it
+        int pieceIndex = request.block.pieceIndex;
+        auto pieces = picker->piecesDownloadingBy(request.peerId);
+        if (std::find(pieces.begin(), pieces.end(), pieceIndex) == pieces.end()) continue;
+        if (pieceStorage->isPieceComplete(pieceIndex)) continue;
+        picker->abortPiece(pieceIndex, pieceStorage->isPieceAllocated(pieceIndex));
     }
 
-    std::cout << "Bitfield length (bits): " << bitfield.size() << '\n';
-    std::cout << "Bitfield length (bytes): " << bitfieldBytes.size() << '\n';
+    for (int peerId : requestTracker.idlePeers(snubTimeout.load())) {
+        auto conn = findPeer(peerId);
+        if (!conn) continue;
+        if (!conn->snubbed.exchange(true)) {
+            std::cout << "Peer " << peerId << " sent nothing for " << snubTimeout.load().count()
+                      << " s, snubbed.\n";
+        }
+        // Its requests move to other peers (releasePeerPieces refills them)
+        releasePeerPieces(peerId);
+    }
 
+    if (!expired.empty()) {
+        std::cout << expired.size() << " block requests timed out.\n";
+        refillPipelines(-1);
+    }
+}
 
-    // Store the processed bitfield in peer's state
-    std::lock_guard<std::mutex> lock(peerMutex);
-    if (peers.find(peerSocket) != peers.end()) {
-        peers[peerSocket]->bitfield = bitfield;
+#ifndef __linux__
+void PeerWireProtocol::requestTimeoutLoop() {
+    // The shard loops run these from timers
+    while (sleepUnlessStopping(std::chrono::seconds(1))) {
+        checkRequestTimeouts();
+        resumeHeldRequests();
+        dialPeers();  // Endpoints come out of backoff over time
     }
+}
+#endif
 
-    std::cout << "Processed bitfield from peer " << peerSocket << ": ";
-    for (bool hasPiece : bitfield) {
-        std::cout << hasPiece;
+void PeerWireProtocol::dropPeer(PeerHandle handle) {
+    if (!handle) return;
+    PeerShard& shard = *shards[handle.shard];
+    int sock;
+    int peerId;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto* found = shard.peers.get(handle.slot);
+        if (!found) return;  // The other I/O thread got here first
+        std::shared_ptr<PeerConnection> conn = std::move(*found);
+        shard.peers.erase(handle.slot);
+        sock = conn->socket;
+        peerId = conn->id;
+        shard.ids.erase(peerId);
+
+        if (conn->in_picker) picker->removePeer(conn->bitfield, conn->picker_seed);
+        // A block cut off mid-payload can be received from someone else
+        PeerConnection::IncomingBlock& incoming = conn->incoming_block;
+        if (conn->receiving_block) {
+            pieceStorage->releaseBlock(static_cast<int>(incoming.piece_index),
+                                       static_cast<int>(incoming.block_offset), incoming.slot);
+        }
+#ifdef __linux__
+        shard.eventLoop->remove(sock);
+#endif
+        auto dialed = shard.dialed.find(peerId);
+        if (dialed != shard.dialed.end()) {
+            connections.onDisconnected(dialed->second);
+            shard.dialed.erase(dialed);
+        }
     }
-    std::cout << '\n';
 
+    // Out of the table already, so nothing new is requested from it. The
+    // bookkeeping is keyed by id, which no later peer gets, so a request
+    // timing out on another thread can't release someone else's pieces.
+    releasePeerPieces(peerId);
+    pipeline.removePeer(peerId);
+    closeSocket(sock);
+}
+
+bool PeerWireProtocol::readingPaused(int peerId) const {
+    if (diskIO->isBacklogged()) return true;
+    if (!memoryBudget.isThrottled()) return false;
+    // Their blocks land in buffers already charged and complete pieces, which
+    // then leave the budget; stopping them could keep it over for good
+    return !requestTracker.owesBlockOf(peerId, [this](int pieceIndex) {
+        return pieceStorage->isPieceAllocated(pieceIndex);
+    });
 }
 
-void PeerWireProtocol::sendRequest(int peerSocket, int pieceIndex, int blockOffset, int blockSize) {
+void PeerWireProtocol::resumeHeldRequests() {
+    if (memoryBudget.isThrottled() || !requestsHeldBack.exchange(false)) return;
+    refillPipelines(-1);
+}
+
+void PeerWireProtocol::sendRequest(int peerId, int pieceIndex, int blockOffset, int blockSize) {
+    // Callers check the memory budget before a piece is assigned: a request
+    // dropped here would leave the picker's assignment without one
     std::vector<uint8_t> message(17);
     uint32_t networkLength = htonl(13);
     uint8_t messageId = 6;
@@ -421,59 +1035,77 @@ void PeerWireProtocol::sendRequest(int peerSocket, int pieceIndex, int blockOffs
     uint32_t networkSize = htonl(blockSize);
     memcpy(message.data() + 13, &networkSize, 4);
 
-    {
-        std::lock_guard<std::mutex> lock(peerMutex);
-        if (peers.find(peerSocket) != peers.end()) {
-            peers[peerSocket]->append_to_output(message);
-        }
-    }
+    auto conn = findPeer(peerId);
+    if (!conn) return;
+    conn->append_to_output(std::move(message));
+    requestTracker.addRequest(peerId, pieceIndex, blockOffset, blockSize);
 }
 
-/////////////////////////////////////////////////////// HERE ///////////////////////////////////////////////////////
-void PeerWireProtocol::handleRequest(int peerSocket, int pieceIndex, int blockOffset, int blockSize) {
-    std::lock_guard<std::mutex> lock(peerMutex);
+void PeerWireProtocol::sendCancel(int peerId, int pieceIndex, int blockOffset, int blockSize) {
+    // Same layout as REQUEST
+    std::vector<uint8_t> message(17);
+    uint32_t networkLength = htonl(13);
+    memcpy(message.data(), &networkLength, 4);
+    message[4] = 8;  // Cancel message ID
 
-    // Check if peer exists
-    if (peers.find(peerSocket) == peers.end()) {
-        std::cerr << "Error: Peer socket " << peerSocket << " not found.\n";
+    uint32_t networkIndex = htonl(pieceIndex);
+    memcpy(message.data() + 5, &networkIndex, 4);
+    uint32_t networkOffset = htonl(blockOffset);
+    memcpy(message.data() + 9, &networkOffset, 4);
+    uint32_t networkSize = htonl(blockSize);
+    memcpy(message.data() + 13, &networkSize, 4);
+
+    if (auto conn = findPeer(peerId)) conn->append_to_output(std::move(message));
+}
+
+/////////////////////////////////////////////////////// HERE ///////////////////////////////////////////////////////
+void PeerWireProtocol::handleRequest(int peerId, int pieceIndex, int blockOffset, int blockSize) {
+    auto conn = findPeer(peerId);
+    if (!conn) {
+        std::cerr << "Error: Peer " << peerId << " not found.\n";
         return;
     }
 
-    // Validate request
-    if (pieceIndex < 0 || pieceIndex >= torrentFile.numPieces || blockSize <= 0 || blockSize > MAX_BLOCK_SIZE) {
-        std::cerr << "Invalid request from peer " << peerSocket << " for piece " << pieceIndex 
+    // Validate request; only verified pieces are served
+    if (pieceIndex < 0 || pieceIndex >= torrentFile.numPieces || blockSize <= 0 || blockSize > MAX_BLOCK_SIZE ||
+        !havePieces.getAtomic(pieceIndex)) {
+        std::cerr << "Invalid request from peer " << peerId << " for piece " << pieceIndex 
                   << ", offset " << blockOffset << ", size " << blockSize << '\n';
         return;
     }
 
-    // Fetch the requested piece data
-    std::vector<uint8_t> pieceData;
-    if (!pieceStorage->getPieceBlock(pieceIndex, blockOffset, blockSize, pieceData)) {
+    // Serve from the piece buffer while it is still in memory (no copy). Pieces
+    // already written to disk are no longer held by PieceManager: those go
+    // from the page cache with sendfile where the event loop can, else they are read.
+    BlockView block = pieceStorage->getBlockView(pieceIndex, blockOffset, blockSize);
+#ifdef __linux__
+    if (!block) {
+        FileBlock fileBlock;
+        if (diskIO->getFileBlock(pieceIndex, blockOffset, blockSize, fileBlock)) {
+            conn->append_block(pieceIndex, blockOffset, std::move(fileBlock));
+            return;
+        }
+    }
+#endif
+    if (!block) {
+        auto blockData = std::make_shared<std::vector<uint8_t>>();
+        if (diskIO->readBlock(pieceIndex, blockOffset, blockSize, *blockData)) {
+            block.data = blockData->data();
+            block.size = blockData->size();
+            block.buffer = std::move(blockData);
+        }
+    }
+    if (!block) {
         std::cerr << "Error: Failed to retrieve requested block.\n";
         return;
-    } else {
-        std::cout << "Retrieved " << pieceData.size() << " bytes for piece " << pieceIndex << " (offset " << blockOffset << ").\n";
     }
 
-    // Construct the Piece message
-    std::vector<uint8_t> pieceMessage(9 + blockSize);  // 9 bytes header + block data
-    uint32_t netPiece = htonl(pieceIndex);
-    uint32_t netOffset = htonl(blockOffset);
-    
-    memcpy(pieceMessage.data(), &netPiece, 4);
-    memcpy(pieceMessage.data() + 4, &netOffset, 4);
-    memcpy(pieceMessage.data() + 8, pieceData.data(), blockSize);
-
-    // Add message to peer's queue
-    peers[peerSocket]->message_queue.push_back(pieceMessage);
-    
-    std::cout << "Queued response for peer " << peerSocket << " for piece " << pieceIndex 
-              << " (offset " << blockOffset << ", size " << blockSize << ").\n";
+    conn->append_block(pieceIndex, blockOffset, std::move(block));
 }
 
 
 
-void PeerWireProtocol::sendPiece(int peerSocket, int pieceIndex, int blockOffset, 
+void PeerWireProtocol::sendPiece(int peerId, int pieceIndex, int blockOffset, 
                                const std::vector<uint8_t>& blockData) {
     const size_t messageSize = 4 + 1 + 4 + 4 + blockData.size();
     std::vector<uint8_t> message(messageSize);
@@ -492,12 +1124,7 @@ void PeerWireProtocol::sendPiece(int peerSocket, int pieceIndex, int blockOffset
     
     memcpy(message.data() + 13, blockData.data(), blockData.size());
 
-    {
-        std::lock_guard<std::mutex> lock(peerMutex);
-        if (peers.find(peerSocket) != peers.end()) {
-            peers[peerSocket]->append_to_output(message);
-        }
-    }
+    if (auto conn = findPeer(peerId)) conn->append_to_output(std::move(message));
 }
 
 ////////////////////HERE//////////////////////////////////////////////////////////////////////////////
@@ -552,64 +1179,301 @@ void PeerWireProtocol::sendPiece(int peerSocket, int pieceIndex, int blockOffset
 //     }
 // }
 
-void PeerWireProtocol::handlePiece(int peerSocket, int pieceIndex, int blockOffset, const std::vector<uint8_t>& blockData) {
-    std::lock_guard<std::mutex> lock(peerMutex);
-
+void PeerWireProtocol::handlePiece(int peerId, int pieceIndex, int blockOffset, const std::vector<uint8_t>& blockData) {
     // Validate piece index
     if (pieceIndex < 0 || pieceIndex >= torrentFile.numPieces) {
-        std::cerr << "Error: Invalid piece index " << pieceIndex << " received from peer " << peerSocket << '\n';
+        std::cerr << "Error: Invalid piece index " << pieceIndex << " received from peer " << peerId << '\n';
+        return;
+    }
+    // Unrequested or cut short: dropped, and a request for it stays outstanding
+    if (!isExpectedBlock(peerId, pieceIndex, blockOffset, static_cast<int>(blockData.size()))) {
+        requestTracker.recordWaste(blockData.size());
+        return;
+    }
+
+    // In endgame the same block may be on its way from other peers too
+    for (int otherPeer : requestTracker.blockReceived(peerId, pieceIndex, blockOffset)) {
+        sendCancel(otherPeer, pieceIndex, blockOffset, static_cast<int>(blockData.size()));
+    }
+    if (havePieces.getAtomic(pieceIndex) || pieceStorage->hasBlock(pieceIndex, blockOffset)) {
+        requestTracker.recordWaste(blockData.size());
         return;
     }
 
-    // Store the received block
+    // Store the received block (PieceManager has its own lock; no shard lock is needed)
     bool success = pieceStorage->storePieceBlock(pieceIndex, blockOffset, blockData);
     if (!success) {
         std::cerr << "Error: Failed to store received piece block for piece " << pieceIndex << '\n';
+        requestTracker.recordWaste(blockData.size());
         return;
     }
+    blockStored(pieceIndex, blockOffset, blockData.size());
+}
 
-    std::cout << "Received piece " << pieceIndex << ", block " << blockOffset 
-              << " (" << blockData.size() << " bytes) from peer " << peerSocket << '\n';
+void PeerWireProtocol::blockStored(int pieceIndex, int blockOffset, size_t blockSize) {
+    // Write the block to its final location now so a crash doesn't lose it
+    BlockView block = pieceStorage->getBlockView(pieceIndex, blockOffset, static_cast<int>(blockSize));
+    if (block) diskIO->queueBlockWrite(pieceIndex, blockOffset, std::move(block));
 
-    // Check if we have received the full piece
-    if (pieceStorage->isPieceComplete(pieceIndex)) {
-        std::cout << "storePieceBlock: Piece " << pieceIndex << " is now complete!\n";
+    // Hand complete pieces to the hashing pool; network threads never hash
+    if (pieceStorage->isPieceComplete(pieceIndex) && verifier->submit(pieceIndex)) {
+        std::cout << "Piece " << pieceIndex << " is complete, queued for verification.\n";
+    }
+}
 
-        std::vector<uint8_t> fullPiece;
-        if (!pieceStorage->getFullPiece(pieceIndex, fullPiece) || fullPiece.empty()) {
-            std::cerr << "Error: Failed to retrieve full piece data for verification (Piece " << pieceIndex << ").\n";
-            return;
+bool PeerWireProtocol::verifyPiece(int pieceIndex) {
+    // Blocks were hashed as they arrived, so this is just finalize and compare
+    Sha1Digest digest;
+    if (!pieceStorage->finalizePieceHash(pieceIndex, digest)) {
+        std::cerr << "Error: Failed to finalize SHA-1 for piece " << pieceIndex << ".\n";
+        return false;
+    }
+
+    const std::string& expectedHash = torrentFile.pieces[pieceIndex];
+    if (expectedHash.size() != digest.size() || memcmp(digest.data(), expectedHash.data(), digest.size()) != 0) {
+        std::cerr << "Error: SHA-1 hash mismatch for piece " << pieceIndex << "!\n";
+        std::cerr << "Computed Hash: " << rawToHex(std::string(digest.begin(), digest.end())) << '\n';
+        std::cerr << "Expected Hash: " << rawToHex(expectedHash) << '\n';
+        return false;
+    }
+    return true;
+}
+
+void PeerWireProtocol::onPieceVerified(int pieceIndex, bool passed) {
+    if (!passed) {
+        // Free the piece so it can be downloaded again
+        pieceStorage->resetPiece(pieceIndex);
+        diskIO->queueReset(pieceIndex);
+        picker->pieceFailed(pieceIndex);
+        if (streaming) streaming->onPieceFailed(pieceIndex);
+        return;
+    }
+
+    // Mark piece as successfully downloaded
+    pieceStorage->markPieceAsDownloaded(pieceIndex);
+    picker->pieceVerified(pieceIndex);
+    havePieces.setAtomic(pieceIndex);
+    piecesNotNeeded.setAtomic(pieceIndex);
+    std::cout << "Piece " << pieceIndex << " successfully verified.\n";
+
+    diskIO->queueWrite(pieceIndex);
+    broadcastHave(pieceIndex);
+
+    if (streaming) {
+        streaming->onPieceVerified(pieceIndex);
+        pieceStream->notifyPieceVerified(pieceIndex);
+    }
+}
+
+void PeerWireProtocol::enableStreaming(int outputFd, const StreamingScheduler::Config& config) {
+    if (streaming) return;
+
+    // Keep log output out of the data stream
+    if (outputFd == 1) std::cout.rdbuf(std::cerr.rdbuf());
+
+    streaming = std::make_unique<StreamingScheduler>(torrentFile.numPieces, torrentFile.pieceLength,
+                                                     diskIO->getTotalSize(), config);
+    streaming->start();
+    pieceStream = std::make_unique<PieceStream>(outputFd, torrentFile.numPieces, torrentFile.pieceLength, havePieces,
+        [this](int pieceIndex, std::vector<uint8_t>& data) {
+            // Verified pieces are in memory until written, then on disk
+            PieceBuffer buffer = pieceStorage->getPieceBuffer(pieceIndex);
+            if (buffer) {
+                data.assign(buffer->begin(), buffer->begin() + pieceStorage->getPieceSize(pieceIndex));
+                return true;
+            }
+            return diskIO->readPiece(pieceIndex, data);
+        },
+        *streaming);
+
+    streamingThread = std::thread([this]() { streamingLoop(); });
+}
+
+void PeerWireProtocol::setFilePriority(size_t fileIndex, FilePriorities::Priority priority) {
+    if (fileIndex >= filePriorities->fileCount()) return;
+
+    if (!diskIO->setFileSkipped(fileIndex, priority == FilePriorities::SKIP)) {
+        std::cerr << "Warning: Failed to move boundary data for file " << fileIndex << ".\n";
+    }
+    for (int pieceIndex : filePriorities->setFilePriority(fileIndex, priority)) {
+        if (filePriorities->isPieceWanted(pieceIndex) && !havePieces.getAtomic(pieceIndex)) {
+            piecesNotNeeded.clearAtomic(pieceIndex);
+        } else {
+            piecesNotNeeded.setAtomic(pieceIndex);
         }
+        picker->setPiecePriority(pieceIndex, filePriorities->getPiecePriority(pieceIndex));
+    }
+}
 
-        std::cout << "Retrieved full piece " << pieceIndex << " (" << fullPiece.size() << " bytes) for verification.\n";
+FilePriorities::Priority PeerWireProtocol::getFilePriority(size_t fileIndex) const {
+    return filePriorities->getFilePriority(fileIndex);
+}
 
-        /////////////////////////// ONLY FOR TESTING //////////////////////////////////////////////////////////////////
-        // if (pieceIndex == 10 || pieceIndex == 20 || pieceIndex == 30) {
-        //     torrentFile.pieces[pieceIndex] = computeSHA1(fullPiece); // Override expected hash for test
-        // }
-        //////////////////////////////////////////////////////////////////////////////////////////////////////////////
+StreamingScheduler::Stats PeerWireProtocol::getStreamingStats() const {
+    return streaming ? streaming->getStats() : StreamingScheduler::Stats();
+}
 
-        // Compute SHA-1 hash and verify
-        std::string computedHash = computeSHA1(fullPiece);
-        std::string expectedHash = rawToHex(torrentFile.pieces[pieceIndex]);
-        // std::string expectedHash = torrentFile.pieces[pieceIndex];
+void PeerWireProtocol::scheduleStreamingRequests() {
+    // Over the memory budget no new pieces are assigned; the loop tries again
+    if (!streaming || memoryBudget.isThrottled()) return;
 
-        // Debugging: Print hashes
-        std::cout << "Computed Hash: " << computedHash << '\n';
-        std::cout << "Expected Hash: " << expectedHash << '\n';
+    std::vector<std::pair<int, int>> assignments;  // (peer, piece)
+    {
+        // Fastest peers pick first, so they get the earliest deadlines
+        std::vector<std::pair<double, std::shared_ptr<PeerConnection>>> candidates;  // (rate, peer)
+        for (auto& conn : allPeers()) {
+            if (!conn->choked_by_peer) {
+                candidates.emplace_back(pipeline.getPeerStats(conn->id).bytesPerSecond, conn);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+            [](const auto& a, const auto& b) {
+                return a.first > b.first;
+            });
 
-        // Validate hash
-        if (computedHash != expectedHash) {
-            std::cerr << "Error: SHA-1 hash mismatch for piece " << pieceIndex << "!\n";
-            return;
+        for (auto& [rate, conn] : candidates) {
+            PeerShard& shard = shardOf(conn->id);  // A BITFIELD may replace conn->bitfield
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            int pieceIndex = streaming->pickPiece(conn->id, conn->bitfield, piecesNotNeeded);
+            if (pieceIndex == StreamingScheduler::NO_PIECE) continue;
+            picker->markDownloading(pieceIndex, conn->id);
+            assignments.emplace_back(conn->id, pieceIndex);
         }
+    }
 
-        // Mark piece as successfully downloaded
-        pieceStorage->markPieceAsDownloaded(pieceIndex);
-        std::cout << "Piece " << pieceIndex << " successfully verified and stored.\n";
+    // sendRequest takes the shard lock itself
+    for (const auto& [peerId, pieceIndex] : assignments) {
+        requestMissingBlocks(peerId, pieceIndex);
     }
 }
 
+bool PeerWireProtocol::sleepUnlessStopping(std::chrono::milliseconds period) {
+    std::unique_lock<std::mutex> lock(stopMutex);
+    return !stopSignal.wait_for(lock, period, [this]() { return stopping; });
+}
+
+void PeerWireProtocol::streamingLoop() {
+    while (!pieceStream->isFinished()) {
+        scheduleStreamingRequests();
+        if (!sleepUnlessStopping(std::chrono::milliseconds(200))) return;
+    }
+
+    auto stats = streaming->getStats();
+    std::cout << "Streaming finished: " << pieceStream->bytesWritten() << " bytes, time to first byte "
+              << stats.timeToFirstByteMs << " ms, " << stats.deadlineMisses << " deadline misses, "
+              << stats.consumerStalls << " stalls.\n";
+}
+
+void PeerWireProtocol::resumeFromJournal() {
+    ResumeJournal::State state = journal->load([this](int pieceIndex) {
+        return pieceStorage->getBlockCount(pieceIndex);
+    });
+
+    for (size_t i = state.completePieces.findNextSet(); i < state.completePieces.size();
+         i = state.completePieces.findNextSet(i + 1)) {
+        havePieces.setAtomic(i);
+        piecesNotNeeded.setAtomic(i);
+        picker->pieceVerified(static_cast<int>(i));
+    }
+
+    int restoredBlocks = 0;
+    std::vector<uint8_t> blockData;
+    for (const auto& [pieceIndex, mask] : state.partialPieces) {
+        int pieceSize = pieceStorage->getPieceSize(pieceIndex);
+        for (size_t block = mask.findNextSet(); block < mask.size(); block = mask.findNextSet(block + 1)) {
+            int blockOffset = static_cast<int>(block) * MAX_BLOCK_SIZE;
+            int blockSize = std::min(MAX_BLOCK_SIZE, pieceSize - blockOffset);
+            if (diskIO->readBlock(pieceIndex, blockOffset, blockSize, blockData) &&
+                pieceStorage->storePieceBlock(pieceIndex, blockOffset, blockData)) {
+                ++restoredBlocks;
+            }
+        }
+        // All blocks were there: the incremental hash is complete, just verify
+        if (pieceStorage->isPieceComplete(pieceIndex)) {
+            verifier->submit(pieceIndex);
+        } else if (pieceStorage->isPieceAllocated(pieceIndex)) {
+            picker->markPartial(pieceIndex);
+        }
+    }
+
+    if (restoredBlocks > 0 || !state.completePieces.none()) {
+        std::cout << "Resumed " << state.completePieces.count() << " complete pieces and "
+                  << restoredBlocks << " blocks of " << state.partialPieces.size() << " partial pieces.\n";
+    }
+}
+
+int PeerWireProtocol::recheckPieces() {
+    // Read pieces in batches so the multi-buffer backend can hash a full set of lanes at once
+    const size_t batchSize = Sha1Engine::MULTI_BUFFER_LANES;
+    std::vector<std::vector<uint8_t>> buffers(batchSize);
+    std::vector<const uint8_t*> pointers(batchSize);
+    std::vector<size_t> lengths(batchSize);
+    std::vector<int> indices(batchSize);
+    std::vector<Sha1Digest> digests(batchSize);
+    int verified = 0;
+
+    for (int pieceIndex = 0; pieceIndex < torrentFile.numPieces;) {
+        size_t count = 0;
+        for (; count < batchSize && pieceIndex < torrentFile.numPieces; ++pieceIndex) {
+            if (havePieces.getAtomic(pieceIndex) || !diskIO->readPiece(pieceIndex, buffers[count])) continue;
+            pointers[count] = buffers[count].data();
+            lengths[count] = buffers[count].size();
+            indices[count] = pieceIndex;
+            ++count;
+        }
+        if (count == 0) continue;
+
+        Sha1Engine::hashMany(pointers.data(), lengths.data(), count, digests.data());
+        for (size_t i = 0; i < count; ++i) {
+            const std::string& expectedHash = torrentFile.pieces[indices[i]];
+            if (expectedHash.size() == digests[i].size() &&
+                memcmp(digests[i].data(), expectedHash.data(), digests[i].size()) == 0) {
+                havePieces.setAtomic(indices[i]);
+                piecesNotNeeded.setAtomic(indices[i]);
+                picker->pieceVerified(indices[i]);
+                ++verified;
+            }
+        }
+    }
+
+    std::cout << "Recheck: " << verified << " pieces already on disk ("
+              << Sha1Engine::backendName(Sha1Engine::multiBufferBackend()) << ").\n";
+    return verified;
+}
+
+void PeerWireProtocol::broadcastHave(int pieceIndex) {
+    std::vector<uint8_t> message(9);
+    uint32_t length = htonl(5);
+    memcpy(message.data(), &length, 4);
+    message[4] = 4;  // Have message ID
+    uint32_t netIndex = htonl(pieceIndex);
+    memcpy(message.data() + 5, &netIndex, 4);
+
+#ifdef __linux__
+    // Each shard queues it on its own loop thread, so the verifier never
+    // contends with peer I/O for the shard locks. The lock is only held to
+    // copy the peer list; with thousands of peers the messages go out a chunk
+    // per loop pass, and reads and writes run in between.
+    auto shared = std::make_shared<const std::vector<uint8_t>>(std::move(message));
+    for (auto& shard : shards) {
+        PeerShard* target = shard.get();
+        target->eventLoop->post([this, target, shared]() {
+            std::shared_ptr<const std::vector<std::shared_ptr<PeerConnection>>> peers;
+            {
+                std::lock_guard<std::mutex> lock(target->mutex);
+                peers = std::make_shared<const std::vector<std::shared_ptr<PeerConnection>>>(
+                    target->peers.begin(), target->peers.end());
+            }
+            broadcastOnShard(*target, shared, peers, 0);
+        });
+    }
+#else
+    for (auto& conn : allPeers()) {
+        conn->append_to_output(message);
+    }
+#endif
+}
+
 
 
 
@@ -618,30 +1482,31 @@ void PeerWireProtocol::manageChoking() {
     while (true) {
         std::this_thread::sleep_for(std::chrono::seconds(10));
         
-        std::lock_guard<std::mutex> lock(peerMutex);
         std::vector<std::shared_ptr<PeerConnection>> candidates;
         
-        // Collect interested peers
-        for (auto& pair : peers) {
-            auto& conn = pair.second;
-            if (conn->peer_interested && !conn->choked_by_us) {
+        // Collect interested peers, choked or not
+        for (auto& conn : allPeers()) {
+            if (conn->peer_interested) {
                 candidates.push_back(conn);
             }
         }
         
-        // Sort by download rate
+        // Sort by download rate, snubbed peers last
         std::sort(candidates.begin(), candidates.end(),
             [](const auto& a, const auto& b) {
+                if (a->snubbed != b->snubbed) return !a->snubbed;
                 return a->download_rate > b->download_rate;
             });
         
-        // Unchoke top 4 peers
-        int unchoked = 0;
+        // Unchoke the top 4 peers that aren't snubbed and choke the rest,
+        // except the optimistic unchoke
+        size_t unchoked = 0;
         for (auto& conn : candidates) {
-            if (unchoked >= 4) break;
-            if (conn->choked_by_us) {
-                conn->send_unchoke();
+            if (unchoked < 4 && !conn->snubbed) {
+                if (conn->choked_by_us) conn->send_unchoke();
                 unchoked++;
+            } else if (!conn->choked_by_us && conn->id != optimisticPeer.load()) {
+                conn->send_choke();
             }
         }
     }
@@ -654,25 +1519,36 @@ void PeerWireProtocol::optimisticUnchoke() {
     while (true) {
         std::this_thread::sleep_for(std::chrono::seconds(30));
         
-        std::lock_guard<std::mutex> lock(peerMutex);
-        std::vector<int> candidates;
+        std::vector<std::shared_ptr<PeerConnection>> candidates;
         
         // Find choked peers
-        for (auto& pair : peers) {
-            if (pair.second->choked_by_us) {
-                candidates.push_back(pair.first);
+        for (auto& conn : allPeers()) {
+            if (conn->choked_by_us) {
+                candidates.push_back(conn);
             }
         }
         
         if (!candidates.empty()) {
             std::uniform_int_distribution<> dist(0, candidates.size()-1);
-            int selected = candidates[dist(gen)];
-            peers[selected]->send_unchoke();
+            auto& chosen = candidates[dist(gen)];
+            optimisticPeer = chosen->id;  // The choker leaves it alone until the next one
+            chosen->send_unchoke();
         }
     }
 }
 
 void PeerWireProtocol::run() {
+    constexpr uint16_t LISTEN_PORT = 6881;
+
+#ifdef __linux__
+    // A listener per shard on the same port; the kernel spreads incoming
+    // connections across them, so each shard accepts its own peers
+    for (size_t i = 0; i < shards.size(); ++i) listenOnShard(i, LISTEN_PORT);
+
+    // Start choking management threads (request timeouts run on shard 0's loop)
+    std::thread([this]() { optimisticUnchoke(); }).detach();
+    manageChoking();
+#else
     int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (listenSocket < 0) {
         throw std::runtime_error("Listener socket creation failed");
@@ -681,18 +1557,19 @@ void PeerWireProtocol::run() {
     sockaddr_in serverAddr{};
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
-    serverAddr.sin_port = htons(6881);
+    serverAddr.sin_port = htons(LISTEN_PORT);
 
     if (bind(listenSocket, (sockaddr*)&serverAddr, sizeof(serverAddr))) {
         closeSocket(listenSocket);
         throw std::runtime_error("Bind failed");
     }
 
-    listen(listenSocket, 5);
+    listen(listenSocket, SOMAXCONN);
 
     // Start choking management threads
     std::thread([this]() { manageChoking(); }).detach();
     std::thread([this]() { optimisticUnchoke(); }).detach();
+    timeoutThread = std::thread([this]() { requestTimeoutLoop(); });
 
     while (true) {
         sockaddr_in clientAddr{};
@@ -703,111 +1580,371 @@ void PeerWireProtocol::run() {
         if (clientSocket < 0) continue;
 
         std::thread([this, clientSocket]() {
+            auto conn = makePeerConnection(clientSocket);
+            PeerHandle handle = registerPeer(conn, 0);
             try {
-                handleHandshake(clientSocket);
-                {
-                    std::lock_guard<std::mutex> lock(peerMutex);
-                    auto conn = std::make_shared<PeerConnection>();
-                    conn->socket = clientSocket;
-                    peers[clientSocket] = conn;
-                }
-                handlePeerInput(clientSocket);
+                handleHandshake(conn->id);
             } catch (...) {
-                closeSocket(clientSocket);
+                dropPeer(handle);  // Closes the socket
+                return;
             }
+            handlePeerInput(conn->id);
         }).detach();
     }
+#endif
+}
+
+#ifdef __linux__
+void PeerWireProtocol::startShard(size_t index) {
+    PeerShard& shard = *shards[index];
+    shard.eventLoop = std::make_unique<EventLoop>();
+    shard.eventLoop->runEvery(std::chrono::milliseconds(100), [this, &shard]() { resumePausedReaders(shard); });
+    shard.eventLoop->runEvery(std::chrono::milliseconds(20), [this, &shard]() { resumeThrottledWriters(shard); });
+    shard.eventLoop->runEvery(std::chrono::milliseconds(250), [this, &shard]() { expireConnects(shard); });
+    if (index == 0) {
+        // Endpoints come out of backoff over time
+        shard.eventLoop->runEvery(std::chrono::seconds(1), [this]() {
+            checkRequestTimeouts();
+            dialPeers();
+        });
+    }
+    shard.thread = std::thread([&shard]() { shard.eventLoop->run(); });
+
+    if (networkConfig.pinThreads) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+        if (pthread_setaffinity_np(shard.thread.native_handle(), sizeof(cpus), &cpus) != 0) {
+            std::cerr << "Could not pin network thread " << index << " to a core.\n";
+        }
+    }
+}
+
+void PeerWireProtocol::listenOnShard(size_t index, uint16_t port) {
+    int listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listenSocket < 0) {
+        throw std::runtime_error("Listener socket creation failed");
+    }
+    int one = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port = htons(port);
+
+    if (bind(listenSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) || listen(listenSocket, SOMAXCONN)) {
+        closeSocket(listenSocket);
+        throw std::runtime_error("Bind failed");
+    }
+
+    PeerShard& shard = *shards[index];
+    shard.listenSocket = listenSocket;
+    shard.eventLoop->add(listenSocket, [this, index](uint32_t) { acceptPeers(index); });
+}
+
+void PeerWireProtocol::acceptPeers(size_t index) {
+    // Edge-triggered: accept until the backlog is empty
+    while (true) {
+        // Non-blocking like dialed sockets: sendfile has no MSG_DONTWAIT
+        int clientSocket = accept4(shards[index]->listenSocket, nullptr, nullptr, SOCK_NONBLOCK);
+        if (clientSocket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+
+        // The handshake is read by the event loop like any other input
+        auto conn = makePeerConnection(clientSocket);
+        conn->awaiting_handshake = true;
+        watchPeer(clientSocket, registerPeer(conn, index));
+    }
+}
+
+void PeerWireProtocol::startConnect(const ConnectionManager::Endpoint& endpoint) {
+    sockaddr_in peerAddr{};
+    peerAddr.sin_family = AF_INET;
+    peerAddr.sin_port = htons(endpoint.port);
+    if (inet_pton(AF_INET, endpoint.ip.c_str(), &peerAddr.sin_addr) != 1) {
+        connections.onFailed(endpoint);
+        return;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        connections.onFailed(endpoint);
+        return;
+    }
+    if (connect(sock, (sockaddr*)&peerAddr, sizeof(peerAddr)) != 0 && errno != EINPROGRESS) {
+        closeSocket(sock);
+        connections.onFailed(endpoint);
+        return;
+    }
+
+    // Outbound peers go round robin across the shards; the socket turns
+    // writable once connected (or failed)
+    size_t index = nextShard.fetch_add(1) % shards.size();
+    PeerShard& shard = *shards[index];
+    auto deadline = ConnectionManager::Clock::now() + connections.getConfig().connectTimeout;
+    shard.eventLoop->post([this, &shard, index, sock, endpoint, deadline]() {
+        shard.connecting[sock] = {endpoint, deadline};
+        shard.eventLoop->add(sock, [this, index, sock](uint32_t events) {
+            if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) finishConnect(index, sock);
+        });
+    });
+}
+
+void PeerWireProtocol::finishConnect(size_t index, int sock) {
+    PeerShard& shard = *shards[index];
+    auto it = shard.connecting.find(sock);
+    if (it == shard.connecting.end()) return;
+    ConnectionManager::Endpoint endpoint = std::move(it->second.endpoint);
+    shard.connecting.erase(it);
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+        shard.eventLoop->remove(sock);
+        closeSocket(sock);
+        connections.onFailed(endpoint);
+        dialPeers();
+        return;
+    }
+    connections.onConnected(endpoint);
+
+    // Ours goes first; theirs is checked when it arrives, as for incoming peers
+    auto conn = makePeerConnection(sock);
+    conn->awaiting_handshake = true;
+    conn->handshake_sent = true;
+    PeerHandle handle = registerPeer(conn, index);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.dialed[conn->id] = endpoint;
+    }
+    watchPeer(sock, handle);  // Replaces the connect handler
+    conn->append_to_output(handshakeMessage());
+    sendBitfield(conn->id, havePieces);
+    dialPeers();
+}
+
+void PeerWireProtocol::expireConnects(PeerShard& shard) {
+    if (shard.connecting.empty()) return;
+    auto now = ConnectionManager::Clock::now();
+    bool expired = false;
+    for (auto it = shard.connecting.begin(); it != shard.connecting.end();) {
+        if (it->second.deadline > now) {
+            ++it;
+            continue;
+        }
+        shard.eventLoop->remove(it->first);
+        closeSocket(it->first);
+        connections.onTimedOut(it->second.endpoint, now);
+        it = shard.connecting.erase(it);
+        expired = true;
+    }
+    if (expired) dialPeers();
+}
+
+void PeerWireProtocol::watchPeer(int sock, PeerHandle handle) {
+    // No Nagle delay: output is already coalesced per loop pass, and flushes
+    // that take several calls hold back short packets themselves (OutputQueue)
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    shards[handle.shard]->eventLoop->add(sock, [this, handle](uint32_t events) {
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) readFromPeer(handle);
+        if (events & EPOLLOUT) flushToPeer(handle);
+    });
 }
 
+void PeerWireProtocol::readFromPeer(PeerHandle handle) {
+    auto conn = findPeer(handle);
+    if (!conn) return;
+    PeerShard& shard = *shards[handle.shard];
+
+    // Edge-triggered: read until the socket is empty, or no new event comes
+    size_t readThisTurn = 0;
+    while (true) {
+        // Stop reading while over the memory budget or the disk writer is
+        // behind; TCP flow control then pushes back on the peer until hashing
+        // and disk catch up
+        if (readingPaused(conn->id)) {
+            if (std::find(shard.pausedReaders.begin(), shard.pausedReaders.end(), handle) ==
+                shard.pausedReaders.end()) {
+                shard.pausedReaders.push_back(handle);
+            }
+            return;
+        }
+        if (readThisTurn >= MAX_READ_PER_EVENT) {
+            shard.eventLoop->post([this, handle]() { readFromPeer(handle); });
+            return;
+        }
+
+        // Straight into the connection's buffer, where messages are framed in
+        // place, or into the piece buffer while a block's payload is arriving
+        ssize_t received = conn->receive(MSG_DONTWAIT);
+        if (received < 0 && errno == EINTR) continue;
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (received <= 0) {
+            dropPeer(handle);
+            return;
+        }
+        readThisTurn += static_cast<size_t>(received);
+
+        if (conn->awaiting_handshake) {
+            if (conn->input_buffer.size() < 68) continue;
+            if (!acceptHandshake(*conn)) {
+                dropPeer(handle);
+                return;
+            }
+        }
+        if (!conn->process_input_buffer()) {
+            dropPeer(handle);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            conn->update_rate_counters(received, 0);
+        }
+    }
+}
+
+void PeerWireProtocol::flushToPeer(PeerHandle handle) {
+    auto conn = findPeer(handle);
+    if (!conn) return;
+
+    conn->flush_scheduled = false;  // Output queued from here on schedules another flush
+    bool throttled;
+    ssize_t sent = writeQueued(*conn, uploadLimiter, throttled);
+    if (sent < 0) {
+        dropPeer(handle);
+        return;
+    }
+    PeerShard& shard = *shards[handle.shard];
+    if (throttled) {
+        // Blocks wait for the upload limit; control messages queued meanwhile
+        // schedule their own flush
+        if (std::find(shard.throttledWriters.begin(), shard.throttledWriters.end(), handle) ==
+            shard.throttledWriters.end()) {
+            shard.throttledWriters.push_back(handle);
+        }
+    }
+    if (sent > 0) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        conn->update_rate_counters(0, sent);
+    }
+}
+
+void PeerWireProtocol::resumePausedReaders(PeerShard& shard) {
+    resumeHeldRequests();
+    // Checked per peer: over the memory budget some may be read again
+    if (shard.pausedReaders.empty() || diskIO->isBacklogged()) return;
+    std::vector<PeerHandle> handles;
+    handles.swap(shard.pausedReaders);
+    for (PeerHandle handle : handles) readFromPeer(handle);
+}
+
+void PeerWireProtocol::resumeThrottledWriters(PeerShard& shard) {
+    if (shard.throttledWriters.empty() || uploadLimiter.available() == 0) return;
+    std::vector<PeerHandle> handles;
+    handles.swap(shard.throttledWriters);
+    for (PeerHandle handle : handles) flushToPeer(handle);
+}
+
+void PeerWireProtocol::broadcastOnShard(PeerShard& shard, std::shared_ptr<const std::vector<uint8_t>> message,
+                                        std::shared_ptr<const std::vector<std::shared_ptr<PeerConnection>>> peers,
+                                        size_t from) {
+    // Peers dropped since the snapshot just queue it on a dead connection
+    size_t end = std::min(peers->size(), from + BROADCAST_CHUNK);
+    for (size_t i = from; i < end; ++i) (*peers)[i]->append_to_output(*message);
+    if (end < peers->size()) {
+        shard.eventLoop->post([this, &shard, message, peers, end]() {
+            broadcastOnShard(shard, message, peers, end);
+        });
+    }
+}
+#endif
+
 // Private helper methods
-void PeerWireProtocol::handlePeerInput(int sock) {
-    std::vector<uint8_t> buffer(4096);
+void PeerWireProtocol::handlePeerInput(int peerId) {
+    PeerHandle handle = handleOf(peerId);
+    auto conn = findPeer(handle);
+    if (!conn) return;
     while (true) {
-        ssize_t received = recv(sock, reinterpret_cast<char *>(buffer.data()), buffer.size(), 0);
-        if (received <= 0) break;
+        // Stop reading while over the memory budget or the disk writer is
+        // behind; TCP flow control then pushes back on the peer until hashing
+        // and disk catch up
+        while (readingPaused(peerId)) {
+            if (memoryBudget.isThrottled()) {
+                memoryBudget.waitForRoom(std::chrono::milliseconds(100));
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));  // The disk writer drains
+            }
+        }
 
+        // The input buffer belongs to this thread; handlers take the shard lock themselves
+        ssize_t received = conn->receive();
+        if (received <= 0) break;
+        if (!conn->process_input_buffer()) break;
         {
-            std::lock_guard<std::mutex> lock(peerMutex);
-            if (peers.find(sock) == peers.end()) continue;
-            
-            auto& conn = peers[sock];
-            conn->input_buffer.insert(conn->input_buffer.end(),
-                                    buffer.begin(),
-                                    buffer.begin() + received);
-            conn->process_input_buffer();
+            std::lock_guard<std::mutex> lock(shards[handle.shard]->mutex);
             conn->update_rate_counters(received, 0);
         }
     }
     
     // Cleanup on disconnect
-    std::lock_guard<std::mutex> lock(peerMutex);
-    closeSocket(sock);
-    peers.erase(sock);
+    dropPeer(handle);
 }
 
-void PeerWireProtocol::handlePeerOutput(int sock) {
+void PeerWireProtocol::handlePeerOutput(int peerId) {
+    PeerHandle handle = handleOf(peerId);
+    OutputQueue queue;  // Taken from the connection each round; blocks over the upload limit stay here
     while (true) {
-        std::vector<uint8_t> data;
+        auto conn = findPeer(handle);
+        if (!conn) break;
+        int sock = conn->socket;
+
         {
-            std::lock_guard<std::mutex> lock(peerMutex);
-            if (peers.find(sock) == peers.end()) break;
-            
-            auto& conn = peers[sock];
-            if (!conn->output_buffer.empty()) {
-                data.swap(conn->output_buffer);
-            }
+            std::lock_guard<std::mutex> lock(conn->buffer_mutex);
+            queue.splice(conn->output_queue);
         }
 
-        if (!data.empty()) {
-            ssize_t sent = send(sock, reinterpret_cast<char *>(data.data()), data.size(), 0);
-            if (sent <= 0) break;
-            
-            std::lock_guard<std::mutex> lock(peerMutex);
-            if (peers.find(sock) != peers.end()) {
-                peers[sock]->update_rate_counters(0, sent);
+        // Blocking socket: each gather write takes as much as it can, then the rest
+        size_t sentTotal = 0;
+        bool failed = false;
+        while (!queue.empty()) {
+            size_t attempted;
+            size_t bulkBefore = queue.bulkSize();
+            ssize_t sent = queue.writeTo(sock, 0, attempted, uploadLimiter.available());
+            uploadLimiter.consume(bulkBefore - queue.bulkSize());
+            if (attempted == 0) break;  // Throttled until the next round
+            if (sent <= 0) {
+                failed = true;
+                break;
             }
+            sentTotal += static_cast<size_t>(sent);
+        }
+        queue.uncork(sock);
+        if (failed) break;
+
+        if (sentTotal > 0) {
+            std::lock_guard<std::mutex> lock(shards[handle.shard]->mutex);
+            conn->update_rate_counters(0, sentTotal);
         }
         
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
     
     // Cleanup on disconnect
-    std::lock_guard<std::mutex> lock(peerMutex);
-    closeSocket(sock);
-    peers.erase(sock);
+    dropPeer(handle);
 }
 
 
 std::string PeerWireProtocol::computeSHA1(const std::vector<uint8_t>& data) {
-    EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
-    if (!mdctx) {
-        throw std::runtime_error("EVP_MD_CTX_new failed");
-    }
-
-    if (EVP_DigestInit_ex(mdctx, EVP_sha1(), nullptr) != 1) {
-        EVP_MD_CTX_free(mdctx);
-        throw std::runtime_error("EVP_DigestInit_ex failed");
-    }
-
-    if (EVP_DigestUpdate(mdctx, data.data(), data.size()) != 1) {
-        EVP_MD_CTX_free(mdctx);
-        throw std::runtime_error("EVP_DigestUpdate failed");
-    }
-
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    unsigned int hashLen = 0;
-    if (EVP_DigestFinal_ex(mdctx, hash, &hashLen) != 1) {
-        EVP_MD_CTX_free(mdctx);
-        throw std::runtime_error("EVP_DigestFinal_ex failed");
-    }
-
-    EVP_MD_CTX_free(mdctx);
+    Sha1Digest digest = Sha1Engine::hash(data);
 
     std::ostringstream oss;
-    for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
-        oss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    for (uint8_t byte : digest) {
+        oss << std::hex << std::setw(2) << std::setfill('0') << (int)byte;
     }
-
     return oss.str();
 }
 
@@ -1,13 +1,16 @@
 #include "../include/piece_manager.hpp"
+#include <algorithm>
 #include <cstring>  // for memset
 #include <iostream> // for debugging
 
-PieceManager::PieceManager(int numPieces, int pieceLength)
-    : numPieces(numPieces), pieceLength(pieceLength) {
+PieceManager::PieceManager(int numPieces, int pieceLength, int64_t totalLength, MemoryBudget* budget)
+    : numPieces(numPieces), pieceLength(pieceLength), totalLength(totalLength), budget(budget) {
     std::cout << "Initializing PieceManager: " << numPieces << " pieces, " << pieceLength << " bytes each.\n";
 }
 
 bool PieceManager::getPieceBlock(int pieceIndex, int blockOffset, int blockSize, std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(mutex);
+
     if (pieceIndex < 0 || pieceIndex >= numPieces) {
         std::cerr << "getPieceBlock: Invalid piece index " << pieceIndex << '\n';
         return false;
@@ -26,59 +29,168 @@ bool PieceManager::getPieceBlock(int pieceIndex, int blockOffset, int blockSize,
     }
 
     // Extract the block
-    data.assign(it->second.data.begin() + blockOffset, it->second.data.begin() + blockOffset + blockSize);
+    data.assign(it->second.data->begin() + blockOffset, it->second.data->begin() + blockOffset + blockSize);
     std::cout << "getPieceBlock: Successfully retrieved " << blockSize << " bytes for piece " 
               << pieceIndex << " (offset " << blockOffset << ")\n";
     return true;
 }
 
-
-bool PieceManager::storePieceBlock(int pieceIndex, int blockOffset, const std::vector<uint8_t>& data) {
+BlockView PieceManager::getBlockView(int pieceIndex, int blockOffset, int blockSize) {
     std::lock_guard<std::mutex> lock(mutex);
-    
+
+    if (blockOffset < 0 || blockSize <= 0 || blockOffset + blockSize > getPieceSize(pieceIndex)) {
+        std::cerr << "getBlockView: Invalid block range (offset=" << blockOffset
+                  << ", size=" << blockSize << ") for piece " << pieceIndex << '\n';
+        return {};
+    }
+
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end()) return {};
+
+    BlockView view;
+    view.buffer = it->second.data;
+    view.data = it->second.data->data() + blockOffset;
+    view.size = blockSize;
+    return view;
+}
+
+PieceManager::PieceData* PieceManager::pieceForBlock(int pieceIndex, int blockOffset, size_t blockSize,
+                                                   const char* caller) {
     if (pieceIndex < 0 || pieceIndex >= numPieces) {
-        std::cerr << "storePieceBlock: Invalid piece index " << pieceIndex << '\n';
-        return false;
+        std::cerr << caller << ": Invalid piece index " << pieceIndex << '\n';
+        return nullptr;
     }
     
-    if (blockOffset < 0 || blockOffset + data.size() > pieceLength) {
-        std::cerr << "storePieceBlock: Invalid block range (offset=" << blockOffset 
-                  << ", size=" << data.size() << ") for piece " << pieceIndex << '\n';
-        return false;
+    if (blockOffset < 0 || blockOffset % MAX_BLOCK_SIZE != 0 || blockSize == 0 ||
+        blockOffset + static_cast<int64_t>(blockSize) > getPieceSize(pieceIndex)) {
+        std::cerr << caller << ": Invalid block range (offset=" << blockOffset 
+                  << ", size=" << blockSize << ") for piece " << pieceIndex << '\n';
+        return nullptr;
     }
 
-    if (pieces.find(pieceIndex) == pieces.end()) {
-        std::cout << "storePieceBlock: Initializing storage for piece " << pieceIndex << '\n';
-        pieces[pieceIndex].data.resize(pieceLength, 0);
-        pieces[pieceIndex].receivedBlocks.resize(getBlockCount(pieceIndex), false);
-        pieces[pieceIndex].receivedBlockCount = 0;
+    auto it = pieces.find(pieceIndex);
+    if (it != pieces.end()) return &it->second;
+
+    std::cout << caller << ": Initializing storage for piece " << pieceIndex << '\n';
+    PieceData& piece = pieces[pieceIndex];
+    piece.data = std::make_shared<std::vector<uint8_t>>(pieceLength, 0);
+    piece.receivedBlocks.resize(getBlockCount(pieceIndex));
+    piece.reservedBlocks.resize(getBlockCount(pieceIndex));
+    piece.receivedBlockCount = 0;
+    piece.hashContext.reset();
+    piece.hashedBytes = 0;
+    piece.hashFinalized = false;
+    if (budget) budget->charge(MemoryBudget::PARTIAL_PIECES, pieceLength);
+    return &piece;
+}
+
+void PieceManager::markReceived(int pieceIndex, int blockIndex, PieceData& piece) {
+    piece.receivedBlocks.set(blockIndex);
+    piece.receivedBlockCount++;
+
+    // Hash while the block is still hot in cache
+    advanceHash(pieceIndex, piece);
+
+    // No per-block logging: this runs for every 16 KiB block on the receive path
+    // **Check if piece is fully received**
+    if (piece.receivedBlockCount == getBlockCount(pieceIndex)) {
+        std::cout << "storePieceBlock: Piece " << pieceIndex << " is now complete!\n";
+        completedPieces.insert(pieceIndex);
+        if (budget) budget->transfer(MemoryBudget::PARTIAL_PIECES, MemoryBudget::VERIFY_QUEUE, pieceLength);
+        piece.budgetCategory = MemoryBudget::VERIFY_QUEUE;
     }
+}
+
+bool PieceManager::storePieceBlock(int pieceIndex, int blockOffset, const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    PieceData* piece = pieceForBlock(pieceIndex, blockOffset, data.size(), "storePieceBlock");
+    if (!piece) return false;
     
     int blockIndex = blockOffset / MAX_BLOCK_SIZE;
 
-    if (pieces[pieceIndex].receivedBlocks[blockIndex]) {
+    if (piece->receivedBlocks[blockIndex] || piece->reservedBlocks[blockIndex]) {
         std::cerr << "storePieceBlock: Block " << blockIndex << " for piece " << pieceIndex 
                   << " is already received, skipping.\n";
         return false;
     }
 
-    std::memcpy(pieces[pieceIndex].data.data() + blockOffset, data.data(), data.size());
-    
-    pieces[pieceIndex].receivedBlocks[blockIndex] = true;
-    pieces[pieceIndex].receivedBlockCount++;
+    std::memcpy(piece->data->data() + blockOffset, data.data(), data.size());
+    markReceived(pieceIndex, blockIndex, *piece);
+    return true;
+}
 
-    std::cout << "storePieceBlock: Stored block " << blockIndex << " for piece " << pieceIndex 
-              << " (" << data.size() << " bytes)\n";
-    std::cout << "storePieceBlock: Piece " << pieceIndex << " now has " 
-              << pieces[pieceIndex].receivedBlockCount << "/" 
-              << getBlockCount(pieceIndex) << " blocks received.\n";
+BlockSlot PieceManager::reserveBlock(int pieceIndex, int blockOffset, int blockSize) {
+    std::lock_guard<std::mutex> lock(mutex);
 
-    // **Check if piece is fully received**
-    if (pieces[pieceIndex].receivedBlockCount == getBlockCount(pieceIndex)) {
-        std::cout << "storePieceBlock: Piece " << pieceIndex << " is now complete!\n";
-        completedPieces.insert(pieceIndex);
+    if (blockSize <= 0) return {};
+    PieceData* piece = pieceForBlock(pieceIndex, blockOffset, static_cast<size_t>(blockSize), "reserveBlock");
+    if (!piece) return {};
+
+    // An endgame duplicate may be arriving from another peer at the same time
+    int blockIndex = blockOffset / MAX_BLOCK_SIZE;
+    if (piece->receivedBlocks[blockIndex] || piece->reservedBlocks[blockIndex]) return {};
+    piece->reservedBlocks.set(blockIndex);
+
+    BlockSlot slot;
+    slot.buffer = piece->data;
+    slot.data = piece->data->data() + blockOffset;
+    slot.size = static_cast<size_t>(blockSize);
+    return slot;
+}
+
+bool PieceManager::commitBlock(int pieceIndex, int blockOffset, const BlockSlot& slot) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // The piece may have been reset (failed hash) while the block was arriving
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end() || it->second.data != slot.buffer) return false;
+    PieceData& piece = it->second;
+    size_t blockIndex = static_cast<size_t>(blockOffset / MAX_BLOCK_SIZE);
+    if (blockIndex >= piece.reservedBlocks.size() || !piece.reservedBlocks[blockIndex]) return false;
+
+    piece.reservedBlocks.clear(blockIndex);
+    markReceived(pieceIndex, static_cast<int>(blockIndex), piece);
+    return true;
+}
+
+void PieceManager::releaseBlock(int pieceIndex, int blockOffset, const BlockSlot& slot) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end() || it->second.data != slot.buffer) return;
+    size_t blockIndex = static_cast<size_t>(blockOffset / MAX_BLOCK_SIZE);
+    if (blockIndex < it->second.reservedBlocks.size()) it->second.reservedBlocks.clear(blockIndex);
+}
+
+// Feeds the next contiguous received blocks into the running hash. An
+// out-of-order block waits until the gap before it is filled.
+void PieceManager::advanceHash(int pieceIndex, PieceData& piece) {
+    if (piece.hashFinalized) return;
+
+    int pieceSize = getPieceSize(pieceIndex);
+    while (piece.hashedBytes < pieceSize && piece.receivedBlocks[piece.hashedBytes / MAX_BLOCK_SIZE]) {
+        int length = std::min(MAX_BLOCK_SIZE, pieceSize - piece.hashedBytes);
+        piece.hashContext.update(piece.data->data() + piece.hashedBytes, length);
+        piece.hashedBytes += length;
     }
+}
 
+bool PieceManager::finalizePieceHash(int pieceIndex, Sha1Digest& digest) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end() || it->second.hashFinalized) return false;
+
+    PieceData& piece = it->second;
+    if (piece.hashedBytes != getPieceSize(pieceIndex)) {
+        std::cerr << "finalizePieceHash: Piece " << pieceIndex << " is not fully hashed ("
+                  << piece.hashedBytes << "/" << getPieceSize(pieceIndex) << " bytes)\n";
+        return false;
+    }
+
+    digest = piece.hashContext.finalize();
+    piece.hashFinalized = true;
     return true;
 }
 
@@ -107,7 +219,7 @@ bool PieceManager::getFullPiece(int pieceIndex, std::vector<uint8_t>& data) {
         return false;
     }
 
-    data = pieces[pieceIndex].data;
+    data = *pieces[pieceIndex].data;
 
     if (data.empty()) {
         std::cerr << "❌ getFullPiece: Retrieved piece " << pieceIndex << " is empty!\n";
@@ -128,13 +240,76 @@ bool PieceManager:: markPieceAsDownloaded(int pieceIndex) {
     }
     
     pieces[pieceIndex].receivedBlockCount = getBlockCount(pieceIndex);
-    std::fill(pieces[pieceIndex].receivedBlocks.begin(), pieces[pieceIndex].receivedBlocks.end(), true);
+    pieces[pieceIndex].receivedBlocks.setAll();
+
+    // Verified data now waits for disk
+    if (budget && pieces[pieceIndex].budgetCategory != MemoryBudget::WRITE_CACHE) {
+        budget->transfer(pieces[pieceIndex].budgetCategory, MemoryBudget::WRITE_CACHE, pieceLength);
+    }
+    pieces[pieceIndex].budgetCategory = MemoryBudget::WRITE_CACHE;
 
     std::cout << "Marked piece " << pieceIndex << " as fully downloaded.\n";
     return true;
 }
 
 int PieceManager::getBlockCount(int pieceIndex) {
-    int lastPieceSize = (pieceIndex == numPieces - 1) ? (pieceLength % MAX_BLOCK_SIZE) : pieceLength;
-    return (lastPieceSize + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE;
+    return (getPieceSize(pieceIndex) + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE;
+}
+
+int PieceManager::getPieceSize(int pieceIndex) {
+    if (pieceIndex == numPieces - 1 && totalLength > 0) {
+        return static_cast<int>(totalLength - static_cast<int64_t>(pieceIndex) * pieceLength);
+    }
+    return pieceLength;
+}
+
+bool PieceManager::isPieceAllocated(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pieces.find(pieceIndex) != pieces.end();
+}
+
+Bitfield PieceManager::getReceivedBlocks(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pieces.find(pieceIndex);
+    return it == pieces.end() ? Bitfield() : it->second.receivedBlocks;
+}
+
+bool PieceManager::hasBlock(int pieceIndex, int blockOffset) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end() || blockOffset < 0) return false;
+    size_t blockIndex = static_cast<size_t>(blockOffset / MAX_BLOCK_SIZE);
+    return blockIndex < it->second.receivedBlocks.size() && it->second.receivedBlocks[blockIndex];
+}
+
+bool PieceManager::evictPiece(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end()) return false;
+
+    if (budget) budget->release(it->second.budgetCategory, pieceLength);
+    pieces.erase(it);
+    return true;
+}
+
+bool PieceManager::resetPiece(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end()) return false;
+
+    if (budget) budget->release(it->second.budgetCategory, pieceLength);
+    pieces.erase(it);
+    completedPieces.erase(pieceIndex);
+    std::cout << "resetPiece: Discarded piece " << pieceIndex << ", it will be downloaded again.\n";
+    return true;
+}
+
+PieceBuffer PieceManager::getPieceBuffer(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = pieces.find(pieceIndex);
+    if (it == pieces.end()) return nullptr;
+    return it->second.data;
 }
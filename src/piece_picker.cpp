@@ -0,0 +1,360 @@
+#include "../include/piece_picker.hpp"
+#include <algorithm>
+
+PiecePicker::PiecePicker(int numPieces, uint32_t seed)
+    : numPieces(numPieces), pieces(numPieces), buckets(NUM_PRIORITIES), rng(seed) {
+    // Everything starts wanted at availability 0, in random order
+    std::vector<int>& initial = buckets[DEFAULT_PRIORITY].emplace_back();
+    initial.resize(numPieces);
+    for (int pieceIndex = 0; pieceIndex < numPieces; ++pieceIndex) initial[pieceIndex] = pieceIndex;
+    std::shuffle(initial.begin(), initial.end(), rng);
+    for (int i = 0; i < numPieces; ++i) pieces[initial[i]].bucketPosition = i;
+    wantedCount = numPieces;
+}
+
+PiecePicker::SpeedClass PiecePicker::classify(double bytesPerSecond, int pieceLength) {
+    if (bytesPerSecond <= 0) return MEDIUM;
+    double pieceSeconds = pieceLength / bytesPerSecond;
+    if (pieceSeconds <= FAST_PIECE_SECONDS) return FAST;
+    return pieceSeconds > SLOW_PIECE_SECONDS ? SLOW : MEDIUM;
+}
+
+void PiecePicker::setInProgressLimit(size_t limit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    inProgressLimit = limit;
+}
+
+bool PiecePicker::atInProgressLimit() const {
+    return inProgressLimit > 0 && downloadingCount + partialPieces.size() >= inProgressLimit;
+}
+
+std::vector<int>& PiecePicker::bucketFor(int pieceIndex) {
+    auto& tier = buckets[pieces[pieceIndex].priority];
+    size_t count = static_cast<size_t>(pieces[pieceIndex].availability);
+    if (tier.size() <= count) tier.resize(count + 1);
+    return tier[count];
+}
+
+void PiecePicker::insertIntoBucket(int pieceIndex) {
+    std::vector<int>& bucket = bucketFor(pieceIndex);
+    bucket.push_back(pieceIndex);
+    pieces[pieceIndex].bucketPosition = static_cast<int>(bucket.size()) - 1;
+
+    // Swap into a random slot to keep the order within a tier random
+    size_t slot = rng() % bucket.size();
+    std::swap(bucket[slot], bucket.back());
+    pieces[bucket[slot]].bucketPosition = static_cast<int>(slot);
+    pieces[bucket.back()].bucketPosition = static_cast<int>(bucket.size()) - 1;
+    ++wantedCount;
+}
+
+void PiecePicker::removeFromBucket(int pieceIndex) {
+    std::vector<int>& bucket = bucketFor(pieceIndex);
+    int position = pieces[pieceIndex].bucketPosition;
+    int last = bucket.back();
+    bucket[position] = last;
+    pieces[last].bucketPosition = position;
+    bucket.pop_back();
+    pieces[pieceIndex].bucketPosition = -1;
+    --wantedCount;
+}
+
+bool PiecePicker::addPeer(const Bitfield& peerHas) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (peerHas.size() >= static_cast<size_t>(numPieces) && peerHas.hasAll()) {
+        ++seeds;
+        return true;
+    }
+
+    size_t limit = std::min(peerHas.size(), static_cast<size_t>(numPieces));
+    for (size_t i = peerHas.findNextSet(); i < limit; i = peerHas.findNextSet(i + 1)) {
+        int pieceIndex = static_cast<int>(i);
+        bool inBucket = pieces[pieceIndex].bucketPosition >= 0;
+        if (inBucket) removeFromBucket(pieceIndex);
+        ++pieces[pieceIndex].availability;
+        if (inBucket) insertIntoBucket(pieceIndex);
+    }
+    return false;
+}
+
+void PiecePicker::removePeer(const Bitfield& peerHas, bool countedAsSeed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (countedAsSeed) {
+        --seeds;
+        return;
+    }
+
+    size_t limit = std::min(peerHas.size(), static_cast<size_t>(numPieces));
+    for (size_t i = peerHas.findNextSet(); i < limit; i = peerHas.findNextSet(i + 1)) {
+        int pieceIndex = static_cast<int>(i);
+        if (pieces[pieceIndex].availability == 0) continue;
+        bool inBucket = pieces[pieceIndex].bucketPosition >= 0;
+        if (inBucket) removeFromBucket(pieceIndex);
+        --pieces[pieceIndex].availability;
+        if (inBucket) insertIntoBucket(pieceIndex);
+    }
+}
+
+void PiecePicker::addHave(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return;
+
+    bool inBucket = pieces[pieceIndex].bucketPosition >= 0;
+    if (inBucket) removeFromBucket(pieceIndex);
+    ++pieces[pieceIndex].availability;
+    if (inBucket) insertIntoBucket(pieceIndex);
+}
+
+int PiecePicker::getAvailability(int pieceIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return 0;
+    return pieces[pieceIndex].availability + seeds;
+}
+
+void PiecePicker::setPiecePriority(int pieceIndex, int priority) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return;
+    priority = std::clamp(priority, 0, NUM_PRIORITIES - 1);
+    if (pieces[pieceIndex].priority == priority) return;
+
+    bool inBucket = pieces[pieceIndex].bucketPosition >= 0;
+    if (inBucket) removeFromBucket(pieceIndex);
+    pieces[pieceIndex].priority = static_cast<uint8_t>(priority);
+    if (pieces[pieceIndex].state == WANTED && priority > 0) insertIntoBucket(pieceIndex);
+}
+
+int PiecePicker::getPiecePriority(int pieceIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return 0;
+    return pieces[pieceIndex].priority;
+}
+
+void PiecePicker::setDownloading(int pieceIndex, int peerId, SpeedClass speed) {
+    pieces[pieceIndex].state = DOWNLOADING;
+    pieces[pieceIndex].downloadingBy = peerId;
+    pieces[pieceIndex].speed = speed;
+    peerPieces[peerId].push_back(pieceIndex);
+    ++downloadingCount;
+    peakInProgress = std::max(peakInProgress, downloadingCount + partialPieces.size());
+}
+
+void PiecePicker::removePartial(int pieceIndex) {
+    auto it = std::find(partialPieces.begin(), partialPieces.end(), pieceIndex);
+    if (it == partialPieces.end()) return;
+    *it = partialPieces.back();
+    partialPieces.pop_back();
+}
+
+void PiecePicker::makeWanted(int pieceIndex) {
+    pieces[pieceIndex].state = WANTED;
+    if (pieces[pieceIndex].priority > 0 && pieces[pieceIndex].bucketPosition < 0) insertIntoBucket(pieceIndex);
+}
+
+int PiecePicker::pickPiece(int peerId, const Bitfield& peerHas, SpeedClass speed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // A slow peer works on one piece at a time
+    if (speed == SLOW && peerPieces.count(peerId)) return NO_PIECE;
+
+    // Finish what others started before starting something new; slow peers
+    // leave that to faster ones and only take it when nothing else is left
+    int pieceIndex = speed == SLOW ? NO_PIECE : pickPartial(peerId, peerHas, speed);
+    if (pieceIndex == NO_PIECE && !atInProgressLimit()) pieceIndex = pickFromBuckets(peerId, peerHas, speed);
+    if (pieceIndex == NO_PIECE && speed == SLOW) pieceIndex = pickPartial(peerId, peerHas, speed);
+    return pieceIndex;
+}
+
+int PiecePicker::pickPartial(int peerId, const Bitfield& peerHas, SpeedClass speed) {
+    for (int pieceIndex : partialPieces) {
+        if (pieces[pieceIndex].priority > 0 && static_cast<size_t>(pieceIndex) < peerHas.size() &&
+            peerHas[pieceIndex]) {
+            removePartial(pieceIndex);
+            setDownloading(pieceIndex, peerId, speed);
+            return pieceIndex;
+        }
+    }
+    return NO_PIECE;
+}
+
+int PiecePicker::pickFromBuckets(int peerId, const Bitfield& peerHas, SpeedClass speed) {
+    auto peerHasPiece = [&](int pieceIndex) {
+        return static_cast<size_t>(pieceIndex) < peerHas.size() && peerHas[pieceIndex];
+    };
+
+    // Pieces a non-seed peer has are counted in availability, so bucket 0 can be skipped
+    size_t firstBucket = peerHas.size() >= static_cast<size_t>(numPieces) && peerHas.hasAll() ? 0 : 1;
+    size_t probes = 0;
+    for (int priority = NUM_PRIORITIES - 1; priority > 0; --priority) {
+        auto& tier = buckets[priority];
+        for (size_t count = firstBucket; count < tier.size(); ++count) {
+            auto& bucket = tier[count];
+            if (bucket.empty()) continue;
+
+            size_t start = rng() % bucket.size();
+            for (size_t k = 0; k < bucket.size(); ++k) {
+                int pieceIndex = bucket[(start + k) % bucket.size()];
+                if (!peerHasPiece(pieceIndex)) {
+                    // A sparse peer behind large buckets it has nothing in: walk its bitfield instead
+                    if (++probes > MAX_BUCKET_PROBES) return pickFromPeerBitfield(peerId, peerHas, speed);
+                    continue;
+                }
+
+                removeFromBucket(pieceIndex);
+                setDownloading(pieceIndex, peerId, speed);
+                return pieceIndex;
+            }
+        }
+    }
+    return NO_PIECE;
+}
+
+int PiecePicker::pickFromPeerBitfield(int peerId, const Bitfield& peerHas, SpeedClass speed) {
+    size_t limit = std::min(peerHas.size(), static_cast<size_t>(numPieces));
+    if (limit == 0) return NO_PIECE;
+
+    // Walk from a random offset, wrapping once; stop after MAX_BITFIELD_SAMPLES pieces
+    // once something is found, so a peer with many pieces costs a bounded amount
+    int best = NO_PIECE;
+    size_t ties = 0;
+    size_t visited = 0;
+    size_t start = rng() % limit;
+    auto visit = [&](size_t i) {
+        const PieceEntry& entry = pieces[i];
+        ++visited;
+        if (entry.bucketPosition < 0) return;
+
+        if (best == NO_PIECE || entry.priority > pieces[best].priority ||
+            (entry.priority == pieces[best].priority && entry.availability < pieces[best].availability)) {
+            best = static_cast<int>(i);
+            ties = 1;
+        } else if (entry.priority == pieces[best].priority && entry.availability == pieces[best].availability &&
+                   rng() % ++ties == 0) {
+            best = static_cast<int>(i);  // Reservoir sampling keeps the choice among equals uniform
+        }
+    };
+    auto done = [&]() { return best != NO_PIECE && visited >= MAX_BITFIELD_SAMPLES; };
+
+    for (size_t i = peerHas.findNextSet(start); i < limit && !done(); i = peerHas.findNextSet(i + 1)) visit(i);
+    for (size_t i = peerHas.findNextSet(); i < start && !done(); i = peerHas.findNextSet(i + 1)) visit(i);
+
+    if (best != NO_PIECE) {
+        removeFromBucket(best);
+        setDownloading(best, peerId, speed);
+    }
+    return best;
+}
+
+std::vector<int> PiecePicker::joinablePieces(int peerId, const Bitfield& peerHas, SpeedClass speed) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Pieces of slower peers; at the in-progress limit also those of equally fast ones
+    bool full = atInProgressLimit();
+    std::vector<int> joinable;
+    for (const auto& [owner, owned] : peerPieces) {
+        if (owner == peerId) continue;
+        for (int pieceIndex : owned) {
+            if (static_cast<size_t>(pieceIndex) >= peerHas.size() || !peerHas[pieceIndex]) continue;
+            if (pieces[pieceIndex].speed < speed || (full && pieces[pieceIndex].speed == speed)) {
+                joinable.push_back(pieceIndex);
+            }
+        }
+    }
+    std::sort(joinable.begin(), joinable.end(),
+              [this](int a, int b) { return pieces[a].speed < pieces[b].speed; });
+    return joinable;
+}
+
+void PiecePicker::markDownloading(int pieceIndex, int peerId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return;
+    if (pieces[pieceIndex].state == HAVE || pieces[pieceIndex].state == DOWNLOADING) return;
+
+    if (pieces[pieceIndex].bucketPosition >= 0) removeFromBucket(pieceIndex);
+    if (pieces[pieceIndex].state == PARTIAL) removePartial(pieceIndex);
+    setDownloading(pieceIndex, peerId, MEDIUM);
+}
+
+void PiecePicker::markPartial(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces || pieces[pieceIndex].state != WANTED) return;
+
+    if (pieces[pieceIndex].bucketPosition >= 0) removeFromBucket(pieceIndex);
+    pieces[pieceIndex].state = PARTIAL;
+    partialPieces.push_back(pieceIndex);
+    peakInProgress = std::max(peakInProgress, downloadingCount + partialPieces.size());
+}
+
+void PiecePicker::stopDownloading(int pieceIndex) {
+    auto it = peerPieces.find(pieces[pieceIndex].downloadingBy);
+    if (it != peerPieces.end()) {
+        auto& owned = it->second;
+        owned.erase(std::remove(owned.begin(), owned.end(), pieceIndex), owned.end());
+        if (owned.empty()) peerPieces.erase(it);
+    }
+    pieces[pieceIndex].downloadingBy = -1;
+    --downloadingCount;
+}
+
+void PiecePicker::pieceVerified(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces || pieces[pieceIndex].state == HAVE) return;
+
+    if (pieces[pieceIndex].state == DOWNLOADING) stopDownloading(pieceIndex);
+    if (pieces[pieceIndex].state == PARTIAL) removePartial(pieceIndex);
+    if (pieces[pieceIndex].bucketPosition >= 0) removeFromBucket(pieceIndex);
+    pieces[pieceIndex].state = HAVE;
+    ++haveCount;
+}
+
+void PiecePicker::pieceFailed(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return;
+
+    if (pieces[pieceIndex].state == HAVE) --haveCount;
+    if (pieces[pieceIndex].state == DOWNLOADING) stopDownloading(pieceIndex);
+    if (pieces[pieceIndex].state == PARTIAL) removePartial(pieceIndex);
+    makeWanted(pieceIndex);
+}
+
+void PiecePicker::abortPiece(int pieceIndex, bool hasData) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces || pieces[pieceIndex].state != DOWNLOADING) return;
+
+    stopDownloading(pieceIndex);
+    if (hasData) {
+        pieces[pieceIndex].state = PARTIAL;
+        partialPieces.push_back(pieceIndex);
+    } else {
+        makeWanted(pieceIndex);
+    }
+}
+
+std::vector<int> PiecePicker::piecesDownloadingBy(int peerId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peerPieces.find(peerId);
+    return it == peerPieces.end() ? std::vector<int>() : it->second;
+}
+
+std::vector<int> PiecePicker::downloadingPieces() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> result;
+    result.reserve(downloadingCount);
+    for (const auto& [peerId, owned] : peerPieces) result.insert(result.end(), owned.begin(), owned.end());
+    return result;
+}
+
+bool PiecePicker::isDownloading(int pieceIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pieceIndex >= 0 && pieceIndex < numPieces && pieces[pieceIndex].state == DOWNLOADING;
+}
+
+PiecePicker::Stats PiecePicker::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats;
+    stats.wantedPieces = wantedCount;
+    stats.partialPieces = partialPieces.size();
+    stats.havePieces = haveCount;
+    stats.seeds = seeds;
+    stats.downloadingPieces = downloadingCount;
+    stats.inProgressLimit = inProgressLimit;
+    stats.peakInProgress = peakInProgress;
+    return stats;
+}
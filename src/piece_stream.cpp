@@ -0,0 +1,81 @@
+#include "../include/piece_stream.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <unistd.h>
+#endif
+
+PieceStream::PieceStream(int outputFd, int numPieces, int64_t pieceLength, const Bitfield& have,
+                         ReadPiece readPiece, StreamingScheduler& scheduler)
+    : outputFd(outputFd), numPieces(numPieces), pieceLength(pieceLength),
+      readPiece(std::move(readPiece)), scheduler(scheduler), available(have) {
+    available.resize(numPieces);
+#ifdef _WIN32
+    _setmode(outputFd, _O_BINARY);  // No newline translation on stdout
+#endif
+    writer = std::thread([this]() { run(); });
+}
+
+PieceStream::~PieceStream() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pieceAvailable.notify_all();
+    if (writer.joinable()) writer.join();
+}
+
+void PieceStream::notifyPieceVerified(int pieceIndex) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pieceIndex < 0 || pieceIndex >= numPieces) return;
+        available.set(pieceIndex);
+    }
+    pieceAvailable.notify_one();
+}
+
+bool PieceStream::writeAll(const uint8_t* data, size_t length) {
+    while (length > 0) {
+#ifdef _WIN32
+        int result = _write(outputFd, data, static_cast<unsigned int>(length));
+#else
+        ssize_t result = write(outputFd, data, length);
+#endif
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+        data += result;
+        length -= result;
+    }
+    return true;
+}
+
+void PieceStream::run() {
+    std::vector<uint8_t> data;
+    for (int pieceIndex = 0; pieceIndex < numPieces; ++pieceIndex) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!available[pieceIndex] && !stopping) scheduler.onConsumerStall();
+            pieceAvailable.wait(lock, [&]() { return stopping || available[pieceIndex]; });
+            if (stopping) return;
+        }
+
+        if (!readPiece(pieceIndex, data)) {
+            std::cerr << "PieceStream: Failed to read verified piece " << pieceIndex << ", stopping.\n";
+            break;
+        }
+        if (!writeAll(data.data(), data.size())) {
+            std::cerr << "PieceStream: Output closed (" << strerror(errno) << "), stopping.\n";
+            break;
+        }
+
+        if (written == 0) scheduler.onFirstByteDelivered();
+        written += data.size();
+        scheduler.setCursor(static_cast<int64_t>(pieceIndex + 1) * pieceLength);
+    }
+    finished = true;
+}
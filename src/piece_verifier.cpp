@@ -0,0 +1,80 @@
+#include "../include/piece_verifier.hpp"
+#include <algorithm>
+#include <iostream>
+
+// Room for every piece that can be in progress at once; a full queue only
+// makes submit() wait
+constexpr size_t MAX_QUEUED_PER_WORKER = 4096;
+
+PieceVerifier::PieceVerifier(size_t numPieces, size_t numThreads, HashCheck check, Completion onComplete)
+    : check(std::move(check)), onComplete(std::move(onComplete)), inFlight(numPieces) {
+    numThreads = std::max<size_t>(numThreads, 1);
+    std::cout << "Starting piece verifier with " << numThreads << " hashing threads.\n";
+    size_t capacity = std::min(std::max<size_t>(numPieces, 1), MAX_QUEUED_PER_WORKER);
+    for (size_t i = 0; i < numThreads; ++i) {
+        workers.push_back(std::make_unique<Worker>(capacity));
+    }
+    for (auto& worker : workers) {
+        Worker* target = worker.get();
+        target->thread = std::thread([this, target]() { workerLoop(*target); });
+    }
+}
+
+PieceVerifier::~PieceVerifier() {
+    stopping = true;
+    for (auto& worker : workers) worker->queue.close();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+    }
+}
+
+bool PieceVerifier::submit(int pieceIndex) {
+    if (stopping || pieceIndex < 0 || static_cast<size_t>(pieceIndex) >= inFlight.size()) return false;
+    if (!inFlight.setAtomic(pieceIndex)) return false;  // Already queued or being hashed
+
+    size_t start = nextWorker.fetch_add(1, std::memory_order_relaxed);
+    Worker* target = workers[start % workers.size()].get();
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker* candidate = workers[(start + i) % workers.size()].get();
+        if (candidate->queue.size() < target->queue.size()) target = candidate;
+    }
+    if (!target->queue.push(pieceIndex)) {
+        inFlight.clearAtomic(pieceIndex);  // Shutting down
+        return false;
+    }
+    return true;
+}
+
+size_t PieceVerifier::queuedCount() const {
+    size_t count = 0;
+    for (const auto& worker : workers) count += worker->queue.size();
+    return count;
+}
+
+size_t PieceVerifier::defaultThreadCount() {
+    // Leave the remaining cores for networking and disk
+    return std::max<size_t>(1, std::thread::hardware_concurrency() / 2);
+}
+
+void PieceVerifier::workerLoop(Worker& worker) {
+    int pieceIndex;
+    while (worker.queue.pop(pieceIndex)) {
+        if (stopping) return;
+
+        bool passed = false;
+        try {
+            passed = check(pieceIndex);
+        } catch (const std::exception& e) {
+            std::cerr << "PieceVerifier: hash check for piece " << pieceIndex << " failed: " << e.what() << '\n';
+        }
+        (passed ? passedCount : failedCount)++;
+
+        // A failed piece is freed for re-download by the completion handler,
+        // so it must be accepted again as soon as that happens
+        if (!passed) inFlight.clearAtomic(pieceIndex);
+
+        onComplete(pieceIndex, passed);
+
+        if (passed) inFlight.clearAtomic(pieceIndex);
+    }
+}
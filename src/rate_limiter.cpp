@@ -0,0 +1,36 @@
+#include "../include/rate_limiter.hpp"
+#include <algorithm>
+
+RateLimiter::RateLimiter(size_t bytesPerSecond, size_t burstBytes) : rate(0) {
+    setRate(bytesPerSecond, burstBytes);
+}
+
+void RateLimiter::setRate(size_t bytesPerSecond, size_t burstBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Never below MIN_BURST: a PIECE is only started once all of it is allowed
+    burstBytes = std::max(burstBytes == 0 ? bytesPerSecond / 10 : burstBytes, MIN_BURST);
+    rate.store(bytesPerSecond, std::memory_order_relaxed);
+    burst = static_cast<double>(burstBytes);
+    tokens = burst;  // Start full, so a new limit doesn't stall what is already queued
+    lastRefill = Clock::now();
+}
+
+void RateLimiter::refillLocked(Clock::time_point now) {
+    if (now <= lastRefill) return;
+    double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+    tokens = std::min(burst, tokens + elapsed * static_cast<double>(rate.load(std::memory_order_relaxed)));
+    lastRefill = now;
+}
+
+size_t RateLimiter::available(Clock::time_point now) {
+    if (getRate() == 0) return UNLIMITED;
+    std::lock_guard<std::mutex> lock(mutex);
+    refillLocked(now);
+    return tokens > 0 ? static_cast<size_t>(tokens) : 0;
+}
+
+void RateLimiter::consume(size_t bytes) {
+    if (getRate() == 0 || bytes == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    tokens -= static_cast<double>(bytes);
+}
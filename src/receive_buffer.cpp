@@ -0,0 +1,74 @@
+#include "../include/receive_buffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+#else
+    #include <arpa/inet.h>
+#endif
+
+ReceiveBuffer::ReceiveBuffer(size_t maxMessageLength) : maxLength(maxMessageLength) {}
+
+void ReceiveBuffer::setMaxMessageLength(size_t length) {
+    maxLength = length;
+}
+
+void ReceiveBuffer::makeRoom(size_t space) {
+    if (storage.size() - writePos >= space) return;
+
+    // Move the unread tail to the front, and grow only if that isn't enough.
+    // The tail is less than one message, so the buffer stays near
+    // maxLength + MIN_READ_SPACE.
+    size_t unread = size();
+    if (readPos > 0) {
+        if (unread > 0) memmove(storage.data(), storage.data() + readPos, unread);
+        readPos = 0;
+        writePos = unread;
+    }
+    if (storage.size() - writePos < space) storage.resize(writePos + space);
+}
+
+uint8_t* ReceiveBuffer::prepare(size_t& space) {
+    // Room for the rest of the current message in one go, so it never has to move twice
+    size_t wanted = MIN_READ_SPACE;
+    if (size() >= LENGTH_PREFIX) {
+        uint32_t length;
+        memcpy(&length, data(), 4);
+        size_t messageEnd = LENGTH_PREFIX + std::min<size_t>(ntohl(length), maxLength);
+        if (messageEnd > size()) wanted = std::max(wanted, messageEnd - size());
+    }
+    makeRoom(wanted);
+    space = storage.size() - writePos;
+    return storage.data() + writePos;
+}
+
+void ReceiveBuffer::commit(size_t bytes) {
+    writePos += bytes;
+}
+
+void ReceiveBuffer::append(const uint8_t* bytes, size_t length) {
+    makeRoom(length);
+    memcpy(storage.data() + writePos, bytes, length);
+    writePos += length;
+}
+
+void ReceiveBuffer::consume(size_t bytes) {
+    readPos += std::min(bytes, size());
+    if (readPos == writePos) readPos = writePos = 0;  // Empty: start over at the front for free
+}
+
+ReceiveBuffer::FrameStatus ReceiveBuffer::nextMessage(const uint8_t*& message, size_t& length) {
+    if (size() < LENGTH_PREFIX) return FRAME_INCOMPLETE;
+    uint32_t prefix;
+    memcpy(&prefix, data(), 4);
+    size_t messageLength = ntohl(prefix);
+    if (messageLength > maxLength) return FRAME_TOO_LONG;
+    if (size() < LENGTH_PREFIX + messageLength) return FRAME_INCOMPLETE;
+
+    message = data() + LENGTH_PREFIX;
+    length = messageLength;
+    // Only the positions move: the bytes stay put until the next prepare()
+    consume(LENGTH_PREFIX + messageLength);
+    return FRAME_READY;
+}
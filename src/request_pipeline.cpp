@@ -0,0 +1,83 @@
+#include "../include/request_pipeline.hpp"
+#include <algorithm>
+#include <cmath>
+
+RequestPipeline::RequestPipeline(const Config& config) : config(config) {}
+
+void RequestPipeline::onBlockReceived(int peerId, size_t bytes, Clock::duration latency, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    PeerState& peer = peers[peerId];
+    if (peer.blocksReceived++ == 0) peer.windowStart = now;
+
+    peer.minLatency = std::min(peer.minLatency, latency);
+    if (peer.blocksReceived == 1) {
+        peer.smoothedLatency = latency;
+        peer.latencyDeviation = latency / 2;
+    } else {
+        auto error = latency > peer.smoothedLatency ? latency - peer.smoothedLatency : peer.smoothedLatency - latency;
+        peer.latencyDeviation = (3 * peer.latencyDeviation + error) / 4;
+        peer.smoothedLatency = (7 * peer.smoothedLatency + latency) / 8;
+    }
+
+    peer.windowBytes += bytes;
+    auto elapsed = now - peer.windowStart;
+    if (elapsed >= config.rateWindow) {
+        double sample = peer.windowBytes / std::chrono::duration<double>(elapsed).count();
+        peer.bytesPerSecond = peer.bytesPerSecond == 0 ? sample : 0.7 * peer.bytesPerSecond + 0.3 * sample;
+        peer.windowBytes = 0;
+        peer.windowStart = now;
+    }
+}
+
+void RequestPipeline::onRttSample(int peerId, Clock::duration rtt) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peers[peerId].transportRtt = rtt;
+}
+
+void RequestPipeline::removePeer(int peerId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peers.erase(peerId);
+}
+
+RequestPipeline::Clock::duration RequestPipeline::roundTrip(const PeerState& peer) {
+    if (peer.transportRtt > Clock::duration::zero()) return peer.transportRtt;
+    return peer.minLatency == Clock::duration::max() ? Clock::duration::zero() : peer.minLatency;
+}
+
+int RequestPipeline::depthFor(const PeerState& peer) const {
+    if (peer.bytesPerSecond == 0) {
+        return std::clamp(config.initialDepth + peer.blocksReceived, config.minDepth, config.maxDepth);
+    }
+    double rttSeconds = std::chrono::duration<double>(roundTrip(peer)).count();
+    double bdpBlocks = peer.bytesPerSecond * rttSeconds / config.blockBytes;
+    double depth = std::ceil(bdpBlocks * config.headroom);
+    return static_cast<int>(std::clamp(depth, static_cast<double>(config.minDepth), static_cast<double>(config.maxDepth)));
+}
+
+int RequestPipeline::targetDepth(int peerId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peerId);
+    return it == peers.end() ? std::clamp(config.initialDepth, config.minDepth, config.maxDepth) : depthFor(it->second);
+}
+
+RequestPipeline::Clock::duration RequestPipeline::requestTimeout(int peerId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peerId);
+    if (it == peers.end() || it->second.blocksReceived == 0) return config.initialRequestTimeout;
+    Clock::duration timeout = it->second.smoothedLatency + 4 * it->second.latencyDeviation;
+    return std::clamp<Clock::duration>(timeout, config.minRequestTimeout, config.maxRequestTimeout);
+}
+
+RequestPipeline::PeerStats RequestPipeline::getPeerStats(int peerId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    PeerStats stats;
+    auto it = peers.find(peerId);
+    if (it == peers.end()) {
+        stats.depth = std::clamp(config.initialDepth, config.minDepth, config.maxDepth);
+        return stats;
+    }
+    stats.bytesPerSecond = it->second.bytesPerSecond;
+    stats.rttMs = std::chrono::duration<double, std::milli>(roundTrip(it->second)).count();
+    stats.depth = depthFor(it->second);
+    return stats;
+}
@@ -0,0 +1,210 @@
+#include "../include/request_tracker.hpp"
+#include <algorithm>
+
+std::vector<RequestTracker::Requester>::const_iterator RequestTracker::findRequester(const PendingBlock& block,
+                                                                                     int peerId) {
+    return std::find_if(block.peers.begin(), block.peers.end(),
+                        [peerId](const Requester& requester) { return requester.peerId == peerId; });
+}
+
+void RequestTracker::addRequest(int peerId, int pieceIndex, int blockOffset, int length, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t key = blockKey(pieceIndex, blockOffset);
+    PendingBlock& block = blocks[key];
+    if (findRequester(block, peerId) != block.peers.end()) return;
+
+    block.length = length;
+    block.peers.push_back({peerId, now});
+    if (block.peers.size() > 1) ++stats.duplicateRequests;
+    auto& keys = peerBlocks[peerId];
+    if (keys.empty()) peerActivity[peerId] = now;  // Waiting starts now
+    keys.push_back(key);
+}
+
+bool RequestTracker::isRequested(int pieceIndex, int blockOffset) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return blocks.count(blockKey(pieceIndex, blockOffset)) != 0;
+}
+
+bool RequestTracker::isRequestedFrom(int peerId, int pieceIndex, int blockOffset, int length) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blocks.find(blockKey(pieceIndex, blockOffset));
+    if (it == blocks.end() || it->second.length != length) return false;
+    return findRequester(it->second, peerId) != it->second.peers.end();
+}
+
+bool RequestTracker::requestLatency(int peerId, int pieceIndex, int blockOffset, Clock::duration& latency,
+                                    Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blocks.find(blockKey(pieceIndex, blockOffset));
+    if (it == blocks.end()) return false;
+    auto requester = findRequester(it->second, peerId);
+    if (requester == it->second.peers.end()) return false;
+    latency = now - requester->requestedAt;
+    return true;
+}
+
+void RequestTracker::eraseFromPeer(int peerId, uint64_t key) {
+    auto it = peerBlocks.find(peerId);
+    if (it == peerBlocks.end()) return;
+    auto& keys = it->second;
+    keys.erase(std::remove(keys.begin(), keys.end(), key), keys.end());
+    if (!keys.empty()) return;
+    peerBlocks.erase(it);
+    peerActivity.erase(peerId);
+}
+
+std::vector<int> RequestTracker::blockReceived(int peerId, int pieceIndex, int blockOffset, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> others;
+
+    // Any block counts as a sign of life, even one we no longer wanted
+    auto active = peerActivity.find(peerId);
+    if (active != peerActivity.end()) active->second = now;
+
+    uint64_t key = blockKey(pieceIndex, blockOffset);
+    auto it = blocks.find(key);
+    if (it == blocks.end()) return others;
+
+    for (const Requester& requester : it->second.peers) {
+        eraseFromPeer(requester.peerId, key);
+        if (requester.peerId != peerId) others.push_back(requester.peerId);
+    }
+    blocks.erase(it);
+    stats.cancelsSent += others.size();
+    return others;
+}
+
+void RequestTracker::recordWaste(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.duplicateBlocks;
+    stats.wastedBytes += bytes;
+}
+
+std::vector<RequestTracker::Block> RequestTracker::removePeer(int peerId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Block> orphaned;
+    auto it = peerBlocks.find(peerId);
+    if (it == peerBlocks.end()) return orphaned;
+
+    for (uint64_t key : it->second) {
+        auto blockIt = blocks.find(key);
+        if (blockIt == blocks.end()) continue;
+        auto& peers = blockIt->second.peers;
+        peers.erase(findRequester(blockIt->second, peerId));
+        if (!peers.empty()) continue;
+
+        orphaned.push_back({static_cast<int>(key >> 32), static_cast<int>(key & 0xffffffff), blockIt->second.length});
+        blocks.erase(blockIt);
+    }
+    peerBlocks.erase(it);
+    peerActivity.erase(peerId);
+    return orphaned;
+}
+
+std::vector<RequestTracker::ExpiredRequest> RequestTracker::expireRequests(
+        const std::function<Clock::duration(int)>& timeoutFor, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ExpiredRequest> expired;
+    std::unordered_map<int, Clock::duration> timeouts;  // One lookup per peer
+
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        uint64_t key = it->first;
+        auto& peers = it->second.peers;
+        for (auto requester = peers.begin(); requester != peers.end();) {
+            auto timeout = timeouts.try_emplace(requester->peerId, Clock::duration::zero());
+            if (timeout.second) timeout.first->second = timeoutFor(requester->peerId);
+            if (now - requester->requestedAt < timeout.first->second) {
+                ++requester;
+                continue;
+            }
+
+            Block block{static_cast<int>(key >> 32), static_cast<int>(key & 0xffffffff), it->second.length};
+            int peerId = requester->peerId;
+            requester = peers.erase(requester);
+            eraseFromPeer(peerId, key);
+            expired.push_back({peerId, block, peers.empty()});
+        }
+        it = peers.empty() ? blocks.erase(it) : std::next(it);
+    }
+    stats.timedOutRequests += expired.size();
+    return expired;
+}
+
+std::vector<int> RequestTracker::idlePeers(Clock::duration period, Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> idle;
+    for (const auto& [peerId, lastActivity] : peerActivity) {
+        if (now - lastActivity >= period) idle.push_back(peerId);
+    }
+    return idle;
+}
+
+bool RequestTracker::setEndgame(bool active) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (endgame == active) return false;
+    endgame = active;
+    return true;
+}
+
+bool RequestTracker::isEndgame() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return endgame;
+}
+
+std::vector<RequestTracker::Block> RequestTracker::pickDuplicates(int peerId, const Bitfield& peerHas) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Block> picked;
+    if (!endgame) return picked;
+
+    // Duplicates this peer already has outstanding count against its budget
+    size_t duplicates = 0;
+    auto own = peerBlocks.find(peerId);
+    if (own != peerBlocks.end()) {
+        for (uint64_t key : own->second) {
+            auto blockIt = blocks.find(key);
+            if (blockIt != blocks.end() && blockIt->second.peers.front().peerId != peerId) ++duplicates;
+        }
+    }
+    if (duplicates >= MAX_DUPLICATES_PER_PEER) return picked;
+
+    std::vector<std::pair<size_t, uint64_t>> candidates;  // (requesters, block)
+    for (const auto& [key, block] : blocks) {
+        size_t pieceIndex = static_cast<size_t>(key >> 32);
+        if (block.peers.size() >= MAX_PEERS_PER_BLOCK || pieceIndex >= peerHas.size() || !peerHas[pieceIndex]) continue;
+        if (findRequester(block, peerId) != block.peers.end()) continue;
+        candidates.emplace_back(block.peers.size(), key);
+    }
+
+    size_t count = std::min(candidates.size(), MAX_DUPLICATES_PER_PEER - duplicates);
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t key = candidates[i].second;
+        picked.push_back({static_cast<int>(key >> 32), static_cast<int>(key & 0xffffffff), blocks.at(key).length});
+    }
+    return picked;
+}
+
+size_t RequestTracker::outstandingCount(int peerId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peerBlocks.find(peerId);
+    return it == peerBlocks.end() ? 0 : it->second.size();
+}
+
+bool RequestTracker::owesBlockOf(int peerId, const std::function<bool(int)>& isPiece) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peerBlocks.find(peerId);
+    if (it == peerBlocks.end()) return false;
+    for (uint64_t key : it->second) {
+        if (isPiece(static_cast<int>(key >> 32))) return true;
+    }
+    return false;
+}
+
+RequestTracker::Stats RequestTracker::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result = stats;
+    result.endgame = endgame;
+    result.outstandingBlocks = blocks.size();
+    return result;
+}
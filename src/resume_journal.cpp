@@ -0,0 +1,147 @@
+#include "../include/resume_journal.hpp"
+#include <filesystem>
+#include <iostream>
+
+ResumeJournal::ResumeJournal(const std::string& path, const std::array<uint8_t, 20>& infoHash, int numPieces)
+    : path(path), infoHash(infoHash), numPieces(numPieces) {}
+
+ResumeJournal::~ResumeJournal() {
+    if (file) fclose(file);
+}
+
+ResumeJournal::Header ResumeJournal::header() const {
+    return {MAGIC, static_cast<uint32_t>(numPieces), infoHash};
+}
+
+bool ResumeJournal::readRecords(std::vector<Record>& records) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) return false;
+
+    Header expected = header();
+    Header found;
+    bool valid = fread(&found, sizeof(found), 1, in) == 1 && found.magic == expected.magic &&
+                 found.numPieces == expected.numPieces && found.infoHash == expected.infoHash;
+    if (!valid) {
+        std::cerr << "ResumeJournal: Ignoring invalid journal " << path << '\n';
+        fclose(in);
+        return false;
+    }
+
+    // A torn record at the end (crash mid-append) is simply dropped
+    Record record;
+    while (fread(&record, sizeof(record), 1, in) == 1) {
+        records.push_back(record);
+    }
+    fclose(in);
+    return true;
+}
+
+ResumeJournal::State ResumeJournal::load(const std::function<int(int)>& blockCount) {
+    State state;
+    state.completePieces.resize(numPieces);
+
+    std::vector<Record> records;
+    if (readRecords(records)) {
+        for (const Record& record : records) {
+            if (record.pieceIndex >= static_cast<uint32_t>(numPieces)) continue;
+            int pieceIndex = static_cast<int>(record.pieceIndex);
+
+            if (record.blockIndex == PIECE_COMPLETE) {
+                state.completePieces.set(pieceIndex);
+                state.partialPieces.erase(pieceIndex);
+            } else if (record.blockIndex == PIECE_RESET) {
+                state.completePieces.clear(pieceIndex);
+                state.partialPieces.erase(pieceIndex);
+            } else if (!state.completePieces[pieceIndex] &&
+                       record.blockIndex < static_cast<uint32_t>(blockCount(pieceIndex))) {
+                Bitfield& mask = state.partialPieces[pieceIndex];
+                if (mask.size() == 0) mask.resize(blockCount(pieceIndex));
+                mask.set(record.blockIndex);
+            }
+        }
+        std::cout << "ResumeJournal: Replayed " << records.size() << " records, "
+                  << state.completePieces.count() << " complete and "
+                  << state.partialPieces.size() << " partial pieces.\n";
+    }
+
+    compact(state);
+    return state;
+}
+
+bool ResumeJournal::compact(const State& state) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out) {
+        std::cerr << "ResumeJournal: Failed to create " << tempPath << '\n';
+        return openForAppend();
+    }
+
+    Header fileHeader = header();
+    bool ok = fwrite(&fileHeader, sizeof(fileHeader), 1, out) == 1;
+    for (size_t i = state.completePieces.findNextSet(); ok && i < state.completePieces.size();
+         i = state.completePieces.findNextSet(i + 1)) {
+        Record record = {static_cast<uint32_t>(i), PIECE_COMPLETE};
+        ok = fwrite(&record, sizeof(record), 1, out) == 1;
+    }
+    for (const auto& [pieceIndex, mask] : state.partialPieces) {
+        for (size_t i = mask.findNextSet(); ok && i < mask.size(); i = mask.findNextSet(i + 1)) {
+            Record record = {static_cast<uint32_t>(pieceIndex), static_cast<uint32_t>(i)};
+            ok = fwrite(&record, sizeof(record), 1, out) == 1;
+        }
+    }
+    ok = fclose(out) == 0 && ok;
+
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tempPath, path, ec);
+    if (!ok || ec) {
+        std::cerr << "ResumeJournal: Failed to compact " << path << '\n';
+        std::filesystem::remove(tempPath, ec);
+    }
+    return openForAppend() && ok;
+}
+
+// Caller holds the mutex
+bool ResumeJournal::openForAppend() {
+    file = fopen(path.c_str(), "ab");
+    if (!file) {
+        std::cerr << "ResumeJournal: Failed to open " << path << ", progress will not be saved.\n";
+        return false;
+    }
+    // A fresh file (compaction failed before writing anything) still needs its header
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        Header fileHeader = header();
+        fwrite(&fileHeader, sizeof(fileHeader), 1, file);
+    }
+    return true;
+}
+
+void ResumeJournal::append(uint32_t pieceIndex, uint32_t blockIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+
+    Record record = {pieceIndex, blockIndex};
+    // Flushed per record: it has to reach the kernel before we could crash
+    if (fwrite(&record, sizeof(record), 1, file) != 1 || fflush(file) != 0) {
+        std::cerr << "ResumeJournal: Write to " << path << " failed.\n";
+    }
+}
+
+void ResumeJournal::recordBlock(int pieceIndex, int blockIndex) {
+    append(static_cast<uint32_t>(pieceIndex), static_cast<uint32_t>(blockIndex));
+}
+
+void ResumeJournal::recordPieceComplete(int pieceIndex) {
+    append(static_cast<uint32_t>(pieceIndex), PIECE_COMPLETE);
+}
+
+void ResumeJournal::recordPieceReset(int pieceIndex) {
+    append(static_cast<uint32_t>(pieceIndex), PIECE_RESET);
+}
@@ -0,0 +1,457 @@
+#include "../include/sha1_engine.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SHA1_X86 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+// GCC/Clang need per-function target attributes to emit SHA/AVX2 code
+// without compiling the whole file for those CPUs; MSVC always allows it
+#if defined(__GNUC__) || defined(__clang__)
+    #define SHA1_TARGET(features) __attribute__((target(features)))
+#else
+    #define SHA1_TARGET(features)
+#endif
+
+namespace {
+
+constexpr uint32_t INITIAL_STATE[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+inline uint32_t loadBigEndian32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline void storeBigEndian32(uint8_t* p, uint32_t v) {
+    p[0] = uint8_t(v >> 24);
+    p[1] = uint8_t(v >> 16);
+    p[2] = uint8_t(v >> 8);
+    p[3] = uint8_t(v);
+}
+
+void compressScalar(uint32_t state[5], const uint8_t* data, size_t numBlocks) {
+    for (; numBlocks > 0; --numBlocks, data += 64) {
+        uint32_t w[80];
+        for (int t = 0; t < 16; ++t) w[t] = loadBigEndian32(data + 4 * t);
+        for (int t = 16; t < 80; ++t) w[t] = rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        auto round = [&](uint32_t f, uint32_t k, uint32_t wt) {
+            uint32_t temp = rotl(a, 5) + f + e + k + wt;
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = temp;
+        };
+        for (int t = 0; t < 20; ++t) round(d ^ (b & (c ^ d)), 0x5A827999, w[t]);
+        for (int t = 20; t < 40; ++t) round(b ^ c ^ d, 0x6ED9EBA1, w[t]);
+        for (int t = 40; t < 60; ++t) round((b & c) | (d & (b | c)), 0x8F1BBCDC, w[t]);
+        for (int t = 60; t < 80; ++t) round(b ^ c ^ d, 0xCA62C1D6, w[t]);
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef SHA1_X86
+
+struct CpuFeatures {
+    bool sha = false;
+    bool avx2 = false;
+};
+
+CpuFeatures detectCpuFeatures() {
+    CpuFeatures features;
+    unsigned int regs1[4] = {}, regs7[4] = {};
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return features;
+    __cpuidex(info, 1, 0);
+    std::memcpy(regs1, info, sizeof(info));
+    __cpuidex(info, 7, 0);
+    std::memcpy(regs7, info, sizeof(info));
+#else
+    if (__get_cpuid_max(0, nullptr) < 7) return features;
+    __get_cpuid(1, &regs1[0], &regs1[1], &regs1[2], &regs1[3]);
+    __get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3]);
+#endif
+    bool ssse3 = regs1[2] & (1u << 9);
+    bool sse41 = regs1[2] & (1u << 19);
+    bool osxsave = regs1[2] & (1u << 27);
+    bool avx = regs1[2] & (1u << 28);
+
+    features.sha = ssse3 && sse41 && (regs7[1] & (1u << 29));
+
+    // AVX2 also needs the OS to save YMM state
+    if (osxsave && avx) {
+#ifdef _MSC_VER
+        unsigned long long xcr0 = _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        unsigned long long xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+        features.avx2 = (xcr0 & 0x6) == 0x6 && (regs7[1] & (1u << 5));
+    }
+    return features;
+}
+
+const CpuFeatures& cpuFeatures() {
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
+
+// One group of four rounds with the message schedule for later groups
+// interleaved (Intel SHA extensions reference flow)
+#define SHA1_ROUNDS4(k, eIn, eOut, m0, m1, m2, m3)  \
+    eIn = _mm_sha1nexte_epu32(eIn, m0);             \
+    eOut = abcd;                                    \
+    m1 = _mm_sha1msg2_epu32(m1, m0);                \
+    abcd = _mm_sha1rnds4_epu32(abcd, eIn, k);       \
+    m3 = _mm_sha1msg1_epu32(m3, m0);                \
+    m2 = _mm_xor_si128(m2, m0);
+
+SHA1_TARGET("sha,sse4.1")
+void compressShaNi(uint32_t state[5], const uint8_t* data, size_t numBlocks) {
+    const __m128i byteSwapMask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    __m128i e1, msg0, msg1, msg2, msg3;
+
+    for (; numBlocks > 0; --numBlocks, data += 64) {
+        __m128i abcdSave = abcd;
+        __m128i e0Save = e0;
+
+        // Rounds 0-3
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), byteSwapMask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        // Rounds 4-7
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), byteSwapMask);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        // Rounds 8-11
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)), byteSwapMask);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        // Rounds 12-67
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)), byteSwapMask);
+        SHA1_ROUNDS4(0, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1_ROUNDS4(0, e0, e1, msg0, msg1, msg2, msg3)
+        SHA1_ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0)
+        SHA1_ROUNDS4(1, e0, e1, msg2, msg3, msg0, msg1)
+        SHA1_ROUNDS4(1, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1_ROUNDS4(1, e0, e1, msg0, msg1, msg2, msg3)
+        SHA1_ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0)
+        SHA1_ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1)
+        SHA1_ROUNDS4(2, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1_ROUNDS4(2, e0, e1, msg0, msg1, msg2, msg3)
+        SHA1_ROUNDS4(2, e1, e0, msg1, msg2, msg3, msg0)
+        SHA1_ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1)
+        SHA1_ROUNDS4(3, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1_ROUNDS4(3, e0, e1, msg0, msg1, msg2, msg3)
+
+        // Rounds 68-71
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        // Rounds 72-75
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        // Rounds 76-79
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+#undef SHA1_ROUNDS4
+
+SHA1_TARGET("avx2")
+inline __m256i rotl256(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+// Loads 32 bytes from each lane and transposes them so that out[t] holds
+// big-endian word t of every lane
+SHA1_TARGET("avx2")
+void loadTransposed(const uint8_t* const lanes[8], size_t offset, __m256i out[8]) {
+    const __m256i byteSwapMask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                                  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i r[8], t[8], u[8];
+    for (int i = 0; i < 8; ++i) {
+        r[i] = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[i] + offset)),
+                                   byteSwapMask);
+    }
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        out[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        out[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+// Hashes numBlocks 64-byte blocks of 8 independent buffers in parallel;
+// states[lane][word] are updated in place
+SHA1_TARGET("avx2")
+void compressAvx2x8(uint32_t states[8][5], const uint8_t* const lanes[8], size_t numBlocks) {
+    __m256i h[5];
+    for (int j = 0; j < 5; ++j) {
+        h[j] = _mm256_setr_epi32(states[0][j], states[1][j], states[2][j], states[3][j],
+                                 states[4][j], states[5][j], states[6][j], states[7][j]);
+    }
+    const __m256i k[4] = {_mm256_set1_epi32(0x5A827999), _mm256_set1_epi32(0x6ED9EBA1),
+                          _mm256_set1_epi32(static_cast<int>(0x8F1BBCDC)),
+                          _mm256_set1_epi32(static_cast<int>(0xCA62C1D6))};
+
+    for (size_t block = 0; block < numBlocks; ++block) {
+        __m256i w[16];
+        loadTransposed(lanes, block * 64, w);
+        loadTransposed(lanes, block * 64 + 32, w + 8);
+
+        __m256i a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int t = 0; t < 80; ++t) {
+            __m256i wt;
+            if (t < 16) {
+                wt = w[t];
+            } else {
+                wt = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                      _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+                wt = rotl256(wt, 1);
+                w[t & 15] = wt;
+            }
+
+            __m256i f;
+            if (t < 20) {
+                f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+            } else if (t < 40 || t >= 60) {
+                f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            } else {
+                f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            }
+
+            __m256i temp = _mm256_add_epi32(_mm256_add_epi32(rotl256(a, 5), f),
+                                            _mm256_add_epi32(_mm256_add_epi32(e, k[t / 20]), wt));
+            e = d;
+            d = c;
+            c = rotl256(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] = _mm256_add_epi32(h[0], a);
+        h[1] = _mm256_add_epi32(h[1], b);
+        h[2] = _mm256_add_epi32(h[2], c);
+        h[3] = _mm256_add_epi32(h[3], d);
+        h[4] = _mm256_add_epi32(h[4], e);
+    }
+
+    for (int j = 0; j < 5; ++j) {
+        alignas(32) uint32_t words[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words), h[j]);
+        for (int lane = 0; lane < 8; ++lane) states[lane][j] = words[lane];
+    }
+}
+
+#endif // SHA1_X86
+
+// -1 = auto-detect, otherwise a forced Sha1Engine::Backend
+std::atomic<int> forcedBackend{-1};
+
+} // namespace
+
+void Sha1Context::reset() {
+    std::memcpy(state, INITIAL_STATE, sizeof(state));
+    totalBytes = 0;
+    bufferLength = 0;
+}
+
+void Sha1Context::update(const uint8_t* data, size_t length) {
+    totalBytes += length;
+
+    if (bufferLength > 0) {
+        size_t take = std::min(length, sizeof(buffer) - bufferLength);
+        std::memcpy(buffer + bufferLength, data, take);
+        bufferLength += take;
+        data += take;
+        length -= take;
+        if (bufferLength < sizeof(buffer)) return;
+        Sha1Engine::compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+
+    // Whole blocks are hashed straight from the caller's buffer
+    size_t numBlocks = length / 64;
+    if (numBlocks > 0) {
+        Sha1Engine::compress(state, data, numBlocks);
+        data += numBlocks * 64;
+        length -= numBlocks * 64;
+    }
+
+    std::memcpy(buffer, data, length);
+    bufferLength = length;
+}
+
+Sha1Digest Sha1Context::finalize() {
+    uint64_t bitLength = totalBytes * 8;
+
+    // Padding: 0x80, zeros up to 56 mod 64, then the 64-bit big-endian length
+    buffer[bufferLength++] = 0x80;
+    if (bufferLength > 56) {
+        std::memset(buffer + bufferLength, 0, sizeof(buffer) - bufferLength);
+        Sha1Engine::compress(state, buffer, 1);
+        bufferLength = 0;
+    }
+    std::memset(buffer + bufferLength, 0, 56 - bufferLength);
+    storeBigEndian32(buffer + 56, static_cast<uint32_t>(bitLength >> 32));
+    storeBigEndian32(buffer + 60, static_cast<uint32_t>(bitLength));
+    Sha1Engine::compress(state, buffer, 1);
+    bufferLength = 0;
+
+    Sha1Digest digest;
+    for (int i = 0; i < 5; ++i) storeBigEndian32(digest.data() + 4 * i, state[i]);
+    return digest;
+}
+
+bool Sha1Engine::isSupported(Backend backend) {
+    switch (backend) {
+        case SCALAR:
+            return true;
+#ifdef SHA1_X86
+        case SHA_NI:
+            return cpuFeatures().sha;
+        case AVX2_MULTI_BUFFER:
+            return cpuFeatures().avx2;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char* Sha1Engine::backendName(Backend backend) {
+    switch (backend) {
+        case SCALAR: return "scalar";
+        case SHA_NI: return "sha-ni";
+        case AVX2_MULTI_BUFFER: return "avx2-x8";
+    }
+    return "unknown";
+}
+
+Sha1Engine::Backend Sha1Engine::singleBufferBackend() {
+    int forced = forcedBackend.load(std::memory_order_relaxed);
+    if (forced >= 0) return forced == SHA_NI ? SHA_NI : SCALAR;
+    return isSupported(SHA_NI) ? SHA_NI : SCALAR;
+}
+
+Sha1Engine::Backend Sha1Engine::multiBufferBackend() {
+    int forced = forcedBackend.load(std::memory_order_relaxed);
+    if (forced >= 0) return static_cast<Backend>(forced);
+    // SHA-NI on one buffer at a time beats 8 AVX2 lanes of plain SHA-1
+    if (isSupported(SHA_NI)) return SHA_NI;
+    if (isSupported(AVX2_MULTI_BUFFER)) return AVX2_MULTI_BUFFER;
+    return SCALAR;
+}
+
+void Sha1Engine::forceBackend(Backend backend) {
+    if (isSupported(backend)) forcedBackend = backend;
+}
+
+void Sha1Engine::resetBackend() {
+    forcedBackend = -1;
+}
+
+void Sha1Engine::compress(uint32_t state[5], const uint8_t* data, size_t numBlocks) {
+#ifdef SHA1_X86
+    if (singleBufferBackend() == SHA_NI) {
+        compressShaNi(state, data, numBlocks);
+        return;
+    }
+#endif
+    compressScalar(state, data, numBlocks);
+}
+
+Sha1Digest Sha1Engine::hash(const uint8_t* data, size_t length) {
+    Sha1Context context;
+    context.update(data, length);
+    return context.finalize();
+}
+
+void Sha1Engine::hashMany(const uint8_t* const* data, const size_t* lengths, size_t count, Sha1Digest* digests) {
+#ifdef SHA1_X86
+    if (multiBufferBackend() == AVX2_MULTI_BUFFER) {
+        for (size_t first = 0; first < count; first += MULTI_BUFFER_LANES) {
+            size_t used = std::min(MULTI_BUFFER_LANES, count - first);
+
+            // Unused lanes repeat lane 0; their results are discarded
+            const uint8_t* lanes[MULTI_BUFFER_LANES];
+            size_t commonBlocks = SIZE_MAX;
+            for (size_t lane = 0; lane < MULTI_BUFFER_LANES; ++lane) {
+                size_t source = first + (lane < used ? lane : 0);
+                lanes[lane] = data[source];
+                commonBlocks = std::min(commonBlocks, lengths[source] / 64);
+            }
+
+            uint32_t states[MULTI_BUFFER_LANES][5];
+            for (auto& laneState : states) std::memcpy(laneState, INITIAL_STATE, sizeof(INITIAL_STATE));
+            compressAvx2x8(states, lanes, commonBlocks);
+
+            // Each lane finishes its own tail (and any blocks past the common length)
+            for (size_t lane = 0; lane < used; ++lane) {
+                Sha1Context context;
+                std::memcpy(context.state, states[lane], sizeof(context.state));
+                context.totalBytes = commonBlocks * 64;
+                context.update(lanes[lane] + commonBlocks * 64, lengths[first + lane] - commonBlocks * 64);
+                digests[first + lane] = context.finalize();
+            }
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        digests[i] = hash(data[i], lengths[i]);
+    }
+}
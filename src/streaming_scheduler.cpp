@@ -0,0 +1,132 @@
+#include "../include/streaming_scheduler.hpp"
+#include <algorithm>
+
+StreamingScheduler::StreamingScheduler(int numPieces, int64_t pieceLength, int64_t totalLength, const Config& config)
+    : numPieces(numPieces), pieceLength(pieceLength), totalLength(totalLength), config(config),
+      deadlines(numPieces, Clock::time_point::max()) {
+    this->config.readAheadPieces = std::max(this->config.readAheadPieces, 1);
+    this->config.maxPeersPerPiece = std::max(this->config.maxPeersPerPiece, 1);
+    if (this->config.playbackBytesPerSecond <= 0) this->config.playbackBytesPerSecond = 1;
+}
+
+void StreamingScheduler::start(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    started = true;
+    startTime = now;
+    assignDeadlines(now);
+}
+
+void StreamingScheduler::setCursor(int64_t byteOffset, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    cursorByte = std::clamp<int64_t>(byteOffset, 0, totalLength);
+    cursorPiece = static_cast<int>(std::min<int64_t>(cursorByte / pieceLength, numPieces));
+    assignDeadlines(now);
+}
+
+int StreamingScheduler::getCursorPiece() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cursorPiece;
+}
+
+void StreamingScheduler::assignDeadlines(Clock::time_point now) {
+    int windowEnd = std::min(numPieces, cursorPiece + config.readAheadPieces);
+    for (int pieceIndex = cursorPiece; pieceIndex < windowEnd; ++pieceIndex) {
+        if (deadlines[pieceIndex] != Clock::time_point::max()) continue;
+
+        int64_t bytesAhead = std::max<int64_t>(0, static_cast<int64_t>(pieceIndex) * pieceLength - cursorByte);
+        auto timeAhead = std::chrono::duration<double>(bytesAhead / config.playbackBytesPerSecond);
+        deadlines[pieceIndex] = now + std::chrono::duration_cast<Clock::duration>(timeAhead);
+    }
+}
+
+int StreamingScheduler::pickPiece(int peerId, const Bitfield& peerHas, const Bitfield& have, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (peerPiece.count(peerId)) return NO_PIECE;
+
+    int windowEnd = std::min(numPieces, cursorPiece + config.readAheadPieces);
+    for (int pieceIndex = cursorPiece; pieceIndex < windowEnd; ++pieceIndex) {
+        if (have[pieceIndex] || pieceIndex >= static_cast<int>(peerHas.size()) || !peerHas[pieceIndex]) continue;
+
+        // Deadlines grow with the index, so the first free piece is the most urgent one
+        auto& assigned = piecePeers[pieceIndex];
+        if (!assigned.empty()) {
+            bool nearDeadline = deadlines[pieceIndex] != Clock::time_point::max() &&
+                                deadlines[pieceIndex] - now < config.duplicateWindow;
+            if (!nearDeadline || static_cast<int>(assigned.size()) >= config.maxPeersPerPiece) continue;
+            ++stats.duplicateAssignments;
+        }
+        assigned.push_back(peerId);
+        peerPiece[peerId] = pieceIndex;
+        return pieceIndex;
+    }
+    return NO_PIECE;
+}
+
+int StreamingScheduler::assignedPiece(int peerId) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peerPiece.find(peerId);
+    return it == peerPiece.end() ? NO_PIECE : it->second;
+}
+
+void StreamingScheduler::onPieceVerified(int pieceIndex, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return;
+
+    if (deadlines[pieceIndex] != Clock::time_point::max()) {
+        if (now > deadlines[pieceIndex]) {
+            ++stats.deadlineMisses;
+        } else {
+            ++stats.piecesOnTime;
+        }
+    }
+
+    releasePiece(pieceIndex);
+}
+
+void StreamingScheduler::onPieceFailed(int pieceIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    releasePiece(pieceIndex);
+}
+
+void StreamingScheduler::releasePiece(int pieceIndex) {
+    auto it = piecePeers.find(pieceIndex);
+    if (it != piecePeers.end()) {
+        for (int peerId : it->second) peerPiece.erase(peerId);
+        piecePeers.erase(it);
+    }
+}
+
+void StreamingScheduler::onPeerDisconnected(int peerId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peerPiece.find(peerId);
+    if (it == peerPiece.end()) return;
+
+    auto& assigned = piecePeers[it->second];
+    assigned.erase(std::remove(assigned.begin(), assigned.end(), peerId), assigned.end());
+    if (assigned.empty()) piecePeers.erase(it->second);
+    peerPiece.erase(it);
+}
+
+void StreamingScheduler::onFirstByteDelivered(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!started || stats.timeToFirstByteMs >= 0) return;
+    stats.timeToFirstByteMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
+}
+
+void StreamingScheduler::onConsumerStall() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++stats.consumerStalls;
+}
+
+StreamingScheduler::Clock::time_point StreamingScheduler::getDeadline(int pieceIndex) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pieceIndex < 0 || pieceIndex >= numPieces) return Clock::time_point::max();
+    return deadlines[pieceIndex];
+}
+
+StreamingScheduler::Stats StreamingScheduler::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result = stats;
+    result.cursorPiece = cursorPiece;
+    return result;
+}
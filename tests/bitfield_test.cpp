@@ -0,0 +1,102 @@
+#include "../include/bitfield.hpp"
+#include <iostream>
+#include <cassert>
+
+void testWireRoundTrip() {
+    // Pieces 0, 9 and 20 set; 21 pieces -> 3 bytes
+    std::vector<uint8_t> wire = {0x80, 0x40, 0x08};
+    Bitfield bitfield = Bitfield::fromWire(wire.data(), wire.size(), 21);
+
+    assert(bitfield.size() == 21);
+    assert(bitfield.count() == 3);
+    assert(bitfield[0] && bitfield[9] && bitfield[20]);
+    assert(!bitfield[1] && !bitfield[8]);
+    assert(bitfield.toWire() == wire);
+    std::cout << "Wire round trip test passed!" << std::endl;
+}
+
+void testSpareBitsIgnored() {
+    // Spare bits past numPieces must not be counted
+    std::vector<uint8_t> wire = {0xff, 0xff};
+    Bitfield bitfield = Bitfield::fromWire(wire.data(), wire.size(), 10);
+
+    assert(bitfield.count() == 10);
+    assert(bitfield.hasAll());
+    assert(bitfield.toWire() == std::vector<uint8_t>({0xff, 0xc0}));
+    std::cout << "Spare bits test passed!" << std::endl;
+}
+
+void testFindNext() {
+    Bitfield bitfield(1000);
+    bitfield.set(3);
+    bitfield.set(64);
+    bitfield.set(999);
+
+    assert(bitfield.findNextSet(0) == 3);
+    assert(bitfield.findNextSet(4) == 64);
+    assert(bitfield.findNextSet(65) == 999);
+    assert(bitfield.findNextSet(1000) == Bitfield::npos);
+    assert(bitfield.findNextClear(3) == 4);
+
+    Bitfield full(130, true);
+    assert(full.findNextClear(0) == Bitfield::npos);
+    full.clear(129);
+    assert(full.findNextClear(0) == 129);
+    std::cout << "Find next test passed!" << std::endl;
+}
+
+void testSetOperations() {
+    Bitfield peer(1000);
+    Bitfield ours(1000);
+    for (size_t i = 0; i < 1000; i += 2) peer.set(i);
+    for (size_t i = 0; i < 1000; i += 4) ours.set(i);
+
+    assert(Bitfield::intersects(peer, ours));
+    assert(Bitfield::anyAndNot(peer, ours));
+    assert(Bitfield::countAndNot(peer, ours) == 250);
+    assert(peer.findNextSetAndNot(ours, 0) == 2);
+    assert(peer.findNextSetAndNot(ours, 999) == Bitfield::npos);
+    assert(!Bitfield::anyAndNot(ours, peer));
+
+    Bitfield wanted = peer;
+    wanted.andNot(ours);
+    assert(wanted.count() == 250);
+    wanted &= ours;
+    assert(wanted.none());
+    std::cout << "Set operations test passed!" << std::endl;
+}
+
+void testHaveAllFastPath() {
+    Bitfield seed(5000, true);
+    Bitfield ours(5000);
+
+    assert(seed.hasAll());
+    assert(seed.count() == 5000);
+    assert(Bitfield::anyAndNot(seed, ours));
+    ours.setAll();
+    assert(!Bitfield::anyAndNot(seed, ours));
+    assert(Bitfield::countAndNot(seed, ours) == 0);
+    std::cout << "Have all test passed!" << std::endl;
+}
+
+void testAtomicUpdates() {
+    Bitfield ours(200);
+    assert(ours.setAtomic(150));
+    assert(!ours.setAtomic(150));
+    assert(ours.getAtomic(150));
+    assert(ours.clearAtomic(150));
+    assert(!ours.getAtomic(150));
+    std::cout << "Atomic updates test passed!" << std::endl;
+}
+
+int main() {
+    testWireRoundTrip();
+    testSpareBitsIgnored();
+    testFindNext();
+    testSetOperations();
+    testHaveAllFastPath();
+    testAtomicUpdates();
+
+    std::cout << "All bitfield tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "../include/concurrent_queue.hpp"
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+void testSpscRing() {
+    SpscRing<int> ring(5);
+    assert(ring.capacity() == 8 && ring.size() == 0);
+
+    // Fills up, refuses more, and keeps order across wraparound
+    int value;
+    assert(!ring.tryPop(value));
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 8; ++i) assert(ring.tryPush(round * 8 + i));
+        int extra = 99;
+        assert(!ring.tryPush(std::move(extra)) && extra == 99);
+        assert(ring.size() == 8);
+        for (int i = 0; i < 8; ++i) {
+            assert(ring.tryPop(value) && value == round * 8 + i);
+        }
+        assert(!ring.tryPop(value));
+    }
+    std::cout << "SPSC ring test passed!" << std::endl;
+}
+
+void testSpscThreads() {
+    // A small ring, so both sides keep blocking on each other
+    constexpr int COUNT = 200000;
+    SpscRing<int> ring(16);
+    std::thread producer([&]() {
+        for (int i = 0; i < COUNT; ++i) assert(ring.push(i));
+        ring.close();
+    });
+
+    int expected = 0;
+    int value;
+    while (ring.pop(value)) assert(value == expected++);
+    assert(expected == COUNT);
+    producer.join();
+    std::cout << "SPSC threads test passed!" << std::endl;
+}
+
+void testMpscQueue() {
+    MpscQueue<std::unique_ptr<int>> queue(4);
+    for (int i = 0; i < 4; ++i) assert(queue.tryPush(std::make_unique<int>(i)));
+    auto extra = std::make_unique<int>(99);
+    assert(!queue.tryPush(std::move(extra)) && extra && *extra == 99);
+
+    std::unique_ptr<int> value;
+    for (int i = 0; i < 4; ++i) assert(queue.tryPop(value) && *value == i);
+    assert(!queue.tryPop(value) && queue.size() == 0);
+
+    // Closed: pushes fail, pops drain what is left
+    assert(queue.push(std::make_unique<int>(7)));
+    queue.close();
+    assert(!queue.push(std::make_unique<int>(8)));
+    assert(queue.pop(value) && *value == 7);
+    assert(!queue.pop(value));
+    std::cout << "MPSC queue test passed!" << std::endl;
+}
+
+void testMpscThreads() {
+    // Every item arrives once, and each producer's items in order
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 100000;
+    MpscQueue<uint64_t> queue(64);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&queue, p]() {
+            for (uint64_t i = 0; i < PER_PRODUCER; ++i) assert(queue.push((uint64_t(p) << 32) | i));
+        });
+    }
+    std::thread closer([&]() {
+        for (auto& producer : producers) producer.join();
+        queue.close();
+    });
+
+    std::vector<uint64_t> next(PRODUCERS, 0);
+    uint64_t value;
+    size_t received = 0;
+    while (queue.pop(value)) {
+        size_t producer = value >> 32;
+        assert(producer < PRODUCERS && (value & 0xffffffff) == next[producer]);
+        ++next[producer];
+        ++received;
+    }
+    closer.join();
+    assert(received == PRODUCERS * PER_PRODUCER);
+    std::cout << "MPSC threads test passed!" << std::endl;
+}
+
+void testBlockedConsumerWakes() {
+    MpscQueue<int> queue(8);
+    std::thread consumer([&]() {
+        int value;
+        assert(queue.pop(value) && value == 42);
+        assert(!queue.pop(value));  // Woken by close
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    assert(queue.push(42));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.close();
+    consumer.join();
+    std::cout << "Blocked consumer wakes test passed!" << std::endl;
+}
+
+int main() {
+    testSpscRing();
+    testSpscThreads();
+    testMpscQueue();
+    testMpscThreads();
+    testBlockedConsumerWakes();
+    std::cout << "All concurrent queue tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "../include/connection_manager.hpp"
+#include <iostream>
+#include <cassert>
+
+using namespace std::chrono_literals;
+using Clock = ConnectionManager::Clock;
+
+void testPriorityAndHalfOpenLimit() {
+    ConnectionConfig config;
+    config.maxHalfOpen = 2;
+    ConnectionManager manager(config);
+    Clock::time_point now{};
+
+    manager.addPeer("10.0.0.1", 6881, ConnectionManager::DHT);
+    manager.addPeer("10.0.0.2", 6881, ConnectionManager::TRACKER);
+    manager.addPeer("10.0.0.3", 6881, ConnectionManager::DHT);
+    manager.addPeer("10.0.0.3", 6881, ConnectionManager::PEX);  // Known: keeps the better source
+
+    // Tracker peers first, then PEX over DHT
+    auto batch = manager.nextToConnect(now);
+    assert(batch.size() == 2);
+    assert(batch[0].ip == "10.0.0.2" && batch[1].ip == "10.0.0.3");
+    assert(manager.nextToConnect(now).empty());
+    assert(manager.getStats(now).halfOpen == 2);
+
+    // A finished attempt frees its slot
+    manager.onConnected(batch[0]);
+    batch = manager.nextToConnect(now);
+    assert(batch.size() == 1 && batch[0].ip == "10.0.0.1");
+
+    auto stats = manager.getStats(now);
+    assert(stats.known == 3 && stats.connected == 1 && stats.halfOpen == 2 && stats.attempts == 3);
+    std::cout << "Priority and half-open limit test passed!" << std::endl;
+}
+
+void testBackoff() {
+    ConnectionConfig config;
+    config.initialBackoff = 10s;
+    config.maxBackoff = 30s;
+    config.maxFailures = 4;
+    ConnectionManager manager(config);
+    Clock::time_point now{};
+    manager.addPeer("10.0.0.1", 6881, ConnectionManager::TRACKER);
+
+    // 10 s, then 20 s, then capped at 30 s
+    auto endpoint = manager.nextToConnect(now).at(0);
+    manager.onFailed(endpoint, now);
+    assert(manager.nextToConnect(now + 9s).empty());
+    endpoint = manager.nextToConnect(now += 10s).at(0);
+    manager.onTimedOut(endpoint, now);
+    assert(manager.nextToConnect(now + 19s).empty());
+    endpoint = manager.nextToConnect(now += 20s).at(0);
+    manager.onFailed(endpoint, now);
+    assert(manager.getStats(now).backingOff == 1);
+    assert(manager.nextToConnect(now + 29s).empty());
+
+    // The fourth failure in a row drops the endpoint
+    endpoint = manager.nextToConnect(now += 30s).at(0);
+    manager.onFailed(endpoint, now);
+    auto stats = manager.getStats(now);
+    assert(stats.known == 0 && stats.failures == 4 && stats.timeouts == 1);
+    assert(manager.nextToConnect(now + 1h).empty());
+    std::cout << "Backoff test passed!" << std::endl;
+}
+
+void testPastSuccessAndConnectionLimit() {
+    ConnectionConfig config;
+    config.maxConnections = 2;
+    config.initialBackoff = 5s;
+    ConnectionManager manager(config);
+    Clock::time_point now{};
+    manager.addPeer("10.0.0.1", 6881, ConnectionManager::DHT);
+    manager.addPeer("10.0.0.2", 6881, ConnectionManager::DHT);
+    manager.addPeer("10.0.0.3", 6881, ConnectionManager::DHT);
+
+    auto batch = manager.nextToConnect(now);
+    assert(batch.size() == 2);  // Connection limit, not the half-open one
+    manager.onConnected(batch[0]);
+    manager.onConnected(batch[1]);
+    assert(manager.nextToConnect(now).empty());
+
+    // A peer that connected before goes ahead of one never tried
+    manager.onDisconnected(batch[1], now);
+    batch = manager.nextToConnect(now);
+    assert(batch.size() == 1 && batch[0].ip == "10.0.0.3");
+    manager.onFailed(batch[0], now);
+    batch = manager.nextToConnect(now + 5s);
+    assert(batch.size() == 1 && batch[0].ip == "10.0.0.2");
+    std::cout << "Past success and connection limit test passed!" << std::endl;
+}
+
+int main() {
+    testPriorityAndHalfOpenLimit();
+    testBackoff();
+    testPastSuccessAndConnectionLimit();
+
+    std::cout << "All connection manager tests passed!" << std::endl;
+    return 0;
+}
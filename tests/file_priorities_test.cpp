@@ -0,0 +1,58 @@
+#include "../include/file_priorities.hpp"
+#include <iostream>
+#include <cassert>
+
+// Piece length 100: a [0,250) b [250,250) c [250,300) d [300,520)
+TorrentFile makeTorrent() {
+    TorrentFile torrent;
+    torrent.name = "archive";
+    torrent.pieceLength = 100;
+    torrent.numPieces = 6;
+    torrent.files = {{"a.bin", 250}, {"empty.txt", 0}, {"c.bin", 50}, {"d.bin", 220}};
+    return torrent;
+}
+
+void testDefaultsAndRanges() {
+    FilePriorities priorities(makeTorrent());
+    assert(priorities.fileCount() == 4);
+    assert(priorities.wantedPieces().count() == 6);
+    assert(priorities.filePieceRange(0) == std::make_pair(0, 2));
+    assert(priorities.filePieceRange(1).first > priorities.filePieceRange(1).second);
+    assert(priorities.filePieceRange(2) == std::make_pair(2, 2));
+    assert(priorities.filePieceRange(3) == std::make_pair(3, 5));
+    std::cout << "Default priorities test passed!" << std::endl;
+}
+
+void testSkipAndStraddlingPieces() {
+    FilePriorities priorities(makeTorrent());
+
+    // Skipping a.bin drops pieces 0 and 1; piece 2 is shared with c.bin
+    auto changed = priorities.setFilePriority(0, FilePriorities::SKIP);
+    assert((changed == std::vector<int>{0, 1}));
+    assert(!priorities.isPieceWanted(0) && !priorities.isPieceWanted(1));
+    assert(priorities.getPiecePriority(2) == FilePriorities::NORMAL);
+
+    // Now piece 2 only has skipped files left
+    changed = priorities.setFilePriority(2, FilePriorities::SKIP);
+    assert((changed == std::vector<int>{2}));
+    assert(priorities.wantedPieces().count() == 3);
+
+    // A piece takes the highest priority of its files
+    priorities.setFilePriority(2, FilePriorities::HIGH);
+    assert(priorities.getPiecePriority(2) == FilePriorities::HIGH);
+    priorities.setFilePriority(0, FilePriorities::LOW);
+    assert(priorities.getPiecePriority(1) == FilePriorities::LOW);
+    assert(priorities.getPiecePriority(2) == FilePriorities::HIGH);
+
+    // Setting the same priority again changes nothing
+    assert(priorities.setFilePriority(0, FilePriorities::LOW).empty());
+    std::cout << "Skipped and straddling pieces test passed!" << std::endl;
+}
+
+int main() {
+    testDefaultsAndRanges();
+    testSkipAndStraddlingPieces();
+
+    std::cout << "All file priority tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "../include/memory_budget.hpp"
+#include <iostream>
+#include <cassert>
+#include <thread>
+
+void testThrottleHysteresis() {
+    MemoryBudget budget(1000, 0.9);
+
+    // Reaching the limit is fine; going over it throttles
+    budget.charge(MemoryBudget::PARTIAL_PIECES, 1000);
+    assert(!budget.isThrottled());
+    assert(!budget.canAllocate(1));
+    budget.charge(MemoryBudget::PARTIAL_PIECES, 1);
+    assert(budget.isThrottled());
+    assert(budget.getStats().throttleEvents == 1);
+
+    // Back under the limit isn't enough: it has to drain to the resume mark
+    budget.release(MemoryBudget::PARTIAL_PIECES, 51);
+    assert(budget.isThrottled());
+    assert(!budget.canAllocate(0));
+    budget.release(MemoryBudget::PARTIAL_PIECES, 50);
+    assert(!budget.isThrottled());
+    assert(budget.canAllocate(100) && !budget.canAllocate(101));
+
+    // Going over again counts as a new event
+    budget.charge(MemoryBudget::WRITE_CACHE, 200);
+    assert(budget.isThrottled());
+    assert(budget.getStats().throttleEvents == 2);
+    assert(budget.getStats().peakUsed == 1100);
+
+    // Raising the limit lifts the throttle right away
+    budget.setLimit(2000);
+    assert(!budget.isThrottled());
+    std::cout << "Throttle hysteresis test passed!" << std::endl;
+}
+
+void testCategories() {
+    MemoryBudget budget(1000);
+    budget.charge(MemoryBudget::PARTIAL_PIECES, 300);
+
+    // A piece moving down the pipeline keeps its bytes charged
+    budget.transfer(MemoryBudget::PARTIAL_PIECES, MemoryBudget::VERIFY_QUEUE, 200);
+    budget.transfer(MemoryBudget::VERIFY_QUEUE, MemoryBudget::WRITE_CACHE, 50);
+    auto stats = budget.getStats();
+    assert(stats.used == 300);
+    assert(stats.partialPieces == 100 && stats.verifyQueue == 150 && stats.writeCache == 50);
+
+    // Neither moves nor releases more than the category holds
+    budget.transfer(MemoryBudget::WRITE_CACHE, MemoryBudget::VERIFY_QUEUE, 500);
+    budget.release(MemoryBudget::PARTIAL_PIECES, 500);
+    stats = budget.getStats();
+    assert(stats.used == 200);
+    assert(stats.partialPieces == 0 && stats.verifyQueue == 200 && stats.writeCache == 0);
+
+    budget.release(MemoryBudget::VERIFY_QUEUE, 200);
+    assert(budget.getStats().used == 0);
+    std::cout << "Categories test passed!" << std::endl;
+}
+
+void testWaitForRoom() {
+    MemoryBudget budget(1000, 0.5);
+    budget.charge(MemoryBudget::VERIFY_QUEUE, 1200);
+    assert(!budget.waitForRoom(std::chrono::milliseconds(10)));
+
+    // Woken once usage drops to the resume mark
+    std::thread releaser([&budget]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        budget.release(MemoryBudget::VERIFY_QUEUE, 700);
+    });
+    assert(budget.waitForRoom(std::chrono::seconds(5)));
+    releaser.join();
+    assert(budget.getStats().used == 500);
+    std::cout << "Wait for room test passed!" << std::endl;
+}
+
+void testInProgressLimit() {
+    // Resume mark 900; a quarter of it (225) is left for the verify queue and write cache
+    MemoryBudget budget(1000, 0.9);
+    assert(budget.inProgressLimit(100) == 6);
+
+    // Floored at MIN_PIECES_IN_PROGRESS while those still fit under the resume mark...
+    assert(budget.inProgressLimit(200) == MIN_PIECES_IN_PROGRESS);
+    // ...and at what fits when fewer do
+    assert(budget.inProgressLimit(300) == 3);
+    // Never below one piece
+    assert(budget.inProgressLimit(2000) == 1);
+    assert(budget.inProgressLimit(0) == MIN_PIECES_IN_PROGRESS);
+
+    // Follows the limit
+    budget.setLimit(10000);
+    assert(budget.inProgressLimit(100) == 67);
+    std::cout << "In-progress limit test passed!" << std::endl;
+}
+
+int main() {
+    testThrottleHysteresis();
+    testCategories();
+    testWaitForRoom();
+    testInProgressLimit();
+
+    std::cout << "All memory budget tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,384 @@
+#include "../include/output_queue.hpp"
+#include <iostream>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+std::vector<uint8_t> pattern(size_t size, uint8_t seed) {
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; ++i) bytes[i] = static_cast<uint8_t>(seed + i * 13);
+    return bytes;
+}
+
+BlockView viewOf(const std::shared_ptr<std::vector<uint8_t>>& buffer) {
+    BlockView view;
+    view.buffer = buffer;
+    view.data = buffer->data();
+    view.size = buffer->size();
+    return view;
+}
+
+// Reads whatever the socket has without blocking
+void drainInto(int sock, std::vector<uint8_t>& out, size_t limit = SIZE_MAX) {
+    uint8_t chunk[4096];
+    while (limit > 0) {
+        ssize_t got = recv(sock, chunk, std::min(sizeof(chunk), limit), MSG_DONTWAIT);
+        if (got <= 0) return;
+        out.insert(out.end(), chunk, chunk + got);
+        limit -= static_cast<size_t>(got);
+    }
+}
+
+void testOneGatherWrite() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+    // Control messages (coalesced into one buffer) ahead of the referenced
+    // block, all in one call
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(16384, 5));
+    OutputQueue queue;
+    queue.append({0, 0, 0, 1, 1});
+    queue.appendBlock(pattern(13, 1), viewOf(block));
+    queue.append({0, 0, 0, 0});
+    assert(queue.segmentCount() == 2 && queue.size() == 5 + 13 + 16384 + 4);
+    assert(block.use_count() == 2);  // Pinned, not copied
+
+    std::vector<uint8_t> expected = {0, 0, 0, 1, 1, 0, 0, 0, 0};
+    auto header = pattern(13, 1);
+    expected.insert(expected.end(), header.begin(), header.end());
+    expected.insert(expected.end(), block->begin(), block->end());
+
+    size_t attempted;
+    assert(queue.writeTo(sockets[0], 0, attempted) == static_cast<ssize_t>(expected.size()));
+    assert(attempted == expected.size() && queue.empty() && queue.size() == 0);
+    assert(block.use_count() == 1);  // Released once sent
+
+    std::vector<uint8_t> received;
+    drainInto(sockets[1], received);
+    assert(received == expected);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "One gather write test passed!" << std::endl;
+}
+
+void testBatchLimit() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+    // Small blocks: a header buffer and a block buffer each
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(8, 0));
+    OutputQueue queue;
+    size_t blocks = OutputQueue::MAX_BUFFERS + 10;
+    for (size_t i = 0; i < blocks; ++i) queue.appendBlock(pattern(13, static_cast<uint8_t>(i)), viewOf(block));
+
+    // No more than MAX_BUFFERS buffers per call
+    size_t attempted;
+    size_t calls = 0;
+    while (!queue.empty()) {
+        assert(queue.writeTo(sockets[0], 0, attempted) == static_cast<ssize_t>(attempted));
+        assert(attempted <= OutputQueue::MAX_BUFFERS / 2 * 21);
+        ++calls;
+    }
+    assert(calls == 3);
+
+    std::vector<uint8_t> received;
+    drainInto(sockets[1], received);
+    assert(received.size() == blocks * 21);
+    for (size_t i = 0; i < blocks; ++i) assert(received[i * 21] == static_cast<uint8_t>(i));
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "Batch limit test passed!" << std::endl;
+}
+
+void testPartialWrites() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    int small = 4096;
+    setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+
+    // Blocks and large control messages, written into a socket that only
+    // takes a little at a time, so writes stop inside headers, blocks and messages
+    OutputQueue queue;
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> pieces;
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> blocks;
+    for (int i = 0; i < 40; ++i) {
+        auto message = pattern(100 + i * 37, static_cast<uint8_t>(i));
+        expected.insert(expected.end(), message.begin(), message.end());
+        queue.append(message);
+
+        blocks.push_back(std::make_shared<std::vector<uint8_t>>(pattern(1000 + 997 * i, static_cast<uint8_t>(i * 3))));
+        auto header = pattern(13, static_cast<uint8_t>(i + 100));
+        pieces.insert(pieces.end(), header.begin(), header.end());
+        pieces.insert(pieces.end(), blocks.back()->begin(), blocks.back()->end());
+        queue.appendBlock(header, viewOf(blocks.back()));
+    }
+    expected.insert(expected.end(), pieces.begin(), pieces.end());  // Control first
+    assert(queue.size() == expected.size());
+
+    std::vector<uint8_t> received;
+    size_t written = 0;
+    size_t shortWrites = 0;
+    while (!queue.empty()) {
+        size_t attempted;
+        ssize_t sent = queue.writeTo(sockets[0], MSG_DONTWAIT, attempted);
+        if (sent < 0) {
+            assert(errno == EAGAIN || errno == EWOULDBLOCK);
+        } else {
+            written += static_cast<size_t>(sent);
+            if (static_cast<size_t>(sent) < attempted) ++shortWrites;
+        }
+        // Byte-exact accounting after every write
+        assert(queue.size() == expected.size() - written);
+        drainInto(sockets[1], received, 3001);
+    }
+    drainInto(sockets[1], received);
+    assert(shortWrites > 0);
+    assert(received == expected);
+    for (const auto& block : blocks) assert(block.use_count() == 1);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "Partial writes test passed!" << std::endl;
+}
+
+void testCoalescing() {
+    // A pass's worth of control messages become one buffer, up to the limits
+    OutputQueue queue;
+    for (int i = 0; i < 100; ++i) queue.append({0, 0, 0, 13, 6, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 64, 0});
+    assert(queue.segmentCount() == 1 && queue.size() == 1700);
+    queue.append(std::vector<uint8_t>(OutputQueue::COALESCE_MESSAGE_SIZE + 1, 0));  // A large BITFIELD: its own segment
+    assert(queue.segmentCount() == 2);
+    queue.append({0, 0, 0, 1, 2});
+    assert(queue.segmentCount() == 2);  // Joins the large message, which has room
+
+    OutputQueue full;
+    for (size_t i = 0; i < OutputQueue::COALESCE_SEGMENT_SIZE / 5 + 1; ++i) full.append({0, 0, 0, 1, 2});
+    assert(full.segmentCount() == 2);
+    std::cout << "Coalescing test passed!" << std::endl;
+}
+
+void testConsume() {
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(100, 0));
+    OutputQueue queue;
+    queue.append(pattern(10, 0));
+    queue.appendBlock(pattern(13, 0), viewOf(block));
+    queue.append(pattern(7, 0));
+
+    // Stopping inside a segment keeps it; passing its end drops it
+    queue.consume(4);
+    assert(queue.segmentCount() == 2 && queue.size() == 126);
+    queue.consume(13);
+    assert(queue.segmentCount() == 1 && queue.bulkSize() == 113);
+    queue.consume(50);
+    assert(queue.size() == 63 && block.use_count() == 2);
+
+    // The PIECE is partly sent, so a new control message waits for its end
+    queue.append(pattern(5, 0));
+    queue.consume(63);
+    assert(queue.segmentCount() == 1 && queue.size() == 5 && block.use_count() == 1);
+    queue.consume(1000);  // Never past the end
+    assert(queue.empty() && queue.size() == 0);
+    std::cout << "Consume test passed!" << std::endl;
+}
+
+void testSplice() {
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(100, 0));
+    OutputQueue queue;
+    queue.appendBlock(pattern(13, 0), viewOf(block));
+    queue.appendBlock(pattern(13, 1), viewOf(block));
+    queue.consume(50);
+
+    // Control from the other queue goes ahead of the blocks not yet started
+    OutputQueue later;
+    later.append(pattern(5, 2));
+    later.appendBlock(pattern(13, 3), viewOf(block));
+    queue.splice(later);
+    assert(later.empty() && later.size() == 0);
+    assert(queue.segmentCount() == 4 && queue.size() == 63 + 5 + 113 + 113);
+    queue.consume(63);
+    assert(queue.bulkSize() == 226 && queue.size() == 231);
+    queue.consume(5);
+    assert(queue.size() == queue.bulkSize() && queue.segmentCount() == 2);
+    std::cout << "Splice test passed!" << std::endl;
+}
+
+std::vector<uint8_t> pieceHeader(uint32_t pieceIndex, uint32_t blockOffset, uint32_t blockSize) {
+    std::vector<uint8_t> header(13);
+    uint32_t fields[3] = {htonl(9 + blockSize), htonl(pieceIndex), htonl(blockOffset)};
+    memcpy(header.data(), &fields[0], 4);
+    header[4] = 7;
+    memcpy(header.data() + 5, &fields[1], 4);
+    memcpy(header.data() + 9, &fields[2], 4);
+    return header;
+}
+
+void testCancelBlock() {
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(100, 0));
+    OutputQueue queue;
+    queue.appendBlock(pieceHeader(1, 0, 100), viewOf(block));
+    queue.appendBlock(pieceHeader(1, 100, 100), viewOf(block));
+    queue.appendBlock(pieceHeader(2, 0, 100), viewOf(block));
+
+    // Only an exact match of index, offset and length
+    assert(!queue.cancelBlock(1, 100, 50));
+    assert(!queue.cancelBlock(3, 0, 100));
+    assert(queue.cancelBlock(1, 100, 100));
+    assert(queue.segmentCount() == 2 && queue.bulkSize() == 226 && block.use_count() == 3);
+
+    // A PIECE partly written has to be finished
+    queue.consume(20);
+    assert(!queue.cancelBlock(1, 0, 100));
+    assert(queue.cancelBlock(2, 0, 100));
+    assert(queue.segmentCount() == 1 && queue.size() == 93 && block.use_count() == 2);
+    std::cout << "Cancel block test passed!" << std::endl;
+}
+
+void testControlAtMessageBoundary() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    int small = 4096;
+    setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+
+    OutputQueue queue;
+    std::vector<std::vector<uint8_t>> messages;
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(16384, 7));
+    for (int i = 0; i < 20; ++i) {
+        auto header = pattern(13, static_cast<uint8_t>(i));
+        messages.push_back(header);
+        messages.back().insert(messages.back().end(), block->begin(), block->end());
+        queue.appendBlock(header, viewOf(block));
+    }
+
+    // Fill the socket, so some PIECE is cut short, then queue a CHOKE
+    size_t attempted;
+    size_t written = 0;
+    ssize_t sent;
+    while ((sent = queue.writeTo(sockets[0], MSG_DONTWAIT, attempted)) > 0) written += static_cast<size_t>(sent);
+    const std::vector<uint8_t> choke = {0, 0, 0, 1, 0};
+    queue.append(choke);
+
+    std::vector<uint8_t> received;
+    while (!queue.empty()) {
+        queue.writeTo(sockets[0], MSG_DONTWAIT, attempted);
+        drainInto(sockets[1], received, 5000);
+    }
+    drainInto(sockets[1], received);
+
+    // It goes right after the PIECE in progress, ahead of everything else queued
+    size_t messageSize = messages[0].size();
+    size_t before = (written + messageSize - 1) / messageSize;
+    assert(before < messages.size());
+    std::vector<uint8_t> expected;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        if (i == before) expected.insert(expected.end(), choke.begin(), choke.end());
+        expected.insert(expected.end(), messages[i].begin(), messages[i].end());
+    }
+    assert(received == expected);
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "Control at message boundary test passed!" << std::endl;
+}
+
+void testBulkAllowance() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    auto block = std::make_shared<std::vector<uint8_t>>(pattern(1000, 3));
+    OutputQueue queue;
+    for (int i = 0; i < 3; ++i) queue.appendBlock(pattern(13, 0), viewOf(block));
+    queue.append({0, 0, 0, 1, 1});
+
+    // Whole PIECEs only, as far as the allowance goes; control never waits
+    size_t attempted;
+    assert(queue.writeTo(sockets[0], 0, attempted, 1500) == 5 + 1013 && attempted == 5 + 1013);
+    assert(queue.writeTo(sockets[0], 0, attempted, 1012) == 0 && attempted == 0);
+    queue.append({0, 0, 0, 1, 0});
+    assert(queue.writeTo(sockets[0], 0, attempted, 0) == 5);
+
+    // A PIECE already started is finished without allowance
+    queue.consume(500);
+    assert(queue.writeTo(sockets[0], 0, attempted, 0) == 513);
+    assert(queue.writeTo(sockets[0], 0, attempted) == 1013 && queue.empty());
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "Bulk allowance test passed!" << std::endl;
+}
+
+#ifdef __linux__
+void testFileBlock() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+    // A block crossing from one file into the next
+    char firstPath[] = "/tmp/output_queue_test_XXXXXX";
+    char secondPath[] = "/tmp/output_queue_test_XXXXXX";
+    int first = mkstemp(firstPath);
+    int second = mkstemp(secondPath);
+    unlink(firstPath);
+    unlink(secondPath);
+    auto firstData = pattern(3000, 1);
+    auto secondData = pattern(2000, 2);
+    assert(write(first, firstData.data(), firstData.size()) == 3000);
+    assert(write(second, secondData.data(), secondData.size()) == 2000);
+
+    FileBlock file;
+    file.regions = {{first, 1000, 2000}, {second, 0, 1500}};
+    file.size = 3500;
+    OutputQueue queue;
+    queue.append({0, 0, 0, 0});
+    queue.appendFile(pattern(13, 9), file);
+    queue.append({0, 0, 0, 1, 2});
+
+    // Control messages and the header in one call, then one sendfile per region
+    size_t attempted;
+    assert(queue.writeTo(sockets[0], 0, attempted) == 22 && attempted == 22);
+    assert(queue.writeTo(sockets[0], 0, attempted) == 2000 && attempted == 2000);
+    assert(queue.writeTo(sockets[0], 0, attempted) == 1500 && attempted == 1500);
+    assert(queue.empty());
+
+    std::vector<uint8_t> expected = {0, 0, 0, 0, 0, 0, 0, 1, 2};
+    auto header = pattern(13, 9);
+    expected.insert(expected.end(), header.begin(), header.end());
+    expected.insert(expected.end(), firstData.begin() + 1000, firstData.end());
+    expected.insert(expected.end(), secondData.begin(), secondData.begin() + 1500);
+    std::vector<uint8_t> received;
+    drainInto(sockets[1], received);
+    assert(received == expected);
+
+    close(first);
+    close(second);
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "File block test passed!" << std::endl;
+}
+#endif
+
+int main() {
+    testOneGatherWrite();
+    testBatchLimit();
+    testPartialWrites();
+    testCoalescing();
+    testConsume();
+    testSplice();
+    testCancelBlock();
+    testControlAtMessageBoundary();
+    testBulkAllowance();
+#ifdef __linux__
+    testFileBlock();
+#endif
+
+    std::cout << "All output queue tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "../include/peer_connection.hpp"
+#include "../include/piece_manager.hpp"
+#include <iostream>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+static constexpr int PIECE_LENGTH = 2 * MAX_BLOCK_SIZE;
+
+void appendUint32(std::vector<uint8_t>& out, uint32_t value) {
+    value = htonl(value);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+void appendPiece(std::vector<uint8_t>& out, uint32_t pieceIndex, uint32_t blockOffset, uint8_t seed) {
+    appendUint32(out, 9 + MAX_BLOCK_SIZE);
+    out.push_back(7);
+    appendUint32(out, pieceIndex);
+    appendUint32(out, blockOffset);
+    for (int i = 0; i < MAX_BLOCK_SIZE; ++i) out.push_back(static_cast<uint8_t>(seed + i * 7));
+}
+
+bool blockMatches(PieceManager& pieces, int pieceIndex, int blockOffset, uint8_t seed) {
+    BlockView view = pieces.getBlockView(pieceIndex, blockOffset, MAX_BLOCK_SIZE);
+    if (!view) return false;
+    for (int i = 0; i < MAX_BLOCK_SIZE; ++i) {
+        if (view.data[i] != static_cast<uint8_t>(seed + i * 7)) return false;
+    }
+    return true;
+}
+
+// Reads everything the socket has, the way the event loop does
+void drain(PeerConnection& conn) {
+    while (true) {
+        ssize_t received = conn.receive(MSG_DONTWAIT);
+        if (received < 0 && errno == EAGAIN) return;
+        assert(received > 0);
+        assert(conn.process_input_buffer());
+    }
+}
+
+struct Received {
+    std::vector<uint8_t> ids;
+    std::vector<uint8_t*> blocks;  // Where each in-place block was written
+};
+
+void connect(PeerConnection& conn, PieceManager& pieces, Received& received) {
+    conn.reserve_block = [&pieces](uint32_t pieceIndex, uint32_t blockOffset, uint32_t length) {
+        return pieces.reserveBlock(pieceIndex, blockOffset, length);
+    };
+    conn.on_block = [&pieces, &received](uint32_t pieceIndex, uint32_t blockOffset, BlockSlot slot) {
+        received.blocks.push_back(slot.data);
+        assert(pieces.commitBlock(pieceIndex, blockOffset, slot));
+    };
+    conn.on_message = [&received](uint8_t messageId, const uint8_t*, size_t) {
+        received.ids.push_back(messageId);
+    };
+}
+
+void testPiecesReceivedInPlace() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    PieceManager pieces(2, PIECE_LENGTH, 2 * PIECE_LENGTH);
+    PeerConnection conn;
+    conn.socket = sockets[0];
+    Received received;
+    connect(conn, pieces, received);
+
+    // Control messages between the blocks, all sent in odd-sized chunks so
+    // headers and payloads straddle reads
+    std::vector<uint8_t> stream;
+    appendUint32(stream, 1);
+    stream.push_back(1);  // Unchoke
+    appendPiece(stream, 0, 0, 1);
+    appendPiece(stream, 0, MAX_BLOCK_SIZE, 2);
+    appendUint32(stream, 0);  // Keep-alive
+    appendPiece(stream, 1, MAX_BLOCK_SIZE, 3);
+    appendUint32(stream, 1);
+    stream.push_back(0);  // Choke
+    appendPiece(stream, 1, 0, 4);
+
+    for (size_t offset = 0; offset < stream.size();) {
+        size_t count = std::min<size_t>(1237, stream.size() - offset);
+        assert(send(sockets[1], stream.data() + offset, count, 0) == static_cast<ssize_t>(count));
+        offset += count;
+        drain(conn);
+    }
+
+    assert(received.ids == std::vector<uint8_t>({1, 0}));  // No PIECE reached on_message
+    assert(received.blocks.size() == 4 && !conn.receiving_block);
+    assert(pieces.isPieceComplete(0) && pieces.isPieceComplete(1));
+    assert(blockMatches(pieces, 0, 0, 1) && blockMatches(pieces, 0, MAX_BLOCK_SIZE, 2));
+    assert(blockMatches(pieces, 1, MAX_BLOCK_SIZE, 3) && blockMatches(pieces, 1, 0, 4));
+
+    // Written where the piece lives, not copied there afterwards
+    PieceBuffer buffer = pieces.getPieceBuffer(1);
+    assert(received.blocks[2] == buffer->data() + MAX_BLOCK_SIZE && received.blocks[3] == buffer->data());
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "Pieces received in place test passed!" << std::endl;
+}
+
+void testUnwantedBlockFallsBack() {
+    int sockets[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    PieceManager pieces(1, PIECE_LENGTH, PIECE_LENGTH);
+    PeerConnection conn;
+    conn.socket = sockets[0];
+    Received received;
+    connect(conn, pieces, received);
+
+    // A duplicate has no slot, so it is framed and handed out like any message
+    std::vector<uint8_t> stream;
+    appendPiece(stream, 0, 0, 5);
+    appendPiece(stream, 0, 0, 6);
+    assert(send(sockets[1], stream.data(), stream.size(), 0) == static_cast<ssize_t>(stream.size()));
+    drain(conn);
+    assert(received.blocks.size() == 1 && received.ids == std::vector<uint8_t>({7}));
+    assert(blockMatches(pieces, 0, 0, 5));
+
+    // A block cut off mid-payload is released and can be received again
+    stream.clear();
+    appendPiece(stream, 0, MAX_BLOCK_SIZE, 7);
+    assert(send(sockets[1], stream.data(), 100, 0) == 100);
+    drain(conn);
+    assert(conn.receiving_block);
+    BlockSlot slot = pieces.reserveBlock(0, MAX_BLOCK_SIZE, MAX_BLOCK_SIZE);
+    assert(!slot);
+    pieces.releaseBlock(0, MAX_BLOCK_SIZE, conn.incoming_block.slot);
+    slot = pieces.reserveBlock(0, MAX_BLOCK_SIZE, MAX_BLOCK_SIZE);
+    assert(slot && pieces.commitBlock(0, MAX_BLOCK_SIZE, slot));
+    assert(pieces.isPieceComplete(0));
+
+    close(sockets[0]);
+    close(sockets[1]);
+    std::cout << "Unwanted block fallback test passed!" << std::endl;
+}
+
+int main() {
+    testPiecesReceivedInPlace();
+    testUnwantedBlockFallsBack();
+
+    std::cout << "All peer connection tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "../include/piece_manager.hpp"
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+
+constexpr int PIECE_LENGTH = 4 * MAX_BLOCK_SIZE;
+// Two full pieces, then a last piece of two full blocks and a short one
+constexpr int64_t TOTAL_LENGTH = 2 * PIECE_LENGTH + 2 * MAX_BLOCK_SIZE + 1000;
+
+std::vector<uint8_t> pieceData(int pieceIndex, int size) {
+    std::vector<uint8_t> bytes(size);
+    for (int i = 0; i < size; ++i) bytes[i] = static_cast<uint8_t>(pieceIndex * 31 + i * 7 + i / 251);
+    return bytes;
+}
+
+std::vector<uint8_t> blockOf(const std::vector<uint8_t>& piece, int blockIndex) {
+    size_t begin = static_cast<size_t>(blockIndex) * MAX_BLOCK_SIZE;
+    size_t end = std::min(piece.size(), begin + MAX_BLOCK_SIZE);
+    return std::vector<uint8_t>(piece.begin() + begin, piece.begin() + end);
+}
+
+void testOutOfOrderBlocks() {
+    PieceManager manager(3, PIECE_LENGTH, TOTAL_LENGTH);
+    auto data = pieceData(0, PIECE_LENGTH);
+    Sha1Digest digest;
+
+    // Blocks after a gap wait for it; nothing can be finalized until the piece is complete
+    for (int blockIndex : {2, 0, 3}) {
+        assert(manager.storePieceBlock(0, blockIndex * MAX_BLOCK_SIZE, blockOf(data, blockIndex)));
+        assert(!manager.finalizePieceHash(0, digest));
+    }
+    assert(manager.storePieceBlock(0, MAX_BLOCK_SIZE, blockOf(data, 1)));
+    assert(manager.isPieceComplete(0));
+
+    assert(manager.finalizePieceHash(0, digest));
+    assert(digest == Sha1Engine::hash(data.data(), data.size()));
+    // Once only
+    assert(!manager.finalizePieceHash(0, digest));
+    std::cout << "Out-of-order blocks test passed!" << std::endl;
+}
+
+void testShortLastPiece() {
+    PieceManager manager(3, PIECE_LENGTH, TOTAL_LENGTH);
+    int pieceSize = manager.getPieceSize(2);
+    assert(pieceSize == 2 * MAX_BLOCK_SIZE + 1000);
+    assert(manager.getBlockCount(2) == 3);
+    auto data = pieceData(2, pieceSize);
+
+    // The short block first, and received in place like blocks off the socket
+    assert(!manager.storePieceBlock(2, 2 * MAX_BLOCK_SIZE, pieceData(2, MAX_BLOCK_SIZE)));
+    BlockSlot slot = manager.reserveBlock(2, 2 * MAX_BLOCK_SIZE, 1000);
+    assert(slot && slot.size == 1000);
+    auto last = blockOf(data, 2);
+    std::copy(last.begin(), last.end(), slot.data);
+    assert(manager.commitBlock(2, 2 * MAX_BLOCK_SIZE, slot));
+
+    assert(manager.storePieceBlock(2, MAX_BLOCK_SIZE, blockOf(data, 1)));
+    assert(manager.storePieceBlock(2, 0, blockOf(data, 0)));
+
+    // Only the piece's own bytes are hashed, not the rest of the buffer
+    Sha1Digest digest;
+    assert(manager.finalizePieceHash(2, digest));
+    assert(digest == Sha1Engine::hash(data.data(), data.size()));
+    std::cout << "Short last piece test passed!" << std::endl;
+}
+
+void testResetRestartsHash() {
+    PieceManager manager(3, PIECE_LENGTH, TOTAL_LENGTH);
+    auto data = pieceData(1, PIECE_LENGTH);
+
+    // A piece that failed its check is hashed from scratch when downloaded again
+    for (int blockIndex = 0; blockIndex < 4; ++blockIndex) {
+        manager.storePieceBlock(1, blockIndex * MAX_BLOCK_SIZE, pieceData(9, MAX_BLOCK_SIZE));
+    }
+    Sha1Digest digest;
+    assert(manager.finalizePieceHash(1, digest));
+    assert(digest != Sha1Engine::hash(data.data(), data.size()));
+    assert(manager.resetPiece(1));
+
+    for (int blockIndex : {3, 1, 2, 0}) {
+        assert(manager.storePieceBlock(1, blockIndex * MAX_BLOCK_SIZE, blockOf(data, blockIndex)));
+    }
+    assert(manager.finalizePieceHash(1, digest));
+    assert(digest == Sha1Engine::hash(data.data(), data.size()));
+    std::cout << "Reset restarts hash test passed!" << std::endl;
+}
+
+int main() {
+    testOutOfOrderBlocks();
+    testShortLastPiece();
+    testResetRestartsHash();
+
+    std::cout << "All piece manager tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include "../include/piece_picker.hpp"
+#include "../include/memory_budget.hpp"
+#include <iostream>
+#include <cassert>
+
+Bitfield makeBitfield(size_t numBits, std::initializer_list<int> pieces) {
+    Bitfield bits(numBits);
+    for (int piece : pieces) bits.set(piece);
+    return bits;
+}
+
+void testRarestFirst() {
+    PiecePicker picker(4, 1);
+    Bitfield common = makeBitfield(4, {0, 1, 2});
+    picker.addPeer(common);
+    picker.addPeer(common);
+    picker.addPeer(makeBitfield(4, {0, 1, 2, 3}));  // A seed
+    picker.addPeer(makeBitfield(4, {1, 2}));
+    picker.addHave(2);
+
+    // Piece 0 is the rarest among those the downloader has
+    assert(picker.getAvailability(0) == 3);
+    assert(picker.getAvailability(3) == 1);
+    assert(picker.pickPiece(1, common) == 0);
+    assert(picker.pickPiece(1, common) == 1);
+    assert(picker.pickPiece(1, common) == 2);
+    assert(picker.pickPiece(1, common) == PiecePicker::NO_PIECE);
+
+    // Only the seed has piece 3
+    Bitfield all(4, true);
+    assert(picker.pickPiece(2, all) == 3);
+    assert(picker.getStats().seeds == 1);
+    assert(picker.getStats().downloadingPieces == 4);
+    std::cout << "Rarest first test passed!" << std::endl;
+}
+
+void testPriorities() {
+    PiecePicker picker(3, 1);
+    Bitfield all(3, true);
+    picker.addPeer(makeBitfield(3, {0, 1, 2}));
+    picker.addPeer(makeBitfield(3, {0, 1}));
+    picker.addPeer(makeBitfield(3, {1}));
+
+    // Priority beats rarity; priority 0 is never picked
+    picker.setPiecePriority(2, 0);
+    picker.setPiecePriority(1, 3);
+    assert(picker.pickPiece(1, all) == 1);
+    assert(picker.pickPiece(1, all) == 0);
+    assert(picker.pickPiece(1, all) == PiecePicker::NO_PIECE);
+    std::cout << "Priority test passed!" << std::endl;
+}
+
+void testPartialAndFailedPieces() {
+    PiecePicker picker(8, 1);
+    Bitfield all(8, true);
+    picker.addPeer(all);
+
+    int first = picker.pickPiece(1, all);
+    int second = picker.pickPiece(1, all);
+    assert(picker.piecesDownloadingBy(1).size() == 2);
+    assert(picker.downloadingPieces().size() == 2);
+
+    // The peer leaves halfway through the first piece; it is offered before anything new
+    picker.abortPiece(first, true);
+    picker.abortPiece(second, false);
+    assert(picker.piecesDownloadingBy(1).empty());
+    assert(picker.getStats().partialPieces == 1);
+    assert(picker.pickPiece(2, all) == first);
+
+    picker.pieceVerified(first);
+    assert(picker.getStats().havePieces == 1);
+    assert(!picker.isDownloading(first));
+
+    // A failed hash check makes the piece wanted again
+    picker.pieceFailed(first);
+    assert(picker.getStats().havePieces == 0);
+    assert(picker.getStats().wantedPieces == 8);
+
+    // Pieces picked by the streaming scheduler leave the buckets too
+    picker.markDownloading(3, 5);
+    assert(picker.isDownloading(3));
+    assert(picker.getStats().wantedPieces == 7);
+
+    // Pieces restored from the resume journal are finished first as well
+    picker.markPartial(6);
+    assert(picker.pickPiece(3, all) == 6);
+    std::cout << "Partial and failed pieces test passed!" << std::endl;
+}
+
+void testPeerRemoval() {
+    PiecePicker picker(4, 1);
+    Bitfield partial = makeBitfield(4, {0, 1});
+    bool seed = picker.addPeer(partial);
+    assert(!seed);
+    assert(picker.getAvailability(0) == 1);
+
+    // HAVEs complete the bitfield, but the peer is still removed piece by piece
+    for (int piece : {2, 3}) {
+        partial.set(piece);
+        picker.addHave(piece);
+    }
+    picker.removePeer(partial, seed);
+    for (int piece = 0; piece < 4; ++piece) assert(picker.getAvailability(piece) == 0);
+    assert(picker.getStats().seeds == 0);
+    std::cout << "Peer removal test passed!" << std::endl;
+}
+
+void testSpeedClasses() {
+    // 256 KiB pieces: 50 KB/s is over 5 s a piece, 5 KB/s over 30 s
+    assert(PiecePicker::classify(0, 262144) == PiecePicker::MEDIUM);
+    assert(PiecePicker::classify(1e6, 262144) == PiecePicker::FAST);
+    assert(PiecePicker::classify(50e3, 262144) == PiecePicker::MEDIUM);
+    assert(PiecePicker::classify(5e3, 262144) == PiecePicker::SLOW);
+
+    PiecePicker picker(8, 1);
+    Bitfield all(8, true);
+    picker.addPeer(all);
+
+    // A slow peer holds one piece at a time and leaves partial pieces to others
+    int slowPiece = picker.pickPiece(1, all, PiecePicker::SLOW);
+    assert(slowPiece != PiecePicker::NO_PIECE);
+    assert(picker.pickPiece(1, all, PiecePicker::SLOW) == PiecePicker::NO_PIECE);
+    int aborted = picker.pickPiece(2, all, PiecePicker::FAST);
+    picker.abortPiece(aborted, true);
+    assert(picker.pickPiece(3, all, PiecePicker::SLOW) != aborted);
+    assert(picker.pickPiece(4, all, PiecePicker::FAST) == aborted);
+
+    // Faster peers may help with the slow peers' pieces, not the other way round
+    auto joinable = picker.joinablePieces(4, all, PiecePicker::FAST);
+    assert(joinable.size() == 2);
+    assert(picker.joinablePieces(1, all, PiecePicker::SLOW).empty());
+    assert(picker.joinablePieces(5, makeBitfield(8, {slowPiece}), PiecePicker::MEDIUM) ==
+           std::vector<int>{slowPiece});
+    std::cout << "Speed classes test passed!" << std::endl;
+}
+
+void testInProgressLimit() {
+    PiecePicker picker(8, 1);
+    Bitfield all(8, true);
+    picker.addPeer(all);
+    picker.setInProgressLimit(3);
+
+    for (int peer = 1; peer <= 3; ++peer) assert(picker.pickPiece(peer, all) != PiecePicker::NO_PIECE);
+    assert(picker.pickPiece(4, all) == PiecePicker::NO_PIECE);
+
+    // At the limit peers join pieces of their own class instead
+    assert(picker.joinablePieces(4, all, PiecePicker::MEDIUM).size() == 3);
+    assert(picker.joinablePieces(4, all, PiecePicker::SLOW).empty());
+
+    // A partial piece still counts, but can be picked up
+    int piece = picker.piecesDownloadingBy(1)[0];
+    picker.abortPiece(piece, true);
+    assert(picker.pickPiece(4, all) == piece);
+    picker.pieceVerified(piece);
+    assert(picker.pickPiece(5, all) != PiecePicker::NO_PIECE);
+
+    auto stats = picker.getStats();
+    assert(stats.downloadingPieces == 3 && stats.inProgressLimit == 3 && stats.peakInProgress == 3);
+    std::cout << "In-progress limit test passed!" << std::endl;
+}
+
+void testInProgressLimitFitsBudget() {
+    const int PIECES = 16;
+    const size_t PIECE_LENGTH = 1000;
+    Bitfield all(PIECES, true);
+
+    // Under the old floor of four pieces, roomy, and smaller than one piece
+    for (size_t budgetBytes : {size_t(2500), size_t(10000), size_t(500)}) {
+        MemoryBudget budget(budgetBytes);
+        size_t limit = budget.inProgressLimit(PIECE_LENGTH);
+        assert(limit == 1 || limit * PIECE_LENGTH <= budgetBytes * 9 / 10);
+        PiecePicker picker(PIECES, 1);
+        picker.addPeer(all);
+        picker.setInProgressLimit(limit);
+
+        int verified = 0;
+        int nextPeer = 1;
+        for (int round = 0; verified < PIECES; ++round) {
+            assert(round < PIECES);
+            // New peers start pieces until the limit; each piece takes a buffer
+            std::vector<int> partial;
+            int piece;
+            while ((piece = picker.pickPiece(nextPeer++, all)) != PiecePicker::NO_PIECE) {
+                budget.charge(MemoryBudget::PARTIAL_PIECES, PIECE_LENGTH);
+                partial.push_back(piece);
+            }
+            assert(!partial.empty());
+            // Partial pieces alone stay under the limit (a piece bigger than
+            // the budget is let through; its peers are still read)
+            if (budgetBytes >= PIECE_LENGTH) assert(!budget.isThrottled());
+
+            // They complete, are hashed and written, and leave the budget
+            for (int done : partial) {
+                budget.transfer(MemoryBudget::PARTIAL_PIECES, MemoryBudget::VERIFY_QUEUE, PIECE_LENGTH);
+                picker.pieceVerified(done);
+                budget.transfer(MemoryBudget::VERIFY_QUEUE, MemoryBudget::WRITE_CACHE, PIECE_LENGTH);
+                budget.release(MemoryBudget::WRITE_CACHE, PIECE_LENGTH);
+                ++verified;
+            }
+            assert(!budget.isThrottled());
+        }
+    }
+    std::cout << "In-progress limit within memory budget test passed!" << std::endl;
+}
+
+int main() {
+    testRarestFirst();
+    testPriorities();
+    testPartialAndFailedPieces();
+    testPeerRemoval();
+    testSpeedClasses();
+    testInProgressLimit();
+    testInProgressLimitFitsBudget();
+
+    std::cout << "All piece picker tests passed!" << std::endl;
+    return 0;
+}
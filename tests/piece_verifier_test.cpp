@@ -0,0 +1,138 @@
+#include "../include/piece_verifier.hpp"
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+// Holds hash checks until opened
+struct Gate {
+    std::mutex mutex;
+    std::condition_variable opened;
+    bool open = false;
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        opened.wait(lock, [this]() { return open; });
+    }
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            open = true;
+        }
+        opened.notify_all();
+    }
+};
+
+template <typename Predicate>
+bool waitUntil(Predicate done) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+void testPassAndFail() {
+    std::mutex mutex;
+    std::map<int, bool> results;
+    PieceVerifier verifier(
+        16, 3,
+        [](int pieceIndex) {
+            // A check that throws counts as a failure
+            if (pieceIndex == 7) throw std::runtime_error("read error");
+            return pieceIndex % 2 == 0;
+        },
+        [&](int pieceIndex, bool passed) {
+            std::lock_guard<std::mutex> lock(mutex);
+            assert(results.emplace(pieceIndex, passed).second);
+        });
+
+    for (int i = 0; i < 8; ++i) assert(verifier.submit(i));
+    assert(waitUntil([&]() { return verifier.verifiedCount() == 8; }));
+    assert(verifier.failedHashCount() == 4);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(results.size() == 8);
+    for (const auto& [pieceIndex, passed] : results) assert(passed == (pieceIndex % 2 == 0));
+    std::cout << "Pass and fail test passed!" << std::endl;
+}
+
+void testDuplicateSubmit() {
+    Gate gate;
+    std::atomic<int> checks{0};
+    std::atomic<int> completions{0};
+    std::atomic<bool> resubmitted{false};
+    PieceVerifier* self = nullptr;
+    PieceVerifier verifier(
+        8, 2,
+        [&](int pieceIndex) {
+            gate.wait();
+            checks++;
+            return pieceIndex != 5;
+        },
+        [&](int pieceIndex, bool passed) {
+            // A failed piece is accepted again straight away (re-downloaded in the client)
+            if (!passed && !resubmitted.exchange(true)) assert(self->submit(pieceIndex));
+            completions++;
+        });
+    self = &verifier;
+
+    // Queued or being hashed: the same piece isn't taken twice
+    assert(verifier.submit(3));
+    assert(!verifier.submit(3));
+    assert(verifier.submit(5));
+    assert(!verifier.submit(5));
+    assert(!verifier.submit(-1) && !verifier.submit(8));
+
+    gate.release();
+    assert(waitUntil([&]() { return completions == 3; }));
+    assert(checks == 3 && verifier.verifiedCount() == 3 && verifier.failedHashCount() == 2);
+
+    // Once its completion has run a piece may be submitted again
+    assert(verifier.submit(3));
+    assert(waitUntil([&]() { return completions == 4; }));
+    std::cout << "Duplicate submit test passed!" << std::endl;
+}
+
+void testShutdownWithQueuedWork() {
+    constexpr int PIECES = 50;
+    Gate gate;
+    std::atomic<int> started{0};
+    std::atomic<int> completions{0};
+    auto verifier = std::make_unique<PieceVerifier>(
+        PIECES, 1,
+        [&](int) {
+            started++;
+            gate.wait();
+            return true;
+        },
+        [&](int, bool) { completions++; });
+
+    for (int i = 0; i < PIECES; ++i) assert(verifier->submit(i));
+    assert(waitUntil([&]() { return started == 1; }));
+
+    // Destroyed while one piece is being hashed and the rest are queued: the
+    // running check finishes, the queued pieces are dropped
+    std::thread destroyer([&]() { verifier.reset(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    gate.release();
+    destroyer.join();
+
+    assert(started < PIECES && completions == started);
+    std::cout << "Shutdown with queued work test passed!" << std::endl;
+}
+
+int main() {
+    testPassAndFail();
+    testDuplicateSubmit();
+    testShutdownWithQueuedWork();
+
+    std::cout << "All piece verifier tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "../include/rate_limiter.hpp"
+#include <iostream>
+#include <cassert>
+
+using namespace std::chrono_literals;
+
+void testUnlimited() {
+    RateLimiter limiter;
+    assert(limiter.getRate() == 0);
+    assert(limiter.available() == RateLimiter::UNLIMITED);
+    limiter.consume(1 << 30);  // Not tracked
+    assert(limiter.available() == RateLimiter::UNLIMITED);
+    std::cout << "Unlimited test passed!" << std::endl;
+}
+
+void testBurstAndRefill() {
+    RateLimiter limiter(1000000, 200000);
+    auto start = RateLimiter::Clock::now();
+
+    // Starts with a full burst, then refills at the rate, up to the burst
+    assert(limiter.available(start) == 200000);
+    limiter.consume(200000);
+    assert(limiter.available(start) == 0);
+    size_t refilled = limiter.available(start + 50ms);
+    assert(refilled >= 49000 && refilled <= 51000);
+    assert(limiter.available(start + 10s) == 200000);
+    std::cout << "Burst and refill test passed!" << std::endl;
+}
+
+void testDebt() {
+    RateLimiter limiter(1000000, 100000);
+    auto start = RateLimiter::Clock::now();
+
+    // Overspending is repaid before anything is available again
+    limiter.consume(150000);
+    assert(limiter.available(start) == 0);
+    assert(limiter.available(start + 40ms) == 0);
+    size_t left = limiter.available(start + 100ms);
+    assert(left >= 40000 && left <= 60000);
+    std::cout << "Debt test passed!" << std::endl;
+}
+
+void testMinimumBurst() {
+    // A burst below one PIECE would never let one start
+    RateLimiter limiter(1000, 100);
+    assert(limiter.available(RateLimiter::Clock::now()) == RateLimiter::MIN_BURST);
+
+    limiter.setRate(0);
+    assert(limiter.available() == RateLimiter::UNLIMITED);
+    std::cout << "Minimum burst test passed!" << std::endl;
+}
+
+int main() {
+    testUnlimited();
+    testBurstAndRefill();
+    testDebt();
+    testMinimumBurst();
+    std::cout << "All rate limiter tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "../include/receive_buffer.hpp"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <arpa/inet.h>
+
+// Length prefix, id and payload filled with a pattern derived from seed
+std::vector<uint8_t> makeMessage(uint8_t id, size_t payloadSize, uint8_t seed) {
+    std::vector<uint8_t> message(5 + payloadSize);
+    uint32_t length = htonl(static_cast<uint32_t>(1 + payloadSize));
+    memcpy(message.data(), &length, 4);
+    message[4] = id;
+    for (size_t i = 0; i < payloadSize; ++i) message[5 + i] = static_cast<uint8_t>(seed + i);
+    return message;
+}
+
+bool matches(const uint8_t* view, size_t length, const std::vector<uint8_t>& message) {
+    return length + 4 == message.size() && memcmp(view, message.data() + 4, length) == 0;
+}
+
+// Copies up to count bytes into the buffer the way a socket read would
+void receive(ReceiveBuffer& buffer, const uint8_t* bytes, size_t count) {
+    size_t space;
+    uint8_t* target = buffer.prepare(space);
+    assert(space >= count);
+    memcpy(target, bytes, count);
+    buffer.commit(count);
+}
+
+void testFraming() {
+    ReceiveBuffer buffer;
+    const uint8_t* view;
+    size_t length;
+
+    // A keep-alive and two messages in one read, then one arriving byte by byte
+    std::vector<uint8_t> stream = {0, 0, 0, 0};
+    auto have = makeMessage(4, 4, 1);
+    auto unchoke = makeMessage(1, 0, 0);
+    stream.insert(stream.end(), have.begin(), have.end());
+    stream.insert(stream.end(), unchoke.begin(), unchoke.end());
+    receive(buffer, stream.data(), stream.size());
+
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY && length == 0);
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY && matches(view, length, have));
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY && matches(view, length, unchoke));
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_INCOMPLETE);
+    assert(buffer.size() == 0);
+
+    auto request = makeMessage(6, 12, 7);
+    for (size_t i = 0; i < request.size(); ++i) {
+        assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_INCOMPLETE);
+        buffer.append(&request[i], 1);
+    }
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY && matches(view, length, request));
+    std::cout << "Framing test passed!" << std::endl;
+}
+
+void testBackToBackPieces() {
+    ReceiveBuffer buffer;
+    const uint8_t* view;
+    size_t length;
+
+    // 16 KiB PIECE messages in 60 KiB reads, so messages straddle reads and
+    // the partial tail has to move to the front now and then
+    std::vector<uint8_t> stream;
+    std::vector<std::vector<uint8_t>> sent;
+    for (int i = 0; i < 200; ++i) {
+        sent.push_back(makeMessage(7, 8 + 16384, static_cast<uint8_t>(i)));
+        stream.insert(stream.end(), sent.back().begin(), sent.back().end());
+    }
+
+    size_t next = 0;
+    size_t maxSpace = 0;
+    for (size_t offset = 0; offset < stream.size();) {
+        size_t space;
+        uint8_t* target = buffer.prepare(space);
+        maxSpace = std::max(maxSpace, space);
+        size_t count = std::min({space, stream.size() - offset, size_t(60 * 1024)});
+        memcpy(target, stream.data() + offset, count);
+        buffer.commit(count);
+        offset += count;
+
+        while (buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY) {
+            // A view into the buffer itself (the unread bytes follow it), not a copy
+            assert(buffer.size() == 0 || view + length == buffer.data());
+            assert(matches(view, length, sent[next]));
+            ++next;
+        }
+    }
+    assert(next == sent.size() && buffer.size() == 0);
+    // Stays around one read plus one message, however much passes through
+    assert(maxSpace <= ReceiveBuffer::MIN_READ_SPACE + ReceiveBuffer::DEFAULT_MAX_MESSAGE_LENGTH + 4);
+    std::cout << "Back-to-back PIECE test passed!" << std::endl;
+}
+
+void testHostileLength() {
+    ReceiveBuffer buffer;
+    const uint8_t* view;
+    size_t length;
+
+    // Rejected from the prefix alone, before any of the claimed bytes arrive
+    uint32_t huge = htonl(0x7fffffff);
+    buffer.append(reinterpret_cast<const uint8_t*>(&huge), 4);
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_TOO_LONG);
+    size_t space;
+    buffer.prepare(space);
+    assert(space < 1024 * 1024);
+
+    // A large BITFIELD is fine once the limit is raised for it
+    ReceiveBuffer bitfieldBuffer;
+    auto bitfield = makeMessage(5, 100000, 3);
+    bitfieldBuffer.append(bitfield.data(), bitfield.size());
+    assert(bitfieldBuffer.nextMessage(view, length) == ReceiveBuffer::FRAME_TOO_LONG);
+    bitfieldBuffer.setMaxMessageLength(100001);
+    assert(bitfieldBuffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY && matches(view, length, bitfield));
+    std::cout << "Hostile length test passed!" << std::endl;
+}
+
+void testHandshakeBeforeFraming() {
+    ReceiveBuffer buffer;
+    std::vector<uint8_t> handshake(68, 0x13);
+    auto bitfield = makeMessage(5, 3, 9);
+    buffer.append(handshake.data(), handshake.size());
+    buffer.append(bitfield.data(), bitfield.size());
+
+    // The handshake isn't length-prefixed, so it is read and consumed first
+    assert(buffer.size() == 68 + bitfield.size());
+    assert(memcmp(buffer.data(), handshake.data(), 68) == 0);
+    buffer.consume(68);
+
+    const uint8_t* view;
+    size_t length;
+    assert(buffer.nextMessage(view, length) == ReceiveBuffer::FRAME_READY && matches(view, length, bitfield));
+    std::cout << "Handshake before framing test passed!" << std::endl;
+}
+
+int main() {
+    testFraming();
+    testBackToBackPieces();
+    testHostileLength();
+    testHandshakeBeforeFraming();
+
+    std::cout << "All receive buffer tests passed!" << std::endl;
+    return 0;
+}
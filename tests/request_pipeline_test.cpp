@@ -0,0 +1,104 @@
+#include "../include/request_pipeline.hpp"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+
+using namespace std::chrono_literals;
+using Clock = RequestPipeline::Clock;
+
+// Feeds blocks for a peer whose upload link carries linkBlocksPerSecond with the
+// given round trip, and returns the depth reached. The peer only sends what was
+// requested, and a full pipe adds queueing delay (Little's law).
+int simulate(RequestPipeline& pipeline, int peerId, double linkBlocksPerSecond, Clock::duration rtt,
+             Clock::duration runTime, Clock::time_point start = {}) {
+    Clock::time_point now = start;
+    const auto step = 10ms;
+    double rttSeconds = std::chrono::duration<double>(rtt).count();
+    double credit = 0;
+    while (now - start < runTime) {
+        int depth = pipeline.targetDepth(peerId);
+        double rate = std::min(depth / rttSeconds, linkBlocksPerSecond);
+        auto latency = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(std::max(rttSeconds, depth / linkBlocksPerSecond)));
+
+        credit += rate * std::chrono::duration<double>(step).count();
+        for (; credit >= 1; credit -= 1) pipeline.onBlockReceived(peerId, 16384, latency, now);
+        now += step;
+    }
+    return pipeline.targetDepth(peerId);
+}
+
+void testGrowsToBandwidthDelayProduct() {
+    RequestPipeline pipeline;
+    assert(pipeline.targetDepth(1) == 8);
+
+    // 100 blocks/s (1.6 MB/s) at 100 ms: BDP is 10 blocks, so 15 with headroom
+    int depth = simulate(pipeline, 1, 100, 100ms, 10s);
+    assert(depth >= 13 && depth <= 17);
+    auto stats = pipeline.getPeerStats(1);
+    assert(stats.rttMs > 99 && stats.rttMs < 101);
+    assert(stats.bytesPerSecond > 1.4e6 && stats.bytesPerSecond < 1.8e6);
+
+    // A fast peer on a long path needs far more than one request per round trip
+    depth = simulate(pipeline, 2, 2000, 200ms, 10s);
+    assert(depth > 400);
+    std::cout << "Bandwidth-delay product test passed!" << std::endl;
+}
+
+void testBounds() {
+    PipelineConfig config;
+    config.minDepth = 4;
+    config.maxDepth = 64;
+    RequestPipeline pipeline(config);
+
+    // A slow peer is saturated by the initial depth, so its latencies are all
+    // queueing; the transport's round trip gets it down to the minimum
+    pipeline.onRttSample(1, 20ms);
+    assert(simulate(pipeline, 1, 5, 20ms, 5s) == 4);
+    assert(simulate(pipeline, 2, 10000, 300ms, 5s) == 64);
+
+    pipeline.removePeer(2);
+    assert(pipeline.targetDepth(2) == 8);
+    std::cout << "Depth bounds test passed!" << std::endl;
+}
+
+void testQueueingDoesNotInflateDepth() {
+    RequestPipeline pipeline;
+
+    // Link-limited at 100 blocks/s with a 5 block BDP: the initial depth already
+    // queues, which costs about one headroom step (8 * 1.5), and then the depth
+    // stays there instead of chasing its own queueing delay
+    int depth = simulate(pipeline, 1, 100, 50ms, 20s);
+    int later = simulate(pipeline, 1, 100, 50ms, 40s, Clock::time_point{} + 20s);
+    assert(depth <= 13 && later <= 13);
+    std::cout << "Queueing test passed!" << std::endl;
+}
+
+void testRequestTimeout() {
+    RequestPipeline pipeline;
+    assert(pipeline.requestTimeout(1) == 20s);
+
+    // Steady 100 ms latencies converge on the lower bound
+    for (int i = 0; i < 50; ++i) pipeline.onBlockReceived(1, 16384, 100ms);
+    assert(pipeline.requestTimeout(1) == 2s);
+
+    // A peer answering in 1-5 s gets well above its mean
+    for (int i = 0; i < 50; ++i) pipeline.onBlockReceived(2, 16384, i % 2 ? 1s : 5s);
+    auto timeout = pipeline.requestTimeout(2);
+    assert(timeout > 8s && timeout < 20s);
+
+    // And never more than the upper bound: a first sample counts as half deviation
+    pipeline.onBlockReceived(3, 16384, 30s);
+    assert(pipeline.requestTimeout(3) == 60s);
+    std::cout << "Request timeout test passed!" << std::endl;
+}
+
+int main() {
+    testGrowsToBandwidthDelayProduct();
+    testBounds();
+    testQueueingDoesNotInflateDepth();
+    testRequestTimeout();
+
+    std::cout << "All request pipeline tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "../include/request_tracker.hpp"
+#include <iostream>
+#include <cassert>
+
+void testNormalRequests() {
+    RequestTracker tracker;
+    tracker.addRequest(1, 0, 0, 16384);
+    tracker.addRequest(1, 0, 16384, 16384);
+    tracker.addRequest(1, 0, 0, 16384);  // Same request again is not a duplicate
+    assert(tracker.outstandingCount(1) == 2);
+    assert(tracker.getStats().duplicateRequests == 0);
+    assert(tracker.isRequested(0, 16384) && !tracker.isRequested(1, 0));
+
+    // Outside endgame nothing is handed out twice
+    Bitfield all(4, true);
+    assert(tracker.pickDuplicates(2, all).empty());
+
+    assert(tracker.owesBlockOf(1, [](int piece) { return piece == 0; }));
+    assert(!tracker.owesBlockOf(1, [](int piece) { return piece == 1; }));
+    assert(!tracker.owesBlockOf(2, [](int) { return true; }));
+    assert(tracker.isRequestedFrom(1, 0, 0, 16384));
+    assert(!tracker.isRequestedFrom(1, 0, 0, 1000));  // Cut short
+    assert(!tracker.isRequestedFrom(2, 0, 0, 16384));  // Never asked
+
+    assert(tracker.blockReceived(1, 0, 0).empty());
+    assert(tracker.outstandingCount(1) == 1);
+
+    // Choke: the remaining block is returned so it can be asked for elsewhere
+    auto orphaned = tracker.removePeer(1);
+    assert(orphaned.size() == 1 && orphaned[0].pieceIndex == 0 && orphaned[0].blockOffset == 16384);
+    assert(tracker.getStats().outstandingBlocks == 0);
+    std::cout << "Normal requests test passed!" << std::endl;
+}
+
+void testEndgame() {
+    RequestTracker tracker;
+    for (int offset = 0; offset < 4 * 16384; offset += 16384) tracker.addRequest(1, 3, offset, 16384);
+    tracker.addRequest(2, 5, 0, 1000);
+    assert(tracker.setEndgame(true));
+    assert(!tracker.setEndgame(true));
+
+    // Peer 3 only has piece 3, so it only gets its blocks
+    Bitfield piece3(8);
+    piece3.set(3);
+    auto duplicates = tracker.pickDuplicates(3, piece3);
+    assert(duplicates.size() == 4);
+    for (const auto& block : duplicates) {
+        assert(block.pieceIndex == 3);
+        tracker.addRequest(3, block.pieceIndex, block.blockOffset, block.length);
+    }
+    assert(tracker.getStats().duplicateRequests == 4);
+    assert(tracker.pickDuplicates(3, piece3).empty());
+
+    // The first copy wins; the original requester gets a CANCEL
+    auto cancel = tracker.blockReceived(3, 3, 0);
+    assert((cancel == std::vector<int>{1}));
+    assert(tracker.getStats().cancelsSent == 1);
+    assert(tracker.outstandingCount(1) == 3 && tracker.outstandingCount(3) == 3);
+
+    // The cancelled copy still arrives: counted as waste
+    assert(tracker.blockReceived(1, 3, 0).empty());
+    tracker.recordWaste(16384);
+    assert(tracker.getStats().wastedBytes == 16384);
+
+    // Least duplicated blocks first: piece 5 has one requester, piece 3 blocks have two
+    Bitfield all(8, true);
+    duplicates = tracker.pickDuplicates(4, all);
+    assert(duplicates.size() == 4 && duplicates[0].pieceIndex == 5 && duplicates[0].length == 1000);
+    std::cout << "Endgame test passed!" << std::endl;
+}
+
+void testDuplicateBounds() {
+    RequestTracker tracker;
+    tracker.setEndgame(true);
+    for (int piece = 0; piece < 20; ++piece) tracker.addRequest(1, piece, 0, 16384);
+    Bitfield all(20, true);
+
+    // Per peer
+    auto duplicates = tracker.pickDuplicates(2, all);
+    assert(duplicates.size() == RequestTracker::MAX_DUPLICATES_PER_PEER);
+    for (const auto& block : duplicates) tracker.addRequest(2, block.pieceIndex, block.blockOffset, block.length);
+    assert(tracker.pickDuplicates(2, all).empty());
+
+    // Per block: pieces 0-7 went to peer 2, so with peer 3 on everything they are full
+    for (size_t i = 0; i < duplicates.size(); ++i) assert(duplicates[i].pieceIndex == static_cast<int>(i));
+    for (int piece = 0; piece < 20; ++piece) tracker.addRequest(3, piece, 0, 16384);
+    duplicates = tracker.pickDuplicates(4, all);
+    assert(duplicates.size() == RequestTracker::MAX_DUPLICATES_PER_PEER);
+    for (const auto& block : duplicates) assert(block.pieceIndex >= 8);
+    std::cout << "Duplicate bounds test passed!" << std::endl;
+}
+
+void testLatency() {
+    using namespace std::chrono_literals;
+    RequestTracker tracker;
+    RequestTracker::Clock::time_point start{};
+    tracker.addRequest(1, 2, 0, 16384, start);
+    tracker.addRequest(2, 2, 0, 16384, start + 30ms);
+
+    RequestTracker::Clock::duration latency{};
+    assert(tracker.requestLatency(1, 2, 0, latency, start + 100ms) && latency == 100ms);
+    assert(tracker.requestLatency(2, 2, 0, latency, start + 100ms) && latency == 70ms);
+    assert(!tracker.requestLatency(3, 2, 0, latency, start + 100ms));
+    std::cout << "Latency test passed!" << std::endl;
+}
+
+void testTimeouts() {
+    using namespace std::chrono_literals;
+    RequestTracker tracker;
+    RequestTracker::Clock::time_point start{};
+    tracker.addRequest(1, 0, 0, 16384, start);
+    tracker.addRequest(1, 0, 16384, 16384, start + 2s);
+    tracker.addRequest(2, 1, 0, 16384, start);
+    tracker.setEndgame(true);
+    tracker.addRequest(3, 1, 0, 16384, start);
+
+    // Peer 1 gets 3 s, the others 10 s
+    auto timeoutFor = [](int peerId) { return peerId == 1 ? 3s : 10s; };
+    auto expired = tracker.expireRequests(timeoutFor, start + 4s);
+    assert(expired.size() == 1);
+    assert(expired[0].peerId == 1 && expired[0].block.pieceIndex == 0 && expired[0].block.blockOffset == 0);
+    assert(expired[0].orphaned && !tracker.isRequested(0, 0));
+    assert(tracker.outstandingCount(1) == 1);
+
+    // Piece 1 was asked of two peers; only the last one to time out leaves it orphaned
+    expired = tracker.expireRequests(timeoutFor, start + 10s);
+    assert(expired.size() == 3);
+    int orphaned = 0;
+    for (const auto& request : expired) orphaned += request.orphaned;
+    assert(orphaned == 2);
+    assert(tracker.getStats().outstandingBlocks == 0);
+    assert(tracker.getStats().timedOutRequests == 4);
+    std::cout << "Timeout test passed!" << std::endl;
+}
+
+void testIdlePeers() {
+    using namespace std::chrono_literals;
+    RequestTracker tracker;
+    RequestTracker::Clock::time_point start{};
+    tracker.addRequest(1, 0, 0, 16384, start);
+    tracker.addRequest(1, 0, 16384, 16384, start + 50s);  // Later requests don't reset the wait
+    tracker.addRequest(2, 1, 0, 16384, start);
+    tracker.addRequest(2, 1, 16384, 16384, start);
+
+    // Peer 2 keeps sending, peer 1 doesn't
+    tracker.blockReceived(2, 1, 0, start + 40s);
+    assert((tracker.idlePeers(60s, start + 70s) == std::vector<int>{1}));
+
+    // No requests outstanding means nothing to wait for
+    tracker.removePeer(1);
+    tracker.blockReceived(2, 1, 16384, start + 45s);
+    assert(tracker.idlePeers(60s, start + 200s).empty());
+    std::cout << "Idle peers test passed!" << std::endl;
+}
+
+int main() {
+    testNormalRequests();
+    testEndgame();
+    testDuplicateBounds();
+    testLatency();
+    testTimeouts();
+    testIdlePeers();
+
+    std::cout << "All request tracker tests passed!" << std::endl;
+    return 0;
+}
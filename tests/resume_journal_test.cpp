@@ -0,0 +1,94 @@
+#include "../include/resume_journal.hpp"
+#include <array>
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+
+const int NUM_PIECES = 10;
+const int BLOCKS_PER_PIECE = 4;
+const std::array<uint8_t, 20> INFO_HASH = {0x12, 0x34, 0x56, 0x78};
+
+std::string journalPath() {
+    return (std::filesystem::temp_directory_path() / "resume_journal_test.resume").string();
+}
+
+ResumeJournal::State loadJournal(ResumeJournal& journal) {
+    return journal.load([](int pieceIndex) { return pieceIndex == NUM_PIECES - 1 ? 2 : BLOCKS_PER_PIECE; });
+}
+
+void testReplay() {
+    std::filesystem::remove(journalPath());
+    {
+        ResumeJournal journal(journalPath(), INFO_HASH, NUM_PIECES);
+        ResumeJournal::State state = loadJournal(journal);
+        assert(state.completePieces.none() && state.partialPieces.empty());
+
+        journal.recordBlock(1, 0);
+        journal.recordBlock(1, 2);
+        journal.recordBlock(3, 1);
+        journal.recordPieceComplete(3);
+        journal.recordBlock(5, 3);
+        journal.recordPieceReset(5);
+        journal.recordBlock(9, 1);
+        journal.recordBlock(9, 2);  // Out of range for the short last piece
+    }
+
+    ResumeJournal journal(journalPath(), INFO_HASH, NUM_PIECES);
+    ResumeJournal::State state = loadJournal(journal);
+    assert(state.completePieces.count() == 1 && state.completePieces[3]);
+    assert(state.partialPieces.size() == 2);
+    assert(state.partialPieces[1].count() == 2 && state.partialPieces[1][0] && state.partialPieces[1][2]);
+    assert(state.partialPieces[9].count() == 1 && state.partialPieces[9][1]);
+    std::cout << "Journal replay test passed!" << std::endl;
+}
+
+void testCompactionAndTornRecord() {
+    // Compaction on load keeps the state
+    {
+        ResumeJournal journal(journalPath(), INFO_HASH, NUM_PIECES);
+        loadJournal(journal);
+        journal.recordBlock(7, 1);
+    }
+    auto sizeBefore = std::filesystem::file_size(journalPath());
+
+    // Simulate a crash in the middle of an append
+    FILE* file = fopen(journalPath().c_str(), "ab");
+    fputc(0x42, file);
+    fclose(file);
+
+    ResumeJournal journal(journalPath(), INFO_HASH, NUM_PIECES);
+    ResumeJournal::State state = loadJournal(journal);
+    assert(state.completePieces[3]);
+    assert(state.partialPieces[1].count() == 2);
+    assert(state.partialPieces[7][1]);
+    assert(std::filesystem::file_size(journalPath()) <= sizeBefore);
+    std::cout << "Journal compaction test passed!" << std::endl;
+}
+
+void testMismatchedTorrentIgnored() {
+    {
+        ResumeJournal journal(journalPath(), INFO_HASH, NUM_PIECES + 1);
+        ResumeJournal::State state = journal.load([](int) { return BLOCKS_PER_PIECE; });
+        assert(state.completePieces.none() && state.partialPieces.empty());
+        journal.recordPieceComplete(2);
+    }
+
+    // Same piece count, another torrent: its complete pieces aren't ours
+    std::array<uint8_t, 20> otherHash = INFO_HASH;
+    otherHash[19] ^= 1;
+    ResumeJournal journal(journalPath(), otherHash, NUM_PIECES + 1);
+    ResumeJournal::State state = journal.load([](int) { return BLOCKS_PER_PIECE; });
+    assert(state.completePieces.none() && state.partialPieces.empty());
+    std::cout << "Mismatched journal test passed!" << std::endl;
+}
+
+int main() {
+    testReplay();
+    testCompactionAndTornRecord();
+    testMismatchedTorrentIgnored();
+    std::filesystem::remove(journalPath());
+
+    std::cout << "All resume journal tests passed!" << std::endl;
+    return 0;
+}
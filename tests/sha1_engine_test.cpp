@@ -0,0 +1,89 @@
+#include "../include/sha1_engine.hpp"
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+std::string toHex(const Sha1Digest& digest) {
+    std::ostringstream oss;
+    oss << std::hex << std::setfill('0');
+    for (uint8_t byte : digest) {
+        oss << std::setw(2) << static_cast<int>(byte);
+    }
+    return oss.str();
+}
+
+Sha1Digest hashString(const std::string& text) {
+    return Sha1Engine::hash(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+void testKnownVectors() {
+    assert(toHex(hashString("")) == "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    assert(toHex(hashString("abc")) == "a9993e364706816aba3e25717850c26c9cd0d89d");
+    assert(toHex(hashString("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")) ==
+           "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    assert(toHex(hashString(std::string(1000000, 'a'))) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+    std::cout << "Known vectors (" << Sha1Engine::backendName(Sha1Engine::singleBufferBackend())
+              << ") test passed!" << std::endl;
+}
+
+void testIncrementalMatchesOneShot() {
+    std::vector<uint8_t> data(100000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<uint8_t>(i * 131 + 7);
+
+    // Odd-sized updates exercise the partial block buffer
+    Sha1Context context;
+    size_t offset = 0, step = 1;
+    while (offset < data.size()) {
+        size_t length = std::min(step, data.size() - offset);
+        context.update(data.data() + offset, length);
+        offset += length;
+        step = step * 3 + 1;
+    }
+    assert(context.finalize() == Sha1Engine::hash(data));
+    std::cout << "Incremental hashing test passed!" << std::endl;
+}
+
+void testBackendsAgree() {
+    std::vector<uint8_t> data(70000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<uint8_t>(i ^ (i >> 8));
+
+    // Pieces of different lengths, including ones shorter than a block
+    std::vector<const uint8_t*> pointers;
+    std::vector<size_t> lengths;
+    for (size_t i = 0; i < 11; ++i) {
+        pointers.push_back(data.data() + i * 100);
+        lengths.push_back(i == 10 ? 3 : 60000 - i * 997);
+    }
+
+    Sha1Engine::forceBackend(Sha1Engine::SCALAR);
+    std::vector<Sha1Digest> expected(pointers.size());
+    Sha1Engine::hashMany(pointers.data(), lengths.data(), pointers.size(), expected.data());
+
+    for (auto backend : {Sha1Engine::SHA_NI, Sha1Engine::AVX2_MULTI_BUFFER}) {
+        if (!Sha1Engine::isSupported(backend)) {
+            std::cout << "Skipping unsupported backend " << Sha1Engine::backendName(backend) << std::endl;
+            continue;
+        }
+        Sha1Engine::forceBackend(backend);
+        std::vector<Sha1Digest> digests(pointers.size());
+        Sha1Engine::hashMany(pointers.data(), lengths.data(), pointers.size(), digests.data());
+        assert(digests == expected);
+        std::cout << "Backend " << Sha1Engine::backendName(backend) << " matches scalar!" << std::endl;
+    }
+    Sha1Engine::resetBackend();
+}
+
+int main() {
+    testKnownVectors();
+    testIncrementalMatchesOneShot();
+    testBackendsAgree();
+
+    Sha1Engine::forceBackend(Sha1Engine::SCALAR);
+    testKnownVectors();
+    Sha1Engine::resetBackend();
+
+    std::cout << "All SHA-1 engine tests passed!" << std::endl;
+    return 0;
+}
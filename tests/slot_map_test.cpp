@@ -0,0 +1,74 @@
+#include "../include/slot_map.hpp"
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+void testInsertGetErase() {
+    SlotMap<std::string> map;
+    assert(map.empty() && !map.get(SlotHandle()));
+
+    auto a = map.insert("a");
+    auto b = map.insert("b");
+    auto c = map.insert("c");
+    assert(map.size() == 3 && a && b && c);
+    assert(*map.get(a) == "a" && *map.get(b) == "b" && *map.get(c) == "c");
+
+    // Erasing moves the last value into the hole; the others stay reachable
+    assert(map.erase(a));
+    assert(!map.erase(a));
+    assert(!map.get(a) && map.size() == 2);
+    assert(*map.get(b) == "b" && *map.get(c) == "c");
+    assert(map.current(a.slot) == SlotHandle());
+    std::cout << "Insert, get and erase test passed!" << std::endl;
+}
+
+void testStaleHandles() {
+    // A reused slot gets a new generation: the old handle misses
+    SlotMap<int> map;
+    auto first = map.insert(7);
+    map.erase(first);
+    auto second = map.insert(8);
+    assert(second.slot == first.slot && second.generation != first.generation);
+    assert(!map.get(first) && !map.contains(first));
+    assert(map.get(second) && *map.get(second) == 8);
+    assert(map.current(second.slot) == second);
+    std::cout << "Stale handles test passed!" << std::endl;
+}
+
+void testDenseIteration() {
+    SlotMap<std::shared_ptr<int>> map;
+    std::vector<SlotHandle> handles;
+    for (int i = 0; i < 1000; ++i) handles.push_back(map.insert(std::make_shared<int>(i)));
+    for (int i = 0; i < 1000; i += 3) assert(map.erase(handles[i]));
+
+    // Every remaining value once, each i-th value matching its handle
+    std::vector<int> seen;
+    size_t index = 0;
+    for (const auto& value : map) {
+        assert(map.get(map.handleAt(index)) && *map.get(map.handleAt(index)) == value);
+        seen.push_back(*value);
+        ++index;
+    }
+    std::sort(seen.begin(), seen.end());
+    std::vector<int> expected;
+    for (int i = 0; i < 1000; ++i) {
+        if (i % 3 != 0) expected.push_back(i);
+    }
+    assert(seen == expected && map.size() == expected.size());
+
+    // Freed slots are reused before the table grows
+    for (int i = 0; i < 1000; i += 3) map.insert(std::make_shared<int>(-1));
+    for (size_t i = 0; i < map.size(); ++i) assert(map.handleAt(i).slot < 1000);
+    std::cout << "Dense iteration test passed!" << std::endl;
+}
+
+int main() {
+    testInsertGetErase();
+    testStaleHandles();
+    testDenseIteration();
+    std::cout << "All slot map tests passed!" << std::endl;
+    return 0;
+}
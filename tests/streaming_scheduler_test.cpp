@@ -0,0 +1,184 @@
+#include "../include/streaming_scheduler.hpp"
+#include "../include/piece_stream.hpp"
+#include <iostream>
+#include <cassert>
+#include <thread>
+#include <unistd.h>
+
+using Clock = StreamingScheduler::Clock;
+using namespace std::chrono_literals;
+
+const int NUM_PIECES = 20;
+const int64_t PIECE_LENGTH = 1000;
+
+Bitfield allPieces() {
+    Bitfield bits(NUM_PIECES);
+    bits.setAll();
+    return bits;
+}
+
+void testDeadlineOrder() {
+    StreamingScheduler::Config config;
+    config.readAheadPieces = 4;
+    config.playbackBytesPerSecond = 1000;  // One piece per second
+    config.duplicateWindow = 0ms;
+    StreamingScheduler scheduler(NUM_PIECES, PIECE_LENGTH, NUM_PIECES * PIECE_LENGTH, config);
+
+    auto now = Clock::now();
+    scheduler.start(now);
+    assert(scheduler.getDeadline(0) == now);
+    assert(scheduler.getDeadline(3) == now + 3s);
+    assert(scheduler.getDeadline(4) == Clock::time_point::max());
+
+    // Earliest deadlines go to whoever asks first; a busy peer gets nothing new
+    Bitfield have(NUM_PIECES);
+    assert(scheduler.pickPiece(1, allPieces(), have, now) == 0);
+    assert(scheduler.pickPiece(1, allPieces(), have, now) == StreamingScheduler::NO_PIECE);
+    assert(scheduler.pickPiece(2, allPieces(), have, now) == 1);
+
+    // Pieces we have or the peer lacks are skipped
+    have.set(2);
+    Bitfield peerHas(NUM_PIECES);
+    peerHas.set(2);
+    peerHas.set(3);
+    assert(scheduler.pickPiece(3, peerHas, have, now) == 3);
+    assert(scheduler.pickPiece(4, peerHas, have, now) == StreamingScheduler::NO_PIECE);
+
+    // Moving the cursor opens the window further
+    scheduler.onPieceVerified(0, now);
+    scheduler.setCursor(PIECE_LENGTH, now + 1s);
+    assert(scheduler.getCursorPiece() == 1);
+    assert(scheduler.getDeadline(4) == now + 1s + 3s);
+    assert(scheduler.assignedPiece(1) == StreamingScheduler::NO_PIECE);
+    std::cout << "Deadline ordering test passed!" << std::endl;
+}
+
+void testDuplicatesNearDeadline() {
+    StreamingScheduler::Config config;
+    config.readAheadPieces = 2;
+    config.playbackBytesPerSecond = 1000;
+    config.duplicateWindow = 500ms;
+    config.maxPeersPerPiece = 2;
+    StreamingScheduler scheduler(NUM_PIECES, PIECE_LENGTH, NUM_PIECES * PIECE_LENGTH, config);
+
+    auto now = Clock::now();
+    scheduler.start(now);
+    Bitfield have(NUM_PIECES);
+    assert(scheduler.pickPiece(1, allPieces(), have, now) == 0);
+    assert(scheduler.pickPiece(2, allPieces(), have, now) == 0);  // Due now: duplicated
+    assert(scheduler.pickPiece(3, allPieces(), have, now) == 1);  // Piece 0 at its limit, 1 not urgent
+    assert(scheduler.pickPiece(4, allPieces(), have, now) == StreamingScheduler::NO_PIECE);
+    assert(scheduler.pickPiece(4, allPieces(), have, now + 600ms) == 1);  // Now within the window
+    assert(scheduler.getStats().duplicateAssignments == 2);
+
+    // A disconnect frees the slot
+    scheduler.onPeerDisconnected(2);
+    assert(scheduler.pickPiece(5, allPieces(), have, now) == 0);
+    std::cout << "Duplicate assignment test passed!" << std::endl;
+}
+
+void testReleaseOnFailureAndChoke() {
+    StreamingScheduler::Config config;
+    config.readAheadPieces = 2;
+    config.playbackBytesPerSecond = 1000;
+    config.duplicateWindow = 0ms;
+    StreamingScheduler scheduler(NUM_PIECES, PIECE_LENGTH, NUM_PIECES * PIECE_LENGTH, config);
+
+    auto now = Clock::now();
+    scheduler.start(now);
+    Bitfield have(NUM_PIECES);
+    assert(scheduler.pickPiece(1, allPieces(), have, now) == 0);
+    assert(scheduler.pickPiece(2, allPieces(), have, now) == 1);
+
+    // A failed hash check frees the piece and its peer, without counting it
+    scheduler.onPieceFailed(0);
+    assert(scheduler.assignedPiece(1) == StreamingScheduler::NO_PIECE);
+    assert(scheduler.pickPiece(3, allPieces(), have, now) == 0);
+    assert(scheduler.getStats().piecesOnTime == 0);
+    assert(scheduler.getStats().deadlineMisses == 0);
+
+    // A choked peer's piece goes to the next one that asks
+    scheduler.onPeerDisconnected(2);
+    assert(scheduler.assignedPiece(2) == StreamingScheduler::NO_PIECE);
+    assert(scheduler.pickPiece(1, allPieces(), have, now) == 1);
+    std::cout << "Release on failure and choke test passed!" << std::endl;
+}
+
+void testMetrics() {
+    StreamingScheduler::Config config;
+    config.playbackBytesPerSecond = 1000;
+    StreamingScheduler scheduler(NUM_PIECES, PIECE_LENGTH, NUM_PIECES * PIECE_LENGTH, config);
+
+    auto now = Clock::now();
+    scheduler.start(now);
+    scheduler.onPieceVerified(1, now + 500ms);   // Due at +1s
+    scheduler.onPieceVerified(2, now + 3s);      // Due at +2s
+    scheduler.onFirstByteDelivered(now + 250ms);
+    scheduler.onFirstByteDelivered(now + 900ms);  // Only the first one counts
+
+    auto stats = scheduler.getStats();
+    assert(stats.piecesOnTime == 1);
+    assert(stats.deadlineMisses == 1);
+    assert(stats.timeToFirstByteMs == 250);
+    std::cout << "Streaming metrics test passed!" << std::endl;
+}
+
+void testPieceStreamInOrder() {
+    StreamingScheduler scheduler(NUM_PIECES, PIECE_LENGTH, NUM_PIECES * PIECE_LENGTH);
+    scheduler.start();
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    Bitfield have(NUM_PIECES);
+    have.set(0);  // Already on disk when streaming starts
+    auto readPiece = [](int pieceIndex, std::vector<uint8_t>& data) {
+        data.assign(PIECE_LENGTH, static_cast<uint8_t>(pieceIndex));
+        return true;
+    };
+
+    {
+        PieceStream stream(fds[1], NUM_PIECES, PIECE_LENGTH, have, readPiece, scheduler);
+
+        // Verify pieces out of order; the stream must still emit 0, 1, 2, ...
+        std::thread producer([&]() {
+            for (int i = NUM_PIECES - 1; i >= 1; --i) {
+                std::this_thread::sleep_for(1ms);
+                stream.notifyPieceVerified(i);
+            }
+        });
+
+        std::vector<uint8_t> received(NUM_PIECES * PIECE_LENGTH);
+        size_t total = 0;
+        while (total < received.size()) {
+            ssize_t got = read(fds[0], received.data() + total, received.size() - total);
+            assert(got > 0);
+            total += got;
+        }
+        producer.join();
+
+        for (size_t i = 0; i < received.size(); ++i) {
+            assert(received[i] == i / PIECE_LENGTH);
+        }
+        while (!stream.isFinished()) std::this_thread::sleep_for(1ms);
+        assert(stream.bytesWritten() == received.size());
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    auto stats = scheduler.getStats();
+    assert(stats.timeToFirstByteMs >= 0);
+    assert(stats.cursorPiece == NUM_PIECES);
+    std::cout << "In-order pipe output test passed!" << std::endl;
+}
+
+int main() {
+    testDeadlineOrder();
+    testDuplicatesNearDeadline();
+    testReleaseOnFailureAndChoke();
+    testMetrics();
+    testPieceStreamInOrder();
+
+    std::cout << "All streaming tests passed!" << std::endl;
+    return 0;
+}